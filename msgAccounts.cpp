@@ -0,0 +1,540 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Accounts that outlive the server: a memory-mapped hash table snapshot that is
+// searched in place, plus an append-only log of what changed since, folded in by a checkpoint.
+
+#include "msgAccounts.h"
+
+// Standard Library
+#include<iostream>
+#include<cstring>
+#include<cstdio>
+#include<vector>
+#include<algorithm>
+#include<ctime>
+
+// System Calls
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<unistd.h>
+#include<errno.h>
+
+// GLOBALS
+AccountStore Accounts = { PTHREAD_RWLOCK_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+			  false, "", NULL, 0, -1, 0, tr1::unordered_map<string, string>(),
+			  tr1::unordered_map<string, string>(), 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+size_t PaddedAccountLength(size_t length) {
+  return (length + 7) & ~(size_t) 7;
+}
+
+double AccountClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t HashAccountName(const char* name, size_t length) {
+
+  // FNV-1a: the snapshot outlives the process, so no hash that may change between builds.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+string AccountLogPath(uint32_t id) {
+
+  char name[32];
+  snprintf(name, sizeof(name), "/wal-%08u.log", id);
+  return Accounts.dir + name;
+}
+
+string SnapshotPath() {
+  return Accounts.dir + "/accounts.snap";
+}
+
+bool OpenAccountLog(uint32_t id) {
+
+  int fd = open(AccountLogPath(id).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  Accounts.logFd = fd;
+  Accounts.logId = id;
+  return true;
+}
+
+bool OpenAccounts(string dir) {
+
+  // Locals
+  vector<uint32_t> ids;
+  double start = AccountClock();
+
+  if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+    return false;
+  }
+  Accounts.dir = dir;
+
+  // The snapshot is only mapped here; pages come in as accounts are looked up.
+  uint64_t firstLog = 1;
+  int fd = open(SnapshotPath().c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (size_t) info.st_size < sizeof(SnapshotHeader)) {
+      close(fd);
+      cerr << "The account snapshot in " << dir << " is damaged." << endl;
+      return false;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      return false;
+    }
+    const SnapshotHeader* header = (const SnapshotHeader*) map;
+    if (!IsSnapshotValid((const char*) map, info.st_size)) {
+      munmap(map, info.st_size);
+      cerr << "The account snapshot in " << dir << " is damaged." << endl;
+      return false;
+    }
+    madvise(map, info.st_size, MADV_RANDOM);
+    Accounts.snapshot = (const char*) map;
+    Accounts.snapshotSize = info.st_size;
+    firstLog = header -> logId;
+  }
+
+  DIR* listing = opendir(dir.c_str());
+  if (listing == NULL) {
+    return false;
+  }
+  struct dirent* file;
+  while ((file = readdir(listing)) != NULL) {
+    unsigned id;
+    char tail;
+    if (sscanf(file -> d_name, "wal-%8u.lo%c", &id, &tail) == 2 && tail == 'g') {
+      if (id < firstLog) {
+	// Left behind by a checkpoint that stopped after writing the snapshot.
+	unlink(AccountLogPath(id).c_str());
+      } else {
+	ids.push_back(id);
+      }
+    }
+  }
+  closedir(listing);
+  sort(ids.begin(), ids.end());
+
+  pthread_mutex_lock(&Accounts.logLock);
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (!LoadAccountLog(ids[i])) {
+      pthread_mutex_unlock(&Accounts.logLock);
+      return false;
+    }
+  }
+  // Appends always go to a fresh file.
+  uint32_t nextId = ids.empty() ? firstLog : ids.back() + 1;
+  if (!OpenAccountLog(nextId)) {
+    pthread_mutex_unlock(&Accounts.logLock);
+    return false;
+  }
+  Accounts.lastCheckpoint = time(NULL);
+  Accounts.isOpen = true;
+  Accounts.openSeconds = AccountClock() - start;
+  pthread_mutex_unlock(&Accounts.logLock);
+  return true;
+}
+
+void CloseAccounts() {
+
+  pthread_mutex_lock(&Accounts.syncLock);
+  pthread_rwlock_wrlock(&Accounts.lock);
+  pthread_mutex_lock(&Accounts.logLock);
+  if (Accounts.snapshot != NULL) {
+    munmap((void*) Accounts.snapshot, Accounts.snapshotSize);
+  }
+  Accounts.snapshot = NULL;
+  Accounts.snapshotSize = 0;
+  if (Accounts.logFd >= 0) {
+    close(Accounts.logFd);
+  }
+  Accounts.logFd = -1;
+  Accounts.pending.clear();
+  Accounts.sealed.clear();
+  Accounts.isOpen = false;
+  pthread_mutex_unlock(&Accounts.logLock);
+  pthread_rwlock_unlock(&Accounts.lock);
+  pthread_mutex_unlock(&Accounts.syncLock);
+}
+
+bool StartCheckpoints() {
+
+  pthread_t checkpointId;
+  if (pthread_create(&checkpointId, NULL, checkpointThread, NULL) != 0) {
+    return false;
+  }
+  pthread_detach(checkpointId);
+  return true;
+}
+
+bool LoadAccountLog(uint32_t id) {
+
+  int fd = open(AccountLogPath(id).c_str(), O_RDWR);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return false;
+  }
+  size_t fileSize = info.st_size;
+  if (fileSize == 0) {
+    close(fd);
+    return true;
+  }
+
+  // Mapped only for the scan; the pages are dropped again right after.
+  char* map = (char*) mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  madvise(map, fileSize, MADV_SEQUENTIAL);
+
+  size_t offset = 0;
+  while (offset + sizeof(AccountRecord) <= fileSize) {
+    AccountRecord record;
+    memcpy(&record, map + offset, sizeof(record));
+    if (record.magic != ACCOUNT_MAGIC || record.length > fileSize - offset ||
+	record.length != PaddedAccountLength(sizeof(AccountRecord) + record.nameLen + record.hashLen)) {
+      // End of what was written (or a torn append).
+      break;
+    }
+    const char* body = map + offset + sizeof(AccountRecord);
+    Accounts.pending[string(body, record.nameLen)].assign(body + record.nameLen, record.hashLen);
+    Accounts.replayed++;
+    offset += record.length;
+  }
+
+  munmap(map, fileSize);
+  if (offset < fileSize && ftruncate(fd, offset) < 0) {
+    // Left as is; the next scan stops at the same place.
+  }
+  close(fd);
+  return true;
+}
+
+bool IsSnapshotValid(const char* snapshot, size_t snapshotSize) {
+
+  const SnapshotHeader* header = (const SnapshotHeader*) snapshot;
+  uint64_t tableSize = header -> tableSize;
+  // Divided rather than multiplied, so a huge tableSize cannot wrap around and pass.
+  return header -> magic == SNAPSHOT_MAGIC && tableSize != 0 && (tableSize & (tableSize - 1)) == 0 &&
+    tableSize <= (snapshotSize - sizeof(SnapshotHeader)) / sizeof(SnapshotBucket) &&
+    header -> count < tableSize;
+}
+
+const SnapshotEntry* SnapshotEntryAt(const char* snapshot, size_t snapshotSize, uint64_t offset) {
+
+  const SnapshotHeader* header = (const SnapshotHeader*) snapshot;
+  uint64_t dataStart = sizeof(SnapshotHeader) + header -> tableSize * sizeof(SnapshotBucket);
+  if (offset < dataStart || offset > snapshotSize || snapshotSize - offset < sizeof(SnapshotEntry)) {
+    return NULL;
+  }
+  const SnapshotEntry* entry = (const SnapshotEntry*) (snapshot + offset);
+  if (snapshotSize - offset - sizeof(SnapshotEntry) < (size_t) entry -> nameLen + entry -> hashLen) {
+    return NULL;
+  }
+  return entry;
+}
+
+bool FindSnapshotAccount(const string& username, string& passwordHash) {
+
+  if (Accounts.snapshot == NULL) {
+    return false;
+  }
+  const SnapshotHeader* header = (const SnapshotHeader*) Accounts.snapshot;
+  const SnapshotBucket* table = (const SnapshotBucket*) (Accounts.snapshot + sizeof(SnapshotHeader));
+  uint64_t nameHash = HashAccountName(username.data(), username.length());
+  uint64_t mask = header -> tableSize - 1;
+  // A damaged table may have no empty bucket; no search goes round more than once.
+  uint64_t probes = 0;
+  for (uint64_t i = nameHash & mask; table[i].offset != 0 && probes < header -> tableSize; i = (i + 1) & mask) {
+    probes++;
+    if (table[i].nameHash != nameHash) {
+      continue;
+    }
+    const SnapshotEntry* entry = SnapshotEntryAt(Accounts.snapshot, Accounts.snapshotSize, table[i].offset);
+    if (entry == NULL) {
+      continue;
+    }
+    const char* name = (const char*) (entry + 1);
+    if (entry -> nameLen == username.length() && memcmp(name, username.data(), entry -> nameLen) == 0) {
+      passwordHash.assign(name + entry -> nameLen, entry -> hashLen);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FindAccount(const string& username, string& passwordHash) {
+
+  if (!Accounts.isOpen) {
+    return false;
+  }
+  pthread_mutex_lock(&Accounts.logLock);
+  tr1::unordered_map<string, string>::const_iterator got = Accounts.pending.find (username);
+  bool isFound = got != Accounts.pending.end();
+  if (!isFound) {
+    got = Accounts.sealed.find (username);
+    isFound = got != Accounts.sealed.end();
+  }
+  if (isFound) {
+    passwordHash = got->second;
+  }
+  pthread_mutex_unlock(&Accounts.logLock);
+  if (isFound) {
+    return true;
+  }
+
+  pthread_rwlock_rdlock(&Accounts.lock);
+  isFound = FindSnapshotAccount(username, passwordHash);
+  pthread_rwlock_unlock(&Accounts.lock);
+  return isFound;
+}
+
+bool LogAccount(AccountRecordType type, const string& username, const string& passwordHash, uint64_t& position) {
+
+  if (username.length() > 0xffff || passwordHash.length() > 0xffff) {
+    return false;
+  }
+  size_t length = PaddedAccountLength(sizeof(AccountRecord) + username.length() + passwordHash.length());
+  vector<char> buffer(length, 0);
+  AccountRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = ACCOUNT_MAGIC;
+  record.length = length;
+  record.type = type;
+  record.nameLen = username.length();
+  record.hashLen = passwordHash.length();
+  memcpy(&buffer[0], &record, sizeof(record));
+  memcpy(&buffer[sizeof(record)], username.data(), record.nameLen);
+  memcpy(&buffer[sizeof(record) + record.nameLen], passwordHash.data(), record.hashLen);
+
+  pthread_mutex_lock(&Accounts.logLock);
+  // One write per record, so a crash of this process never leaves half of one.
+  bool isWritten = Accounts.logFd >= 0 && write(Accounts.logFd, &buffer[0], length) == (ssize_t) length;
+  if (isWritten) {
+    Accounts.pending[username] = passwordHash;
+    (type == ACCOUNT_REGISTER ? Accounts.registered : Accounts.changed)++;
+    position = ++Accounts.logged;
+  }
+  pthread_mutex_unlock(&Accounts.logLock);
+  return isWritten;
+}
+
+bool SyncAccountLog(uint64_t position) {
+
+  bool isSynced = true;
+  pthread_mutex_lock(&Accounts.syncLock);
+  if (Accounts.synced < position) {
+    // Everything appended so far; appends go on meanwhile and wait for the next one.
+    pthread_mutex_lock(&Accounts.logLock);
+    int fd = Accounts.logFd;
+    uint64_t logged = Accounts.logged;
+    pthread_mutex_unlock(&Accounts.logLock);
+    isSynced = fd >= 0 && fdatasync(fd) == 0;
+    if (isSynced) {
+      Accounts.synced = logged;
+    }
+  }
+  pthread_mutex_unlock(&Accounts.syncLock);
+  return isSynced;
+}
+
+size_t PutSnapshotEntry(char* map, uint64_t tableSize, size_t offset, const char* name, size_t nameLen,
+			const char* hash, size_t hashLen) {
+
+  SnapshotBucket* table = (SnapshotBucket*) (map + sizeof(SnapshotHeader));
+  SnapshotEntry* entry = (SnapshotEntry*) (map + offset);
+  entry -> nameLen = nameLen;
+  entry -> hashLen = hashLen;
+  memcpy((char*) (entry + 1), name, nameLen);
+  memcpy((char*) (entry + 1) + nameLen, hash, hashLen);
+
+  uint64_t nameHash = HashAccountName(name, nameLen);
+  uint64_t bucket = nameHash & (tableSize - 1);
+  while (table[bucket].offset != 0) {
+    bucket = (bucket + 1) & (tableSize - 1);
+  }
+  table[bucket].nameHash = nameHash;
+  table[bucket].offset = offset;
+  return offset + PaddedAccountLength(sizeof(SnapshotEntry) + nameLen + hashLen);
+}
+
+void RestoreSealed() {
+
+  pthread_mutex_lock(&Accounts.logLock);
+  // insert leaves a name that is already pending alone, so later changes win.
+  Accounts.pending.insert(Accounts.sealed.begin(), Accounts.sealed.end());
+  Accounts.sealed.clear();
+  pthread_mutex_unlock(&Accounts.logLock);
+}
+
+bool CheckpointAccounts(bool force) {
+
+  // Locals
+  vector<const SnapshotEntry*> kept;
+  double start = AccountClock();
+
+  pthread_mutex_lock(&Accounts.logLock);
+  if (!Accounts.isOpen || Accounts.logFd < 0) {
+    pthread_mutex_unlock(&Accounts.logLock);
+    return false;
+  }
+  if (Accounts.pending.empty() || (!force && Accounts.pending.size() < CHECKPOINT_RECORDS &&
+				   time(NULL) - Accounts.lastCheckpoint < CHECKPOINT_INTERVAL)) {
+    pthread_mutex_unlock(&Accounts.logLock);
+    return true;
+  }
+  // New changes go to a new file; the ones before it are what this snapshot takes in. A file is
+  // synced before it is left behind, since SyncAccountLog only ever syncs the current one.
+  fdatasync(Accounts.logFd);
+  int oldFd = Accounts.logFd;
+  uint32_t oldId = Accounts.logId;
+  if (!OpenAccountLog(oldId + 1)) {
+    pthread_mutex_unlock(&Accounts.logLock);
+    return false;
+  }
+  Accounts.sealed.swap(Accounts.pending);
+  uint32_t firstLog = Accounts.logId;
+  pthread_mutex_unlock(&Accounts.logLock);
+  // Not while a sync may still be using it.
+  pthread_mutex_lock(&Accounts.syncLock);
+  close(oldFd);
+  pthread_mutex_unlock(&Accounts.syncLock);
+
+  // Only this thread changes sealed and replaces the snapshot, so both are read here unlocked.
+  const tr1::unordered_map<string, string>& changes = Accounts.sealed;
+  const char* old = Accounts.snapshot;
+  size_t dataSize = 0;
+  if (old != NULL) {
+    const SnapshotHeader* header = (const SnapshotHeader*) old;
+    const SnapshotBucket* table = (const SnapshotBucket*) (old + sizeof(SnapshotHeader));
+    kept.reserve(header -> count);
+    for (uint64_t i = 0; i < header -> tableSize; i++) {
+      const SnapshotEntry* entry = table[i].offset == 0 ? NULL :
+	SnapshotEntryAt(old, Accounts.snapshotSize, table[i].offset);
+      if (entry == NULL) {
+	continue;
+      }
+      if (changes.find (string((const char*) (entry + 1), entry -> nameLen)) == changes.end()) {
+	kept.push_back(entry);
+	dataSize += PaddedAccountLength(sizeof(SnapshotEntry) + entry -> nameLen + entry -> hashLen);
+      }
+    }
+  }
+  tr1::unordered_map<string, string>::const_iterator change = changes.begin();
+  for ( ; change != changes.end(); change++) {
+    dataSize += PaddedAccountLength(sizeof(SnapshotEntry) + change->first.length() + change->second.length());
+  }
+
+  // At most half full, so a miss stops after a probe or two.
+  uint64_t count = kept.size() + changes.size();
+  uint64_t tableSize = 1024;
+  while (tableSize < count * 2) {
+    tableSize *= 2;
+  }
+  size_t fileSize = sizeof(SnapshotHeader) + tableSize * sizeof(SnapshotBucket) + dataSize;
+  string tmpPath = SnapshotPath() + ".tmp";
+  int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || ftruncate(fd, fileSize) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    RestoreSealed();
+    return false;
+  }
+  char* map = (char*) mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    RestoreSealed();
+    return false;
+  }
+
+  size_t offset = sizeof(SnapshotHeader) + tableSize * sizeof(SnapshotBucket);
+  for (size_t i = 0; i < kept.size(); i++) {
+    const char* name = (const char*) (kept[i] + 1);
+    offset = PutSnapshotEntry(map, tableSize, offset, name, kept[i] -> nameLen,
+			      name + kept[i] -> nameLen, kept[i] -> hashLen);
+  }
+  for (change = changes.begin(); change != changes.end(); change++) {
+    offset = PutSnapshotEntry(map, tableSize, offset, change->first.data(), change->first.length(),
+			      change->second.data(), change->second.length());
+  }
+  SnapshotHeader* header = (SnapshotHeader*) map;
+  header -> count = count;
+  header -> tableSize = tableSize;
+  header -> logId = firstLog;
+  header -> magic = SNAPSHOT_MAGIC;
+
+  // On disk before it replaces the old one, or a crash could leave neither.
+  bool isSynced = msync(map, fileSize, MS_SYNC) == 0 && fsync(fd) == 0;
+  munmap(map, fileSize);
+  close(fd);
+  if (!isSynced || rename(tmpPath.c_str(), SnapshotPath().c_str()) < 0) {
+    unlink(tmpPath.c_str());
+    RestoreSealed();
+    return false;
+  }
+
+  fd = open(SnapshotPath().c_str(), O_RDONLY);
+  void* mapped = fd < 0 ? MAP_FAILED : mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (mapped == MAP_FAILED) {
+    // The new snapshot is on disk but not in use; the logs it covers stay until the next open.
+    RestoreSealed();
+    return false;
+  }
+  madvise(mapped, fileSize, MADV_RANDOM);
+  pthread_rwlock_wrlock(&Accounts.lock);
+  size_t oldSize = Accounts.snapshotSize;
+  Accounts.snapshot = (const char*) mapped;
+  Accounts.snapshotSize = fileSize;
+  pthread_rwlock_unlock(&Accounts.lock);
+  if (old != NULL) {
+    munmap((void*) old, oldSize);
+  }
+
+  pthread_mutex_lock(&Accounts.logLock);
+  Accounts.sealed.clear();
+  Accounts.lastCheckpoint = time(NULL);
+  Accounts.checkpoints++;
+  Accounts.checkpointSeconds = AccountClock() - start;
+  pthread_mutex_unlock(&Accounts.logLock);
+
+  // Only the files below the logId the new snapshot starts from are in it; the oldest was deleted
+  // by the last checkpoint.
+  uint32_t id = ((const SnapshotHeader*) mapped) -> logId;
+  while (id > 1 && unlink(AccountLogPath(id - 1).c_str()) == 0) {
+    id--;
+  }
+  return true;
+}
+
+void* checkpointThread(void* args_p) {
+
+  while (true) {
+    sleep(CHECKPOINT_POLL);
+    CheckpointAccounts(false);
+  }
+  return NULL;
+}
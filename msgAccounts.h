@@ -0,0 +1,186 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Accounts that outlive the server: a memory-mapped hash table snapshot that is
+// searched in place, plus an append-only log of what changed since, folded in by a checkpoint.
+
+#ifndef MSGACCOUNTS_H
+#define MSGACCOUNTS_H
+
+// Standard Library
+#include<string>
+#include<tr1/unordered_map>
+#include<stdint.h>
+
+// Multithreading
+#include<pthread.h>
+
+using namespace std;
+
+// DATA TYPES
+enum AccountRecordType {
+  ACCOUNT_REGISTER = 1,
+  // A new hash for an existing account.
+  ACCOUNT_PASSWORD = 2
+};
+
+// In a log file, followed by name and hash and padded to 8 bytes.
+struct AccountRecord {
+  uint32_t magic;
+  uint32_t length;
+  uint8_t type;
+  uint8_t pad;
+  uint16_t nameLen;
+  uint16_t hashLen;
+  uint16_t pad2;
+};
+
+// First 64 bytes of the snapshot, then tableSize buckets, then the entries they point at.
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t pad;
+  uint64_t count;
+  uint64_t tableSize;
+  // Log files from this one on are not in the snapshot.
+  uint64_t logId;
+  char pad2[32];
+};
+
+// Open addressing with linear probing; offset 0 is an empty bucket.
+struct SnapshotBucket {
+  uint64_t nameHash;
+  uint64_t offset;
+};
+
+// In the snapshot, followed by name and hash and padded to 8 bytes.
+struct SnapshotEntry {
+  uint16_t nameLen;
+  uint16_t hashLen;
+  uint32_t pad;
+};
+
+struct AccountStore {
+  // Held shared to search the snapshot; a checkpoint holds it exclusive to swap in a new one.
+  pthread_rwlock_t lock;
+  // Appends to the log, and the two tables below.
+  pthread_mutex_t logLock;
+  // Held for an fdatasync of the log; whoever waited on it finds their record synced too.
+  pthread_mutex_t syncLock;
+  bool isOpen;
+  string dir;
+  const char* snapshot;
+  size_t snapshotSize;
+  int logFd;
+  uint32_t logId;
+  // Logged since the snapshot, and what a running checkpoint is writing out.
+  tr1::unordered_map<string, string> pending;
+  tr1::unordered_map<string, string> sealed;
+  // Records appended, under logLock, and how many of them are known to be on disk, under syncLock.
+  uint64_t logged;
+  uint64_t synced;
+  time_t lastCheckpoint;
+  long registered;
+  long changed;
+  long replayed;
+  long checkpoints;
+  double checkpointSeconds;
+  double openSeconds;
+};
+
+// GLOBALS
+const uint32_t ACCOUNT_MAGIC = 0x4d534131;    // "MSA1"
+const uint32_t SNAPSHOT_MAGIC = 0x4d535331;   // "MSS1"
+// A checkpoint runs once this many changes are logged, or CHECKPOINT_INTERVAL seconds after the first.
+const size_t CHECKPOINT_RECORDS = 100000;
+const int CHECKPOINT_INTERVAL = 300;
+const int CHECKPOINT_POLL = 5;
+extern AccountStore Accounts;
+
+// Function Prototypes
+uint64_t HashAccountName(const char* name, size_t length);
+// Function hashes a username for the snapshot table; the same on every run.
+// pre: none
+// post: never returns 0.
+
+string AccountLogPath(uint32_t id);
+// Function names the file that holds one stretch of the log.
+// pre: Accounts.dir should be set.
+// post: none
+
+bool OpenAccounts(string dir);
+// Function maps the snapshot in dir and replays the log files it does not cover.
+// pre: dir should be writable.
+// post: returns false if they could not be read; a torn tail is trimmed off the last log file.
+
+void CloseAccounts();
+// Function unmaps the snapshot and closes the log.
+// pre: no checkpoint should be running.
+// post: Accounts.isOpen is false.
+
+bool StartCheckpoints();
+// Function starts the thread that folds the log into a new snapshot.
+// pre: OpenAccounts should have succeeded.
+// post: returns false if the thread could not be started.
+
+bool LoadAccountLog(uint32_t id);
+// Function replays one log file into Accounts.pending.
+// pre: Accounts.logLock should be held. Files must be loaded oldest first.
+// post: a torn tail is trimmed off the file.
+
+bool IsSnapshotValid(const char* snapshot, size_t snapshotSize);
+// Function checks a snapshot's header against the size of the file it came from.
+// pre: snapshotSize should be at least sizeof(SnapshotHeader).
+// post: returns false unless the table size is a power of two, the table fits in the file and
+//       the table has an empty bucket to stop a search.
+
+const SnapshotEntry* SnapshotEntryAt(const char* snapshot, size_t snapshotSize, uint64_t offset);
+// Function finds the entry a snapshot bucket points at.
+// pre: snapshot should have passed IsSnapshotValid.
+// post: returns NULL unless the entry, with its name and hash, lies after the table and inside the file.
+
+bool FindSnapshotAccount(const string& username, string& passwordHash);
+// Function searches the mapped snapshot for an account.
+// pre: Accounts.lock should be held.
+// post: returns false if it is not there.
+
+bool FindAccount(const string& username, string& passwordHash);
+// Function finds an account's current hash, logged changes first.
+// pre: none
+// post: returns false if the account was never registered or accounts are not open.
+
+bool LogAccount(AccountRecordType type, const string& username, const string& passwordHash, uint64_t& position);
+// Function appends a registration or new hash to the log.
+// pre: the user's shard lock should be held exclusively, so two logins cannot both register a name.
+// post: returns false if it could not be written. position is what SyncAccountLog needs to wait for
+//       the record; until then a crash of the machine can lose it.
+
+bool SyncAccountLog(uint64_t position);
+// Function makes sure the log is on disk up to a record, as a group commit: one fdatasync covers
+// every record appended before it started, so callers that queued behind it return at once.
+// pre: no shard lock should be held; the sync takes milliseconds.
+// post: returns false if the log could not be synced.
+
+size_t PutSnapshotEntry(char* map, uint64_t tableSize, size_t offset, const char* name, size_t nameLen,
+			const char* hash, size_t hashLen);
+// Function writes one account into a snapshot being built and points a free bucket at it.
+// pre: map should hold the header, tableSize zeroed buckets and room at offset.
+// post: returns the offset of the next entry.
+
+void RestoreSealed();
+// Function hands the changes a failed checkpoint took back to Accounts.pending.
+// pre: Accounts.logLock should not be held.
+// post: a name changed again since the checkpoint started keeps its newer hash.
+
+bool CheckpointAccounts(bool force);
+// Function writes the snapshot and the changes logged since into a new snapshot and deletes the log
+// files it covers.
+// pre: only one checkpoint may run at a time.
+// post: without force, does nothing until CHECKPOINT_RECORDS or CHECKPOINT_INTERVAL is reached.
+
+void* checkpointThread(void* args_p);
+// Function runs CheckpointAccounts every CHECKPOINT_POLL seconds.
+// pre: none
+// post: none
+
+#endif
@@ -0,0 +1,233 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Password hashing with yescrypt, run on a small pool of threads so a login never
+// holds a directory lock or an event loop while the hash is computed.
+
+#include "msgAuth.h"
+
+// Standard Library
+#include<iostream>
+#include<cstring>
+#include<algorithm>
+
+// User Directory
+#include "msgUsers.h"
+
+// Cluster Routing
+#include "msgCluster.h"
+
+// DATA TYPES
+// Lets a thread that is allowed to block wait for its own login.
+struct AuthWaiter {
+  AuthRequest request;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  bool isDone;
+};
+
+// GLOBALS
+AuthPool AuthWorkers = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, deque<AuthRequest*>(),
+			 0, 0, 0, 0, 0, 0, 0, 0 };
+int HashCost = DEFAULT_HASH_COST;
+
+void WakeWaiter(AuthRequest* request);
+// Function marks an AuthWaiter done and wakes the thread blocked on it.
+// pre: request should be the first member of an AuthWaiter.
+// post: none
+
+bool StartAuthPool(int numThreads, size_t maxWaiting) {
+
+  for (int i = 0; i < numThreads; i++) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, authThread, NULL) != 0) {
+      cerr << "Failed to create hashing thread." << endl;
+      break;
+    }
+    AuthWorkers.numThreads++;
+  }
+  pthread_mutex_lock(&AuthWorkers.lock);
+  AuthWorkers.maxWaiting = maxWaiting;
+  pthread_mutex_unlock(&AuthWorkers.lock);
+  return AuthWorkers.numThreads > 0;
+}
+
+void* authThread(void* args_p) {
+
+  // Locals
+  // Big enough that it should not live on the stack.
+  struct crypt_data* scratch = new struct crypt_data;
+  memset(scratch, 0, sizeof(*scratch));
+
+  pthread_detach(pthread_self());
+  while (true) {
+    pthread_mutex_lock(&AuthWorkers.lock);
+    while (AuthWorkers.waiting.empty()) {
+      pthread_cond_wait(&AuthWorkers.ready, &AuthWorkers.lock);
+    }
+    AuthRequest* request = AuthWorkers.waiting.front();
+    AuthWorkers.waiting.pop_front();
+    AuthWorkers.busy++;
+    pthread_mutex_unlock(&AuthWorkers.lock);
+
+    request -> isLoggedIn = Authenticate(request -> username, request -> password, *scratch);
+    fill(request -> password.begin(), request -> password.end(), '\0');
+    request -> password.clear();
+
+    pthread_mutex_lock(&AuthWorkers.lock);
+    AuthWorkers.busy--;
+    if (request -> isLoggedIn) {
+      AuthWorkers.accepted++;
+    } else {
+      AuthWorkers.rejected++;
+    }
+    pthread_mutex_unlock(&AuthWorkers.lock);
+
+    // The submitter may free the request from here on.
+    request -> onDone(request);
+  }
+
+  pthread_exit(NULL);
+}
+
+bool SubmitAuth(AuthRequest* request) {
+
+  pthread_mutex_lock(&AuthWorkers.lock);
+  if (AuthWorkers.waiting.size() >= AuthWorkers.maxWaiting) {
+    // A flood of logins would otherwise hold a password in memory for each, for as long as it likes.
+    AuthWorkers.turnedAway++;
+    pthread_mutex_unlock(&AuthWorkers.lock);
+    fill(request -> password.begin(), request -> password.end(), '\0');
+    request -> password.clear();
+    return false;
+  }
+  AuthWorkers.waiting.push_back(request);
+  pthread_cond_signal(&AuthWorkers.ready);
+  pthread_mutex_unlock(&AuthWorkers.lock);
+  return true;
+}
+
+void WakeWaiter(AuthRequest* request) {
+
+  AuthWaiter* waiter = (AuthWaiter*) request -> owner;
+  pthread_mutex_lock(&waiter -> lock);
+  waiter -> isDone = true;
+  pthread_cond_signal(&waiter -> done);
+  pthread_mutex_unlock(&waiter -> lock);
+}
+
+bool AuthenticateAndWait(string username, string password, bool& isBusy) {
+
+  // Locals
+  AuthWaiter waiter;
+  waiter.request.username = username;
+  waiter.request.password = password;
+  waiter.request.isLoggedIn = false;
+  waiter.request.onDone = WakeWaiter;
+  waiter.request.owner = &waiter;
+  pthread_mutex_init(&waiter.lock, NULL);
+  pthread_cond_init(&waiter.done, NULL);
+  waiter.isDone = false;
+  fill(password.begin(), password.end(), '\0');
+
+  isBusy = !SubmitAuth(&waiter.request);
+  if (isBusy) {
+    pthread_cond_destroy(&waiter.done);
+    pthread_mutex_destroy(&waiter.lock);
+    return false;
+  }
+  pthread_mutex_lock(&waiter.lock);
+  while (!waiter.isDone) {
+    pthread_cond_wait(&waiter.done, &waiter.lock);
+  }
+  pthread_mutex_unlock(&waiter.lock);
+
+  pthread_cond_destroy(&waiter.done);
+  pthread_mutex_destroy(&waiter.lock);
+  return waiter.request.isLoggedIn;
+}
+
+bool Authenticate(const string& username, const string& password, struct crypt_data& scratch) {
+
+  // Locals
+  string stored;
+  string hash;
+
+  // Hash with no lock held; the login only compares the result.
+  bool exists = DirectoryHash(username, stored);
+  if (exists) {
+    if (!VerifyPassword(password, stored, scratch)) {
+      return false;
+    }
+    hash = stored;
+    // A hash made at another -k cost is redone at this one while the password is at hand.
+    string upgraded;
+    if (!Cluster.isOn && NeedsRehash(stored) && HashPassword(password, upgraded, scratch) &&
+	ChangePasswordHash(username, stored, upgraded)) {
+      hash = upgraded;
+      __sync_fetch_and_add(&AuthWorkers.rehashed, 1);
+    }
+  } else if (!HashPassword(password, hash, scratch)) {
+    return false;
+  }
+  if (DirectoryLogin(username, hash)) {
+    if (!exists) {
+      __sync_fetch_and_add(&AuthWorkers.created, 1);
+    }
+    return true;
+  }
+
+  // Someone else created the account while we were hashing; check against theirs.
+  if (!exists && DirectoryHash(username, stored) && VerifyPassword(password, stored, scratch)) {
+    return DirectoryLogin(username, stored);
+  }
+  return false;
+}
+
+bool HashPassword(const string& password, string& hash, struct crypt_data& scratch) {
+
+  // Locals
+  char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+
+  // A NULL random source makes libxcrypt read the salt from the kernel.
+  if (crypt_gensalt_rn("$y$", HashCost, NULL, 0, salt, sizeof(salt)) == NULL) {
+    cerr << "Unable to generate a password salt." << endl;
+    return false;
+  }
+  char* result = crypt_rn(password.c_str(), salt, &scratch, sizeof(scratch));
+  if (result == NULL || result[0] == '*') {
+    return false;
+  }
+  hash = result;
+  return true;
+}
+
+bool NeedsRehash(const string& hash) {
+
+  // Locals
+  char setting[CRYPT_GENSALT_OUTPUT_SIZE];
+
+  // "$y$<params>$<salt>$<hash>": params encode the cost.
+  if (crypt_gensalt_rn("$y$", HashCost, NULL, 0, setting, sizeof(setting)) == NULL) {
+    return false;
+  }
+  const char* paramsEnd = strchr(setting + 3, '$');
+  if (paramsEnd == NULL) {
+    return false;
+  }
+  return hash.compare(0, paramsEnd - setting + 1, setting, paramsEnd - setting + 1) != 0;
+}
+
+bool VerifyPassword(const string& password, const string& hash, struct crypt_data& scratch) {
+
+  char* result = crypt_rn(password.c_str(), hash.c_str(), &scratch, sizeof(scratch));
+  if (result == NULL || result[0] == '*' || strlen(result) != hash.length()) {
+    return false;
+  }
+  unsigned char diff = 0;
+  for (size_t i = 0; i < hash.length(); i++) {
+    diff |= result[i] ^ hash[i];
+  }
+  return diff == 0;
+}
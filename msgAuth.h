@@ -0,0 +1,101 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Password hashing with yescrypt, run on a small pool of threads so a login never
+// holds a directory lock or an event loop while the hash is computed.
+
+#ifndef MSGAUTH_H
+#define MSGAUTH_H
+
+// Standard Library
+#include<string>
+#include<deque>
+
+// Multithreading
+#include<pthread.h>
+
+// Password Hashing
+#include<crypt.h>
+
+using namespace std;
+
+// DATA TYPES
+// One login waiting for its password to be checked. The submitter owns it until onDone runs.
+struct AuthRequest {
+  string username;
+  // Wiped as soon as it has been hashed.
+  string password;
+  bool isLoggedIn;
+  // Runs on a pool thread once loginUser has been tried.
+  void (*onDone)(AuthRequest* request);
+  void* owner;
+};
+
+struct AuthPool {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  deque<AuthRequest*> waiting;
+  // Past this many waiting, logins are turned away instead of queued.
+  size_t maxWaiting;
+  int numThreads;
+  int busy;
+  long accepted;
+  long rejected;
+  long created;
+  long rehashed;
+  long turnedAway;
+};
+
+// GLOBALS
+const int DEFAULT_HASH_COST = 5;
+// Room for a reconnect storm; memory stays small, and a flood is still cut off.
+const long DEFAULT_AUTH_QUEUE = 4096;
+extern AuthPool AuthWorkers;
+extern int HashCost;
+
+// Function Prototypes
+bool StartAuthPool(int numThreads, size_t maxWaiting);
+// Function starts the threads that check passwords.
+// pre: none
+// post: at most numThreads hashes are computed at once and maxWaiting logins wait; returns false if
+//       no thread could be started.
+
+void* authThread(void* args_p);
+// Function serves as the entry point to a hashing thread.
+// pre: none
+// post: none
+
+bool SubmitAuth(AuthRequest* request);
+// Function queues a login for the pool.
+// pre: StartAuthPool should have succeeded.
+// post: request -> onDone is called from a pool thread with isLoggedIn set. Returns false, and
+//       onDone is never called, if the queue is full; the caller answers the login itself.
+
+bool AuthenticateAndWait(string username, string password, bool& isBusy);
+// Function checks a login on the pool and blocks the calling thread until it is done.
+// pre: StartAuthPool should have succeeded.
+// post: returns whether the user is now logged in. isBusy says the queue was full and nothing
+//       was checked.
+
+bool Authenticate(const string& username, const string& password, struct crypt_data& scratch);
+// Function verifies a password against the stored hash, or hashes it for a new account, then logs in.
+// pre: none
+// post: returns whether loginUser succeeded.
+
+bool HashPassword(const string& password, string& hash, struct crypt_data& scratch);
+// Function hashes a password with a fresh salt at HashCost.
+// pre: none
+// post: returns false if no salt could be generated.
+
+bool NeedsRehash(const string& hash);
+// Function tells whether a stored hash was made at another cost than HashCost.
+// pre: none
+// post: returns false if that cannot be told.
+
+bool VerifyPassword(const string& password, const string& hash, struct crypt_data& scratch);
+// Function checks a password against a stored hash.
+// pre: none
+// post: the comparison takes the same time wherever the strings differ.
+
+#endif
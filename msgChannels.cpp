@@ -0,0 +1,168 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Named channels: a channel-to-members index that chat fan-out reads without
+// holding a lock, so a line costs as much as its channel is big rather than the server.
+
+#include "msgChannels.h"
+
+// Standard Library
+#include<algorithm>
+#include<cctype>
+
+// GLOBALS
+ChannelShard ChannelIndex[CHANNEL_SHARDS];
+
+int InitChannelIndex() {
+  for (int i = 0; i < CHANNEL_SHARDS; i++) {
+    pthread_rwlock_init(&ChannelIndex[i].lock, NULL);
+  }
+  return 0;
+}
+int ChannelStatus = InitChannelIndex();
+
+ChannelShard& ChannelShardFor(const string& channel) {
+  static tr1::hash<string> hashName;
+  return ChannelIndex[hashName(channel) % CHANNEL_SHARDS];
+}
+
+bool ValidChannelName(const string& name, string& channel) {
+
+  channel = (!name.empty() && name[0] == '#') ? name.substr(1) : name;
+  if (channel.empty() || channel.length() > MAX_CHANNEL_NAME) {
+    return false;
+  }
+  for (size_t i = 0; i < channel.length(); i++) {
+    if (!isalnum((unsigned char) channel[i]) && channel[i] != '_' && channel[i] != '-') {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t JoinChannel(string username, string channel) {
+
+  // Locals
+  Mailbox* mailbox = NULL;
+  bool isMember = false;
+  size_t numMembers;
+
+  // The user's own list first, then the index; never both locks at once.
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  if (got != shard.users.end()) {
+    vector<string>& joined = got->second.channels;
+    isMember = find(joined.begin(), joined.end(), channel) != joined.end();
+    if (!isMember) {
+      joined.push_back(channel);
+    }
+    got->second.channel = channel;
+    mailbox = got->second.mailbox;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  if (mailbox == NULL) {
+    return 0;
+  }
+
+  ChannelShard& index = ChannelShardFor(channel);
+  pthread_rwlock_wrlock(&index.lock);
+  MemberList& members = index.channels[channel];
+  if (!isMember) {
+    // Copy on write: readers holding the old list are not disturbed.
+    vector<Mailbox*>* grown = members ? new vector<Mailbox*>(*members) : new vector<Mailbox*>;
+    grown -> push_back(mailbox);
+    members.reset(grown);
+  }
+  numMembers = members -> size();
+  pthread_rwlock_unlock(&index.lock);
+  return numMembers;
+}
+
+bool LeaveChannel(string username, string channel) {
+
+  // Locals
+  Mailbox* mailbox = NULL;
+
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  if (got != shard.users.end()) {
+    vector<string>& joined = got->second.channels;
+    vector<string>::iterator member = find(joined.begin(), joined.end(), channel);
+    if (member != joined.end()) {
+      joined.erase(member);
+      mailbox = got->second.mailbox;
+      if (got->second.channel == channel) {
+	got->second.channel.clear();
+      }
+    }
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  if (mailbox == NULL) {
+    return false;
+  }
+
+  RemoveMember(mailbox, channel);
+  return true;
+}
+
+void LeaveAllChannels(string username) {
+
+  // Locals
+  vector<string> joined;
+  Mailbox* mailbox = NULL;
+
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  if (got != shard.users.end()) {
+    joined.swap(got->second.channels);
+    got->second.channel.clear();
+    mailbox = got->second.mailbox;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+
+  for (size_t i = 0; i < joined.size(); i++) {
+    RemoveMember(mailbox, joined[i]);
+  }
+}
+
+MemberList GetChannelMembers(string channel) {
+
+  // Locals
+  MemberList members;
+
+  ChannelShard& index = ChannelShardFor(channel);
+  pthread_rwlock_rdlock(&index.lock);
+  tr1::unordered_map<string, MemberList>::const_iterator got = index.channels.find (channel);
+  if (got != index.channels.end()) {
+    members = got->second;
+  }
+  pthread_rwlock_unlock(&index.lock);
+  return members;
+}
+
+void RemoveMember(Mailbox* mailbox, string channel) {
+
+  ChannelShard& index = ChannelShardFor(channel);
+  pthread_rwlock_wrlock(&index.lock);
+  tr1::unordered_map<string, MemberList>::iterator got = index.channels.find (channel);
+  if (got != index.channels.end()) {
+    vector<Mailbox*>* shrunk = new vector<Mailbox*>;
+    shrunk -> reserve(got->second -> size());
+    for (size_t i = 0; i < got->second -> size(); i++) {
+      if ((*got->second)[i] != mailbox) {
+	shrunk -> push_back((*got->second)[i]);
+      }
+    }
+    if (shrunk -> empty()) {
+      delete shrunk;
+      index.channels.erase(got);
+    } else {
+      got->second.reset(shrunk);
+    }
+  }
+  pthread_rwlock_unlock(&index.lock);
+}
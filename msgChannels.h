@@ -0,0 +1,78 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Named channels: a channel-to-members index that chat fan-out reads without
+// holding a lock, so a line costs as much as its channel is big rather than the server.
+
+#ifndef MSGCHANNELS_H
+#define MSGCHANNELS_H
+
+// Standard Library
+#include<string>
+#include<vector>
+#include<tr1/unordered_map>
+#include<tr1/memory>
+
+// Multithreading
+#include<pthread.h>
+
+// User Directory
+#include "msgUsers.h"
+
+using namespace std;
+
+// DATA TYPES
+// Mailboxes of everyone in a channel. Never changed once published: a join or leave builds a new
+// list, so a fan-out already under way keeps the list it started with.
+typedef tr1::shared_ptr<const vector<Mailbox*> > MemberList;
+
+// One slice of the channel index. Fan-out takes the lock shared only long enough to copy a
+// MemberList; joins and leaves take it exclusive.
+struct ChannelShard {
+  pthread_rwlock_t lock;
+  tr1::unordered_map<string, MemberList> channels;
+};
+
+// GLOBALS
+const int CHANNEL_SHARDS = 16;
+const size_t MAX_CHANNEL_NAME = 32;
+extern ChannelShard ChannelIndex[CHANNEL_SHARDS];
+
+// Function Prototypes
+ChannelShard& ChannelShardFor(const string& channel);
+// Function finds the index shard that owns a channel.
+// pre: none
+// post: none
+
+bool ValidChannelName(const string& name, string& channel);
+// Function checks a channel name typed by a user, with or without its leading '#'.
+// pre: none
+// post: channel holds the name without the '#'; returns false for empty, long or odd names.
+
+size_t JoinChannel(string username, string channel);
+// Function adds a user to a channel and makes it the one their plain chat goes to.
+// pre: channel should have passed ValidChannelName.
+// post: returns the channel's size afterwards, or 0 if the user does not exist.
+
+bool LeaveChannel(string username, string channel);
+// Function takes a user out of a channel.
+// pre: none
+// post: returns false if they were not in it. Leaving the current channel clears it.
+
+void LeaveAllChannels(string username);
+// Function takes a user out of every channel they are in.
+// pre: none
+// post: the user has no current channel.
+
+MemberList GetChannelMembers(string channel);
+// Function takes a snapshot of a channel's members.
+// pre: none
+// post: no index locks are held on return. Returns an empty MemberList if nobody is in it.
+
+void RemoveMember(Mailbox* mailbox, string channel);
+// Function drops one mailbox from a channel's member list, deleting the channel once it is empty.
+// pre: none
+// post: none
+
+#endif
@@ -7,23 +7,28 @@
 #include<sstream>
 #include<string>
 #include<cstring>
+#include<vector>
+#include<algorithm>
+#include<ctime>
 
 // Network Function
 #include<sys/types.h>
 #include<sys/socket.h>
-#include<sys/select.h>
-#include<sys/time.h>
 #include<netinet/in.h>
 #include<arpa/inet.h>
 #include<unistd.h>
 #include<netdb.h>
+#include<errno.h>
+
+// File Functions
+#include<fcntl.h>
+
+// Event Notification
+#include<poll.h>
 
 // User Interface
 #include<curses.h>
 
-// Multithreading
-#include<pthread.h>
-
 using namespace std;
 
 // GLOBALS
@@ -31,10 +36,18 @@ const int INPUT_LINES = 3;
 const char ENTER_SYM = '\n';
 const char BACKSPACE_SYM = '\b';
 const int DELETE_SYM = 127;
+const size_t RECV_CHUNK = 4096;
+// Rows of scrollback kept, each at most one screen wide, and the shortest time between repaints.
+const size_t SCROLLBACK_ROWS = 10000;
+const double FRAME_SECONDS = 1.0 / 60;
+const short MSG_PAIR = 1;
+const short CMD_PAIR = 2;
+// Headless mode reads input this much at a time and stops reading while this much waits to be sent.
+const size_t PIPE_CHUNK = 65536;
+const size_t PIPE_SEND_LIMIT = 262144;
+const string PM_RULE = "************************************";
 WINDOW *INPUT_SCREEN;
 WINDOW *MSG_SCREEN;
-fd_set hostfd;
-struct timeval tv;
 /*const short MSG_COLOR_BLACK = 0;
 const short MSG_COLOR_RED = 1;
 const short MSG_COLOR_GREEN = 2;
@@ -43,30 +56,100 @@ const short MSG_COLOR_BLUE = 4;
 const short MSG_COLOR_MAGENTA = 5; 
 const short MSG_COLOR_CYAN = 6;
 const short MSG_COLOR_WHITE = 7;*/
-pthread_mutex_t displayLock;
-int displayStatus = pthread_mutex_init(&displayLock, NULL);
 string serverRsp;
 
 
 // Data Structures
-struct threadArgs {
-  int clientSock;
+// One row of the message window.
+struct ScreenRow {
+  string text;
+  short color;
+};
+
+// What the message window shows: a ring of the last SCROLLBACK_ROWS rows, repainted at most
+// once per FRAME_SECONDS however many messages arrive.
+struct Scrollback {
+  vector<ScreenRow> rows;
+  size_t first;        // oldest row
+  size_t count;
+  bool isRowOpen;      // the newest row has not ended with a newline
+  size_t offset;       // rows scrolled back from the newest
+  bool isDirty;
+  double lastPaint;
+};
+// Where the one loop is: keys and server frames mean different things before login.
+enum LoginState {
+  LOGIN_USER,
+  LOGIN_PWD,
+  LOGIN_WAIT,
+  LOGIN_DONE
+};
+
+// A headless client: lines in from a pipe or file, records out on stdout.
+struct PipeSession {
+  int sock;
+  int inFd;
+  LoginState state;
+  string userName;
+  string input;        // read, but not a whole line yet
+  string output;       // frames the socket has not taken yet
+  string records;      // for stdout
+  bool isInputOpen;
+  bool hasQuit;
+  // Sent to ourselves once input ends; when it comes back the server is done with every line before it.
+  string drainMark;
+  int status;
+  long numSent;
+  long numFrames;
+  double started;
 };
 
+Scrollback MsgLog = { vector<ScreenRow>(), 0, 0, false, 0, false, 0 };
+
 // Function Prototypes
 void clearInputScreen();
 // Function resets InputScreen to default state.
 // pre: InputScreen should exist.
 // post: none
 
-bool getUserInput(string& inputStr, bool isPwd);
-// Function tests whether the user has typed a message.
+bool getUserInput(string& inputStr, bool isPwd, int userText);
+// Function adds one typed key to inputStr and tests whether the user has finished a message.
 // pre: InputScreen should exist.
 // post: none
 
 void displayMsg(string& msg);
-// Function displays message
+// Function adds a message to the scrollback.
 // pre: ChatScreen should exist.
+// post: the screen is repainted by PaintScreen.
+
+double Now();
+// Function returns a monotonic time in seconds.
+// pre: none
+// post: none
+
+ScreenRow& NewRow(Scrollback& log, short color);
+// Function appends an empty row, overwriting the oldest once SCROLLBACK_ROWS are kept.
+// pre: none
+// post: a view scrolled back stays on the same rows.
+
+void AddText(Scrollback& log, const string& text, short color);
+// Function appends text to the scrollback, wrapping it at the width of the screen.
+// pre: MSG_SCREEN should exist.
+// post: a backspace takes back the character before it, as it does on the terminal.
+
+void ScrollBy(Scrollback& log, int rows);
+// Function moves the view back (positive) or forward through the scrollback.
+// pre: MSG_SCREEN should exist.
+// post: the view stays between the oldest and the newest rows.
+
+int FrameTimeout(Scrollback& log);
+// Function tells the loop how long it may sleep before the next repaint is due.
+// pre: none
+// post: -1 when nothing is waiting to be painted, 0 when a repaint is due now.
+
+void PaintScreen(Scrollback& log);
+// Function draws the rows in view and the input line with one update of the terminal.
+// pre: MSG_SCREEN and INPUT_SCREEN should exist.
 // post: none
 
 void prepareWindows();
@@ -84,121 +167,164 @@ bool SendMessage(int HostSock, string msg);
 // pre: HostSock should exist.
 // post: none
 
-string GetMessage(int HostSock, int messageLength);
-// Function retrieves message from Host socket.
-// pre: HostSock should exist.
-// post: none
-
 bool SendInteger(int HostSock, int hostInt);
 // Function sends a network long variable over the network.
 // pre: HostSock must exist
 // post: none
 
-long GetInteger(int HostSocks);
-// Function listens to socket for a network Long variable.
-// pre: HostSock must exist.
+bool ReadFrames(int HostSock, string& buffer, vector<string>& frames);
+// Function takes whatever has arrived on Host socket without waiting and splits off whole frames.
+// pre: HostSock should exist.
+// post: partial frames stay in buffer. Returns false if the server closed the connection.
+
+void promptLogin();
+// Function clears the screens and asks for a username.
+// pre: MSG_SCREEN should exist.
 // post: none
 
-void* clientThread(void* args_p);
-// Function serves as the entry point to a new thread.
+bool HandleKeys(int hostSock, LoginState& state, string& inputStr, string& userName, string& userPwd);
+// Function takes every key curses has waiting and acts on each finished line.
+// pre: INPUT_SCREEN should not block in wgetch.
+// post: returns false if the user quit or the connection failed.
+
+void HandleFrame(LoginState& state, string& frame);
+// Function shows a frame from the server, or takes it as the answer to a login.
 // pre: none
-// post: none
+// post: a failed login asks for a username again.
 
-bool hasAuthenticated (int hostSock, string &username);
-// Function handles authentication with server.
+int RunPipe(int hostSock, int inFd);
+// Function logs in with the first two lines of inFd and sends every line after as a message,
+// without waiting for answers, writing what the server sends to stdout until it is done.
+// pre: hostSock should be connected.
+// post: returns the exit status; 1 if the login failed. Totals go to stderr.
+
+void TakeLines(PipeSession& pipe);
+// Function turns each whole line of input into a frame to send.
 // pre: none
-// post: none
+// post: stops at the password until the server has answered the login.
+
+void TakePipeFrame(PipeSession& pipe, string& frame);
+// Function writes a frame from the server as a record, or takes it as the login answer or drain mark.
+// pre: none
+// post: a failed login or the drain mark ends the session.
 
-void DisplayData (int hostSock);
-// Function loops over polling a socket for data.
+void QueueFrame(string& output, const string& msg);
+// Function appends msg to output as a frame: network long length, then the message and its NUL.
 // pre: none
 // post: none
 
+void PutRecord(string& records, const char* kind, const string& text);
+// Function appends one line: kind, a tab, then text with backslash, newline and tab escaped.
+// pre: none
+// post: the /\b markers the window client hides are dropped, as are surrounding newlines.
+
+bool WriteOut(int fd, string& buffer);
+// Function writes all of buffer to fd, waiting as long as it takes.
+// pre: none
+// post: buffer is empty. Returns false if fd failed.
+
 int main (int argNum, char* argValues[]) {
 
   // Locals
   string inputStr;
   string hostname;
   string username = "";
+  string userPwd;
   unsigned short serverPort;
   int hostSock;
-  int numberOfSocks;
+  LoginState state = LOGIN_USER;
+  string recvBuffer;
+  vector<string> frames;
+  bool isHeadless = false;
+  int inFd = STDIN_FILENO;
+  int opt;
 
   // Need to grab Command-line arguments and convert them to useful types
   // Initialize arguments with proper variables.
-  if (argNum < 3 || argNum > 3){
+  while ((opt = getopt(argNum, argValues, "bi:")) != -1) {
+    switch (opt) {
+    case 'b':
+      isHeadless = true;
+      break;
+    case 'i':
+      isHeadless = true;
+      inFd = open(optarg, O_RDONLY);
+      if (inFd < 0) {
+	cerr << "Unable to open " << optarg << "." << endl;
+	return -1;
+      }
+      break;
+    default:
+      cerr << "Usage: " << argValues[0] << " [-b] [-i input file] host port" << endl;
+      return -1;
+    }
+  }
+  if (argNum - optind != 2) {
     // Incorrect number of arguments
     cerr << "Incorrect number of arguments. Please try again." << endl;
     return -1;
   }
 
   // Need to store arguments
-  hostname = argValues[1];
-  serverPort = atoi(argValues[2]);
+  hostname = argValues[optind];
+  serverPort = atoi(argValues[optind+1]);
+
+  // Bots and scripts get no windows.
+  if (isHeadless) {
+    hostSock = openSocket(hostname, serverPort);
+    if (hostSock <= 0) {
+      return -1;
+    }
+    int status = RunPipe(hostSock, inFd);
+    close(hostSock);
+    return status;
+  }
 
   // Begin User Interface
   prepareWindows();
 
   // Establish a socket Connection
   hostSock = openSocket(hostname, serverPort);
-  
-  // Login State
-  while (!hasAuthenticated(hostSock, username)) {
-  }
-  string welcomeMsg = "\nWelcome!\n\n";
-  displayMsg(welcomeMsg);
-  wrefresh(INPUT_SCREEN);
-  
-  // Establish a Thread to handle displaying new messages.
-  struct threadArgs* args_p = new threadArgs;
-  args_p -> clientSock = hostSock;
-  pthread_t tid;
-  int threadStatus = pthread_create(&tid, NULL, clientThread, (void*)args_p);
-  if (threadStatus != 0){
-    // Failed to create child thread
-    cerr << "Failed to create child process." << endl;
-  }//*/
 
   if (hostSock > 0 ) {
-    // Enter a loop to begin
-    while (true) {
-
-      // If the user finished typing a message, get it and process it.
-      if (getUserInput(inputStr, false)) {
-
-	// If it's a command, handle it.
-	if (inputStr == "/quit" || inputStr == "/exit" || inputStr == "/close") {
-	  if (!SendInteger(hostSock, inputStr.length()+1)) {
-	    cerr << "Unable to send Int. " << endl;
-	    break;
-	  }
-	  if (!SendMessage(hostSock, inputStr)) {
-	    cerr << "Unable to send Message. " << endl;
-	    break;
-	  }
-	  break;
-	}
+    // Login State
+    promptLogin();
+
+    // One loop for keys and server frames; it sleeps until one of them has something.
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = hostSock;
+    fds[1].events = POLLIN;
+    bool isOpen = true;
+    while (isOpen) {
+      if (poll(fds, 2, FrameTimeout(MsgLog)) < 0 && errno != EINTR) {
+	break;
+      }
+      if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+	// The terminal went away.
+	break;
+      }
 
-	// Display message in chat window
-	string tmp = "You said: ";
-	tmp.append(inputStr);
-	tmp.append("\n");
-	displayMsg(tmp);
+      // Keys first, including any curses buffered or a resize that interrupted poll.
+      isOpen = HandleKeys(hostSock, state, inputStr, username, userPwd);
 
-	// Send to Server
-	if (!SendInteger(hostSock, inputStr.length()+1)) {
-	  cerr << "Unable to send Int. " << endl;
-	  break;
+      if (isOpen && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+	isOpen = ReadFrames(hostSock, recvBuffer, frames);
+	for (size_t i = 0; i < frames.size(); i++) {
+	  HandleFrame(state, frames[i]);
 	}
-
-	if (!SendMessage(hostSock, inputStr)) {
-	  cerr << "Unable to send Message. " << endl;
-	  break;
+	frames.clear();
+	if (!isOpen) {
+	  string closedMsg = "\nThe server closed the connection.\n";
+	  displayMsg(closedMsg);
+	  PaintScreen(MsgLog);
 	}
+      }
 
-	// Clean slate
-	inputStr.clear();
-	clearInputScreen();
+      // One repaint for everything that came in since the last frame.
+      if (FrameTimeout(MsgLog) == 0) {
+	PaintScreen(MsgLog);
       }
     }
   }//*/
@@ -212,65 +338,132 @@ int main (int argNum, char* argValues[]) {
   exit(-1);
 }
 
-bool hasAuthenticated (int hostSock, string &username) {
+void promptLogin() {
 
   // Locals
   string loginMsg = "////////////////////////////////////////////////////////\nPlease enter your username.\nThe system will create a new account if your username could not be found.\n";
-  string pwdMsg = "/\b\nPlease enter your password.\n";
   string clearScr = "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n";
-  string userName;
-  string userPwd;
-  long responseLen = 0;
-  string hostResponse;
 
   // Reset Screen
   displayMsg(clearScr);
-  wrefresh(INPUT_SCREEN);
   clearInputScreen();
 
   // Get UserName
   displayMsg(loginMsg);
-  wrefresh(INPUT_SCREEN);
-  while (!getUserInput(userName, false)) {
-  }
-  clearInputScreen();
+}
 
-  // Get Password
-  displayMsg(pwdMsg);
-  wrefresh(INPUT_SCREEN);
-  while (!getUserInput(userPwd, true)) {
+bool HandleKeys(int hostSock, LoginState& state, string& inputStr, string& userName, string& userPwd) {
+
+  // Locals
+  string pwdMsg = "/\b\nPlease enter your password.\n";
+  string clearScr = "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n";
+  int userText;
+
+  // wgetch does not wait: ERR means every key typed so far has been taken.
+  while ((userText = wgetch(INPUT_SCREEN)) != ERR) {
+
+    // Page through the scrollback a screen at a time, less a row to keep one in sight.
+    if (userText == KEY_PPAGE || userText == KEY_NPAGE) {
+      int page = max(getmaxy(MSG_SCREEN) - 1, 1);
+      ScrollBy(MsgLog, userText == KEY_PPAGE ? page : -page);
+      continue;
+    }
+
+    // If the user finished typing a message, get it and process it.
+    if (!getUserInput(inputStr, state == LOGIN_PWD, userText)) {
+      continue;
+    }
+
+    switch (state) {
+    case LOGIN_USER:
+      userName = inputStr;
+      inputStr.clear();
+      clearInputScreen();
+
+      // Get Password
+      displayMsg(pwdMsg);
+      state = LOGIN_PWD;
+      break;
+    case LOGIN_PWD:
+      userPwd = inputStr;
+      inputStr.clear();
+
+      // Reset Screen
+      displayMsg(clearScr);
+      clearInputScreen();
+
+      // Send Data; the answer arrives in HandleFrame.
+      if (!SendInteger(hostSock, userName.length()+1) || !SendMessage(hostSock, userName) ||
+	  !SendInteger(hostSock, userPwd.length()+1) || !SendMessage(hostSock, userPwd)) {
+	return false;
+      }
+      userPwd.clear();
+      state = LOGIN_WAIT;
+      break;
+    case LOGIN_WAIT:
+      // Keep the line until the server has answered.
+      break;
+    case LOGIN_DONE:
+      // If it's a command, handle it.
+      if (inputStr == "/quit" || inputStr == "/exit" || inputStr == "/close") {
+	if (!SendInteger(hostSock, inputStr.length()+1)) {
+	  cerr << "Unable to send Int. " << endl;
+	  return false;
+	}
+	if (!SendMessage(hostSock, inputStr)) {
+	  cerr << "Unable to send Message. " << endl;
+	}
+	return false;
+      }
+
+      // Display message in chat window
+      {
+	string tmp = "You said: ";
+	tmp.append(inputStr);
+	tmp.append("\n");
+	displayMsg(tmp);
+      }
+
+      // Send to Server
+      if (!SendInteger(hostSock, inputStr.length()+1)) {
+	cerr << "Unable to send Int. " << endl;
+	return false;
+      }
+
+      if (!SendMessage(hostSock, inputStr)) {
+	cerr << "Unable to send Message. " << endl;
+	return false;
+      }
+
+      // Clean slate
+      inputStr.clear();
+      clearInputScreen();
+      break;
+    }
   }
-  clearInputScreen();
+  return true;
+}
 
-  // Reset Screen
-  displayMsg(clearScr);
-  wrefresh(INPUT_SCREEN);
-  clearInputScreen();
-  
-  // Send Data
-  SendInteger(hostSock, userName.length()+1);
-  SendMessage(hostSock, userName);
-  SendInteger(hostSock, userPwd.length()+1);
-  SendMessage(hostSock, userPwd);
+void HandleFrame(LoginState& state, string& frame) {
 
-  // Receive Data
-  responseLen = GetInteger(hostSock);
-  hostResponse = GetMessage(hostSock, responseLen);
+  if (state != LOGIN_WAIT) {
+    displayMsg(frame);
+    return;
+  }
 
   // Evaluate Host Response
-  if (hostResponse == "Login Successful!\n") {
+  if (frame == "Login Successful!\n") {
     // Login Sucessful!
-    username = userName;
-    return true;
+    string welcomeMsg = "\nWelcome!\n\n";
+    displayMsg(welcomeMsg);
+    state = LOGIN_DONE;
   } else {
     // Login Failed
-    return false;
-    
+    promptLogin();
+    state = LOGIN_USER;
   }
-
 }
 
-
 bool SendMessage(int HostSock, string msg) {
 
   // Local Variables
@@ -290,46 +483,6 @@ bool SendMessage(int HostSock, string msg) {
   return true;
 }
 
-string GetMessage(int HostSock, int messageLength) {
-
-  // Retrieve msg
-  int bytesLeft = messageLength;
-  char buffer[messageLength];
-  char* buffPTR = buffer;
-  while (bytesLeft > 0){
-    int bytesRecv = recv(HostSock, buffPTR, messageLength, 0);
-    if (bytesRecv <= 0) {
-      // Failed to Read for some reason.
-      cerr << "Could not recv bytes. Closing clientSocket: " << HostSock << "." << endl;
-      return "";
-    }
-    bytesLeft = bytesLeft - bytesRecv;
-    buffPTR = buffPTR + bytesRecv;
-  }
-
-  return buffer;
-}
-
-long GetInteger(int HostSock) {
-
-  // Retreive length of msg
-  int bytesLeft = sizeof(long);
-  long networkInt;
-  char* bp = (char *) &networkInt;
-  
-  while (bytesLeft) {
-    int bytesRecv = recv(HostSock, bp, bytesLeft, 0);
-    if (bytesRecv <= 0){
-      // Failed to receive bytes
-      cerr << "Failed to receive bytes. Closing clientSocket: " << HostSock << "." << endl;
-      return -1;
-    }
-    bytesLeft = bytesLeft - bytesRecv;
-    bp = bp + bytesRecv;
-  }
-  return ntohl(networkInt);
-}
-
 bool SendInteger(int HostSock, int hostInt) {
 
   // Local Variables
@@ -346,12 +499,51 @@ bool SendInteger(int HostSock, int hostInt) {
   return true;
 }
 
+bool ReadFrames(int HostSock, string& buffer, vector<string>& frames) {
+
+  // Locals
+  char chunk[RECV_CHUNK];
+  bool isOpen = true;
+
+  // The socket stays blocking for sends; reads take only what is already here.
+  while (true) {
+    int bytesRecv = recv(HostSock, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (bytesRecv > 0) {
+      buffer.append(chunk, bytesRecv);
+      continue;
+    }
+    if (bytesRecv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRecv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      isOpen = false;
+    }
+    break;
+  }
+
+  // Each frame is a network long length, then the message and its NUL.
+  size_t pos = 0;
+  while (buffer.length() - pos >= sizeof(long)) {
+    long networkInt;
+    memcpy(&networkInt, buffer.data() + pos, sizeof(long));
+    size_t msgLength = ntohl(networkInt);
+    if (buffer.length() - pos - sizeof(long) < msgLength) {
+      break;
+    }
+    const char* msg = buffer.data() + pos + sizeof(long);
+    frames.push_back(string(msg, strnlen(msg, msgLength)));
+    pos += sizeof(long) + msgLength;
+  }
+  buffer.erase(0, pos);
+
+  return isOpen;
+}
+
 int openSocket (string hostName, unsigned short serverPort) {
 
   // Local variables.
   struct hostent* host;
   int status;
-  int bytesRecv;
 
   // Create a socket and start server communications.
   int hostSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -393,24 +585,24 @@ void prepareWindows() {
   initscr();
   start_color();
 
-  // Set timeout of input to 2 miliseconds.
-  halfdelay(1);
-  //nodelay(INPUT_SCREEN, true);
-
-  // Create new MSG_SCREEN window and enable scrolling of text.
+  // Create new MSG_SCREEN window. PaintScreen draws it from the scrollback.
   noecho();
   cbreak();
   MSG_SCREEN = newwin(LINES - INPUT_LINES, COLS, 0, 0);
-  scrollok(MSG_SCREEN, TRUE);
-  wsetscrreg(MSG_SCREEN, 0, LINES - INPUT_LINES - 1);
   wrefresh(MSG_SCREEN);
 
-  // SET Colors for window.
-  init_pair(1, COLOR_CYAN, COLOR_BLACK);
-  wbkgd(MSG_SCREEN, COLOR_PAIR(1));
+  // SET Colors for window: chat, and command replies.
+  init_pair(MSG_PAIR, COLOR_CYAN, COLOR_BLACK);
+  init_pair(CMD_PAIR, COLOR_MAGENTA, COLOR_BLACK);
+  wbkgd(MSG_SCREEN, COLOR_PAIR(MSG_PAIR));
+  MsgLog.rows.resize(SCROLLBACK_ROWS);
 
   // Create new INPUT_SCREEN window. No scrolling.
   INPUT_SCREEN = newwin(INPUT_LINES, COLS, LINES - INPUT_LINES, 0);
+
+  // Keys are read when poll says stdin has some, so wgetch never waits.
+  nodelay(INPUT_SCREEN, true);
+  keypad(INPUT_SCREEN, true);
   
   // Prepare Input Screen.
   clearInputScreen();
@@ -431,21 +623,13 @@ void clearInputScreen() {
 
 }
 
-bool getUserInput(string& inputStr, bool isPwd) {
+bool getUserInput(string& inputStr, bool isPwd, int userText) {
 
   // Locals
   bool success = false;
-  int userText;
-
-  // Get input from from the input screen. Timeout will occur if no characters are available.
-  userText = wgetch(INPUT_SCREEN);
-
-  // Did we return a proper value?
-  if (userText == ERR)
-    return false;
 
   // Can we display the text? Add to inputStr if yes.
-  if (isprint(userText)) {
+  if (userText < 256 && isprint(userText)) {
     inputStr += (char)userText;
     if (!isPwd) {
       waddch(INPUT_SCREEN, userText);
@@ -457,7 +641,7 @@ bool getUserInput(string& inputStr, bool isPwd) {
   // Pressing <enter> signals that the user has 'sent' something.
   else {
     // Allow for Backspacing.
-    if (userText == BACKSPACE_SYM || userText == DELETE_SYM) {
+    if (userText == BACKSPACE_SYM || userText == DELETE_SYM || userText == KEY_BACKSPACE) {
       if (inputStr.length() > 0) {
 	inputStr.replace(inputStr.length()-1, 1, "");
 	wmove(INPUT_SCREEN, 1, 8 + inputStr.length());
@@ -470,7 +654,7 @@ bool getUserInput(string& inputStr, bool isPwd) {
       wrefresh(INPUT_SCREEN);
     }
     
-    if (userText == ENTER_SYM) {
+    if (userText == ENTER_SYM || userText == KEY_ENTER) {
     // If inputStr isn't empty, it should be submitted.
       if (inputStr.size() > 0) {
 	success = true;
@@ -481,84 +665,338 @@ bool getUserInput(string& inputStr, bool isPwd) {
 }
 
 void displayMsg(string &msg) {
-  pthread_mutex_lock(&displayLock);
-  // Add Msg to screen.
+  // Add Msg to scrollback.
   if (msg.c_str()[0] == '/') {
-    string blank = "\n";
-    waddstr(MSG_SCREEN, blank.c_str());
-    init_pair(2, COLOR_MAGENTA, COLOR_BLACK);
-    wbkgd(MSG_SCREEN, COLOR_PAIR(2));
-    
+    AddText(MsgLog, "\n", MSG_PAIR);
+    AddText(MsgLog, msg, CMD_PAIR);
   } else {
-    // SET Colors for window.
-    init_pair(1, COLOR_CYAN, COLOR_BLACK);
-    wbkgd(MSG_SCREEN, COLOR_PAIR(1));
+    AddText(MsgLog, msg, MSG_PAIR);
   }
-  waddstr(MSG_SCREEN, msg.c_str());
-  //waddch(MSG_SCREEN, '\n');
-  
-  // Show new screen.
-  wrefresh(MSG_SCREEN);
-  pthread_mutex_unlock(&displayLock);
+}
 
+double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
+ScreenRow& NewRow(Scrollback& log, short color) {
 
-void* clientThread(void* args_p) {
-  
-  // Local Variables
-  threadArgs* tmp = (threadArgs*) args_p;
-  int hostSock = tmp -> clientSock;
-  delete tmp;
+  // Full: the oldest row makes way.
+  size_t index = (log.first + log.count) % log.rows.size();
+  if (log.count == log.rows.size()) {
+    log.first = (log.first + 1) % log.rows.size();
+  } else {
+    log.count++;
+  }
+  if (log.offset > 0) {
+    // Someone reading back keeps their place.
+    log.offset = min(log.offset + 1, log.count - 1);
+  }
+  log.rows[index].text.clear();
+  log.rows[index].color = color;
+  return log.rows[index];
+}
 
-  // Detach Thread to ensure that resources are deallocated on return.
-  pthread_detach(pthread_self());
+void AddText(Scrollback& log, const string& text, short color) {
 
-  // Communicate with Client
-  DisplayData(hostSock);
+  // Locals
+  size_t width = max(getmaxx(MSG_SCREEN), 1);
 
-  // Close Client socket
-  close(hostSock);
+  for (size_t i = 0; i < text.length(); i++) {
+    if (text[i] == '\n') {
+      if (!log.isRowOpen) {
+	NewRow(log, color);
+      }
+      log.isRowOpen = false;
+      continue;
+    }
+    if (!log.isRowOpen || log.rows[(log.first + log.count - 1) % log.rows.size()].text.length() >= width) {
+      NewRow(log, color);
+      log.isRowOpen = true;
+    }
+    string& row = log.rows[(log.first + log.count - 1) % log.rows.size()].text;
+    if (text[i] == '\b') {
+      if (!row.empty()) {
+	row.erase(row.length() - 1);
+      }
+    } else {
+      row += text[i];
+    }
+  }
+  log.isDirty = true;
+}
+
+void ScrollBy(Scrollback& log, int rows) {
 
-  // Quit thread
-  pthread_exit(NULL);
+  // Locals
+  size_t height = max(getmaxy(MSG_SCREEN), 1);
+  size_t maxOffset = log.count > height ? log.count - height : 0;
+
+  if (rows < 0) {
+    log.offset -= min((size_t) -rows, log.offset);
+  } else {
+    log.offset = min(log.offset + rows, maxOffset);
+  }
+  log.isDirty = true;
+}
+
+int FrameTimeout(Scrollback& log) {
+
+  if (!log.isDirty) {
+    return -1;
+  }
+  double wait = log.lastPaint + FRAME_SECONDS - Now();
+  return wait <= 0 ? 0 : (int) (wait * 1000) + 1;
+}
+
+void PaintScreen(Scrollback& log) {
+
+  // Locals
+  int height, width;
+  getmaxyx(MSG_SCREEN, height, width);
+
+  // The newest row in view goes at the bottom.
+  werase(MSG_SCREEN);
+  size_t shown = min((size_t) height, log.count - log.offset);
+  for (size_t i = 0; i < shown; i++) {
+    ScreenRow& row = log.rows[(log.first + log.count - log.offset - shown + i) % log.rows.size()];
+    wattrset(MSG_SCREEN, COLOR_PAIR(row.color));
+    mvwaddnstr(MSG_SCREEN, height - shown + i, 0, row.text.c_str(), width);
+  }
+  if (log.offset > 0) {
+    stringstream more;
+    more << " " << log.offset << " more rows below: PageDown ";
+    wattrset(MSG_SCREEN, A_REVERSE);
+    mvwaddnstr(MSG_SCREEN, height - 1, max(width - (int) more.str().length(), 0), more.str().c_str(), width);
+  }
+  wattrset(MSG_SCREEN, A_NORMAL);
+
+  // Input last, so the cursor ends up where the user types.
+  wnoutrefresh(MSG_SCREEN);
+  wnoutrefresh(INPUT_SCREEN);
+  doupdate();
+  log.isDirty = false;
+  log.lastPaint = Now();
 }
 
-void DisplayData (int hostSock) {
+int RunPipe(int hostSock, int inFd) {
 
   // Locals
-  bool canRead = true;
-  fd_set hostfd;
-  struct timeval tv;
-
-  // Clear FD_Set and set timeout.
-  FD_ZERO(&hostfd);
-  tv.tv_sec = 1;
-  tv.tv_usec = 10000;
-
-  // Initialize Data
-  FD_SET(hostSock, &hostfd);
-  int numberOfSocks = hostSock + 1;
-
-  while (canRead) {
-    // Read Data
-    int pollSock = select(numberOfSocks, &hostfd, NULL, NULL, &tv);
-    tv.tv_sec = 1;
-    tv.tv_usec = 10000;
-    FD_SET(hostSock, &hostfd);
-    if (pollSock != 0 && pollSock != -1) {
-      long msgLength = GetInteger(hostSock);
-      if (msgLength <= 0) {
-	cerr << "Couldn't get integer from Client." << endl;
+  PipeSession pipe;
+  string recvBuffer;
+  vector<string> frames;
+  bool isOpen = true;
+  stringstream mark;
+
+  pipe.sock = hostSock;
+  pipe.inFd = inFd;
+  pipe.state = LOGIN_USER;
+  pipe.isInputOpen = true;
+  pipe.hasQuit = false;
+  pipe.status = 0;
+  pipe.numSent = 0;
+  pipe.numFrames = 0;
+  pipe.started = Now();
+  mark << "msgClient drain " << getpid();
+  pipe.drainMark = mark.str();
+
+  struct pollfd fds[2];
+  fds[1].fd = hostSock;
+  while (isOpen) {
+    // Input waits while the login is out or the socket is behind; the server never waits on us.
+    bool wantsInput = pipe.isInputOpen && !pipe.hasQuit && pipe.state != LOGIN_WAIT && pipe.output.length() < PIPE_SEND_LIMIT;
+    fds[0].fd = wantsInput ? inFd : -1;
+    fds[0].events = POLLIN;
+    fds[1].events = POLLIN | (pipe.output.empty() ? 0 : POLLOUT);
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      break;
+    }
+
+    if (fds[0].revents) {
+      char chunk[PIPE_CHUNK];
+      ssize_t got = read(inFd, chunk, sizeof(chunk));
+      if (got > 0) {
+	pipe.input.append(chunk, got);
+      } else if (got == 0 || errno != EINTR) {
+	// A last line without its newline still counts.
+	pipe.isInputOpen = false;
+	if (!pipe.input.empty()) {
+	  pipe.input += '\n';
+	}
+      }
+    }
+
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      isOpen = ReadFrames(hostSock, recvBuffer, frames);
+      for (size_t i = 0; i < frames.size(); i++) {
+	TakePipeFrame(pipe, frames[i]);
+      }
+      frames.clear();
+      if (!WriteOut(STDOUT_FILENO, pipe.records)) {
 	break;
       }
-      string clientMsg = GetMessage(hostSock, msgLength);
-      if (clientMsg == "") {
-	cerr << "Couldn't get message from Client." << endl;
+    }
+    if (pipe.status != 0) {
+      break;
+    }
+
+    // Everything typed so far goes out in as few sends as the socket allows.
+    TakeLines(pipe);
+    while (!pipe.output.empty()) {
+      ssize_t sent = send(hostSock, pipe.output.data(), pipe.output.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (sent > 0) {
+	pipe.output.erase(0, sent);
+	continue;
+      }
+      if (sent < 0 && errno == EINTR) {
+	continue;
+      }
+      if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+	isOpen = false;
+      }
+      break;
+    }
+  }
+
+  double seconds = Now() - pipe.started;
+  cerr << "msgClient: sent " << pipe.numSent << " lines in " << seconds << " s ("
+       << (long) (pipe.numSent / max(seconds, 1e-9)) << " lines/s), received " << pipe.numFrames << " frames" << endl;
+  return pipe.status;
+}
+
+void TakeLines(PipeSession& pipe) {
+
+  // Locals
+  size_t pos = 0;
+  size_t end;
+
+  while (pipe.state != LOGIN_WAIT && !pipe.hasQuit && (end = pipe.input.find('\n', pos)) != string::npos) {
+    string line = pipe.input.substr(pos, end - pos);
+    pos = end + 1;
+    if (!line.empty() && line[line.length() - 1] == '\r') {
+      line.erase(line.length() - 1);
+    }
+
+    switch (pipe.state) {
+    case LOGIN_USER:
+      pipe.userName = line;
+      pipe.state = LOGIN_PWD;
+      break;
+    case LOGIN_PWD:
+      // Nothing else is sent until the answer: after a failed login the server wants a username again.
+      QueueFrame(pipe.output, pipe.userName);
+      QueueFrame(pipe.output, line);
+      pipe.state = LOGIN_WAIT;
+      break;
+    case LOGIN_WAIT:
+      break;
+    case LOGIN_DONE:
+      if (line.empty()) {
 	break;
       }
-      displayMsg(clientMsg);
-      wrefresh(INPUT_SCREEN);
+      QueueFrame(pipe.output, line);
+      pipe.numSent++;
+      if (line == "/quit" || line == "/exit" || line == "/close") {
+	// The server hangs up; whatever it sends first is still read.
+	pipe.hasQuit = true;
+      }
+      break;
     }
   }
+  pipe.input.erase(0, pos);
+
+  // Out of input: find out when the server has caught up, then leave.
+  if (!pipe.isInputOpen && pipe.input.empty() && pipe.state == LOGIN_DONE && !pipe.hasQuit) {
+    QueueFrame(pipe.output, "/msg " + pipe.userName + " " + pipe.drainMark);
+    pipe.hasQuit = true;
+  }
+}
+
+void TakePipeFrame(PipeSession& pipe, string& frame) {
+
+  pipe.numFrames++;
+  if (pipe.state == LOGIN_WAIT) {
+    PutRecord(pipe.records, "login", frame);
+    if (frame == "Login Successful!\n") {
+      pipe.state = LOGIN_DONE;
+      pipe.started = Now();
+    } else {
+      pipe.status = 1;
+    }
+    return;
+  }
+
+  // Our own mark comes back after everything sent before it, possibly sharing a frame.
+  string echo = "/\b\n" + PM_RULE + "\npm from " + pipe.userName + ": " + pipe.drainMark + "\n" + PM_RULE + "\n";
+  size_t at = frame.find(echo);
+  if (at != string::npos) {
+    frame.erase(at, echo.length());
+    QueueFrame(pipe.output, "/quit");
+  }
+  if (!frame.empty()) {
+    PutRecord(pipe.records, frame.compare(0, 2, "/\b") == 0 ? "reply" : "chat", frame);
+  }
+}
+
+void QueueFrame(string& output, const string& msg) {
+
+  // Locals
+  long networkInt = htonl(msg.length() + 1);
+
+  output.append((const char*) &networkInt, sizeof(long));
+  output.append(msg.c_str(), msg.length() + 1);
+}
+
+void PutRecord(string& records, const char* kind, const string& text) {
+
+  // Locals
+  size_t first = 0;
+  size_t last = text.length();
+
+  while (first < last && (text[first] == '\n' || text.compare(first, 2, "/\b") == 0)) {
+    first += text[first] == '\n' ? 1 : 2;
+  }
+  while (last > first && text[last - 1] == '\n') {
+    last--;
+  }
+
+  records.append(kind);
+  records += '\t';
+  for (size_t i = first; i < last; i++) {
+    if (text[i] == '/' && i + 1 < last && text[i + 1] == '\b') {
+      i++;
+    } else if (text[i] == '\\') {
+      records.append("\\\\");
+    } else if (text[i] == '\n') {
+      records.append("\\n");
+    } else if (text[i] == '\t') {
+      records.append("\\t");
+    } else {
+      records += text[i];
+    }
+  }
+  records += '\n';
+}
+
+bool WriteOut(int fd, string& buffer) {
+
+  // Locals
+  size_t pos = 0;
+
+  while (pos < buffer.length()) {
+    ssize_t written = write(fd, buffer.data() + pos, buffer.length() - pos);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    pos += written;
+  }
+  buffer.clear();
+  return true;
 }
@@ -0,0 +1,824 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Several servers acting as one. Every user has a home node, picked by hashing the
+// name, that owns their account and knows which node they are connected to; private messages
+// go through it, and broadcasts and channel lines go to every node, over one batched link per peer.
+
+#include "msgCluster.h"
+
+// Chat Commands
+#include "msgCommands.h"
+#include "msgChannels.h"
+#include "msgHistory.h"
+
+// Instrumentation
+#include "msgMetrics.h"
+
+// Standard Library
+#include<iostream>
+#include<sstream>
+#include<cstring>
+#include<cstdlib>
+#include<deque>
+#include<tr1/functional>
+
+// Network Functions
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+#include<netdb.h>
+#include<unistd.h>
+#include<errno.h>
+#include<time.h>
+#include<sys/time.h>
+
+// GLOBALS
+ClusterState Cluster = { false, 0, vector<NodeLink*>(), 0, "", PTHREAD_MUTEX_INITIALIZER,
+			 PTHREAD_COND_INITIALIZER, 1, map<uint32_t, NodeCall*>(), 0, 0, 0 };
+
+bool StartCluster(int self, string peers, string secret) {
+
+  // Locals
+  stringstream list(peers);
+  string peer;
+  struct sockaddr_in address;
+  int numNodes = 0;
+
+  while (getline(list, peer, ',')) {
+    size_t colon = peer.rfind(':');
+    unsigned short port = colon == string::npos ? 0 : atoi(peer.c_str() + colon + 1);
+    if (port == 0) {
+      cerr << "Bad node address: " << peer << endl;
+      return false;
+    }
+    if (numNodes == self) {
+      if (!NodeAddress(peer.substr(0, colon), port, address)) {
+	cerr << "Unable to resolve " << peer << endl;
+	return false;
+      }
+      Cluster.listenPort = port;
+      Cluster.links.push_back(NULL);
+    } else {
+      NodeLink* link = new NodeLink;
+      link -> node = numNodes;
+      link -> host = peer.substr(0, colon);
+      link -> port = port;
+      pthread_mutex_init(&link -> lock, NULL);
+      pthread_cond_init(&link -> ready, NULL);
+      link -> waiting = link -> frames = link -> writes = link -> connects = link -> dropped = 0;
+      Cluster.links.push_back(link);
+    }
+    numNodes++;
+  }
+  if (self < 0 || self >= numNodes) {
+    cerr << "Node " << self << " is not in the list of " << numNodes << " nodes." << endl;
+    return false;
+  }
+
+  // Other nodes connect to the address this node has in the list.
+  int listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  int reuse = 1;
+  if (listenSock < 0 || setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 || bind(listenSock, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+      listen(listenSock, SOMAXCONN) < 0) {
+    cerr << "Unable to open the node link port " << Cluster.listenPort << endl;
+    return false;
+  }
+
+  Cluster.self = self;
+  Cluster.secret = secret;
+  LocalNode = self;
+  Cluster.isOn = true;
+  pthread_t tid;
+  pthread_create(&tid, NULL, listenNodesThread, (void*) (intptr_t) listenSock);
+  for (int i = 0; i < numNodes; i++) {
+    if (Cluster.links[i] != NULL) {
+      pthread_create(&tid, NULL, linkThread, (void*) Cluster.links[i]);
+    }
+  }
+  return true;
+}
+
+int HomeNode(const string& username) {
+
+  static tr1::hash<string> hashName;
+  return Cluster.isOn ? hashName(username) % Cluster.links.size() : 0;
+}
+
+void PutNumber(string& out, uint32_t value) {
+
+  uint32_t networkInt = htonl(value);
+  out.append((const char*) &networkInt, sizeof(networkInt));
+}
+
+void PutString(string& out, const string& value) {
+
+  PutNumber(out, value.length());
+  out.append(value);
+}
+
+bool GetNumber(const string& frame, size_t& pos, uint32_t& value) {
+
+  if (frame.length() - pos < sizeof(uint32_t)) {
+    return false;
+  }
+  uint32_t networkInt;
+  memcpy(&networkInt, frame.data() + pos, sizeof(networkInt));
+  value = ntohl(networkInt);
+  pos += sizeof(networkInt);
+  return true;
+}
+
+bool GetString(const string& frame, size_t& pos, string& value) {
+
+  size_t start = pos;
+  uint32_t length;
+  if (!GetNumber(frame, pos, length) || frame.length() - pos < length) {
+    pos = start;
+    return false;
+  }
+  value.assign(frame, pos, length);
+  pos += length;
+  return true;
+}
+
+void PutMsg(string& out, const Msg& msg) {
+
+  PutNumber(out, msg.cmd);
+  PutString(out, msg.to);
+  PutString(out, msg.from);
+  PutString(out, msg.msg);
+}
+
+bool GetMsg(const string& frame, size_t& pos, Msg& msg) {
+
+  uint32_t cmd;
+  if (!GetNumber(frame, pos, cmd) || cmd > CMD_HISTORY || !GetString(frame, pos, msg.to) ||
+      !GetString(frame, pos, msg.from) || !GetString(frame, pos, msg.msg)) {
+    return false;
+  }
+  msg.cmd = (CommandType) cmd;
+  msg.queuedAt = MetricsClock();
+  return true;
+}
+
+bool NodeAddress(const string& host, unsigned short port, struct sockaddr_in& address) {
+
+  struct addrinfo hints;
+  struct addrinfo* found;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), NULL, &hints, &found) != 0) {
+    return false;
+  }
+  memcpy(&address, found -> ai_addr, sizeof(address));
+  address.sin_port = htons(port);
+  freeaddrinfo(found);
+  return true;
+}
+
+bool SendFrame(int sock, NodeFrameType type, const string& fields) {
+
+  string frame;
+  PutNumber(frame, fields.length() + 1);
+  frame.push_back((char) type);
+  frame.append(fields);
+  size_t sent = 0;
+  while (sent < frame.length()) {
+    ssize_t bytesSent = send(sock, frame.data() + sent, frame.length() - sent, MSG_NOSIGNAL);
+    if (bytesSent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesSent <= 0) {
+      return false;
+    }
+    sent += bytesSent;
+  }
+  return true;
+}
+
+bool ReadFrame(int sock, string& frame) {
+
+  // Locals
+  // Handshake frames are short.
+  char buffer[1024];
+  size_t want = sizeof(uint32_t);
+  size_t got = 0;
+  uint32_t length = 0;
+
+  while (got < want) {
+    ssize_t bytesRecv = recv(sock, buffer + got, want - got, 0);
+    if (bytesRecv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRecv <= 0) {
+      return false;
+    }
+    got += bytesRecv;
+    if (got == sizeof(uint32_t) && want == sizeof(uint32_t)) {
+      size_t pos = 0;
+      GetNumber(string(buffer, got), pos, length);
+      if (length == 0 || length > sizeof(buffer) - sizeof(uint32_t)) {
+	return false;
+      }
+      want += length;
+    }
+  }
+  frame.assign(buffer + sizeof(uint32_t), length);
+  return true;
+}
+
+string LinkProof(const string& nonce) {
+
+  if (nonce.compare(0, strlen(LINK_PROOF_PREFIX), LINK_PROOF_PREFIX) != 0) {
+    return "";
+  }
+  struct crypt_data* scratch = new struct crypt_data;
+  memset(scratch, 0, sizeof(*scratch));
+  char* result = crypt_rn(Cluster.secret.c_str(), nonce.c_str(), scratch, sizeof(*scratch));
+  string proof = result == NULL || result[0] == '*' ? "" : result;
+  delete scratch;
+  return proof;
+}
+
+bool CheckHello(int sock, const string& frame, const string& nonce) {
+
+  // Locals
+  size_t pos = 1;
+  uint32_t node;
+  string proof;
+  struct sockaddr_in peer;
+  socklen_t peerLength = sizeof(peer);
+  struct sockaddr_in listed;
+
+  if (frame[0] != NODE_HELLO || !GetNumber(frame, pos, node) || !GetString(frame, pos, proof) ||
+      node >= Cluster.links.size() || Cluster.links[node] == NULL) {
+    return false;
+  }
+  // At least the connection must come from where the list says that node is.
+  if (getpeername(sock, (struct sockaddr *) &peer, &peerLength) < 0 ||
+      !NodeAddress(Cluster.links[node] -> host, Cluster.links[node] -> port, listed) ||
+      peer.sin_addr.s_addr != listed.sin_addr.s_addr) {
+    return false;
+  }
+  if (Cluster.secret.empty()) {
+    return true;
+  }
+  string expected = LinkProof(nonce);
+  if (expected.empty() || proof.length() != expected.length()) {
+    return false;
+  }
+  // Compared in full whatever differs, so the timing says nothing.
+  unsigned char diff = 0;
+  for (size_t i = 0; i < proof.length(); i++) {
+    diff |= proof[i] ^ expected[i];
+  }
+  return diff == 0;
+}
+
+void SendNode(int node, NodeFrameType type, const string& fields) {
+
+  NodeLink* link = Cluster.links[node];
+  pthread_mutex_lock(&link -> lock);
+  if (link -> out.length() + fields.length() > MAX_LINK_BACKLOG) {
+    link -> dropped++;
+    pthread_mutex_unlock(&link -> lock);
+    return;
+  }
+  bool wasEmpty = link -> out.empty();
+  PutNumber(link -> out, fields.length() + 1);
+  link -> out.push_back((char) type);
+  link -> out.append(fields);
+  link -> waiting++;
+  link -> frames++;
+  if (wasEmpty) {
+    pthread_cond_signal(&link -> ready);
+  }
+  pthread_mutex_unlock(&link -> lock);
+}
+
+int ConnectNode(NodeLink* link) {
+
+  struct sockaddr_in address;
+  if (!NodeAddress(link -> host, link -> port, address)) {
+    return -1;
+  }
+  int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock < 0) {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    close(sock);
+    return -1;
+  }
+  // Batching happens in out; anything that reaches the socket should go now.
+  int noDelay = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  // The other node speaks first; a link that never reads only needs the timeout here.
+  struct timeval timeout = { NODE_CALL_TIMEOUT, 0 };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  string challenge;
+  string nonce;
+  size_t pos = 1;
+  if (!ReadFrame(sock, challenge) || challenge[0] != NODE_CHALLENGE || !GetString(challenge, pos, nonce)) {
+    close(sock);
+    return -1;
+  }
+  string hello;
+  PutNumber(hello, Cluster.self);
+  PutString(hello, Cluster.secret.empty() ? "" : LinkProof(nonce));
+  if (!SendFrame(sock, NODE_HELLO, hello)) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+void* linkThread(void* args_p) {
+
+  // Locals
+  NodeLink* link = (NodeLink*) args_p;
+  int sock = -1;
+  string batch;
+  long batchFrames;
+
+  pthread_detach(pthread_self());
+  while (true) {
+    if (sock < 0) {
+      sock = ConnectNode(link);
+      if (sock < 0) {
+	usleep(LINK_RETRY_MS * 1000);
+	continue;
+      }
+      pthread_mutex_lock(&link -> lock);
+      link -> connects++;
+      pthread_mutex_unlock(&link -> lock);
+    }
+
+    // Take everything queued since the last write.
+    pthread_mutex_lock(&link -> lock);
+    while (link -> out.empty()) {
+      pthread_cond_wait(&link -> ready, &link -> lock);
+    }
+    batch.swap(link -> out);
+    batchFrames = link -> waiting;
+    link -> waiting = 0;
+    pthread_mutex_unlock(&link -> lock);
+
+    size_t sent = 0;
+    while (sent < batch.length()) {
+      ssize_t bytesSent = send(sock, batch.data() + sent, batch.length() - sent, MSG_NOSIGNAL);
+      if (bytesSent < 0 && errno == EINTR) {
+	continue;
+      }
+      if (bytesSent <= 0) {
+	break;
+      }
+      sent += bytesSent;
+    }
+    pthread_mutex_lock(&link -> lock);
+    link -> writes++;
+    if (sent < batch.length()) {
+      // The peer went away; what it did not take is lost.
+      link -> dropped += batchFrames;
+    }
+    pthread_mutex_unlock(&link -> lock);
+    if (sent < batch.length()) {
+      close(sock);
+      sock = -1;
+    }
+    batch.clear();
+  }
+
+  pthread_exit(NULL);
+}
+
+void* listenNodesThread(void* args_p) {
+
+  int listenSock = (int) (intptr_t) args_p;
+  pthread_detach(pthread_self());
+  while (true) {
+    int sock = accept(listenSock, NULL, NULL);
+    if (sock < 0) {
+      continue;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, nodeReaderThread, (void*) (intptr_t) sock) != 0) {
+      close(sock);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+void* nodeReaderThread(void* args_p) {
+
+  // Locals
+  int sock = (int) (intptr_t) args_p;
+  string in;
+  char chunk[65536];
+  bool isOpen = true;
+  bool isTrusted = false;
+  char nonce[CRYPT_GENSALT_OUTPUT_SIZE];
+  struct timeval timeout = { NODE_CALL_TIMEOUT, 0 };
+
+  pthread_detach(pthread_self());
+  // Anyone can reach the link port, so a peer proves it is a listed node before its frames count.
+  // A NULL random source makes libxcrypt read the nonce from the kernel.
+  string challenge;
+  if (crypt_gensalt_rn(LINK_PROOF_PREFIX, 0, NULL, 0, nonce, sizeof(nonce)) == NULL) {
+    isOpen = false;
+  } else {
+    PutString(challenge, nonce);
+    isOpen = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+      SendFrame(sock, NODE_CHALLENGE, challenge);
+  }
+  while (isOpen) {
+    ssize_t bytesRecv = recv(sock, chunk, sizeof(chunk), 0);
+    if (bytesRecv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRecv <= 0) {
+      break;
+    }
+    in.append(chunk, bytesRecv);
+
+    size_t pos = 0;
+    uint32_t length;
+    while (GetNumber(in, pos, length)) {
+      if (length == 0 || length > MAX_NODE_FRAME) {
+	cerr << "Bad frame from another node; dropping the link." << endl;
+	isOpen = false;
+	break;
+      }
+      if (in.length() - pos < length) {
+	pos -= sizeof(length);
+	break;
+      }
+      if (!isTrusted) {
+	isTrusted = CheckHello(sock, in.substr(pos, length), nonce);
+	if (!isTrusted) {
+	  cerr << "A connection to the node link port failed the handshake; dropping it." << endl;
+	  isOpen = false;
+	  break;
+	}
+	// A listed node may go quiet for as long as it likes.
+	timeout.tv_sec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      } else {
+	HandleNodeFrame(in.substr(pos, length));
+      }
+      pos += length;
+    }
+    in.erase(0, pos);
+  }
+
+  close(sock);
+  pthread_exit(NULL);
+}
+
+void HandleNodeFrame(const string& frame) {
+
+  // Locals
+  size_t pos = 1;
+  uint32_t call;
+  uint32_t origin;
+  uint32_t number;
+  string user;
+  string hash;
+  string text;
+  string reply;
+  Msg newMsg;
+
+  __sync_fetch_and_add(&Cluster.received, 1);
+  switch (frame[0]) {
+  case NODE_HASH_REQ:
+    if (GetNumber(frame, pos, call) && GetNumber(frame, pos, origin) && GetString(frame, pos, user) &&
+	origin < Cluster.links.size() && Cluster.links[origin] != NULL) {
+      bool exists = GetPasswordHash(user, hash);
+      PutNumber(reply, call);
+      PutNumber(reply, exists ? 1 : 0);
+      PutString(reply, hash);
+      SendNode(origin, NODE_HASH_REP, reply);
+    }
+    break;
+  case NODE_HASH_REP:
+  case NODE_CLAIM_REP:
+    if (GetNumber(frame, pos, call) && GetNumber(frame, pos, number)) {
+      GetString(frame, pos, hash);
+      FinishCall(call, number != 0, hash);
+    }
+    break;
+  case NODE_CLAIM_REQ:
+    if (GetNumber(frame, pos, call) && GetNumber(frame, pos, origin) && GetString(frame, pos, user) &&
+	GetString(frame, pos, hash) && origin < Cluster.links.size() && Cluster.links[origin] != NULL) {
+      bool ok = claimUser(user, hash, origin, true);
+      PutNumber(reply, call);
+      PutNumber(reply, ok ? 1 : 0);
+      SendNode(origin, NODE_CLAIM_REP, reply);
+      if (ok) {
+	// Sent after the reply, on the same link, so the session exists when they arrive.
+	HandOverMailbox(user, origin);
+      }
+    }
+    break;
+  case NODE_RELEASE:
+    if (GetNumber(frame, pos, origin) && GetString(frame, pos, user)) {
+      releaseUser(user, origin);
+    }
+    break;
+  case NODE_ROUTE:
+    if (GetNumber(frame, pos, origin) && GetMsg(frame, pos, newMsg) &&
+	(origin < Cluster.links.size() || origin == (uint32_t) -1)) {
+      RouteMsg(newMsg, (int) origin);
+    }
+    break;
+  case NODE_DELIVER:
+    if (GetMsg(frame, pos, newMsg)) {
+      bool isConnected;
+      int node;
+      if (LocateUser(newMsg.to, isConnected, node) && !isConnected && HomeNode(newMsg.to) != Cluster.self) {
+	// Logged out of here before this arrived: the release went home first, so home now keeps it.
+	RouteMsg(newMsg, -1);
+      } else {
+	addToMsgQueue(newMsg);
+      }
+    }
+    break;
+  case NODE_RECORD:
+    if (GetMsg(frame, pos, newMsg)) {
+      RecordHistory(DirectKey(newMsg.from, newMsg.to), newMsg.from, newMsg.msg);
+    }
+    break;
+  case NODE_TIME:
+    if (GetNumber(frame, pos, origin) && GetString(frame, pos, newMsg.to) && GetString(frame, pos, user) &&
+	origin < Cluster.links.size()) {
+      newMsg.from = "SERVER";
+      newMsg.cmd = CMD_TIME;
+      newMsg.msg = GrabTime(user);
+      DeliverTo(origin, newMsg);
+    }
+    break;
+  case NODE_BROADCAST:
+    if (GetNumber(frame, pos, number) && number <= CMD_HISTORY && GetString(frame, pos, newMsg.from) &&
+	GetString(frame, pos, newMsg.msg) && GetString(frame, pos, text)) {
+      newMsg.cmd = (CommandType) number;
+      newMsg.queuedAt = MetricsClock();
+      addToMailboxes(GetConnectedMailboxes(newMsg.from, newMsg.cmd == CMD_PRESENCE), MsgRef(new Msg(newMsg)));
+      if (!text.empty()) {
+	RecordHistory(EVERYONE_KEY, newMsg.from, text);
+      }
+    }
+    break;
+  case NODE_CHANNEL:
+    if (GetString(frame, pos, user) && GetString(frame, pos, newMsg.from) && GetString(frame, pos, newMsg.msg) &&
+	GetString(frame, pos, text)) {
+      newMsg.cmd = CMD_CHANNEL;
+      newMsg.queuedAt = MetricsClock();
+      MemberList members = GetChannelMembers(user);
+      if (members) {
+	addToMailboxes(*members, MsgRef(new Msg(newMsg)));
+      }
+      RecordHistory("#" + user, newMsg.from, text);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+bool CallNode(int node, NodeFrameType type, const string& fields, NodeCall& result) {
+
+  // Locals
+  string frame;
+  struct timespec deadline;
+
+  result.isDone = false;
+  result.ok = false;
+  pthread_mutex_lock(&Cluster.callLock);
+  uint32_t call = Cluster.nextCall++;
+  Cluster.calls[call] = &result;
+  pthread_mutex_unlock(&Cluster.callLock);
+
+  PutNumber(frame, call);
+  frame.append(fields);
+  SendNode(node, type, frame);
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += NODE_CALL_TIMEOUT;
+  pthread_mutex_lock(&Cluster.callLock);
+  while (!result.isDone) {
+    if (pthread_cond_timedwait(&Cluster.callDone, &Cluster.callLock, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  Cluster.calls.erase(call);
+  bool isDone = result.isDone;
+  pthread_mutex_unlock(&Cluster.callLock);
+  if (!isDone) {
+    cerr << "Node " << node << " did not answer." << endl;
+  }
+  return isDone;
+}
+
+void FinishCall(uint32_t call, bool ok, const string& hash) {
+
+  pthread_mutex_lock(&Cluster.callLock);
+  map<uint32_t, NodeCall*>::iterator got = Cluster.calls.find(call);
+  if (got != Cluster.calls.end()) {
+    got->second -> ok = ok;
+    got->second -> hash = hash;
+    got->second -> isDone = true;
+    // Few callers wait at once: only hashing threads make calls.
+    pthread_cond_broadcast(&Cluster.callDone);
+  }
+  pthread_mutex_unlock(&Cluster.callLock);
+}
+
+bool DirectoryHash(const string& username, string& passwordHash) {
+
+  int home = HomeNode(username);
+  if (!Cluster.isOn || home == Cluster.self) {
+    return GetPasswordHash(username, passwordHash);
+  }
+
+  string fields;
+  NodeCall result;
+  PutNumber(fields, Cluster.self);
+  PutString(fields, username);
+  if (!CallNode(home, NODE_HASH_REQ, fields, result) || !result.ok) {
+    return false;
+  }
+  passwordHash = result.hash;
+  return true;
+}
+
+bool DirectoryLogin(const string& username, const string& passwordHash) {
+
+  int home = HomeNode(username);
+  if (!Cluster.isOn || home == Cluster.self) {
+    return loginUser(username, passwordHash);
+  }
+
+  // Claimed here first, so mail home hands over right after its reply finds the session.
+  if (!claimUser(username, passwordHash, LocalNode, false)) {
+    return false;
+  }
+  string fields;
+  NodeCall result;
+  PutNumber(fields, Cluster.self);
+  PutString(fields, username);
+  PutString(fields, passwordHash);
+  if (CallNode(home, NODE_CLAIM_REQ, fields, result) && result.ok) {
+    return true;
+  }
+  // Home has the final say; drop what reached the mailbox meanwhile.
+  deque<MsgRef> msgs;
+  releaseUser(username, LocalNode);
+  TakeMessages(GetMailbox(username), msgs);
+  if (!result.isDone) {
+    // Home may still take the claim after the timeout; undo it there too.
+    fields.clear();
+    PutNumber(fields, Cluster.self);
+    PutString(fields, username);
+    SendNode(home, NODE_RELEASE, fields);
+  }
+  return false;
+}
+
+void HandOverMailbox(const string& username, int node) {
+
+  // Locals
+  deque<MsgRef> msgs;
+
+  Mailbox* mailbox = GetMailbox(username);
+  if (mailbox == NULL) {
+    return;
+  }
+  TakeMessages(mailbox, msgs);
+  for (size_t i = 0; i < msgs.size(); i++) {
+    Msg newMsg = *msgs[i];
+    newMsg.to = username;
+    DeliverTo(node, newMsg);
+  }
+}
+
+void LogoutUser(string username) {
+
+  setUserDisconnected(username);
+  int home = HomeNode(username);
+  if (Cluster.isOn && home != Cluster.self) {
+    string fields;
+    PutNumber(fields, Cluster.self);
+    PutString(fields, username);
+    SendNode(home, NODE_RELEASE, fields);
+  }
+}
+
+void RouteMsg(const Msg& newMsg, int origin) {
+
+  // Locals
+  bool isConnected;
+  int node;
+
+  int home = HomeNode(newMsg.to);
+  if (home != Cluster.self) {
+    string fields;
+    PutNumber(fields, origin);
+    PutMsg(fields, newMsg);
+    SendNode(home, NODE_ROUTE, fields);
+    __sync_fetch_and_add(&Cluster.routed, 1);
+    return;
+  }
+  if (!LocateUser(newMsg.to, isConnected, node)) {
+    return;
+  }
+  RecordDirect(newMsg, origin, node);
+  // Offline users' mail waits here, at home.
+  DeliverTo(node, newMsg);
+}
+
+void RecordDirect(const Msg& newMsg, int origin, int node) {
+
+  // Locals
+  int nodes[2] = { origin, node == origin ? -1 : node };
+
+  if (newMsg.cmd != CMD_MSG) {
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (nodes[i] == Cluster.self) {
+      RecordHistory(DirectKey(newMsg.from, newMsg.to), newMsg.from, newMsg.msg);
+    } else if (nodes[i] >= 0) {
+      string fields;
+      PutMsg(fields, newMsg);
+      SendNode(nodes[i], NODE_RECORD, fields);
+    }
+  }
+}
+
+void DeliverTo(int node, const Msg& newMsg) {
+
+  if (node == Cluster.self) {
+    addToMsgQueue(newMsg);
+    return;
+  }
+  string fields;
+  PutMsg(fields, newMsg);
+  SendNode(node, NODE_DELIVER, fields);
+  __sync_fetch_and_add(&Cluster.routed, 1);
+}
+
+bool RequestTime(const string& requester, const string& username) {
+
+  int home = HomeNode(username);
+  if (!Cluster.isOn || home == Cluster.self) {
+    return false;
+  }
+  string fields;
+  PutNumber(fields, Cluster.self);
+  PutString(fields, requester);
+  PutString(fields, username);
+  SendNode(home, NODE_TIME, fields);
+  return true;
+}
+
+void ForwardBroadcast(const Msg& payload, const string& text) {
+
+  if (!Cluster.isOn) {
+    return;
+  }
+  string fields;
+  PutNumber(fields, payload.cmd);
+  PutString(fields, payload.from);
+  PutString(fields, payload.msg);
+  PutString(fields, text);
+  for (size_t i = 0; i < Cluster.links.size(); i++) {
+    if (Cluster.links[i] != NULL) {
+      SendNode(i, NODE_BROADCAST, fields);
+      __sync_fetch_and_add(&Cluster.forwarded, 1);
+    }
+  }
+}
+
+void ForwardChannel(const string& channel, const Msg& payload, const string& text) {
+
+  if (!Cluster.isOn) {
+    return;
+  }
+  string fields;
+  PutString(fields, channel);
+  PutString(fields, payload.from);
+  PutString(fields, payload.msg);
+  PutString(fields, text);
+  for (size_t i = 0; i < Cluster.links.size(); i++) {
+    if (Cluster.links[i] != NULL) {
+      SendNode(i, NODE_CHANNEL, fields);
+      __sync_fetch_and_add(&Cluster.forwarded, 1);
+    }
+  }
+}
@@ -0,0 +1,259 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Several servers acting as one. Every user has a home node, picked by hashing the
+// name, that owns their account and knows which node they are connected to; private messages
+// go through it, and broadcasts and channel lines go to every node, over one batched link per peer.
+
+#ifndef MSGCLUSTER_H
+#define MSGCLUSTER_H
+
+// Standard Library
+#include<string>
+#include<vector>
+#include<map>
+#include<stdint.h>
+
+// Network Functions
+#include<netinet/in.h>
+
+// Multithreading
+#include<pthread.h>
+
+// Link Handshake
+#include<crypt.h>
+
+// User Directory
+#include "msgUsers.h"
+
+using namespace std;
+
+// DATA TYPES
+// On a link every frame is a 4 byte length, a type byte, then numbers (4 bytes, network order)
+// and strings (a number, then the bytes) in the order listed.
+enum NodeFrameType {
+  NODE_HASH_REQ = 1,   // call, origin, user
+  NODE_HASH_REP,       // call, exists, hash
+  NODE_CLAIM_REQ,      // call, origin, user, hash
+  NODE_CLAIM_REP,      // call, ok
+  NODE_RELEASE,        // origin, user
+  NODE_ROUTE,          // origin (-1: already recorded there), cmd, to, from, msg: to the recipient's home node
+  NODE_DELIVER,        // cmd, to, from, msg: to the node the recipient is connected to
+  NODE_TIME,           // origin, requester, user: to the user's home node
+  NODE_BROADCAST,      // cmd, from, msg, text for history ("" for none)
+  NODE_CHANNEL,        // channel, from, msg, text for history
+  NODE_RECORD,         // cmd, to, from, msg: a private message for history, once home has found the recipient
+  NODE_CHALLENGE,      // nonce: sent first by the accepting node
+  NODE_HELLO           // node, proof: the connecting node's answer; nothing else is taken before it
+};
+
+// The way to one other node. Frames queue in out; the link's thread writes everything that
+// has built up with one send, so a busy link carries many frames per system call.
+struct NodeLink {
+  int node;
+  string host;
+  unsigned short port;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  string out;
+  long waiting;        // frames in out
+  long frames;
+  long writes;
+  long connects;
+  long dropped;
+};
+
+// A request waiting for its reply.
+struct NodeCall {
+  bool isDone;
+  bool ok;
+  string hash;
+};
+
+struct ClusterState {
+  bool isOn;
+  int self;
+  // By node id; links[self] is NULL.
+  vector<NodeLink*> links;
+  unsigned short listenPort;
+  // Shared by every node; "" checks peers by address only.
+  string secret;
+  pthread_mutex_t callLock;
+  pthread_cond_t callDone;
+  uint32_t nextCall;
+  map<uint32_t, NodeCall*> calls;
+  long routed;
+  long forwarded;
+  long received;
+};
+
+// GLOBALS
+// A peer that is down for long gets its frames dropped past this much.
+const size_t MAX_LINK_BACKLOG = 64 * 1024 * 1024;
+const size_t MAX_NODE_FRAME = 16 * 1024 * 1024;
+const int NODE_CALL_TIMEOUT = 5;
+const int LINK_RETRY_MS = 200;
+// sha256crypt: the nonce is its salt.
+const char* const LINK_PROOF_PREFIX = "$5$";
+extern ClusterState Cluster;
+
+// Function Prototypes
+bool StartCluster(int self, string peers, string secret);
+// Function joins a cluster: peers lists every node's link address as host:port,host:port,...
+// pre: self should index peers. Every node should be given the same list and secret.
+// post: returns false if the list is bad or the link port could not be opened.
+
+int HomeNode(const string& username);
+// Function picks the node that owns a user's account and location.
+// pre: none
+// post: always 0 outside a cluster.
+
+void PutNumber(string& out, uint32_t value);
+// Function appends a number to a frame being built.
+// pre: none
+// post: none
+
+void PutString(string& out, const string& value);
+// Function appends a string to a frame being built.
+// pre: none
+// post: none
+
+bool GetNumber(const string& frame, size_t& pos, uint32_t& value);
+// Function reads a number from a received frame.
+// pre: none
+// post: returns false, leaving pos alone, if the frame is too short.
+
+bool GetString(const string& frame, size_t& pos, string& value);
+// Function reads a string from a received frame.
+// pre: none
+// post: returns false, leaving pos alone, if the frame is too short.
+
+void PutMsg(string& out, const Msg& msg);
+// Function appends a message's command, recipient, sender and text to a frame being built.
+// pre: none
+// post: none
+
+bool GetMsg(const string& frame, size_t& pos, Msg& msg);
+// Function reads a message written by PutMsg.
+// pre: none
+// post: returns false if the frame is too short.
+
+bool NodeAddress(const string& host, unsigned short port, struct sockaddr_in& address);
+// Function resolves a node's link address.
+// pre: none
+// post: returns false if host could not be resolved.
+
+bool SendFrame(int sock, NodeFrameType type, const string& fields);
+// Function writes one frame straight to a link's socket, for the handshake.
+// pre: nothing else should be writing to sock.
+// post: returns false if the socket failed.
+
+bool ReadFrame(int sock, string& frame);
+// Function reads one frame from a link's socket, for the handshake.
+// pre: sock should have a receive timeout, so a silent peer cannot hold it.
+// post: frame is the type byte and fields; returns false on a bad frame or a failed socket.
+
+string LinkProof(const string& nonce);
+// Function answers a challenge: the shared secret hashed with the nonce as its salt.
+// pre: nonce should be a "$5$" setting.
+// post: returns "" if it could not be hashed.
+
+bool CheckHello(int sock, const string& frame, const string& nonce);
+// Function decides whether a connecting node may send frames.
+// pre: frame should be the first one read from sock, after nonce was sent.
+// post: returns false unless it is a hello from a listed node, from that node's address, with
+//       the right proof when there is a secret.
+
+void SendNode(int node, NodeFrameType type, const string& fields);
+// Function queues one frame for another node.
+// pre: node should not be Cluster.self.
+// post: the frame is dropped if the link has MAX_LINK_BACKLOG bytes waiting.
+
+int ConnectNode(NodeLink* link);
+// Function opens a link's connection and answers the other node's challenge.
+// pre: none
+// post: returns -1 if the node could not be reached or did not send a challenge.
+
+void* linkThread(void* args_p);
+// Function keeps a link connected and writes whatever has been queued on it.
+// pre: args_p should be the link's NodeLink.
+// post: none
+
+void* listenNodesThread(void* args_p);
+// Function accepts links from other nodes.
+// pre: args_p should be the listening socket.
+// post: none
+
+void* nodeReaderThread(void* args_p);
+// Function challenges one other node, then reads its frames and handles them.
+// pre: args_p should be the connected socket.
+// post: the socket is closed when the peer goes away or fails the handshake.
+
+void HandleNodeFrame(const string& frame);
+// Function carries out one frame from another node.
+// pre: frame should be the type byte and fields, without the length.
+// post: malformed frames are ignored.
+
+bool CallNode(int node, NodeFrameType type, const string& fields, NodeCall& result);
+// Function sends a request and blocks until its reply arrives.
+// pre: fields should not include the call number; it is put first.
+// post: returns false if no reply came within NODE_CALL_TIMEOUT seconds.
+
+void FinishCall(uint32_t call, bool ok, const string& hash);
+// Function hands a reply to the thread waiting for it.
+// pre: none
+// post: replies nobody waits for any more are ignored.
+
+bool DirectoryHash(const string& username, string& passwordHash);
+// Function looks up a user's password hash at their home node.
+// pre: none
+// post: returns false if the account does not exist or the home node did not answer.
+
+bool DirectoryLogin(const string& username, const string& passwordHash);
+// Function logs a user in at their home node, then here.
+// pre: passwordHash should have been checked as for loginUser.
+// post: messages the home node held for the user are sent on to this node. On false the
+//       user is left disconnected here.
+
+void HandOverMailbox(const string& username, int node);
+// Function sends what is waiting in a user's mailbox here on to the node they connected to.
+// pre: this should be the user's home node.
+// post: the mailbox is empty.
+
+void LogoutUser(string username);
+// Function marks a user disconnected here and, in a cluster, at their home node.
+// pre: none
+// post: none
+
+void RouteMsg(const Msg& newMsg, int origin);
+// Function delivers a private message or poke wherever its recipient is.
+// pre: origin should be the sender's node, or -1 if its history already has the message.
+// post: messages to unknown users are dropped by their home node, and recorded nowhere.
+
+void RecordDirect(const Msg& newMsg, int origin, int node);
+// Function keeps a private message in the history of the sender's node and of the node holding it.
+// pre: this should be the recipient's home node, and the recipient should exist.
+// post: other commands are ignored.
+
+void DeliverTo(int node, const Msg& newMsg);
+// Function queues a message for a user connected to a given node.
+// pre: none
+// post: none
+
+bool RequestTime(const string& requester, const string& username);
+// Function asks a user's home node how long they have been connected.
+// pre: none
+// post: returns false, sending nothing, if this node is the home node.
+
+void ForwardBroadcast(const Msg& payload, const string& text);
+// Function sends a broadcast or presence notice to every other node.
+// pre: none
+// post: each node queues it for its own connected users.
+
+void ForwardChannel(const string& channel, const Msg& payload, const string& text);
+// Function sends a channel line to every other node.
+// pre: none
+// post: each node queues it for its own members of the channel.
+
+#endif
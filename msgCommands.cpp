@@ -0,0 +1,683 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Chat command parsing, dispatch and delivery formatting for the server.
+
+#include "msgCommands.h"
+
+// Instrumentation
+#include "msgMetrics.h"
+
+// Cluster Routing
+#include "msgCluster.h"
+
+// Saved Accounts
+#include "msgAccounts.h"
+
+// Standard Library
+#include<iostream>
+#include<sstream>
+#include<cstring>
+#include<cstdlib>
+#include<vector>
+#include<algorithm>
+
+// Network Functions
+#include<unistd.h>
+
+// GLOBALS
+// Every command the server understands, matched against the text before the first space.
+// The length comes from the literal, so adding a command cannot get it wrong.
+#define COMMAND(name, type) { name, sizeof(name) - 1, type }
+const CommandEntry COMMAND_TABLE[] = {
+  COMMAND("/all", CMD_ALL),
+  COMMAND("/msg", CMD_MSG),
+  COMMAND("/poke", CMD_POKE),
+  COMMAND("/time", CMD_TIME),
+  COMMAND("/joke", CMD_JOKE),
+  COMMAND("/users", CMD_USERS),
+  COMMAND("/picture", CMD_PICTURE),
+  COMMAND("/presence", CMD_PRESENCE),
+  COMMAND("/join", CMD_JOIN),
+  COMMAND("/leave", CMD_LEAVE),
+  COMMAND("/history", CMD_HISTORY)
+};
+#undef COMMAND
+PresenceBatch PendingPresence = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, map<string, bool>(), 0, 0, 0 };
+long PresenceWindowMs = 0;
+
+void broadcastMsg(string userName, string msg, bool isConnected) {
+
+  // Build the payload once; every recipient shares it.
+  Msg* tmp = new Msg;
+  tmp->from = userName;
+  tmp->cmd = CMD_ALL;
+  tmp->queuedAt = MetricsClock();
+  if (msg == "") {
+    tmp->cmd = CMD_PRESENCE;
+    // This is a login/logoff announcement.
+    tmp->msg.append (userName);
+    if (isConnected) {
+      tmp->msg.append (" has connected! :)\n");
+    } else {
+      tmp->msg.append (" has disconnected! :(\n");
+    }
+  } else {
+    // This is a global Msg
+    tmp->msg.append (userName);
+    tmp->msg.append (" has said: ");
+    tmp->msg.append (msg);
+    RecordHistory(EVERYONE_KEY, userName, msg);
+  }
+  MsgRef payload(tmp);
+
+  // Snapshot the recipients, then enqueue with no directory lock held.
+  vector<Mailbox*> recipients = GetConnectedMailboxes(userName, tmp->cmd == CMD_PRESENCE);
+  addToMailboxes(recipients, payload);
+  ForwardBroadcast(*tmp, tmp->cmd == CMD_ALL ? msg : "");
+}
+
+bool SendToChannel(string userFrom, string msg) {
+
+  // Locals
+  string channel;
+  Mailbox* own = NULL;
+
+  if (!GetCurrentChannel(userFrom, channel, own) || channel.empty()) {
+    return false;
+  }
+  Msg* tmp = new Msg;
+  tmp->from = userFrom;
+  tmp->cmd = CMD_CHANNEL;
+  tmp->queuedAt = MetricsClock();
+  tmp->msg = "#" + channel + " " + userFrom + " has said: " + msg;
+  MsgRef payload(tmp);
+  // A snapshot: members joining or leaving from here on do not hold up the fan-out.
+  MemberList members = GetChannelMembers(channel);
+  if (members) {
+    addToMailboxes(*members, payload, own);
+  }
+  // Other nodes may have members even when this one has no others.
+  ForwardChannel(channel, *tmp, msg);
+  RecordHistory("#" + channel, userFrom, msg);
+  return true;
+}
+
+void SendHistory(string userFrom, string args) {
+
+  // Locals
+  istringstream words(args);
+  vector<string> tokens;
+  string word;
+  string target;
+  string channel;
+  Mailbox* own;
+  string key;
+  size_t count = DEFAULT_HISTORY_LINES;
+  uint64_t before = 0;
+  vector<HistoryEntry> entries;
+  Msg page;
+  page.to = userFrom;
+  page.from = "SERVER";
+  page.cmd = CMD_HISTORY;
+
+  while (words >> word) {
+    tokens.push_back(word);
+  }
+  size_t next = 0;
+  if (next < tokens.size() && (tokens[next][0] == '#' || tokens[next][0] == '@' || tokens[next] == "all")) {
+    target = tokens[next++];
+  }
+  if (target.empty()) {
+    // Wherever the user's plain chat goes.
+    GetCurrentChannel(userFrom, channel, own);
+    target = channel.empty() ? "all" : "#" + channel;
+  }
+  if (target == "all") {
+    key = EVERYONE_KEY;
+  } else if (target[0] == '@' && target.length() > 1) {
+    key = DirectKey(userFrom, target.substr(1));
+  } else if (target[0] == '#' && ValidChannelName(target, channel)) {
+    key = "#" + channel;
+  }
+  char* end;
+  bool isValid = !key.empty();
+  if (isValid && next < tokens.size()) {
+    count = strtoul(tokens[next++].c_str(), &end, 10);
+    isValid = *end == '\0' && count > 0;
+  }
+  if (isValid && next < tokens.size()) {
+    before = strtoull(tokens[next++].c_str(), &end, 10);
+    isValid = *end == '\0';
+  }
+  if (!isValid || next < tokens.size()) {
+    page.msg = "/\bUsage: /history [#channel|@user|all] [n] [before-id]\n";
+    addToMsgQueue(page);
+    return;
+  }
+  if (key[0] == '#' && !IsChannelMember(userFrom, channel)) {
+    // A channel's lines are for its members; "all" and @user are keyed to what the user can see anyway.
+    page.msg = "/\bJoin " + target + " to read its history.\n";
+    addToMsgQueue(page);
+    return;
+  }
+
+  bool hasOlder = ReadHistory(key, min(count, History.numSlots), before, entries);
+  if (entries.empty()) {
+    page.msg = "/\bNo history for " + target + ".\n";
+    addToMsgQueue(page);
+    return;
+  }
+  // Oldest first, HISTORY_PAGE_LINES to a message, all through the user's own mailbox.
+  for (size_t i = 0; i < entries.size(); i += HISTORY_PAGE_LINES) {
+    stringstream text;
+    text << "/\b";
+    if (i == 0) {
+      text << "History of " << target << ":" << endl;
+    }
+    for (size_t j = i; j < entries.size() && j < i + HISTORY_PAGE_LINES; j++) {
+      char stamp[16];
+      struct tm local;
+      localtime_r(&entries[j].stamp, &local);
+      strftime(stamp, sizeof(stamp), "%m-%d %H:%M", &local);
+      text << "[" << entries[j].id << " " << stamp << "] " << entries[j].from << ": "
+	   << entries[j].text << endl;
+    }
+    if (i + HISTORY_PAGE_LINES >= entries.size() && hasOlder) {
+      text << "Older: /history " << target << " " << count << " " << entries[0].id << endl;
+    }
+    page.msg = text.str();
+    addToMsgQueue(page);
+    __sync_fetch_and_add(&History.pagesSent, 1);
+  }
+}
+
+void AnnouncePresence(string userName, bool isConnected) {
+
+  if (PresenceWindowMs == 0) {
+    // One notice per event, to everyone else.
+    broadcastMsg(userName, "", isConnected);
+    return;
+  }
+
+  pthread_mutex_lock(&PendingPresence.lock);
+  PendingPresence.events++;
+  map<string, bool>::iterator got = PendingPresence.changes.find(userName);
+  if (got == PendingPresence.changes.end()) {
+    if (PendingPresence.changes.empty()) {
+      pthread_cond_signal(&PendingPresence.queued);
+    }
+    PendingPresence.changes[userName] = isConnected;
+  } else if (got->second != isConnected) {
+    // Back where the last notice left them; nobody needs to hear about it.
+    PendingPresence.changes.erase(got);
+    PendingPresence.cancelled++;
+  }
+  pthread_mutex_unlock(&PendingPresence.lock);
+}
+
+void FlushPresence() {
+
+  // Locals
+  map<string, bool> changes;
+  stringstream joined;
+  stringstream left;
+  size_t numJoined = 0;
+  size_t numLeft = 0;
+
+  pthread_mutex_lock(&PendingPresence.lock);
+  changes.swap(PendingPresence.changes);
+  pthread_mutex_unlock(&PendingPresence.lock);
+  if (changes.empty()) {
+    return;
+  }
+
+  // "joined: a, b, c / left: d"
+  for (map<string, bool>::iterator it = changes.begin(); it != changes.end(); it++) {
+    stringstream& names = it->second ? joined : left;
+    size_t& count = it->second ? numJoined : numLeft;
+    if (count < PRESENCE_MAX_NAMES) {
+      names << (count > 0 ? ", " : "") << it->first;
+    }
+    count++;
+  }
+  Msg* tmp = new Msg;
+  tmp->from = "SERVER";
+  tmp->cmd = CMD_PRESENCE;
+  tmp->queuedAt = MetricsClock();
+  if (numJoined > 0) {
+    tmp->msg.append("joined: " + joined.str());
+    if (numJoined > PRESENCE_MAX_NAMES) {
+      stringstream more;
+      more << " and " << numJoined - PRESENCE_MAX_NAMES << " more";
+      tmp->msg.append(more.str());
+    }
+  }
+  if (numLeft > 0) {
+    tmp->msg.append(numJoined > 0 ? " / left: " : "left: ");
+    tmp->msg.append(left.str());
+    if (numLeft > PRESENCE_MAX_NAMES) {
+      stringstream more;
+      more << " and " << numLeft - PRESENCE_MAX_NAMES << " more";
+      tmp->msg.append(more.str());
+    }
+  }
+  tmp->msg.append("\n");
+  MsgRef payload(tmp);
+
+  // Everyone gets the same notice, the users it names included.
+  vector<Mailbox*> recipients = GetConnectedMailboxes("", true);
+  addToMailboxes(recipients, payload);
+  ForwardBroadcast(*tmp, "");
+  __sync_fetch_and_add(&PendingPresence.notices, 1);
+}
+
+bool StartPresence(long windowMs) {
+
+  PresenceWindowMs = windowMs;
+  if (windowMs == 0) {
+    return true;
+  }
+  pthread_t presenceTid;
+  if (pthread_create(&presenceTid, NULL, presenceThread, NULL) != 0) {
+    return false;
+  }
+  pthread_detach(presenceTid);
+  return true;
+}
+
+void* presenceThread(void* args_p) {
+
+  pthread_mutex_lock(&PendingPresence.lock);
+  while (true) {
+    // An idle server has nothing to flush, so nothing wakes this thread.
+    while (PendingPresence.changes.empty()) {
+      pthread_cond_wait(&PendingPresence.queued, &PendingPresence.lock);
+    }
+    pthread_mutex_unlock(&PendingPresence.lock);
+    // The first change sets the deadline; whatever comes in before it goes out in the same notice.
+    usleep(PresenceWindowMs * 1000);
+    FlushPresence();
+    pthread_mutex_lock(&PendingPresence.lock);
+  }
+  return NULL;
+}
+
+
+string GetMsgs(Mailbox* mailbox, int* numMsgs, vector<long>* queuedAt) {
+  stringstream ss;
+  deque<MsgRef> msgs;
+
+  // Take everything queued so far and format it outside the lock.
+  TakeMessages(mailbox, msgs);
+  if (numMsgs != NULL) {
+    *numMsgs = msgs.size();
+  }
+  if (msgs.empty()) {
+    return "";
+  }
+  ObserveMetric(HIST_MAILBOX_DEPTH, msgs.size());
+  long delivered[METRIC_COMMANDS] = { 0 };
+
+  for (size_t i = 0; i < msgs.size(); i++) {
+    CommandType cmd = msgs[i]->cmd;
+    delivered[cmd]++;
+    if (queuedAt != NULL) {
+      queuedAt->push_back(msgs[i]->queuedAt);
+    }
+    switch (cmd) {
+    case CMD_MSG:
+      // Msg was intended for our user.
+      ss << "/\b\n************************************\npm from " << msgs[i]->from << ": ";
+      ss << msgs[i]->msg << endl << "************************************" << endl;
+      break;
+    case CMD_ALL:
+    case CMD_PRESENCE:
+    case CMD_CHANNEL:
+    case CMD_JOIN:
+    case CMD_LEAVE:
+      // Msg was intended for all users, a channel, or is a reply to a setting.
+      ss << msgs[i]->msg << endl;
+      break;
+    case CMD_USERS:
+      ss << msgs[i]->msg << endl;
+      break;
+    case CMD_POKE:
+      ss << "/\b\n" << msgs[i]->from << " has poked you!" << endl;
+      break;
+    case CMD_TIME:
+    case CMD_JOKE:
+    case CMD_PICTURE:
+    case CMD_HISTORY:
+      ss << msgs[i]->msg;
+      break;
+    default:
+      break;
+    }
+  }
+  ThreadMetrics& metrics = LocalMetrics();
+  for (int i = 0; i < METRIC_COMMANDS; i++) {
+    if (delivered[i] > 0) {
+      Bump(metrics.delivered[i], delivered[i]);
+    }
+  }
+  
+  return ss.str();
+}
+
+void SaveMsg(const char* data, size_t length, string userFrom) {
+  
+  // Local Variables
+  ParsedMsg parsed;
+  processMsg(data, length, parsed);
+  Msg newMsg;
+  newMsg.cmd = parsed.type;
+  newMsg.from = userFrom;
+
+  switch (parsed.type) {
+  case CMD_ALL:
+    // Plain chat goes to the current channel; "/all", or chat outside any channel, to everyone.
+    if (parsed.cmd.length > 0 || !SendToChannel(userFrom, string(data, length))) {
+      broadcastMsg(userFrom, string(data, length), false);
+    }
+    break;
+  case CMD_MSG:
+  case CMD_POKE:
+    // Regular Private message or poke.
+    newMsg.to.assign(parsed.userTo.data, parsed.userTo.length);
+    if (Cluster.isOn) {
+      // The recipient's home node knows where they are, and whether they exist; both ends keep the history.
+      newMsg.msg.assign(parsed.text.data, parsed.text.length);
+      RouteMsg(newMsg, Cluster.self);
+    } else if (doesUserExist(newMsg.to)) {
+      newMsg.msg.assign(parsed.text.data, parsed.text.length);
+      addToMsgQueue(newMsg);
+      if (parsed.type == CMD_MSG) {
+	RecordHistory(DirectKey(userFrom, newMsg.to), userFrom, newMsg.msg);
+      }
+    }
+    break;
+  case CMD_USERS:
+    newMsg.to = userFrom;
+    newMsg.from = "SERVER";
+    newMsg.msg = GrabUsers(userFrom);
+    addToMsgQueue(newMsg);
+    break;
+  case CMD_TIME:
+    newMsg.from = "SERVER";
+    if (parsed.userTo.length == 0) {
+      newMsg.msg = GrabTime(userFrom);
+    } else if (RequestTime(userFrom, string(parsed.userTo.data, parsed.userTo.length))) {
+      // Their home node answers.
+      break;
+    } else {
+      newMsg.msg = GrabTime(string(parsed.userTo.data, parsed.userTo.length));
+    }
+    newMsg.to = userFrom;
+    addToMsgQueue(newMsg);
+    break;
+  case CMD_JOKE:
+    newMsg.to = userFrom;
+    newMsg.from = "SERVER";
+    newMsg.msg = GrabJoke();
+    addToMsgQueue(newMsg);
+    break;
+  case CMD_PICTURE:
+    newMsg.to = userFrom;
+    newMsg.from = "SERVER";
+    newMsg.msg = GrabPic();
+    addToMsgQueue(newMsg);
+    break;
+  case CMD_PRESENCE:
+    newMsg.to = userFrom;
+    newMsg.from = "SERVER";
+    if (ViewEquals(parsed.userTo, "on") || ViewEquals(parsed.userTo, "off")) {
+      SetPresenceWanted(userFrom, ViewEquals(parsed.userTo, "on"));
+      newMsg.msg = "/\bJoin and leave notices are now " + string(parsed.userTo.data, parsed.userTo.length) + ".";
+    } else {
+      newMsg.msg = "/\bUsage: /presence on|off";
+    }
+    addToMsgQueue(newMsg);
+    break;
+  case CMD_JOIN: {
+    string channel;
+    newMsg.to = userFrom;
+    newMsg.from = "SERVER";
+    if (ValidChannelName(string(parsed.userTo.data, parsed.userTo.length), channel)) {
+      stringstream reply;
+      size_t numMembers = JoinChannel(userFrom, channel);
+      reply << "/\bJoined #" << channel << " (" << numMembers << (numMembers == 1 ? " member" : " members")
+	    << "). Chat now goes to #" << channel << ".";
+      newMsg.msg = reply.str();
+    } else {
+      newMsg.msg = "/\bUsage: /join #channel (letters, digits, _ and -, at most 32)";
+    }
+    addToMsgQueue(newMsg);
+    break;
+  }
+  case CMD_LEAVE: {
+    string channel;
+    Mailbox* own;
+    newMsg.to = userFrom;
+    newMsg.from = "SERVER";
+    if (parsed.userTo.length == 0) {
+      // No name: the current channel.
+      GetCurrentChannel(userFrom, channel, own);
+    } else {
+      ValidChannelName(string(parsed.userTo.data, parsed.userTo.length), channel);
+    }
+    if (channel.empty()) {
+      newMsg.msg = "/\bUsage: /leave [#channel]";
+    } else if (LeaveChannel(userFrom, channel)) {
+      newMsg.msg = "/\bLeft #" + channel + ".";
+    } else {
+      newMsg.msg = "/\bYou are not in #" + channel + ".";
+    }
+    addToMsgQueue(newMsg);
+    break;
+  }
+  case CMD_HISTORY:
+    // Everything after "/history"; userTo starts it.
+    SendHistory(userFrom, string(parsed.userTo.data, data + length - parsed.userTo.data));
+    break;
+  default:
+    break;
+  }
+
+}
+
+bool ViewEquals(MsgView view, const char* text) {
+
+  return strlen(text) == view.length && memcmp(view.data, text, view.length) == 0;
+}
+
+CommandType LookupCommand(const char* name, size_t length) {
+
+  for (size_t i = 0; i < sizeof(COMMAND_TABLE) / sizeof(COMMAND_TABLE[0]); i++) {
+    if (COMMAND_TABLE[i].length == length && memcmp(COMMAND_TABLE[i].name, name, length) == 0) {
+      return COMMAND_TABLE[i].type;
+    }
+  }
+  return CMD_UNKNOWN;
+}
+
+void processMsg(const char* data, size_t length, ParsedMsg& parsed) {
+  
+  // Turn
+  // "/msg user blahblahbah"
+  // into
+  // (/msg, user, blahblahblah)
+  // without copying anything out of data.
+  const char* end = data + length;
+  parsed.cmd.data = data;
+  parsed.cmd.length = 0;
+  parsed.userTo.data = end;
+  parsed.userTo.length = 0;
+  parsed.text.data = data;
+  parsed.text.length = length;
+
+  if (length == 0 || data[0] != '/') {
+    // Plain chat goes to the current channel, or to everyone.
+    parsed.type = CMD_ALL;
+    return;
+  }
+
+  // Was a Command, Let's figure out what it was.
+  const char* cmdEnd = (const char*) memchr(data + 1, ' ', length - 1);
+  if (cmdEnd == NULL) {
+    // must be a non-argument command.
+    cmdEnd = end;
+  }
+  parsed.cmd.length = cmdEnd - data;
+  parsed.type = LookupCommand(data, parsed.cmd.length);
+  parsed.text.data = end;
+  parsed.text.length = 0;
+
+  if (parsed.type == CMD_MSG || parsed.type == CMD_POKE || parsed.type == CMD_TIME ||
+      parsed.type == CMD_PRESENCE || parsed.type == CMD_JOIN || parsed.type == CMD_LEAVE ||
+      parsed.type == CMD_HISTORY) {
+    // Need to grab user information.
+    if (cmdEnd == end) {
+      return;
+    }
+    const char* userStart = cmdEnd + 1;
+    const char* userEnd = (const char*) memchr(userStart, ' ', end - userStart);
+    if (userEnd == NULL) {
+      // no message, just action
+      userEnd = end;
+    }
+    parsed.userTo.data = userStart;
+    parsed.userTo.length = userEnd - userStart;
+    if (userEnd != end) {
+      parsed.text.data = userEnd + 1;
+      parsed.text.length = end - userEnd - 1;
+    }
+  }
+}
+
+string GrabPic() {
+
+  stringstream welcomeMsg;
+  welcomeMsg <<"/\b#############################################################"<<endl;
+  welcomeMsg <<"#                    _                                      #"<<endl;  
+  welcomeMsg <<"#                  -=\\`\\                                    #"<<endl;  
+  welcomeMsg <<"#              |\\ ____\\_\\__                                 #"<<endl;  
+  welcomeMsg <<"#            -=\\c`\"\"\"\"\"\"\" \"`)                               #"<<endl;  
+  welcomeMsg <<"#               `~~~~~/ /~~`                                #"<<endl;  
+  welcomeMsg <<"#                 -==/ /                                    #"<<endl;  
+  welcomeMsg <<"#                   '-'                                     #"<<endl;  
+  welcomeMsg <<"#                  _  _                                     #"<<endl;  
+  welcomeMsg <<"#                 ( `   )_                                  #"<<endl;  
+  welcomeMsg <<"#                (    )    `)                               #"<<endl;  
+  welcomeMsg <<"#              (_   (_ .  _) _)                             #"<<endl;  
+  welcomeMsg <<"#                                             _             #"<<endl;  
+  welcomeMsg <<"#                                            (  )           #"<<endl;  
+  welcomeMsg <<"#             _ .                         ( `  ) . )        #"<<endl;  
+  welcomeMsg <<"#           (  _ )_                      (_, _(  ,_)_)      #"<<endl;  
+  welcomeMsg <<"#         (_  _(_ ,)                                        #"<<endl; 
+  welcomeMsg <<"#############################################################"<<endl;
+
+  return welcomeMsg.str();
+}
+
+string GrabJoke() {
+
+  stringstream ss;
+  // Need to get a random number.
+  srand (time(NULL));
+  int rndNum = rand() % 10 + 1; // between 1 and 10
+
+  // Grab the joke!
+  switch (rndNum) {
+  case 1:
+    ss << "/\bMost people believe that if it ain't broke, don't fix it. Engineers believe that if it ain't broke, it doesn't have enough features yet." << endl;
+    break;
+  case 2:
+    ss << "/\bQ: How does a computer tell you it needs more memory?   A: It says ''byte me''" << endl;
+    break;
+  case 3:
+    ss << "/\bQ: What is the first programming language you learn when studying computer science?  A: Profanity" << endl;
+    break;
+  case 4:
+    ss << "/\bA blind man walks into a bar...   and a chair and a table." << endl;
+    break;
+  case 5:
+    ss << "/\bQ: Why don't cows make large bets?   A: The steaks are too high." << endl;
+    break;
+  case 6:
+    ss << "/\bQ: Why aren't jokes in base 8 funny?   A: Because 7, 10, 11." << endl;
+    break;
+  case 7:
+    ss << "/\bQ: What did people say after two satellite dishes got married?   A: The wedding was dull, but the reception was great." << endl;
+    break;
+  case 8:
+    ss << "/\bQ: If Al Gore tried his hand as a musician, what would his album be called?   A. Algorithms." << endl;
+    break;
+  case 9:
+    ss << "/\bA programmer goes to do groceries. His wife tells him: \n-- Buy a loaf of bread, and if they have eggs, buy a dozen.\n";
+    ss << " He comes back with thirteen loaves of bread.\n -- 'But why?', she asks.\n --'They had eggs.'" << endl;
+    break;
+  case 10:
+    ss << "/\bSilly chat person, NO JOKE FOR YOU!" << endl;
+    break;
+  default:
+    ss << "/\bSilly chat person, NO JOKE FOR YOU!" << endl;
+    break;
+  }
+  
+  return ss.str();
+}
+
+string GrabTime(string userName) {
+
+  stringstream ss;
+
+  UserShard& shard = ShardFor(userName);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (userName);
+  string savedHash;
+ if (got == shard.users.end() && FindAccount(userName, savedHash)) {
+    // Saved, and not seen since the restart.
+    ss << "/\b" << userName << " is not connected." << endl;
+ } else if (got == shard.users.end() ) {
+    // User not in list
+    ss << "/\bCould not find: " << userName << endl;
+ } else {
+   // User was found.
+   if ((got)->second.isConnected) {
+     ss << "/\b" << userName << " has been connected for "
+	<< time(NULL) - (got)->second.timeConnected << " seconds." << endl;
+   } else {
+     ss << "/\b" << userName << " is not connected." << endl;
+   }
+ }
+ pthread_rwlock_unlock(&shard.lock);
+
+  return ss.str();
+}
+
+string GrabUsers(string userName) {
+
+  stringstream ss;
+  int numOfUsers = 1;
+  ss << "/\bConnected Users: " << endl;
+
+  for (int shard = 0; shard < USER_SHARDS; shard++) {
+    ReadLockShard(UsersList[shard]);
+    tr1::unordered_map<string, User>::iterator got = UsersList[shard].users.begin();
+    for ( ; got != UsersList[shard].users.end(); got++) {
+      if ((got)->second.isConnected == true && (got)->second.node == LocalNode) {
+	// Add to list
+	if ((got)->second.username == userName) {
+	  ss << numOfUsers++ << ". " << "You" << endl;
+	} else {
+	  ss << numOfUsers++ << ". " << (got)->second.username << endl;
+	}
+      }
+    }
+    pthread_rwlock_unlock(&UsersList[shard].lock);
+  }
+
+  return ss.str();
+}
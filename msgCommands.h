@@ -0,0 +1,150 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Chat command parsing, dispatch and delivery formatting for the server.
+
+#ifndef MSGCOMMANDS_H
+#define MSGCOMMANDS_H
+
+// Standard Library
+#include<string>
+#include<cstddef>
+#include<map>
+#include<vector>
+
+// Multithreading
+#include<pthread.h>
+
+// User Directory
+#include "msgUsers.h"
+#include "msgChannels.h"
+
+// Message History
+#include "msgHistory.h"
+
+using namespace std;
+
+// DATA TYPES
+// A slice of someone else's buffer; valid only as long as that buffer is.
+struct MsgView {
+  const char* data;
+  size_t length;
+};
+
+struct ParsedMsg {
+  CommandType type;
+  MsgView cmd;
+  MsgView userTo;
+  MsgView text;
+};
+
+struct CommandEntry {
+  const char* name;
+  size_t length;
+  CommandType type;
+};
+
+// Joins and leaves waiting for the next presence notice.
+struct PresenceBatch {
+  pthread_mutex_t lock;
+  // Signalled when changes stops being empty, which opens the next window.
+  pthread_cond_t queued;
+  // Net change per user since the last flush: true joined, false left. Sorted for the notice.
+  map<string, bool> changes;
+  long events;
+  // Leave-then-join (or join-then-leave) pairs inside one window that cancelled out.
+  long cancelled;
+  long notices;
+};
+
+// GLOBALS
+const long DEFAULT_PRESENCE_WINDOW = 250;
+// Names listed per notice before the rest are only counted.
+const size_t PRESENCE_MAX_NAMES = 50;
+extern PresenceBatch PendingPresence;
+extern long PresenceWindowMs;
+
+// Function Prototypes
+bool ViewEquals(MsgView view, const char* text);
+// Function compares a view with a NUL terminated string.
+// pre: none
+// post: none
+
+CommandType LookupCommand(const char* name, size_t length);
+// Function maps a command name such as "/msg" to its CommandType.
+// pre: none
+// post: returns CMD_UNKNOWN for names not in COMMAND_TABLE.
+
+void processMsg(const char* data, size_t length, ParsedMsg& parsed);
+// Function splits a chat line into command, target user and text in one pass.
+// pre: none
+// post: parsed views point into data; nothing is copied.
+
+void SaveMsg(const char* data, size_t length, string userFrom);
+// Function takes data from a session, processes the message and then finally adds to a queue.
+// pre: none
+// post: none
+
+string GetMsgs(Mailbox* mailbox, int* numMsgs = NULL, vector<long>* queuedAt = NULL);
+// Function drains a mailbox and compiles a list of messages to send.
+// pre: mailbox should exist.
+// post: mailbox will be empty. numMsgs, if given, receives how many were drained, and queuedAt
+//       when each was queued, for QueueFrame.
+
+void broadcastMsg(string userName, string msg, bool isConnected);
+// Function allows system to create a broadcast message to all other users.
+// pre: none
+// post: none
+
+bool SendToChannel(string userFrom, string msg);
+// Function sends a chat line to the members of the sender's current channel.
+// pre: none
+// post: returns false, sending nothing, if the sender is in no channel.
+
+void SendHistory(string userFrom, string args);
+// Function queues pages of a conversation's past messages for a user.
+// pre: args should be what followed "/history": [#channel|@user|all] [n] [before-id].
+// post: with no conversation named, the user's current channel (or everyone) is used.
+
+void AnnouncePresence(string userName, bool isConnected);
+// Function records that a user logged in or out.
+// pre: none
+// post: with PresenceWindowMs 0 the notice is broadcast right away, otherwise it waits for FlushPresence.
+
+void FlushPresence();
+// Function sends every user who wants presence one notice covering the joins and leaves since the last flush.
+// pre: none
+// post: PendingPresence.changes is empty.
+
+bool StartPresence(long windowMs);
+// Function sets the presence window and starts the thread that flushes it.
+// pre: none
+// post: returns false if the thread could not be started.
+
+void* presenceThread(void* args_p);
+// Function sleeps until a change is queued, then runs FlushPresence PresenceWindowMs milliseconds later.
+// pre: none
+// post: none
+
+string GrabUsers(string userName);
+// Function returns a list of connected users.
+// pre: none
+// post: none
+
+string GrabTime(string userName);
+// Function returns a duration of a user.
+// pre: none
+// post: none
+
+string GrabJoke();
+// Function returns a joke.
+// pre: none
+// post: none
+
+string GrabPic();
+// Function returns a picture
+// pre: none
+// post: none
+
+#endif
@@ -0,0 +1,245 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Per-connection frame buffers: pooled, bounded receive buffers and output buffers
+// that write queued frames with as few syscalls as possible.
+
+#include "msgFrames.h"
+
+// Instrumentation
+#include "msgMetrics.h"
+
+// Standard Library
+#include<cstring>
+#include<cstdlib>
+#include<algorithm>
+
+// Network Functions
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
+#include<arpa/inet.h>
+#include<errno.h>
+
+// GLOBALS
+size_t MaxFrameSize = DEFAULT_MAX_FRAME;
+FrameStats FrameCounters = { 0, 0, 0, 0, 0, 0, 0 };
+BufferPool RecvPool = { PTHREAD_MUTEX_INITIALIZER, vector<char*>() };
+
+char* AcquireChunk(size_t capacity) {
+
+  __sync_fetch_and_add(&FrameCounters.bufferAcquires, 1);
+  __sync_fetch_and_add(&FrameCounters.bytesInUse, capacity);
+  if (capacity == RECV_CHUNK_SIZE) {
+    pthread_mutex_lock(&RecvPool.lock);
+    if (!RecvPool.freeChunks.empty()) {
+      char* chunk = RecvPool.freeChunks.back();
+      RecvPool.freeChunks.pop_back();
+      pthread_mutex_unlock(&RecvPool.lock);
+      __sync_fetch_and_add(&FrameCounters.bufferHits, 1);
+      return chunk;
+    }
+    pthread_mutex_unlock(&RecvPool.lock);
+  }
+  return (char*) malloc(capacity);
+}
+
+void ReturnChunk(char* chunk, size_t capacity) {
+
+  __sync_fetch_and_sub(&FrameCounters.bytesInUse, capacity);
+  if (capacity == RECV_CHUNK_SIZE) {
+    pthread_mutex_lock(&RecvPool.lock);
+    if (RecvPool.freeChunks.size() < POOL_MAX_FREE) {
+      RecvPool.freeChunks.push_back(chunk);
+      chunk = NULL;
+    }
+    pthread_mutex_unlock(&RecvPool.lock);
+  }
+  free(chunk);
+}
+
+void QueueFrame(OutBuffer& out, string& body, int numMsgs, vector<long>* queuedAt) {
+
+  out.frames.push_back(OutFrame());
+  OutFrame& frame = out.frames.back();
+  frame.header = htonl(body.length()+1);
+  frame.body.swap(body);
+  if (queuedAt != NULL) {
+    frame.queuedAt.swap(*queuedAt);
+  }
+  out.bytesQueued += FRAME_HEADER_SIZE + frame.body.length() + 1;
+
+  __sync_fetch_and_add(&FrameCounters.framesQueued, 1);
+  __sync_fetch_and_add(&FrameCounters.messages, numMsgs);
+}
+
+int GatherFrames(OutBuffer& out, struct iovec* iov, int maxFrames, size_t& wanted) {
+
+  // Headers and bodies, skipping whatever earlier calls already wrote.
+  int numIov = 0;
+  size_t skip = out.frontSent;
+  wanted = 0;
+  for (size_t i = 0; i < out.frames.size() && i < (size_t) maxFrames; i++) {
+    OutFrame& frame = out.frames[i];
+    if (skip < FRAME_HEADER_SIZE) {
+      iov[numIov].iov_base = (char*) &frame.header + skip;
+      iov[numIov].iov_len = FRAME_HEADER_SIZE - skip;
+      wanted += iov[numIov].iov_len;
+      numIov++;
+      skip = 0;
+    } else {
+      skip -= FRAME_HEADER_SIZE;
+    }
+    iov[numIov].iov_base = (char*) frame.body.c_str() + skip;
+    iov[numIov].iov_len = frame.body.length() + 1 - skip;
+    wanted += iov[numIov].iov_len;
+    numIov++;
+    skip = 0;
+  }
+  return numIov;
+}
+
+void RetireFrames(OutBuffer& out, size_t sent, size_t wanted) {
+
+  __sync_fetch_and_add(&FrameCounters.sendCalls, 1);
+  CountMetric(METRIC_BYTES_OUT, sent);
+  if (sent < wanted) {
+    // Socket buffer filled part way; the next call resumes where this one stopped.
+    __sync_fetch_and_add(&FrameCounters.partialSends, 1);
+  }
+
+  // Drop every frame that went out completely.
+  out.bytesQueued -= sent;
+  size_t written = out.frontSent + sent;
+  long now = 0;
+  while (!out.frames.empty()) {
+    OutFrame& frame = out.frames.front();
+    size_t frameSize = FRAME_HEADER_SIZE + frame.body.length() + 1;
+    if (written < frameSize) {
+      break;
+    }
+    written -= frameSize;
+    // Delivered as far as the server can tell: the socket has all of it. One clock read per send.
+    for (size_t i = 0; i < frame.queuedAt.size(); i++) {
+      now = now == 0 ? MetricsClock() : now;
+      ObserveMetric(HIST_DELIVERY_NS, now - frame.queuedAt[i]);
+    }
+    out.frames.pop_front();
+  }
+  out.frontSent = written;
+}
+
+FlushStatus FlushFrames(int sock, OutBuffer& out) {
+
+  // Locals
+  struct iovec iov[2 * MAX_FLUSH_FRAMES];
+  size_t wanted;
+
+  while (!out.frames.empty()) {
+    struct msghdr msg = msghdr();
+    msg.msg_iov = iov;
+    msg.msg_iovlen = GatherFrames(out, iov, MAX_FLUSH_FRAMES, wanted);
+    ssize_t msgSent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (msgSent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (msgSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      __sync_fetch_and_add(&FrameCounters.sendCalls, 1);
+      return FLUSH_PENDING;
+    }
+    if (msgSent <= 0) {
+      return FLUSH_FAILED;
+    }
+    RetireFrames(out, msgSent, wanted);
+  }
+
+  return FLUSH_DONE;
+}
+
+bool SendFrame(int sock, string body) {
+
+  OutBuffer out;
+  QueueFrame(out, body, 0);
+  return FlushFrames(sock, out) == FLUSH_DONE;
+}
+
+size_t ReserveSpace(InBuffer& in) {
+
+  if (in.data == NULL) {
+    in.data = AcquireChunk(RECV_CHUNK_SIZE);
+    in.capacity = RECV_CHUNK_SIZE;
+    in.start = in.end = 0;
+  } else if (in.end == in.capacity) {
+    // Full: slide the partial frame to the front, or move it somewhere bigger.
+    size_t pending = in.end - in.start;
+    size_t needed = RECV_CHUNK_SIZE;
+    if (pending >= FRAME_HEADER_SIZE) {
+      long networkInt;
+      memcpy(&networkInt, in.data + in.start, FRAME_HEADER_SIZE);
+      // NextFrame has already checked this against MaxFrameSize.
+      needed = max(needed, FRAME_HEADER_SIZE + (size_t) ntohl(networkInt));
+    }
+    if (needed > in.capacity) {
+      char* bigger = AcquireChunk(needed);
+      memcpy(bigger, in.data + in.start, pending);
+      ReturnChunk(in.data, in.capacity);
+      in.data = bigger;
+      in.capacity = needed;
+    } else {
+      memmove(in.data, in.data + in.start, pending);
+    }
+    in.start = 0;
+    in.end = pending;
+  }
+
+  return in.capacity - in.end;
+}
+
+int RecvFrames(int sock, InBuffer& in) {
+
+  size_t room = ReserveSpace(in);
+  if (room == 0) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  int bytesRecv = recv(sock, in.data + in.end, room, 0);
+  if (bytesRecv > 0) {
+    in.end += bytesRecv;
+    CountMetric(METRIC_BYTES_IN, bytesRecv);
+  }
+  return bytesRecv;
+}
+
+FrameStatus NextFrame(InBuffer& in, MsgView& frame) {
+
+  size_t pending = in.end - in.start;
+  if (pending < FRAME_HEADER_SIZE) {
+    return FRAME_PARTIAL;
+  }
+  long networkInt;
+  memcpy(&networkInt, in.data + in.start, FRAME_HEADER_SIZE);
+  long msgLength = ntohl(networkInt);
+  if (msgLength <= 0 || (size_t) msgLength > MaxFrameSize) {
+    return FRAME_INVALID;
+  }
+  if (pending - FRAME_HEADER_SIZE < (size_t) msgLength) {
+    return FRAME_PARTIAL;
+  }
+
+  // Bodies are NUL terminated on the wire; hand out a view, not a copy.
+  frame.data = in.data + in.start + FRAME_HEADER_SIZE;
+  frame.length = strnlen(frame.data, msgLength);
+  in.start += FRAME_HEADER_SIZE + msgLength;
+  return FRAME_READY;
+}
+
+void ReleaseBuffer(InBuffer& in, bool force) {
+
+  if (in.data == NULL || (in.start != in.end && !force)) {
+    return;
+  }
+  ReturnChunk(in.data, in.capacity);
+  in.data = NULL;
+  in.capacity = in.start = in.end = 0;
+}
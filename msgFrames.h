@@ -0,0 +1,150 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Per-connection frame buffers: pooled, bounded receive buffers and output buffers
+// that write queued frames with as few syscalls as possible.
+
+#ifndef MSGFRAMES_H
+#define MSGFRAMES_H
+
+// Standard Library
+#include<string>
+#include<deque>
+#include<vector>
+#include<cstddef>
+
+// Network Functions
+#include<sys/uio.h>
+
+// Multithreading
+#include<pthread.h>
+
+// Chat Commands
+#include "msgCommands.h"
+
+using namespace std;
+
+// DATA TYPES
+// One length-prefixed frame waiting to go out. The body is sent with its NUL.
+struct OutFrame {
+  long header;
+  string body;
+  // When each message in it was queued; delivery latency is observed once the frame is written.
+  vector<long> queuedAt;
+};
+
+struct OutBuffer {
+  deque<OutFrame> frames;
+  size_t frontSent;    // bytes of frames.front() already written
+  size_t bytesQueued;  // bytes of every frame not yet written
+  OutBuffer() : frontSent(0), bytesQueued(0) {}
+};
+
+enum FlushStatus {
+  FLUSH_DONE,
+  FLUSH_PENDING,
+  FLUSH_FAILED
+};
+
+// Received bytes not yet parsed into frames. Holds no memory while idle.
+struct InBuffer {
+  char* data;
+  size_t capacity;
+  size_t start;        // first unparsed byte
+  size_t end;          // one past the last received byte
+  InBuffer() : data(NULL), capacity(0), start(0), end(0) {}
+};
+
+enum FrameStatus {
+  FRAME_READY,
+  FRAME_PARTIAL,
+  FRAME_INVALID
+};
+
+// Receive buffers of RECV_CHUNK_SIZE bytes are recycled; larger ones come from the heap.
+struct BufferPool {
+  pthread_mutex_t lock;
+  vector<char*> freeChunks;
+};
+
+// Process-wide totals, updated atomically by every session.
+struct FrameStats {
+  long framesQueued;
+  long messages;
+  long sendCalls;
+  long partialSends;
+  long bufferAcquires;
+  long bufferHits;
+  long bytesInUse;
+};
+
+// GLOBALS
+const size_t FRAME_HEADER_SIZE = sizeof(long);
+const int MAX_FLUSH_FRAMES = 64;
+const size_t RECV_CHUNK_SIZE = 4096;
+const size_t POOL_MAX_FREE = 1024;
+const size_t DEFAULT_MAX_FRAME = 65536;
+extern size_t MaxFrameSize;
+extern FrameStats FrameCounters;
+extern BufferPool RecvPool;
+
+// Function Prototypes
+void QueueFrame(OutBuffer& out, string& body, int numMsgs, vector<long>* queuedAt = NULL);
+// Function appends a length-prefixed frame carrying numMsgs chat messages.
+// pre: queuedAt, if given, should come from GetMsgs with body.
+// post: body and queuedAt are moved into the buffer and left empty.
+
+int GatherFrames(OutBuffer& out, struct iovec* iov, int maxFrames, size_t& wanted);
+// Function points iov at the unsent part of up to maxFrames queued frames.
+// pre: iov should have room for 2 * maxFrames entries.
+// post: returns the number of entries used; wanted is their total length.
+
+void RetireFrames(OutBuffer& out, size_t sent, size_t wanted);
+// Function drops the bytes one send of a GatherFrames list wrote and counts the call.
+// pre: sent <= wanted.
+// post: frames that went out completely are freed, observing the delivery latency of their messages.
+
+FlushStatus FlushFrames(int sock, OutBuffer& out);
+// Function writes queued frames, up to MAX_FLUSH_FRAMES per sendmsg call.
+// pre: sock should exist.
+// post: returns FLUSH_PENDING if a non-blocking socket filled up; the rest stays queued.
+
+bool SendFrame(int sock, string body);
+// Function queues and fully writes a single frame.
+// pre: sock should be a blocking socket.
+// post: none
+
+char* AcquireChunk(size_t capacity);
+// Function hands out a receive buffer, reusing a pooled one when capacity is RECV_CHUNK_SIZE.
+// pre: none
+// post: bytesInUse grows by capacity.
+
+void ReturnChunk(char* chunk, size_t capacity);
+// Function takes back a buffer from AcquireChunk, keeping up to POOL_MAX_FREE for reuse.
+// pre: chunk came from AcquireChunk with the same capacity.
+// post: bytesInUse shrinks by capacity.
+
+size_t ReserveSpace(InBuffer& in);
+// Function makes sure a receive buffer has free space after in.end.
+// pre: complete frames should have been taken with NextFrame first.
+// post: returns the bytes free at in.data + in.end; views from NextFrame are no longer valid.
+
+int RecvFrames(int sock, InBuffer& in);
+// Function makes room in a receive buffer and reads once from sock into it.
+// pre: complete frames should have been taken with NextFrame first.
+// post: returns what recv returned; views from NextFrame are no longer valid. A buffer full of
+//       whole frames is not read into: -1 with errno ENOBUFS, never 0, which means the peer closed.
+
+FrameStatus NextFrame(InBuffer& in, MsgView& frame);
+// Function takes the next complete frame out of a receive buffer.
+// pre: none
+// post: frame points into the buffer until the next RecvFrames or ReleaseBuffer.
+//       FRAME_INVALID means the peer announced a length over MaxFrameSize.
+
+void ReleaseBuffer(InBuffer& in, bool force);
+// Function hands a receive buffer back to RecvPool once it holds no partial frame.
+// pre: none
+// post: with force the buffer is released even if bytes remain.
+
+#endif
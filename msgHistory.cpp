@@ -0,0 +1,379 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Recent messages per conversation (everyone, a channel, or a pair of users), kept
+// in fixed-size rings of fixed-size slots in memory-mapped files so they survive a restart.
+// Channels share one pool of rings and pairs another, so however many channels are named and pairs
+// talk the memory stays bounded.
+
+#include "msgHistory.h"
+
+// Standard Library
+#include<iostream>
+#include<cstring>
+#include<cstdio>
+#include<algorithm>
+
+// File Functions
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<errno.h>
+
+// GLOBALS
+HistoryIndex History = { PTHREAD_RWLOCK_INITIALIZER, "", DEFAULT_HISTORY_SLOTS,
+			 tr1::unordered_map<string, HistoryRing*>(),
+			 { "channel.pool", DEFAULT_CHANNEL_RINGS, NULL, tr1::unordered_map<string, HistoryRing*>(), 0, 0 },
+			 { "direct.pool", DEFAULT_DIRECT_RINGS, NULL, tr1::unordered_map<string, HistoryRing*>(), 0, 0 },
+			 0, 0 };
+
+HistoryRing* MapRing(const string& key, bool create);
+// Function maps a conversation's ring file, or fresh memory when there is no directory.
+// pre: History.lock should be held exclusive.
+// post: returns NULL if the file could not be opened or mapped, or is missing and create is false.
+
+bool StartHistory(string dir, size_t numSlots, size_t numChannels, size_t numDirect) {
+
+  if (!dir.empty() && mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+    return false;
+  }
+  pthread_rwlock_wrlock(&History.lock);
+  History.dir = dir;
+  History.numSlots = min(numSlots, MAX_HISTORY_SLOTS);
+  History.channels.numRings = numChannels;
+  History.direct.numRings = numDirect;
+  pthread_rwlock_unlock(&History.lock);
+  return true;
+}
+
+string DirectKey(const string& userA, const string& userB) {
+
+  return userA < userB ? "@" + userA + " @" + userB : "@" + userB + " @" + userA;
+}
+
+string HistoryPath(const string& key) {
+
+  // Hex, so any username makes a safe file name.
+  string path = History.dir + "/";
+  char digits[3];
+  for (size_t i = 0; i < key.length(); i++) {
+    snprintf(digits, sizeof(digits), "%02x", (unsigned char) key[i]);
+    path.append(digits);
+  }
+  return path + ".ring";
+}
+
+HistoryRing* MapRing(const string& key, bool create) {
+
+  // Locals
+  size_t mapSize = sizeof(HistoryHeader) + History.numSlots * sizeof(HistorySlot);
+  void* map;
+
+  if (History.dir.empty() || key.length() > MAX_HISTORY_KEY) {
+    if (!create) {
+      return NULL;
+    }
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    int fd = open(HistoryPath(key).c_str(), O_RDWR | (create ? O_CREAT : 0), 0600);
+    if (fd < 0) {
+      return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+      close(fd);
+      return NULL;
+    }
+    if ((size_t) info.st_size != mapSize) {
+      // New, or a ring of another size (-Y changed): start over empty.
+      if (ftruncate(fd, 0) < 0 || ftruncate(fd, mapSize) < 0) {
+	close(fd);
+	return NULL;
+      }
+    }
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  HistoryRing* ring = new HistoryRing;
+  pthread_mutex_init(&ring -> lock, NULL);
+  ring -> header = (HistoryHeader*) map;
+  ring -> slots = (HistorySlot*) ((char*) map + sizeof(HistoryHeader));
+  ring -> mapSize = mapSize;
+  ring -> owner = NULL;
+  ring -> pool = NULL;
+  if (ring -> header -> magic != HISTORY_MAGIC || ring -> header -> numSlots != History.numSlots) {
+    // Fresh memory and new files are zero already; only a damaged file needs clearing.
+    if (ring -> header -> magic != 0) {
+      memset(map, 0, mapSize);
+    }
+    ring -> header -> magic = HISTORY_MAGIC;
+    ring -> header -> numSlots = History.numSlots;
+    ring -> header -> nextId = 1;
+  }
+  // nextId may not have reached the file before a crash; the slots say how far it got.
+  for (size_t i = 0; i < History.numSlots; i++) {
+    ring -> header -> nextId = max(ring -> header -> nextId, ring -> slots[i].id + 1);
+  }
+  return ring;
+}
+
+HistoryRing* OpenRing(const string& key, bool create) {
+
+  // Locals
+  HistoryRing* ring = NULL;
+
+  if (!key.empty() && key[0] == '@') {
+    return OpenPooled(History.direct, key, create);
+  }
+  if (!key.empty() && key[0] == '#') {
+    return OpenPooled(History.channels, key, create);
+  }
+  pthread_rwlock_rdlock(&History.lock);
+  if (History.numSlots == 0) {
+    pthread_rwlock_unlock(&History.lock);
+    return NULL;
+  }
+  tr1::unordered_map<string, HistoryRing*>::const_iterator got = History.rings.find (key);
+  if (got != History.rings.end()) {
+    ring = got->second;
+  }
+  pthread_rwlock_unlock(&History.lock);
+  if (ring != NULL) {
+    pthread_mutex_lock(&ring -> lock);
+    return ring;
+  }
+
+  pthread_rwlock_wrlock(&History.lock);
+  got = History.rings.find (key);
+  if (got != History.rings.end()) {
+    ring = got->second;
+  } else {
+    ring = MapRing(key, create);
+    if (ring != NULL) {
+      History.rings.insert (make_pair(key, ring));
+    }
+  }
+  pthread_rwlock_unlock(&History.lock);
+  if (ring != NULL) {
+    pthread_mutex_lock(&ring -> lock);
+  }
+  return ring;
+}
+
+HistoryRing* OpenPooled(HistoryPool& pool, const string& key, bool create) {
+
+  // Locals
+  HistoryRing* ring = NULL;
+
+  if (key.length() > sizeof(ring -> owner -> key)) {
+    return NULL;
+  }
+  while (true) {
+    pthread_rwlock_rdlock(&History.lock);
+    if (History.numSlots == 0 || pool.numRings == 0) {
+      pthread_rwlock_unlock(&History.lock);
+      return NULL;
+    }
+    if (pool.rings == NULL) {
+      // The first lookup maps the pool, so conversations kept from the last run can be read.
+      pthread_rwlock_unlock(&History.lock);
+      pthread_rwlock_wrlock(&History.lock);
+      bool isMapped = pool.rings != NULL || MapPool(pool);
+      pthread_rwlock_unlock(&History.lock);
+      if (!isMapped) {
+	return NULL;
+      }
+      continue;
+    }
+    tr1::unordered_map<string, HistoryRing*>::const_iterator got = pool.owners.find (key);
+    ring = got != pool.owners.end() ? got->second : NULL;
+    pthread_rwlock_unlock(&History.lock);
+    if (ring == NULL) {
+      break;
+    }
+    // Handed to another conversation since the lookup: look again.
+    pthread_mutex_lock(&ring -> lock);
+    if (ring -> owner -> keyLen == key.length() && memcmp(ring -> owner -> key, key.data(), key.length()) == 0) {
+      return ring;
+    }
+    pthread_mutex_unlock(&ring -> lock);
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  pthread_rwlock_wrlock(&History.lock);
+  tr1::unordered_map<string, HistoryRing*>::iterator got = pool.owners.find (key);
+  if (got != pool.owners.end()) {
+    ring = got->second;
+    pthread_mutex_lock(&ring -> lock);
+  } else {
+    // Unused rings have never been written, so they come first.
+    ring = &pool.rings[0];
+    for (size_t i = 1; i < pool.numRings; i++) {
+      if (pool.rings[i].owner -> lastUsed < ring -> owner -> lastUsed) {
+	ring = &pool.rings[i];
+      }
+    }
+    pthread_mutex_lock(&ring -> lock);
+    RingOwner* owner = ring -> owner;
+    if (owner -> keyLen > 0) {
+      pool.owners.erase (string(owner -> key, owner -> keyLen));
+      pool.reused++;
+    }
+    if (ring -> header -> magic != HISTORY_MAGIC || ring -> header -> numSlots != History.numSlots) {
+      ring -> header -> magic = HISTORY_MAGIC;
+      ring -> header -> numSlots = History.numSlots;
+      ring -> header -> nextId = 1;
+    }
+    // The slots keep the last conversation's messages; their ids are below firstId, so nobody sees them.
+    owner -> firstId = ring -> header -> nextId;
+    owner -> lastUsed = __sync_add_and_fetch(&pool.writes, 1);
+    owner -> keyLen = key.length();
+    memcpy(owner -> key, key.data(), key.length());
+    pool.owners.insert (make_pair(key, ring));
+  }
+  pthread_rwlock_unlock(&History.lock);
+  return ring;
+}
+
+bool MapPool(HistoryPool& pool) {
+
+  // Locals
+  size_t ringSize = sizeof(HistoryHeader) + History.numSlots * sizeof(HistorySlot);
+  size_t mapSize = sizeof(PoolHeader) + pool.numRings * (sizeof(RingOwner) + ringSize);
+  void* map;
+
+  if (History.dir.empty()) {
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  } else {
+    int fd = open((History.dir + "/" + pool.fileName).c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+      close(fd);
+      return false;
+    }
+    if ((size_t) info.st_size != mapSize) {
+      // New, or a pool of another shape (-Y, -C or -D changed): start over empty, and sparse.
+      if (ftruncate(fd, 0) < 0 || ftruncate(fd, mapSize) < 0) {
+	close(fd);
+	return false;
+      }
+    }
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  PoolHeader* header = (PoolHeader*) map;
+  RingOwner* owners = (RingOwner*) ((char*) map + sizeof(PoolHeader));
+  char* rings = (char*) (owners + pool.numRings);
+  bool isKept = header -> magic == POOL_MAGIC && header -> numRings == pool.numRings &&
+    header -> numSlots == History.numSlots;
+  if (!isKept) {
+    // Fresh memory and new files are zero already; only a damaged file needs clearing.
+    if (header -> magic != 0) {
+      memset(map, 0, mapSize);
+    }
+    header -> magic = POOL_MAGIC;
+    header -> numRings = pool.numRings;
+    header -> numSlots = History.numSlots;
+  }
+
+  pool.rings = new HistoryRing[pool.numRings];
+  for (size_t i = 0; i < pool.numRings; i++) {
+    HistoryRing& ring = pool.rings[i];
+    pthread_mutex_init(&ring.lock, NULL);
+    ring.header = (HistoryHeader*) (rings + i * ringSize);
+    ring.slots = (HistorySlot*) (rings + i * ringSize + sizeof(HistoryHeader));
+    ring.mapSize = ringSize;
+    ring.owner = &owners[i];
+    ring.pool = &pool;
+    // Unowned rings are not touched, so their memory is not used until a conversation is given one.
+    if (ring.owner -> keyLen == 0) {
+      continue;
+    }
+    if (ring.owner -> keyLen > sizeof(ring.owner -> key) || ring.header -> magic != HISTORY_MAGIC ||
+	ring.header -> numSlots != History.numSlots) {
+      ring.owner -> keyLen = 0;
+      ring.owner -> lastUsed = 0;
+      continue;
+    }
+    // nextId may not have reached the file before a crash; the slots say how far it got.
+    for (size_t j = 0; j < History.numSlots; j++) {
+      ring.header -> nextId = max(ring.header -> nextId, ring.slots[j].id + 1);
+    }
+    pool.writes = max(pool.writes, ring.owner -> lastUsed);
+    pool.owners.insert (make_pair(string(ring.owner -> key, ring.owner -> keyLen), &ring));
+  }
+  return true;
+}
+
+void RecordHistory(const string& key, const string& from, const string& text) {
+
+  HistoryRing* ring = OpenRing(key, true);
+  if (ring == NULL) {
+    return;
+  }
+
+  uint64_t id = ring -> header -> nextId++;
+  HistorySlot& slot = ring -> slots[id % ring -> header -> numSlots];
+  slot.id = 0;
+  __sync_synchronize();
+  slot.stamp = time(NULL);
+  slot.fromLen = min(from.length(), sizeof(slot.data));
+  slot.textLen = min(text.length(), sizeof(slot.data) - slot.fromLen);
+  memcpy(slot.data, from.data(), slot.fromLen);
+  memcpy(slot.data + slot.fromLen, text.data(), slot.textLen);
+  __sync_synchronize();
+  slot.id = id;
+  if (ring -> owner != NULL) {
+    ring -> owner -> lastUsed = __sync_add_and_fetch(&ring -> pool -> writes, 1);
+  }
+  pthread_mutex_unlock(&ring -> lock);
+
+  __sync_fetch_and_add(&History.recorded, 1);
+}
+
+bool ReadHistory(const string& key, size_t count, uint64_t before, vector<HistoryEntry>& entries) {
+
+  HistoryRing* ring = OpenRing(key, false);
+  if (ring == NULL) {
+    return false;
+  }
+
+  uint64_t next = ring -> header -> nextId;
+  uint64_t numSlots = ring -> header -> numSlots;
+  uint64_t end = (before == 0 || before > next) ? next : before;
+  uint64_t oldest = next > numSlots ? next - numSlots : 1;
+  if (ring -> owner != NULL) {
+    oldest = max(oldest, ring -> owner -> firstId);
+  }
+  uint64_t first = end > oldest + count ? end - count : oldest;
+  for (uint64_t id = first; id < end; id++) {
+    const HistorySlot& slot = ring -> slots[id % numSlots];
+    if (slot.id != id) {
+      continue;
+    }
+    HistoryEntry entry;
+    entry.id = id;
+    entry.stamp = slot.stamp;
+    entry.from.assign(slot.data, slot.fromLen);
+    entry.text.assign(slot.data + slot.fromLen, slot.textLen);
+    entries.push_back(entry);
+  }
+  pthread_mutex_unlock(&ring -> lock);
+  return first > oldest;
+}
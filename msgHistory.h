@@ -0,0 +1,159 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Recent messages per conversation (everyone, a channel, or a pair of users), kept
+// in fixed-size rings of fixed-size slots in memory-mapped files so they survive a restart.
+// Channels share one pool of rings and pairs another, so however many channels are named and pairs
+// talk the memory stays bounded.
+
+#ifndef MSGHISTORY_H
+#define MSGHISTORY_H
+
+// Standard Library
+#include<string>
+#include<vector>
+#include<tr1/unordered_map>
+#include<ctime>
+#include<stdint.h>
+
+// Multithreading
+#include<pthread.h>
+
+using namespace std;
+
+// DATA TYPES
+// First 64 bytes of a ring file.
+struct HistoryHeader {
+  uint32_t magic;
+  uint32_t numSlots;
+  uint64_t nextId;
+  char pad[48];
+};
+
+// One message, a multiple of the cache line size. id is written last, so a torn write reads as empty.
+struct HistorySlot {
+  uint64_t id;
+  int64_t stamp;
+  uint16_t fromLen;
+  uint16_t textLen;
+  uint32_t pad;
+  char data[488];
+};
+
+// Which conversation holds a ring of a pool; kept in the pool so it survives a restart.
+struct RingOwner {
+  int64_t lastUsed;    // the pool's write count at this ring's last write; the lowest is handed on
+  uint64_t firstId;    // ids below this were written by an earlier conversation
+  uint16_t keyLen;
+  char key[110];
+};
+
+// First 64 bytes of a pool, then numRings owners, then numRings rings.
+struct PoolHeader {
+  uint32_t magic;
+  uint32_t numRings;
+  uint32_t numSlots;
+  char pad[52];
+};
+
+struct HistoryRing {
+  pthread_mutex_t lock;
+  HistoryHeader* header;
+  HistorySlot* slots;
+  size_t mapSize;
+  // NULL unless the ring is in a pool; guarded by lock.
+  RingOwner* owner;
+  struct HistoryPool* pool;
+};
+
+// numRings rings mapped together the first time one is needed, and which conversation holds each.
+struct HistoryPool {
+  string fileName;
+  size_t numRings;
+  HistoryRing* rings;
+  tr1::unordered_map<string, HistoryRing*> owners;
+  long reused;
+  // Counts writes to the pool, so a burst of new conversations within a second still has an order.
+  int64_t writes;
+};
+
+struct HistoryEntry {
+  uint64_t id;
+  time_t stamp;
+  string from;
+  string text;
+};
+
+struct HistoryIndex {
+  pthread_rwlock_t lock;
+  // "" until StartHistory is given a directory: rings then live in anonymous memory.
+  string dir;
+  size_t numSlots;
+  // Everyone; never unmapped once opened.
+  tr1::unordered_map<string, HistoryRing*> rings;
+  // Any client can name a channel, so channels take turns in a pool like pairs of users do.
+  HistoryPool channels;
+  HistoryPool direct;
+  long recorded;
+  long pagesSent;
+};
+
+// GLOBALS
+const uint32_t HISTORY_MAGIC = 0x4d534832;   // "MSH2"
+const uint32_t POOL_MAGIC = 0x4d534431;      // "MSD1"
+const size_t DEFAULT_HISTORY_SLOTS = 128;
+const size_t DEFAULT_CHANNEL_RINGS = 1024;
+const size_t DEFAULT_DIRECT_RINGS = 1024;
+const size_t MAX_HISTORY_SLOTS = 65536;
+// Lines per message /history queues; a long request arrives as several.
+const size_t HISTORY_PAGE_LINES = 50;
+const size_t DEFAULT_HISTORY_LINES = 20;
+// Keys longer than this get a ring in memory only: their file name would be too long.
+const size_t MAX_HISTORY_KEY = 100;
+const string EVERYONE_KEY = "all";
+extern HistoryIndex History;
+
+// Function Prototypes
+bool StartHistory(string dir, size_t numSlots, size_t numChannels, size_t numDirect);
+// Function sets where rings are kept, how many messages each holds and how many channels and pairs
+// of users have one.
+// pre: none
+// post: numSlots 0 turns history off. Returns false if dir could not be created.
+
+string DirectKey(const string& userA, const string& userB);
+// Function names the conversation between two users, the same whichever one asks.
+// pre: none
+// post: none
+
+string HistoryPath(const string& key);
+// Function names the file that holds a conversation's ring.
+// pre: History.dir should be set.
+// post: none
+
+HistoryRing* OpenRing(const string& key, bool create);
+// Function finds a conversation's ring, mapping its file (or fresh memory) the first time.
+// pre: none
+// post: returns the ring locked, or NULL if history is off or the ring does not exist and create is false.
+
+HistoryRing* OpenPooled(HistoryPool& pool, const string& key, bool create);
+// Function finds a conversation's ring in a pool, taking the least recently written one for a new one.
+// pre: none
+// post: returns the ring locked, or NULL if there is none.
+
+bool MapPool(HistoryPool& pool);
+// Function maps a pool from its file in History.dir, or fresh memory, and indexes its owners.
+// pre: History.lock should be held exclusive.
+// post: returns false if it could not be mapped; its conversations then go unrecorded.
+
+void RecordHistory(const string& key, const string& from, const string& text);
+// Function appends one message to a conversation's ring, overwriting the oldest when it is full.
+// pre: none
+// post: text longer than a slot holds is cut short.
+
+bool ReadHistory(const string& key, size_t count, uint64_t before, vector<HistoryEntry>& entries);
+// Function copies up to count of the newest messages with ids below before, oldest first.
+// pre: before 0 means from the newest.
+// post: returns whether older messages than the ones copied are still in the ring.
+
+#endif
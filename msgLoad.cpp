@@ -0,0 +1,1374 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: This program opens many client connections against msgServer and
+// reports what it costs the server to hold them, how fast it delivers a mix of commands and
+// how fast it logs users back in.
+
+// Standard Library
+#include<iostream>
+#include<sstream>
+#include<string>
+#include<cstring>
+#include<cstdlib>
+#include<cstdio>
+#include<vector>
+#include<deque>
+#include<map>
+#include<algorithm>
+
+// Network Functions
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+#include<netdb.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<signal.h>
+
+// Event Notification
+#include<sys/epoll.h>
+#include<poll.h>
+#include<time.h>
+
+using namespace std;
+
+// DATA TYPES
+enum ConnState {
+  CONN_LOGGING_IN,
+  CONN_READY,
+  CONN_CLOSED
+};
+
+struct Conn {
+  int sock;
+  ConnState state;
+  string inBuf;
+  double probeSent;
+  bool probeDone;
+  deque<double> usersSent;             // /users asked, oldest first
+  map<int, deque<double> > pokesFrom;  // /poke sent to us, by sender
+};
+
+// The commands a mixed run sends.
+enum MixType {
+  MIX_MSG,
+  MIX_ALL,
+  MIX_USERS,
+  MIX_POKE,
+  MIX_TYPES
+};
+
+struct MixStats {
+  long sent[MIX_TYPES];
+  long expected[MIX_TYPES];
+  long received[MIX_TYPES];
+  vector<double> latencies[MIX_TYPES];
+};
+
+struct ServerStats {
+  long threads;
+  long rssKb;
+  double cpuSec;
+};
+
+// One wave of a reconnect storm.
+struct WaveStats {
+  vector<double> latencies;       // connect until the login is answered
+  vector<double> probeLatencies;  // /msg round trips of a session already logged in
+  long noticeFrames;              // what logged in sessions were sent during the wave
+  long noticeBytes;
+  long peakRssKb;                 // server, sampled every 100 ms
+  double drainTime;               // from the start until notices stopped arriving
+};
+
+// GLOBALS
+const size_t FRAME_HEADER_SIZE = sizeof(long);
+const int MAX_EVENTS = 256;
+const char* LOGIN_SUCCESS = "Login Successful!\n";
+const char* PM_REPLY = "pm from ";
+const char* BROADCAST_TAG = " has said: ";
+const long FLOOD_WINDOW = 32;
+const size_t STALL_PADDING = 256;
+const char* MIX_NAMES[MIX_TYPES] = { "/msg", "/all", "/users", "/poke" };
+// Bodies carry STAMP_TAG, the command's letter and the microsecond it was due.
+const char* STAMP_TAG = "@@";
+const char* USERS_REPLY = "Connected Users: ";
+const char* POKE_REPLY = " has poked you!";
+const int MIX_BATCH = 64;
+const char* STORM_PWD = "stormpwd";
+long BroadcastsSeen = 0;
+
+// Function Prototypes
+double Now();
+// Function returns a monotonic timestamp in seconds.
+// pre: none
+// post: none
+
+bool ResolveHost(string hostName, unsigned short serverPort, struct sockaddr_in& serverAddress);
+// Function fills in the server's address.
+// pre: none
+// post: returns false if hostName does not resolve.
+
+int openSocket(string hostName, unsigned short serverPort);
+// Function opens a blocking connection to the server.
+// pre: none
+// post: returns -1 on failure.
+
+bool SendFrame(int HostSock, string msg);
+// Function sends a length-prefixed message, exactly like msgClient does.
+// pre: HostSock should exist.
+// post: none
+
+bool ReadFrames(Conn& conn, vector<string>& frames);
+// Function drains a non-blocking socket and splits out whole frames.
+// pre: conn.sock should be non-blocking.
+// post: returns false if the connection closed.
+
+bool ReadServerStats(int pid, ServerStats& stats);
+// Function samples a process' thread count, resident memory and CPU time from /proc.
+// pre: none
+// post: returns false if pid could not be read.
+
+void PumpEvents(int epollFd, vector<Conn>& conns, int timeoutMs, int& numReady, vector<double>& latencies);
+// Function services readable connections for up to timeoutMs.
+// pre: none
+// post: numReady and latencies are updated.
+
+int RunBurst(string hostName, unsigned short serverPort, int numConns);
+// Function starts numConns non-blocking connects at once and times each until the server answers its login.
+// pre: none
+// post: every burst connection is closed.
+
+bool LoginSession(string hostName, unsigned short serverPort, string userName, Conn& conn,
+		  vector<string>& frames);
+// Function connects, logs in and waits for the server's answer.
+// pre: none
+// post: conn.sock is non-blocking; frames holds whatever arrived with the answer.
+//       Returns false (and closes the socket) unless the login succeeded.
+
+bool WaitFrames(Conn& conn, vector<string>& frames, int timeoutMs);
+// Function waits up to timeoutMs for one connection to become readable and reads its frames.
+// pre: conn.sock should be non-blocking.
+// post: returns false if the connection closed.
+
+int RunOffline(string hostName, unsigned short serverPort, int numMsgs, int serverPid);
+// Function sends numMsgs /msg lines to users who are logged out, then logs one back in and times the replay.
+// pre: none
+// post: every connection is closed.
+
+bool ParseMix(string spec, int weights[MIX_TYPES]);
+// Function reads a msg:all:users:poke weight list such as "80:2:3:15".
+// pre: none
+// post: returns false unless there are four non-negative weights and one is positive.
+
+void PumpMix(int epollFd, vector<Conn>& conns, int timeoutMs, int& numReady, MixStats& stats);
+// Function services readable connections for up to timeoutMs and matches what arrives to what was sent.
+// pre: none
+// post: numReady, received counts and latencies are updated.
+
+void PrintLatency(const char* label, vector<double>& latencies);
+// Function prints the p50/p99/p99.9/max of a set of latencies.
+// pre: none
+// post: latencies is sorted.
+
+int RunMix(string hostName, unsigned short serverPort, int numUsers, int weights[MIX_TYPES],
+	   int rate, int seconds, int serverPid, int numNodes);
+// Function logs in numUsers sessions and sends rate commands per second, drawn from weights,
+// for seconds, then reports throughput and end-to-end delivery latency per command.
+// pre: with numNodes > 1, a cluster's nodes should listen on serverPort and the ports after it.
+// post: every connection is closed.
+
+int LoginWave(const struct sockaddr_in& serverAddress, const vector<string>& names, vector<Conn>& conns,
+	      Conn& probe, string probeName, int serverPid, WaveStats& stats);
+// Function starts a non-blocking connect and login as names[i] for every conn at once while probe, already
+// logged in, keeps one /msg to itself outstanding.
+// pre: probe.sock should be non-blocking.
+// post: returns how many logged in; they stay connected and keep reading until every login is answered
+//       and no notice has arrived for half a second.
+
+int RunStorm(string hostName, unsigned short serverPort, int numUsers, int serverPid);
+// Function logs numUsers new accounts in at once, drops them all and reconnects them at once,
+// reporting logins per second and how long a logged in session waits for a reply meanwhile.
+// pre: none
+// post: every connection is closed.
+
+int main(int argc, char* argv[]) {
+
+  // Locals
+  int numConns = 500;
+  int serverPid = 0;
+  int holdSec = 5;
+  int numProbes = 50;
+  int numLines = 0;
+  bool isBurst = false;
+  bool isStorm = false;
+  int numStalled = -1;
+  int numOffline = 0;
+  string mixSpec;
+  int mixRate = 1000;
+  int mixSeconds = 10;
+  int numNodes = 1;
+  int opt;
+
+  // Process Arguments
+  while ((opt = getopt(argc, argv, "n:p:h:r:a:BXo:S:x:R:d:N:")) != -1) {
+    switch (opt) {
+    case 'n':
+      numConns = atoi(optarg);
+      break;
+    case 'p':
+      serverPid = atoi(optarg);
+      break;
+    case 'h':
+      holdSec = atoi(optarg);
+      break;
+    case 'r':
+      numProbes = atoi(optarg);
+      break;
+    case 'a':
+      numLines = atoi(optarg);
+      break;
+    case 'B':
+      isBurst = true;
+      break;
+    case 'X':
+      isStorm = true;
+      break;
+    case 'o':
+      numOffline = atoi(optarg);
+      break;
+    case 'S':
+      numStalled = atoi(optarg);
+      break;
+    case 'x':
+      mixSpec = optarg;
+      break;
+    case 'R':
+      mixRate = atoi(optarg);
+      break;
+    case 'd':
+      mixSeconds = atoi(optarg);
+      break;
+    case 'N':
+      numNodes = atoi(optarg);
+      break;
+    default:
+      cerr << "Usage: " << argv[0] << " [-n connections] [-p server pid] [-h hold seconds] [-r probes] [-a broadcast lines] [-S stalled readers] [-B] [-X] [-o offline messages] [-x msg:all:users:poke] [-R commands/s] [-d seconds] [-N cluster nodes] host port" << endl;
+      return -1;
+    }
+  }
+  if (argc - optind != 2) {
+    cerr << "Incorrect number of arguments. Please try again." << endl;
+    return -1;
+  }
+  string hostName = argv[optind];
+  unsigned short serverPort = atoi(argv[optind+1]);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (isBurst) {
+    return RunBurst(hostName, serverPort, numConns);
+  }
+  if (isStorm) {
+    return RunStorm(hostName, serverPort, numConns, serverPid);
+  }
+  if (numOffline > 0) {
+    return RunOffline(hostName, serverPort, numOffline, serverPid);
+  }
+  if (!mixSpec.empty()) {
+    int weights[MIX_TYPES];
+    if (!ParseMix(mixSpec, weights) || mixRate < 1 || mixSeconds < 1 || numNodes < 1) {
+      cerr << "Bad command mix " << mixSpec << "; expected msg:all:users:poke weights." << endl;
+      return -1;
+    }
+    return RunMix(hostName, serverPort, numConns, weights, mixRate, mixSeconds, serverPid, numNodes);
+  }
+
+  ServerStats before = {0, 0, 0};
+  if (serverPid > 0 && !ReadServerStats(serverPid, before)) {
+    cerr << "Unable to read stats for pid " << serverPid << "." << endl;
+    return -1;
+  }
+
+  // Connect and log everyone in.
+  int epollFd = epoll_create1(0);
+  vector<Conn> conns(numConns);
+  double startTime = Now();
+  for (int i = 0; i < numConns; i++) {
+    conns[i].sock = openSocket(hostName, serverPort);
+    conns[i].state = CONN_LOGGING_IN;
+    conns[i].probeSent = 0;
+    conns[i].probeDone = false;
+    if (conns[i].sock < 0) {
+      cerr << "Connection " << i << " failed." << endl;
+      return -1;
+    }
+    stringstream userName;
+    userName << "load" << getpid() << "_" << i;
+    SendFrame(conns[i].sock, userName.str());
+    SendFrame(conns[i].sock, "loadpwd");
+    fcntl(conns[i].sock, F_SETFL, fcntl(conns[i].sock, F_GETFL, 0) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].sock, &ev);
+  }
+  double connectTime = Now() - startTime;
+
+  int numReady = 0;
+  vector<double> latencies;
+  double deadline = Now() + 60;
+  while (numReady < numConns && Now() < deadline) {
+    PumpEvents(epollFd, conns, 100, numReady, latencies);
+  }
+  double loginTime = Now() - startTime;
+  if (numReady < numConns) {
+    cerr << "Only " << numReady << " of " << numConns << " connections logged in." << endl;
+  }
+
+  // Let presence announcements settle, then measure the idle cost.
+  ServerStats idleStart = before;
+  if (serverPid > 0) {
+    PumpEvents(epollFd, conns, 1000, numReady, latencies);
+    ReadServerStats(serverPid, idleStart);
+  }
+  double holdEnd = Now() + holdSec;
+  while (Now() < holdEnd) {
+    PumpEvents(epollFd, conns, 100, numReady, latencies);
+  }
+  ServerStats held = idleStart;
+  if (serverPid > 0) {
+    ReadServerStats(serverPid, held);
+  }
+
+  // Delivery probes: one session sends a /msg and we time its arrival at another.
+  for (int i = 0; i < numProbes && numConns > 1; i++) {
+    int from = (i * 7919) % numConns;
+    int to = (from + 1 + i) % numConns;
+    if (from == to || conns[from].state != CONN_READY || conns[to].state != CONN_READY) {
+      continue;
+    }
+    stringstream probe;
+    probe << "/msg load" << getpid() << "_" << to << " probe";
+    conns[to].probeSent = Now();
+    conns[to].probeDone = false;
+    SendFrame(conns[from].sock, probe.str());
+    double probeDeadline = Now() + 5;
+    while (!conns[to].probeDone && Now() < probeDeadline) {
+      PumpEvents(epollFd, conns, 10, numReady, latencies);
+    }
+  }
+
+  // Broadcast flood: plain chat lines from every session in turn, each fanned out to all the others.
+  // With -S the flood is paced to readers that keep up, and /msg probes between the last two
+  // sessions time delivery while the first numStalled sessions stop reading, like clients on
+  // a dead link. -S 0 is the same run with nobody stalled.
+  long expected = 0;
+  long linesSent = 0;
+  double floodTime = 0;
+  int probeFrom = numConns - 1;
+  int probeTo = numConns - 2;
+  vector<double> floodLatencies;
+  ServerStats floodStart = held;
+  bool isPaced = numStalled >= 0 && numReady == numConns && numConns - numStalled > 2;
+  if (numLines > 0 && numReady > 1) {
+    if (serverPid > 0) {
+      ReadServerStats(serverPid, floodStart);
+    }
+    for (int i = 0; isPaced && i < numStalled; i++) {
+      int small = 4096;
+      setsockopt(conns[i].sock, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, conns[i].sock, NULL);
+    }
+    long fanout = numReady - 1 - (isPaced ? numStalled : 0);
+    BroadcastsSeen = 0;
+    double floodBegin = Now();
+    double floodDeadline = floodBegin + 60;
+    for (int i = 0; i < numLines; i++) {
+      Conn& conn = conns[i % numConns];
+      if (conn.state != CONN_READY || (isPaced && i % numConns < numStalled)) {
+	continue;
+      }
+      stringstream line;
+      line << "flood line " << i;
+      if (isPaced) {
+	// Stay at most FLOOD_WINDOW lines ahead of the readers. The padding pushes
+	// more at a stalled session than its socket buffers hold.
+	while (linesSent * fanout - BroadcastsSeen > FLOOD_WINDOW * fanout && Now() < floodDeadline) {
+	  PumpEvents(epollFd, conns, 10, numReady, floodLatencies);
+	}
+	line << " " << string(STALL_PADDING, '.');
+      }
+      SendFrame(conn.sock, line.str());
+      linesSent++;
+      // Keep reading so the server never blocks on us.
+      if (i % 16 == 0) {
+	if (isPaced && (conns[probeTo].probeSent == 0 || conns[probeTo].probeDone)) {
+	  stringstream probe;
+	  probe << "/msg load" << getpid() << "_" << probeTo << " probe";
+	  conns[probeTo].probeSent = Now();
+	  conns[probeTo].probeDone = false;
+	  SendFrame(conns[probeFrom].sock, probe.str());
+	}
+	PumpEvents(epollFd, conns, 0, numReady, floodLatencies);
+      }
+    }
+    expected = linesSent * fanout;
+    while (BroadcastsSeen < expected && Now() < floodDeadline) {
+      PumpEvents(epollFd, conns, 100, numReady, floodLatencies);
+    }
+    floodTime = Now() - floodBegin;
+  }
+
+  // Report
+  sort(latencies.begin(), latencies.end());
+  printf("connections:        %d\n", numConns);
+  printf("logged in:          %d\n", numReady);
+  printf("connect time:       %.3f s\n", connectTime);
+  printf("login time:         %.3f s\n", loginTime);
+  if (!latencies.empty()) {
+    printf("/msg delivery:      p50 %.3f ms, max %.3f ms (%d probes)\n",
+	   latencies[latencies.size() / 2] * 1000, latencies.back() * 1000, (int) latencies.size());
+  }
+  if (serverPid > 0) {
+    printf("server threads:     %ld (was %ld)\n", held.threads, before.threads);
+    printf("server rss:         %ld kB (was %ld kB, %.1f kB/conn)\n", held.rssKb, before.rssKb,
+	   numConns > 0 ? (double) (held.rssKb - before.rssKb) / numConns : 0.0);
+    printf("server idle cpu:    %.3f s over %d s hold\n", held.cpuSec - idleStart.cpuSec, holdSec);
+  }
+  if (expected > 0) {
+    printf("broadcast flood:    %ld lines, %ld of %ld deliveries in %.3f s (%.0f deliveries/s)\n",
+	   linesSent, BroadcastsSeen, expected, floodTime, BroadcastsSeen / floodTime);
+    if (isPaced) {
+      printf("stalled readers:    %d\n", numStalled);
+    }
+    if (!floodLatencies.empty()) {
+      sort(floodLatencies.begin(), floodLatencies.end());
+      printf("/msg during flood:  p50 %.3f ms, p99 %.3f ms, max %.3f ms (%d probes)\n",
+	     floodLatencies[floodLatencies.size() / 2] * 1000,
+	     floodLatencies[floodLatencies.size() * 99 / 100] * 1000,
+	     floodLatencies.back() * 1000, (int) floodLatencies.size());
+    }
+    if (serverPid > 0) {
+      ServerStats floodEnd = floodStart;
+      ReadServerStats(serverPid, floodEnd);
+      printf("server flood rss:   %ld kB (was %ld kB)\n", floodEnd.rssKb, floodStart.rssKb);
+      printf("server flood cpu:   %.3f s (%.2f us/delivery)\n", floodEnd.cpuSec - floodStart.cpuSec,
+	     BroadcastsSeen > 0 ? (floodEnd.cpuSec - floodStart.cpuSec) * 1e6 / BroadcastsSeen : 0.0);
+    }
+  }
+
+  for (int i = 0; i < numConns; i++) {
+    close(conns[i].sock);
+  }
+  close(epollFd);
+
+  return 0;
+}
+
+void PumpEvents(int epollFd, vector<Conn>& conns, int timeoutMs, int& numReady, vector<double>& latencies) {
+
+  struct epoll_event events[MAX_EVENTS];
+  int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+  for (int i = 0; i < numEvents; i++) {
+    Conn& conn = conns[events[i].data.u32];
+    vector<string> frames;
+    if (!ReadFrames(conn, frames)) {
+      if (conn.state != CONN_CLOSED) {
+	cerr << "Server closed connection " << events[i].data.u32 << "." << endl;
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.sock, NULL);
+	conn.state = CONN_CLOSED;
+      }
+    }
+    for (size_t j = 0; j < frames.size(); j++) {
+      if (conn.state == CONN_LOGGING_IN) {
+	if (frames[j] == LOGIN_SUCCESS) {
+	  conn.state = CONN_READY;
+	  numReady++;
+	} else {
+	  cerr << "Login rejected for connection " << events[i].data.u32 << "." << endl;
+	}
+	continue;
+      }
+      // GetMsgs batches, so one frame can carry many broadcasts and a probe among them.
+      size_t pos = 0;
+      while ((pos = frames[j].find(BROADCAST_TAG, pos)) != string::npos) {
+	BroadcastsSeen++;
+	pos += strlen(BROADCAST_TAG);
+      }
+      if (conn.probeSent > 0 && !conn.probeDone && frames[j].find(PM_REPLY) != string::npos) {
+	latencies.push_back(Now() - conn.probeSent);
+	conn.probeDone = true;
+      }
+    }
+  }
+}
+
+double Now() {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool ResolveHost(string hostName, unsigned short serverPort, struct sockaddr_in& serverAddress) {
+
+  // Get host IP and Set proper fields
+  struct hostent* host = gethostbyname(hostName.c_str());
+  if (!host) {
+    cerr << "Unable to resolve hostname's ip address. Exiting..." << endl;
+    return false;
+  }
+  memset(&serverAddress, 0, sizeof(serverAddress));
+  serverAddress.sin_family = AF_INET;
+  memcpy(&serverAddress.sin_addr, host->h_addr_list[0], sizeof(serverAddress.sin_addr));
+  serverAddress.sin_port = htons(serverPort);
+  return true;
+}
+
+int openSocket(string hostName, unsigned short serverPort) {
+
+  // Create a socket and start server communications.
+  int hostSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (hostSock < 0) {
+    cerr << "Socket was unable to be opened." << endl;
+    return -1;
+  }
+  struct sockaddr_in serverAddress;
+  if (!ResolveHost(hostName, serverPort, serverAddress)) {
+    close(hostSock);
+    return -1;
+  }
+
+  if (connect(hostSock, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0) {
+    cerr << "Error with the connection." << endl;
+    close(hostSock);
+    return -1;
+  }
+
+  // Probes are tiny; don't let Nagle hold them back.
+  int noDelay = 1;
+  setsockopt(hostSock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  return hostSock;
+}
+
+bool SendFrame(int HostSock, string msg) {
+
+  // Same layout as SendInteger + SendMessage: a long holding htonl(length), then the NUL terminated body.
+  string frame;
+  long networkInt = htonl(msg.length()+1);
+  frame.append((char*) &networkInt, FRAME_HEADER_SIZE);
+  frame.append(msg.c_str(), msg.length()+1);
+
+  size_t offset = 0;
+  while (offset < frame.length()) {
+    int msgSent = send(HostSock, frame.data() + offset, frame.length() - offset, MSG_NOSIGNAL);
+    if (msgSent < 0 && (errno == EAGAIN || errno == EINTR)) {
+      continue;
+    }
+    if (msgSent <= 0) {
+      return false;
+    }
+    offset += msgSent;
+  }
+
+  return true;
+}
+
+bool ReadFrames(Conn& conn, vector<string>& frames) {
+
+  char buffer[16384];
+  bool isOpen = true;
+  while (true) {
+    int bytesRecv = recv(conn.sock, buffer, sizeof(buffer), 0);
+    if (bytesRecv > 0) {
+      conn.inBuf.append(buffer, bytesRecv);
+      continue;
+    }
+    if (bytesRecv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRecv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      isOpen = false;
+    }
+    break;
+  }
+
+  size_t offset = 0;
+  while (conn.inBuf.length() - offset >= FRAME_HEADER_SIZE) {
+    long networkInt;
+    memcpy(&networkInt, conn.inBuf.data() + offset, FRAME_HEADER_SIZE);
+    size_t msgLength = ntohl(networkInt);
+    if (conn.inBuf.length() - offset - FRAME_HEADER_SIZE < msgLength) {
+      break;
+    }
+    const char* body = conn.inBuf.data() + offset + FRAME_HEADER_SIZE;
+    frames.push_back(string(body, strnlen(body, msgLength)));
+    offset += FRAME_HEADER_SIZE + msgLength;
+  }
+  conn.inBuf.erase(0, offset);
+
+  return isOpen;
+}
+
+bool ReadServerStats(int pid, ServerStats& stats) {
+
+  // Threads and VmRSS come from status; utime + stime from stat.
+  char path[64];
+  char line[512];
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  FILE* status = fopen(path, "r");
+  if (!status) {
+    return false;
+  }
+  while (fgets(line, sizeof(line), status)) {
+    sscanf(line, "Threads: %ld", &stats.threads);
+    sscanf(line, "VmRSS: %ld", &stats.rssKb);
+  }
+  fclose(status);
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE* stat = fopen(path, "r");
+  if (!stat) {
+    return false;
+  }
+  string contents;
+  while (fgets(line, sizeof(line), stat)) {
+    contents.append(line);
+  }
+  fclose(stat);
+
+  // Fields after the parenthesised command name; utime and stime are fields 14 and 15.
+  size_t paren = contents.rfind(')');
+  if (paren == string::npos) {
+    return false;
+  }
+  stringstream fields(contents.substr(paren + 2));
+  string field;
+  unsigned long utime = 0;
+  unsigned long stime = 0;
+  for (int i = 3; i <= 15 && fields >> field; i++) {
+    if (i == 14) utime = strtoul(field.c_str(), NULL, 10);
+    if (i == 15) stime = strtoul(field.c_str(), NULL, 10);
+  }
+  stats.cpuSec = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+
+  return true;
+}
+
+int RunBurst(string hostName, unsigned short serverPort, int numConns) {
+
+  // Locals
+  struct sockaddr_in serverAddress;
+  if (!ResolveHost(hostName, serverPort, serverAddress)) {
+    return -1;
+  }
+  int epollFd = epoll_create1(0);
+  vector<Conn> conns(numConns);
+  vector<double> started(numConns);
+  vector<double> latencies;
+  int numFailed = 0;
+
+  // Every connection claims the same account, so after the first the server answers
+  // "Login Failed!" and nobody gets presence fan-out; the reply is just proof of accept.
+  stringstream userName;
+  userName << "burst" << getpid();
+
+  double startTime = Now();
+  for (int i = 0; i < numConns; i++) {
+    conns[i].sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    conns[i].state = CONN_LOGGING_IN;
+    started[i] = Now();
+    if (conns[i].sock < 0 ||
+	(connect(conns[i].sock, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0 &&
+	 errno != EINPROGRESS)) {
+      conns[i].state = CONN_CLOSED;
+      numFailed++;
+      continue;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u32 = i;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].sock, &ev);
+  }
+
+  // Log in as each handshake completes, then wait for the server's answer.
+  int numPending = numConns - numFailed;
+  double deadline = Now() + 30;
+  struct epoll_event events[MAX_EVENTS];
+  while (numPending > 0 && Now() < deadline) {
+    int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, 100);
+    for (int i = 0; i < numEvents; i++) {
+      int id = events[i].data.u32;
+      Conn& conn = conns[id];
+      if (conn.state == CONN_CLOSED) {
+	continue;
+      }
+      bool isDone = false;
+      bool isFailed = false;
+      if (events[i].events & EPOLLOUT) {
+	int sockErr = 0;
+	socklen_t errLen = sizeof(sockErr);
+	getsockopt(conn.sock, SOL_SOCKET, SO_ERROR, &sockErr, &errLen);
+	if (sockErr != 0 || !SendFrame(conn.sock, userName.str()) || !SendFrame(conn.sock, "burstpwd")) {
+	  isFailed = true;
+	} else {
+	  struct epoll_event ev;
+	  ev.events = EPOLLIN;
+	  ev.data.u32 = id;
+	  epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.sock, &ev);
+	}
+      } else {
+	vector<string> frames;
+	bool isOpen = ReadFrames(conn, frames);
+	if (!frames.empty()) {
+	  latencies.push_back(Now() - started[id]);
+	  isDone = true;
+	} else if (!isOpen) {
+	  isFailed = true;
+	}
+      }
+      if (isDone || isFailed) {
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.sock, NULL);
+	close(conn.sock);
+	conn.state = CONN_CLOSED;
+	numFailed += isFailed ? 1 : 0;
+	numPending--;
+      }
+    }
+  }
+  double burstTime = Now() - startTime;
+  for (int i = 0; i < numConns; i++) {
+    if (conns[i].state != CONN_CLOSED) {
+      close(conns[i].sock);
+    }
+  }
+  close(epollFd);
+
+  // Report
+  sort(latencies.begin(), latencies.end());
+  printf("burst connections:  %d\n", numConns);
+  printf("answered:           %d in %.3f s (%d failed, %d timed out)\n", (int) latencies.size(), burstTime,
+	 numFailed, numPending);
+  if (!latencies.empty()) {
+    printf("accept latency:     p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	   latencies[latencies.size() / 2] * 1000,
+	   latencies[latencies.size() * 99 / 100] * 1000,
+	   latencies.back() * 1000);
+  }
+
+  return 0;
+}
+
+bool LoginSession(string hostName, unsigned short serverPort, string userName, Conn& conn,
+		  vector<string>& frames) {
+
+  conn.sock = openSocket(hostName, serverPort);
+  conn.state = CONN_LOGGING_IN;
+  conn.inBuf.clear();
+  if (conn.sock < 0) {
+    return false;
+  }
+  SendFrame(conn.sock, userName);
+  SendFrame(conn.sock, "loadpwd");
+  fcntl(conn.sock, F_SETFL, fcntl(conn.sock, F_GETFL, 0) | O_NONBLOCK);
+
+  frames.clear();
+  double deadline = Now() + 10;
+  while (frames.empty() && Now() < deadline) {
+    if (!WaitFrames(conn, frames, 100)) {
+      break;
+    }
+  }
+  if (frames.empty() || frames[0] != LOGIN_SUCCESS) {
+    close(conn.sock);
+    conn.state = CONN_CLOSED;
+    return false;
+  }
+  conn.state = CONN_READY;
+  frames.erase(frames.begin());
+  return true;
+}
+
+bool WaitFrames(Conn& conn, vector<string>& frames, int timeoutMs) {
+
+  struct pollfd pfd;
+  pfd.fd = conn.sock;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeoutMs) <= 0) {
+    return true;
+  }
+  return ReadFrames(conn, frames);
+}
+
+int RunOffline(string hostName, unsigned short serverPort, int numMsgs, int serverPid) {
+
+  // Locals
+  const int NUM_RECIPIENTS = 10;
+  vector<string> frames;
+  Conn sender;
+  Conn recipient;
+
+  // Create the recipients' accounts, then leave.
+  for (int i = 0; i < NUM_RECIPIENTS; i++) {
+    stringstream userName;
+    userName << "offline" << getpid() << "_" << i;
+    if (!LoginSession(hostName, serverPort, userName.str(), recipient, frames)) {
+      cerr << "Unable to log in " << userName.str() << "." << endl;
+      return -1;
+    }
+    close(recipient.sock);
+  }
+  stringstream senderName;
+  senderName << "offline" << getpid() << "_sender";
+  if (!LoginSession(hostName, serverPort, senderName.str(), sender, frames)) {
+    cerr << "Unable to log in the sender." << endl;
+    return -1;
+  }
+  // Let the logouts land before anything is addressed to them.
+  double settle = Now() + 1;
+  while (Now() < settle) {
+    WaitFrames(sender, frames, 100);
+  }
+
+  ServerStats before = {0, 0, 0};
+  if (serverPid > 0) {
+    ReadServerStats(serverPid, before);
+  }
+  string padding(100, 'x');
+  double sendBegin = Now();
+  for (int i = 0; i < numMsgs; i++) {
+    stringstream line;
+    line << "/msg offline" << getpid() << "_" << i % NUM_RECIPIENTS << " offline " << i << " " << padding;
+    SendFrame(sender.sock, line.str());
+    if (i % 256 == 0) {
+      ReadFrames(sender, frames);
+    }
+  }
+  // Commands are handled in order, so the /time answer means every /msg before it is stored.
+  frames.clear();
+  SendFrame(sender.sock, "/time");
+  double deadline = Now() + 60;
+  while (frames.empty() && Now() < deadline) {
+    WaitFrames(sender, frames, 100);
+  }
+  double sendTime = Now() - sendBegin;
+  ServerStats after = before;
+  if (serverPid > 0) {
+    ReadServerStats(serverPid, after);
+  }
+
+  // Log one recipient back in and count what arrives.
+  long expected = numMsgs / NUM_RECIPIENTS + (numMsgs % NUM_RECIPIENTS > 0 ? 1 : 0);
+  long received = 0;
+  stringstream userName;
+  userName << "offline" << getpid() << "_0";
+  double replayBegin = Now();
+  if (!LoginSession(hostName, serverPort, userName.str(), recipient, frames)) {
+    cerr << "Unable to log " << userName.str() << " back in." << endl;
+    return -1;
+  }
+  double lastFrame = Now();
+  bool isOpen = true;
+  while (received < expected && Now() - lastFrame < 2 && isOpen) {
+    for (size_t i = 0; i < frames.size(); i++) {
+      size_t pos = 0;
+      while ((pos = frames[i].find(PM_REPLY, pos)) != string::npos) {
+	received++;
+	pos += strlen(PM_REPLY);
+      }
+      lastFrame = Now();
+    }
+    frames.clear();
+    isOpen = WaitFrames(recipient, frames, 100);
+  }
+  double replayTime = lastFrame - replayBegin;
+  close(recipient.sock);
+  close(sender.sock);
+
+  // Report
+  printf("offline messages:   %d to %d logged-out users in %.3f s\n", numMsgs, NUM_RECIPIENTS, sendTime);
+  if (serverPid > 0) {
+    printf("server rss:         %ld kB (was %ld kB, %+ld kB)\n", after.rssKb, before.rssKb,
+	   after.rssKb - before.rssKb);
+  }
+  printf("replay at login:    %ld of %ld messages in %.3f ms\n", received, expected, replayTime * 1000);
+
+  return 0;
+}
+
+bool ParseMix(string spec, int weights[MIX_TYPES]) {
+
+  stringstream ss(spec);
+  string field;
+  int numFields = 0;
+  int total = 0;
+  while (getline(ss, field, ':')) {
+    if (numFields == MIX_TYPES || field.empty()) {
+      return false;
+    }
+    weights[numFields] = atoi(field.c_str());
+    if (weights[numFields] < 0) {
+      return false;
+    }
+    total += weights[numFields++];
+  }
+  return numFields == MIX_TYPES && total > 0;
+}
+
+void PumpMix(int epollFd, vector<Conn>& conns, int timeoutMs, int& numReady, MixStats& stats) {
+
+  struct epoll_event events[MAX_EVENTS];
+  int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+  for (int i = 0; i < numEvents; i++) {
+    Conn& conn = conns[events[i].data.u32];
+    vector<string> frames;
+    if (!ReadFrames(conn, frames)) {
+      if (conn.state != CONN_CLOSED) {
+	cerr << "Server closed connection " << events[i].data.u32 << "." << endl;
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.sock, NULL);
+	conn.state = CONN_CLOSED;
+	numReady--;
+      }
+    }
+    double now = Now();
+    for (size_t j = 0; j < frames.size(); j++) {
+      const string& frame = frames[j];
+      if (conn.state == CONN_LOGGING_IN) {
+	if (frame == LOGIN_SUCCESS) {
+	  conn.state = CONN_READY;
+	  numReady++;
+	} else {
+	  cerr << "Login rejected for connection " << events[i].data.u32 << "." << endl;
+	}
+	continue;
+      }
+
+      // /msg and /all bodies carry the time they were due; GetMsgs may batch many per frame.
+      size_t pos = 0;
+      while ((pos = frame.find(STAMP_TAG, pos)) != string::npos) {
+	pos += strlen(STAMP_TAG);
+	if (pos >= frame.length() || (frame[pos] != 'm' && frame[pos] != 'a')) {
+	  continue;
+	}
+	MixType type = frame[pos] == 'm' ? MIX_MSG : MIX_ALL;
+	double stamp = strtoll(frame.c_str() + pos + 1, NULL, 10) / 1e6;
+	stats.received[type]++;
+	stats.latencies[type].push_back(now - stamp);
+      }
+      // /users answers come back in the order they were asked.
+      pos = 0;
+      while ((pos = frame.find(USERS_REPLY, pos)) != string::npos) {
+	pos += strlen(USERS_REPLY);
+	if (!conn.usersSent.empty()) {
+	  stats.received[MIX_USERS]++;
+	  stats.latencies[MIX_USERS].push_back(now - conn.usersSent.front());
+	  conn.usersSent.pop_front();
+	}
+      }
+      // "<name> has poked you!" carries no body; match it to the oldest poke from that sender.
+      pos = 0;
+      while ((pos = frame.find(POKE_REPLY, pos)) != string::npos) {
+	size_t start = frame.rfind('\n', pos);
+	start = start == string::npos ? 0 : start + 1;
+	size_t underscore = frame.rfind('_', pos);
+	pos += strlen(POKE_REPLY);
+	if (underscore == string::npos || underscore < start) {
+	  continue;
+	}
+	deque<double>& pokes = conn.pokesFrom[atoi(frame.c_str() + underscore + 1)];
+	if (!pokes.empty()) {
+	  stats.received[MIX_POKE]++;
+	  stats.latencies[MIX_POKE].push_back(now - pokes.front());
+	  pokes.pop_front();
+	}
+      }
+    }
+  }
+}
+
+void PrintLatency(const char* label, vector<double>& latencies) {
+
+  if (latencies.empty()) {
+    return;
+  }
+  sort(latencies.begin(), latencies.end());
+  printf("%-20sp50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n", label,
+	 latencies[latencies.size() / 2] * 1000,
+	 latencies[latencies.size() * 99 / 100] * 1000,
+	 latencies[latencies.size() * 999 / 1000] * 1000,
+	 latencies.back() * 1000);
+}
+
+int RunMix(string hostName, unsigned short serverPort, int numUsers, int weights[MIX_TYPES],
+	   int rate, int seconds, int serverPid, int numNodes) {
+
+  // Locals
+  MixStats stats;
+  for (int t = 0; t < MIX_TYPES; t++) {
+    stats.sent[t] = stats.expected[t] = stats.received[t] = 0;
+  }
+  int totalWeight = 0;
+  for (int t = 0; t < MIX_TYPES; t++) {
+    totalWeight += weights[t];
+  }
+  if (numUsers < 2) {
+    cerr << "A command mix needs at least 2 users." << endl;
+    return -1;
+  }
+  srand(getpid());
+
+  // Connect and log everyone in.
+  int epollFd = epoll_create1(0);
+  vector<Conn> conns(numUsers);
+  double startTime = Now();
+  for (int i = 0; i < numUsers; i++) {
+    // Spread over the nodes, so most private messages cross a link.
+    conns[i].sock = openSocket(hostName, serverPort + i % numNodes);
+    conns[i].state = CONN_LOGGING_IN;
+    conns[i].probeSent = 0;
+    conns[i].probeDone = false;
+    if (conns[i].sock < 0) {
+      cerr << "Connection " << i << " failed." << endl;
+      return -1;
+    }
+    stringstream userName;
+    userName << "mix" << getpid() << "_" << i;
+    SendFrame(conns[i].sock, userName.str());
+    SendFrame(conns[i].sock, "loadpwd");
+    fcntl(conns[i].sock, F_SETFL, fcntl(conns[i].sock, F_GETFL, 0) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].sock, &ev);
+    if (i % 64 == 0) {
+      // Take presence announcements as they come so the server never waits on us.
+      int numReady = 0;
+      PumpMix(epollFd, conns, 0, numReady, stats);
+    }
+  }
+  int numReady = 0;
+  for (int i = 0; i < numUsers; i++) {
+    numReady += conns[i].state == CONN_READY ? 1 : 0;
+  }
+  double deadline = Now() + 60;
+  while (numReady < numUsers && Now() < deadline) {
+    PumpMix(epollFd, conns, 100, numReady, stats);
+  }
+  double loginTime = Now() - startTime;
+  if (numReady < numUsers) {
+    cerr << "Only " << numReady << " of " << numUsers << " users logged in." << endl;
+  }
+  // Let the presence announcements settle.
+  double settle = Now() + 1;
+  while (Now() < settle) {
+    PumpMix(epollFd, conns, 100, numReady, stats);
+  }
+
+  ServerStats before = {0, 0, 0};
+  if (serverPid > 0) {
+    ReadServerStats(serverPid, before);
+  }
+
+  // Open loop: command k is due at begin + k / rate whether or not the server has kept up,
+  // and its latency counts from then, so a stalled server cannot hide its backlog.
+  long total = (long) rate * seconds;
+  long issued = 0;
+  double begin = Now();
+  while (issued < total) {
+    long due = min(total, (long) ((Now() - begin) * rate) + 1);
+    for (int b = 0; issued < due && b < MIX_BATCH; b++, issued++) {
+      double dueAt = begin + (double) issued / rate;
+      long long stamp = (long long) (dueAt * 1e6);
+      int pick = rand() % totalWeight;
+      int type = 0;
+      while (pick >= weights[type]) {
+	pick -= weights[type++];
+      }
+      int from = rand() % numUsers;
+      int to = rand() % (numUsers - 1);
+      to += to >= from ? 1 : 0;
+      if (conns[from].state != CONN_READY || conns[to].state != CONN_READY) {
+	continue;
+      }
+
+      stringstream line;
+      switch (type) {
+      case MIX_MSG:
+	line << "/msg mix" << getpid() << "_" << to << " " << STAMP_TAG << "m" << stamp;
+	stats.expected[type]++;
+	break;
+      case MIX_ALL:
+	line << "/all " << STAMP_TAG << "a" << stamp;
+	stats.expected[type] += numReady - 1;
+	break;
+      case MIX_USERS:
+	line << "/users";
+	conns[from].usersSent.push_back(dueAt);
+	stats.expected[type]++;
+	break;
+      case MIX_POKE:
+	line << "/poke mix" << getpid() << "_" << to;
+	conns[to].pokesFrom[from].push_back(dueAt);
+	stats.expected[type]++;
+	break;
+      }
+      SendFrame(conns[from].sock, line.str());
+      stats.sent[type]++;
+    }
+    PumpMix(epollFd, conns, issued < due ? 0 : 1, numReady, stats);
+  }
+  double sendTime = Now() - begin;
+
+  // Wait for the stragglers.
+  long expected = 0;
+  long received = 0;
+  deadline = Now() + 10;
+  while (Now() < deadline) {
+    expected = received = 0;
+    for (int t = 0; t < MIX_TYPES; t++) {
+      expected += stats.expected[t];
+      received += stats.received[t];
+    }
+    if (received >= expected) {
+      break;
+    }
+    PumpMix(epollFd, conns, 100, numReady, stats);
+  }
+  double runTime = Now() - begin;
+  ServerStats after = before;
+  if (serverPid > 0) {
+    ReadServerStats(serverPid, after);
+  }
+  for (int i = 0; i < numUsers; i++) {
+    close(conns[i].sock);
+  }
+  close(epollFd);
+
+  // Report
+  long numSent = 0;
+  vector<double> everything;
+  for (int t = 0; t < MIX_TYPES; t++) {
+    numSent += stats.sent[t];
+    everything.insert(everything.end(), stats.latencies[t].begin(), stats.latencies[t].end());
+  }
+  printf("users:              %d (%d logged in, %.3f s)\n", numUsers, numReady, loginTime);
+  printf("command mix:        %d:%d:%d:%d (msg:all:users:poke) at %d/s for %d s\n",
+	 weights[MIX_MSG], weights[MIX_ALL], weights[MIX_USERS], weights[MIX_POKE], rate, seconds);
+  printf("commands sent:      %ld in %.3f s (%.0f/s)\n", numSent, sendTime, numSent / sendTime);
+  printf("deliveries:         %ld of %ld in %.3f s (%.0f/s)\n", received, expected, runTime,
+	 received / runTime);
+  for (int t = 0; t < MIX_TYPES; t++) {
+    if (stats.sent[t] == 0) {
+      continue;
+    }
+    string label = string(MIX_NAMES[t]) + ":";
+    printf("%-20s%ld sent, %ld of %ld delivered\n", label.c_str(), stats.sent[t],
+	   stats.received[t], stats.expected[t]);
+    PrintLatency("", stats.latencies[t]);
+  }
+  PrintLatency("all deliveries:", everything);
+  if (serverPid > 0) {
+    printf("server rss:         %ld kB (was %ld kB)\n", after.rssKb, before.rssKb);
+    printf("server cpu:         %.3f s (%.2f us/delivery)\n", after.cpuSec - before.cpuSec,
+	   received > 0 ? (after.cpuSec - before.cpuSec) * 1e6 / received : 0.0);
+  }
+
+  return 0;
+}
+
+int LoginWave(const struct sockaddr_in& serverAddress, const vector<string>& names, vector<Conn>& conns,
+	      Conn& probe, string probeName, int serverPid, WaveStats& stats) {
+
+  // Locals
+  int numConns = conns.size();
+  int epollFd = epoll_create1(0);
+  vector<double> started(numConns);
+  int numPending = 0;
+  int numOk = 0;
+  double startTime = Now();
+  double nextSample = startTime;
+  double lastNotice = startTime;
+  stats.noticeFrames = stats.noticeBytes = stats.peakRssKb = 0;
+
+  // The probe's id is one past the last connection.
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u32 = numConns;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, probe.sock, &ev);
+  string ping = "/msg " + probeName + " ping";
+  double pingSent = Now();
+  SendFrame(probe.sock, ping);
+
+  for (int i = 0; i < numConns; i++) {
+    conns[i].sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    conns[i].state = CONN_LOGGING_IN;
+    conns[i].inBuf.clear();
+    started[i] = Now();
+    if (conns[i].sock < 0 ||
+	(connect(conns[i].sock, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0 &&
+	 errno != EINPROGRESS)) {
+      conns[i].state = CONN_CLOSED;
+      continue;
+    }
+    ev.events = EPOLLOUT;
+    ev.data.u32 = i;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].sock, &ev);
+    numPending++;
+  }
+
+  // Log in as each handshake completes; sessions that got in keep draining presence notices.
+  double deadline = Now() + 120;
+  struct epoll_event events[MAX_EVENTS];
+  while ((numPending > 0 || Now() - lastNotice < 0.5) && Now() < deadline) {
+    if (serverPid > 0 && Now() >= nextSample) {
+      ServerStats sample = {0, 0, 0};
+      ReadServerStats(serverPid, sample);
+      stats.peakRssKb = max(stats.peakRssKb, sample.rssKb);
+      nextSample = Now() + 0.1;
+    }
+    int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, 100);
+    for (int i = 0; i < numEvents; i++) {
+      int id = events[i].data.u32;
+      vector<string> frames;
+      if (id == numConns) {
+	ReadFrames(probe, frames);
+	for (size_t f = 0; f < frames.size(); f++) {
+	  if (frames[f].find(PM_REPLY) != string::npos) {
+	    stats.probeLatencies.push_back(Now() - pingSent);
+	    pingSent = Now();
+	    SendFrame(probe.sock, ping);
+	  }
+	}
+	continue;
+      }
+      Conn& conn = conns[id];
+      if (conn.state == CONN_CLOSED) {
+	continue;
+      }
+      bool isFailed = false;
+      if (conn.state == CONN_LOGGING_IN && (events[i].events & EPOLLOUT)) {
+	int sockErr = 0;
+	socklen_t errLen = sizeof(sockErr);
+	getsockopt(conn.sock, SOL_SOCKET, SO_ERROR, &sockErr, &errLen);
+	if (sockErr != 0 || !SendFrame(conn.sock, names[id]) || !SendFrame(conn.sock, STORM_PWD)) {
+	  isFailed = true;
+	} else {
+	  ev.events = EPOLLIN;
+	  ev.data.u32 = id;
+	  epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.sock, &ev);
+	}
+      } else {
+	bool isOpen = ReadFrames(conn, frames);
+	size_t first = 0;
+	if (conn.state == CONN_LOGGING_IN && !frames.empty()) {
+	  stats.latencies.push_back(Now() - started[id]);
+	  if (frames[0] == LOGIN_SUCCESS) {
+	    conn.state = CONN_READY;
+	    numPending--;
+	    numOk++;
+	    first = 1;
+	  } else {
+	    isFailed = true;
+	  }
+	}
+	for (size_t f = first; conn.state == CONN_READY && f < frames.size(); f++) {
+	  stats.noticeFrames++;
+	  stats.noticeBytes += FRAME_HEADER_SIZE + frames[f].length() + 1;
+	  lastNotice = Now();
+	}
+	if (!isOpen) {
+	  isFailed = true;
+	}
+      }
+      if (isFailed) {
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.sock, NULL);
+	close(conn.sock);
+	numPending -= conn.state == CONN_LOGGING_IN ? 1 : 0;
+	conn.state = CONN_CLOSED;
+      }
+    }
+  }
+  close(epollFd);
+  stats.drainTime = lastNotice - startTime;
+
+  return numOk;
+}
+
+int RunStorm(string hostName, unsigned short serverPort, int numUsers, int serverPid) {
+
+  // Locals
+  struct sockaddr_in serverAddress;
+  if (!ResolveHost(hostName, serverPort, serverAddress)) {
+    return -1;
+  }
+  vector<string> frames;
+  stringstream prefix;
+  prefix << "storm" << getpid() << "_";
+  vector<string> names(numUsers);
+  for (int i = 0; i < numUsers; i++) {
+    stringstream userName;
+    userName << prefix.str() << i;
+    names[i] = userName.str();
+  }
+  const char* waveNames[2] = { "new accounts:", "reconnect storm:" };
+
+  // An established session whose replies show whether the server keeps serving during the storm.
+  Conn probe;
+  string probeName = prefix.str() + "probe";
+  if (!LoginSession(hostName, serverPort, probeName, probe, frames)) {
+    cerr << "Unable to log in the probe." << endl;
+    return -1;
+  }
+
+  printf("storm users:        %d\n", numUsers);
+  for (int wave = 0; wave < 2; wave++) {
+    vector<Conn> conns(numUsers);
+    WaveStats stats;
+    ServerStats before = {0, 0, 0};
+    if (serverPid > 0) {
+      ReadServerStats(serverPid, before);
+    }
+    double startTime = Now();
+    int numOk = LoginWave(serverAddress, names, conns, probe, probeName, serverPid, stats);
+    double waveTime = Now() - startTime;
+    ServerStats after = before;
+    if (serverPid > 0) {
+      ReadServerStats(serverPid, after);
+    }
+
+    printf("%-20s%d of %d logged in, %.3f s (%.0f logins/s)\n", waveNames[wave], numOk, numUsers,
+	   waveTime, numOk / waveTime);
+    PrintLatency("login latency:", stats.latencies);
+    PrintLatency("probe reply:", stats.probeLatencies);
+    printf("notices received:   %ld frames, %.1f KB, last at %.3f s\n", stats.noticeFrames,
+	   stats.noticeBytes / 1024.0, stats.drainTime);
+    if (serverPid > 0) {
+      printf("server cpu:         %.3f s (%.3f ms/login)\n", after.cpuSec - before.cpuSec,
+	     numOk > 0 ? (after.cpuSec - before.cpuSec) * 1000 / numOk : 0.0);
+      printf("server memory:      %ld KB before, %ld KB peak\n", before.rssKb, stats.peakRssKb);
+    }
+
+    // Everyone drops at once; let the logouts land before they come back.
+    for (int i = 0; i < numUsers; i++) {
+      if (conns[i].state != CONN_CLOSED) {
+	close(conns[i].sock);
+      }
+    }
+    double settle = Now() + 1;
+    while (Now() < settle) {
+      WaitFrames(probe, frames, 100);
+    }
+    frames.clear();
+  }
+  close(probe.sock);
+
+  return 0;
+}
@@ -0,0 +1,146 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Per-thread counters and histograms, summed on demand and rendered in the
+// Prometheus text format.
+
+#include "msgMetrics.h"
+
+// Standard Library
+#include<sstream>
+#include<cstring>
+#include<algorithm>
+
+// GLOBALS
+MetricsRegistry Metrics = { PTHREAD_MUTEX_INITIALIZER, vector<ThreadMetrics*>(), ThreadMetrics() };
+__thread ThreadMetrics* MyMetrics = NULL;
+// Label values for CommandType, in enum order.
+const char* COMMAND_LABELS[METRIC_COMMANDS] = {
+  "unknown", "all", "msg", "users", "poke", "time", "joke", "picture", "presence",
+  "join", "leave", "channel", "history"
+};
+pthread_key_t MetricsKey;
+pthread_once_t MetricsOnce = PTHREAD_ONCE_INIT;
+
+void CreateMetricsKey() {
+  pthread_key_create(&MetricsKey, RetireThreadMetrics);
+}
+
+ThreadMetrics* NewThreadMetrics() {
+
+  ThreadMetrics* block = new ThreadMetrics;
+  memset(block, 0, sizeof(*block));
+  pthread_once(&MetricsOnce, CreateMetricsKey);
+  pthread_setspecific(MetricsKey, block);
+
+  pthread_mutex_lock(&Metrics.lock);
+  Metrics.live.push_back(block);
+  pthread_mutex_unlock(&Metrics.lock);
+  return block;
+}
+
+void RetireThreadMetrics(void* block_p) {
+
+  ThreadMetrics* block = (ThreadMetrics*) block_p;
+  pthread_mutex_lock(&Metrics.lock);
+  AddMetrics(Metrics.retired, *block);
+  Metrics.live.erase(find(Metrics.live.begin(), Metrics.live.end(), block));
+  pthread_mutex_unlock(&Metrics.lock);
+  delete block;
+}
+
+void AddMetrics(ThreadMetrics& total, const ThreadMetrics& block) {
+
+  for (int i = 0; i < METRIC_COUNTERS; i++) {
+    total.counters[i] += __atomic_load_n(&block.counters[i], __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < METRIC_COMMANDS; i++) {
+    total.enqueued[i] += __atomic_load_n(&block.enqueued[i], __ATOMIC_RELAXED);
+    total.delivered[i] += __atomic_load_n(&block.delivered[i], __ATOMIC_RELAXED);
+  }
+  for (int h = 0; h < HIST_COUNT; h++) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+      total.histograms[h].buckets[i] += __atomic_load_n(&block.histograms[h].buckets[i], __ATOMIC_RELAXED);
+    }
+    total.histograms[h].sum += __atomic_load_n(&block.histograms[h].sum, __ATOMIC_RELAXED);
+    total.histograms[h].count += __atomic_load_n(&block.histograms[h].count, __ATOMIC_RELAXED);
+  }
+}
+
+void SumMetrics(ThreadMetrics& total) {
+
+  memset(&total, 0, sizeof(total));
+  pthread_mutex_lock(&Metrics.lock);
+  AddMetrics(total, Metrics.retired);
+  for (size_t i = 0; i < Metrics.live.size(); i++) {
+    AddMetrics(total, *Metrics.live[i]);
+  }
+  pthread_mutex_unlock(&Metrics.lock);
+}
+
+string FormatMetrics() {
+
+  // Locals
+  ThreadMetrics total;
+  stringstream ss;
+  SumMetrics(total);
+
+  ss << "# HELP msgserver_sessions Users logged in right now." << endl
+     << "# TYPE msgserver_sessions gauge" << endl
+     << "msgserver_sessions " << total.counters[METRIC_LOGINS] - total.counters[METRIC_LOGOUTS] << endl;
+  ss << "# HELP msgserver_logins_total Successful logins." << endl
+     << "# TYPE msgserver_logins_total counter" << endl
+     << "msgserver_logins_total " << total.counters[METRIC_LOGINS] << endl;
+
+  ss << "# HELP msgserver_messages_enqueued_total Messages added to a mailbox, per recipient." << endl
+     << "# TYPE msgserver_messages_enqueued_total counter" << endl;
+  for (int i = CMD_ALL; i < METRIC_COMMANDS; i++) {
+    ss << "msgserver_messages_enqueued_total{command=\"" << COMMAND_LABELS[i] << "\"} "
+       << total.enqueued[i] << endl;
+  }
+  ss << "# HELP msgserver_messages_delivered_total Messages taken from a mailbox and formatted for sending." << endl
+     << "# TYPE msgserver_messages_delivered_total counter" << endl;
+  for (int i = CMD_ALL; i < METRIC_COMMANDS; i++) {
+    ss << "msgserver_messages_delivered_total{command=\"" << COMMAND_LABELS[i] << "\"} "
+       << total.delivered[i] << endl;
+  }
+
+  ss << "# HELP msgserver_received_bytes_total Bytes read from client sockets." << endl
+     << "# TYPE msgserver_received_bytes_total counter" << endl
+     << "msgserver_received_bytes_total " << total.counters[METRIC_BYTES_IN] << endl;
+  ss << "# HELP msgserver_sent_bytes_total Bytes written to client sockets." << endl
+     << "# TYPE msgserver_sent_bytes_total counter" << endl
+     << "msgserver_sent_bytes_total " << total.counters[METRIC_BYTES_OUT] << endl;
+
+  ss << "# HELP msgserver_lock_contended_total Lock acquisitions that had to wait." << endl
+     << "# TYPE msgserver_lock_contended_total counter" << endl
+     << "msgserver_lock_contended_total{lock=\"shard\"} " << total.counters[METRIC_SHARD_WAITS] << endl
+     << "msgserver_lock_contended_total{lock=\"mailbox\"} " << total.counters[METRIC_MAILBOX_WAITS] << endl;
+  ss << "# HELP msgserver_lock_wait_seconds_total Time spent waiting for locks." << endl
+     << "# TYPE msgserver_lock_wait_seconds_total counter" << endl
+     << "msgserver_lock_wait_seconds_total{lock=\"shard\"} " << total.counters[METRIC_SHARD_WAIT_NS] / 1e9 << endl
+     << "msgserver_lock_wait_seconds_total{lock=\"mailbox\"} " << total.counters[METRIC_MAILBOX_WAIT_NS] / 1e9 << endl;
+
+  const char* names[HIST_COUNT] = { "msgserver_delivery_latency_seconds", "msgserver_mailbox_depth" };
+  const char* helps[HIST_COUNT] = { "Time from enqueue until the frame carrying the message has been written to the client's socket.",
+				    "Messages waiting each time a mailbox is drained." };
+  double scales[HIST_COUNT] = { 1e9, 1 };
+  for (int h = 0; h < HIST_COUNT; h++) {
+    Histogram& histogram = total.histograms[h];
+    ss << "# HELP " << names[h] << " " << helps[h] << endl
+       << "# TYPE " << names[h] << " histogram" << endl;
+    long cumulative = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+      cumulative += histogram.buckets[i];
+      ss << names[h] << "_bucket{le=\"" << (HISTOGRAM_BASE[h] << i) / scales[h] << "\"} " << cumulative << endl;
+    }
+    // Count from the buckets so +Inf and _count agree even if a thread was mid-update.
+    cumulative += histogram.buckets[HISTOGRAM_BUCKETS - 1];
+    ss << names[h] << "_bucket{le=\"+Inf\"} " << cumulative << endl
+       << names[h] << "_sum " << histogram.sum / scales[h] << endl
+       << names[h] << "_count " << cumulative << endl;
+  }
+
+  return ss.str();
+}
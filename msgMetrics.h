@@ -0,0 +1,164 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Per-thread counters and histograms, summed on demand and rendered in the
+// Prometheus text format.
+
+#ifndef MSGMETRICS_H
+#define MSGMETRICS_H
+
+// Standard Library
+#include<string>
+#include<vector>
+#include<time.h>
+
+// Multithreading
+#include<pthread.h>
+
+// User Directory
+#include "msgUsers.h"
+
+using namespace std;
+
+// DATA TYPES
+enum MetricId {
+  METRIC_LOGINS,
+  METRIC_LOGOUTS,
+  METRIC_BYTES_IN,
+  METRIC_BYTES_OUT,
+  METRIC_SHARD_WAITS,
+  METRIC_SHARD_WAIT_NS,
+  METRIC_MAILBOX_WAITS,
+  METRIC_MAILBOX_WAIT_NS,
+  METRIC_COUNTERS
+};
+
+enum HistogramId {
+  HIST_DELIVERY_NS,      // enqueue until the socket has taken the frame, every message
+  HIST_MAILBOX_DEPTH,    // messages GetMsgs found waiting
+  HIST_COUNT
+};
+
+const int METRIC_COMMANDS = CMD_HISTORY + 1;
+// Bucket i holds values up to HISTOGRAM_BASE << i; the last one has no upper bound.
+const int HISTOGRAM_BUCKETS = 25;
+
+struct Histogram {
+  long buckets[HISTOGRAM_BUCKETS];
+  long sum;
+  long count;
+};
+
+// Written only by the thread that owns it, so updates need no lock or atomic read-modify-write.
+struct ThreadMetrics {
+  long counters[METRIC_COUNTERS];
+  long enqueued[METRIC_COMMANDS];
+  long delivered[METRIC_COMMANDS];
+  Histogram histograms[HIST_COUNT];
+};
+
+struct MetricsRegistry {
+  pthread_mutex_t lock;
+  vector<ThreadMetrics*> live;
+  // What threads that have exited left behind.
+  ThreadMetrics retired;
+};
+
+// GLOBALS
+const long HISTOGRAM_BASE[HIST_COUNT] = { 1000, 1 };
+extern MetricsRegistry Metrics;
+extern __thread ThreadMetrics* MyMetrics;
+
+// Function Prototypes
+void CreateMetricsKey();
+// Function creates the thread-specific key whose destructor retires a thread's block.
+// pre: none
+// post: none
+
+ThreadMetrics* NewThreadMetrics();
+// Function registers the calling thread's metrics block.
+// pre: none
+// post: the block is folded into Metrics.retired when the thread exits.
+
+void RetireThreadMetrics(void* block_p);
+// Function folds an exiting thread's block into Metrics.retired.
+// pre: none
+// post: block_p is freed.
+
+void AddMetrics(ThreadMetrics& total, const ThreadMetrics& block);
+// Function adds one block's counts into total.
+// pre: none
+// post: none
+
+void SumMetrics(ThreadMetrics& total);
+// Function adds up every live thread and the retired ones.
+// pre: none
+// post: counts read while a thread is updating them may be one behind.
+
+string FormatMetrics();
+// Function renders SumMetrics in the Prometheus text format.
+// pre: none
+// post: none
+
+inline ThreadMetrics& LocalMetrics();
+// Function finds the calling thread's metrics block.
+// pre: none
+// post: the block is created on first use.
+
+inline void Bump(long& slot, long n);
+// Function adds n to a slot of the calling thread's own block.
+// pre: slot should belong to LocalMetrics().
+// post: none
+
+inline void CountMetric(MetricId id, long n);
+// Function adds n to one of the calling thread's counters.
+// pre: none
+// post: none
+
+inline long MetricsClock();
+// Function returns a monotonic timestamp in nanoseconds.
+// pre: none
+// post: none
+
+inline void ObserveMetric(HistogramId id, long value);
+// Function records value in one of the calling thread's histograms.
+// pre: value should be in nanoseconds for HIST_DELIVERY_NS.
+// post: none
+
+// Inline Functions
+inline ThreadMetrics& LocalMetrics() {
+  if (MyMetrics == NULL) {
+    MyMetrics = NewThreadMetrics();
+  }
+  return *MyMetrics;
+}
+
+inline void Bump(long& slot, long n) {
+  // Only this thread writes slot; the relaxed store keeps readers from seeing a torn value.
+  __atomic_store_n(&slot, slot + n, __ATOMIC_RELAXED);
+}
+
+inline void CountMetric(MetricId id, long n) {
+  Bump(LocalMetrics().counters[id], n);
+}
+
+inline long MetricsClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+inline void ObserveMetric(HistogramId id, long value) {
+  Histogram& histogram = LocalMetrics().histograms[id];
+  unsigned long units = value > 0 ? (value + HISTOGRAM_BASE[id] - 1) / HISTOGRAM_BASE[id] : 0;
+  int bucket = units <= 1 ? 0 : 64 - __builtin_clzl(units - 1);
+  if (bucket >= HISTOGRAM_BUCKETS) {
+    bucket = HISTOGRAM_BUCKETS - 1;
+  }
+  Bump(histogram.buckets[bucket], 1);
+  Bump(histogram.sum, value);
+  Bump(histogram.count, 1);
+}
+
+#endif
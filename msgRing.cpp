@@ -0,0 +1,261 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: A minimal io_uring submission/completion ring with a provided buffer ring,
+// driven through the raw system calls.
+
+#include "msgRing.h"
+
+// Standard Library
+#include<cstring>
+#include<cstdlib>
+#include<algorithm>
+
+// System Calls
+#include<sys/syscall.h>
+#include<sys/mman.h>
+#include<unistd.h>
+#include<errno.h>
+
+bool SetupRing(Ring& ring, unsigned entries, unsigned cqEntries) {
+
+  // Locals
+  struct io_uring_params params;
+  memset(&ring, 0, sizeof(ring));
+  ring.fd = -1;
+
+  // Only the owning worker submits; let completions run when it asks for them.
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  params.cq_entries = cqEntries;
+  ring.fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring.fd < 0 && errno == EINVAL) {
+    // Older than 6.1.
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cqEntries;
+    ring.fd = syscall(__NR_io_uring_setup, entries, &params);
+  }
+  if (ring.fd < 0) {
+    return false;
+  }
+
+  // Map the queues.
+  ring.sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring.sqMapSize = ring.cqMapSize = max(ring.sqMapSize, ring.cqMapSize);
+  }
+  ring.sqMap = mmap(NULL, ring.sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring.fd, IORING_OFF_SQ_RING);
+  if (ring.sqMap == MAP_FAILED) {
+    ring.sqMap = NULL;
+    TeardownRing(ring);
+    return false;
+  }
+  ring.cqMap = ring.sqMap;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    ring.cqMap = mmap(NULL, ring.cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		      ring.fd, IORING_OFF_CQ_RING);
+    if (ring.cqMap == MAP_FAILED) {
+      ring.cqMap = NULL;
+      TeardownRing(ring);
+      return false;
+    }
+  }
+  ring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring.sqes = (struct io_uring_sqe*) mmap(NULL, ring.sqesSize, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED) {
+    ring.sqes = NULL;
+    TeardownRing(ring);
+    return false;
+  }
+
+  char* sq = (char*) ring.sqMap;
+  ring.sqHead = (unsigned*) (sq + params.sq_off.head);
+  ring.sqTail = (unsigned*) (sq + params.sq_off.tail);
+  ring.sqArray = (unsigned*) (sq + params.sq_off.array);
+  ring.sqMask = *(unsigned*) (sq + params.sq_off.ring_mask);
+  ring.sqEntries = params.sq_entries;
+  char* cq = (char*) ring.cqMap;
+  ring.cqHead = (unsigned*) (cq + params.cq_off.head);
+  ring.cqTail = (unsigned*) (cq + params.cq_off.tail);
+  ring.cqMask = *(unsigned*) (cq + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+  return true;
+}
+
+bool SetupBufferRing(Ring& ring, unsigned numBuffers, size_t bufSize) {
+
+  size_t ringSize = numBuffers * sizeof(struct io_uring_buf);
+  void* mem = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return false;
+  }
+  ring.bufRing = (struct io_uring_buf_ring*) mem;
+  ring.bufEntries = numBuffers;
+  ring.bufSize = bufSize;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) ring.bufRing;
+  reg.ring_entries = numBuffers;
+  reg.bgid = RING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    munmap(ring.bufRing, ringSize);
+    ring.bufRing = NULL;
+    return false;
+  }
+
+  ring.bufBase = new char[numBuffers * bufSize];
+  ring.bufRing -> tail = 0;
+  for (unsigned i = 0; i < numBuffers; i++) {
+    RecycleBuffer(ring, i);
+  }
+  return true;
+}
+
+void TeardownRing(Ring& ring) {
+
+  if (ring.bufRing != NULL) {
+    munmap(ring.bufRing, ring.bufEntries * sizeof(struct io_uring_buf));
+    delete [] ring.bufBase;
+  }
+  if (ring.sqes != NULL) {
+    munmap(ring.sqes, ring.sqesSize);
+  }
+  if (ring.cqMap != NULL && ring.cqMap != ring.sqMap) {
+    munmap(ring.cqMap, ring.cqMapSize);
+  }
+  if (ring.sqMap != NULL) {
+    munmap(ring.sqMap, ring.sqMapSize);
+  }
+  if (ring.fd >= 0) {
+    close(ring.fd);
+  }
+  free(ring.stash);
+  memset(&ring, 0, sizeof(ring));
+  ring.fd = -1;
+}
+
+bool ProbeRing() {
+
+  Ring ring;
+  bool isSupported = SetupRing(ring, 8, 16) && SetupBufferRing(ring, 8, RING_BUFFER_SIZE);
+  TeardownRing(ring);
+  return isSupported;
+}
+
+struct io_uring_sqe* GetSqe(Ring& ring) {
+
+  unsigned tail = *ring.sqTail;
+  // Full: hand what we have to the kernel first. The slot at tail is only reused once it took them.
+  while (ring.error == 0 && tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) >= ring.sqEntries) {
+    int status = SubmitAndWait(ring, 0);
+    if (status > 0) {
+      continue;
+    }
+    if (status < 0 && errno != EBUSY && errno != EAGAIN) {
+      ring.error = errno;
+      break;
+    }
+    // The completion queue has no room; the kernel takes nothing until some are reaped.
+    StashCompletions(ring);
+  }
+  if (ring.error != 0) {
+    memset(&ring.spare, 0, sizeof(ring.spare));
+    return &ring.spare;
+  }
+  struct io_uring_sqe* sqe = &ring.sqes[tail & ring.sqMask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring.sqArray[tail & ring.sqMask] = tail & ring.sqMask;
+  __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring.toSubmit++;
+  return sqe;
+}
+
+void StashCompletions(Ring& ring) {
+
+  unsigned head = *ring.cqHead;
+  unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+  unsigned needed = ring.stashCount + (tail - head);
+  if (needed > ring.stashSize) {
+    unsigned size = max(needed, ring.stashSize * 2);
+    struct io_uring_cqe* grown = (struct io_uring_cqe*) realloc(ring.stash, size * sizeof(struct io_uring_cqe));
+    if (grown == NULL) {
+      ring.error = ENOMEM;
+      return;
+    }
+    ring.stash = grown;
+    ring.stashSize = size;
+  }
+  // Compact first, so what is left of the stash stays in order ahead of the new ones.
+  memmove(ring.stash, ring.stash + ring.stashHead, ring.stashCount * sizeof(struct io_uring_cqe));
+  ring.stashHead = 0;
+  for ( ; head != tail; head++) {
+    ring.stash[ring.stashCount++] = ring.cqes[head & ring.cqMask];
+  }
+  __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+}
+
+int SubmitAndWait(Ring& ring, unsigned waitNr) {
+
+  if (ring.error != 0) {
+    errno = ring.error;
+    return -1;
+  }
+  if (ring.stashCount > 0) {
+    // Stashed completions are ready to be handled already.
+    waitNr = 0;
+  }
+  unsigned flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int status;
+  do {
+    status = syscall(__NR_io_uring_enter, ring.fd, ring.toSubmit, waitNr, flags, NULL, 0);
+  } while (status < 0 && errno == EINTR);
+  if (status >= 0) {
+    ring.toSubmit -= min((unsigned) status, ring.toSubmit);
+  }
+  return status;
+}
+
+struct io_uring_cqe* PeekCqe(Ring& ring) {
+
+  if (ring.stashCount > 0) {
+    return &ring.stash[ring.stashHead];
+  }
+  unsigned head = *ring.cqHead;
+  if (head == __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring.cqes[head & ring.cqMask];
+}
+
+void AdvanceCq(Ring& ring) {
+
+  if (ring.stashCount > 0) {
+    ring.stashHead++;
+    ring.stashCount--;
+    return;
+  }
+  __atomic_store_n(ring.cqHead, *ring.cqHead + 1, __ATOMIC_RELEASE);
+}
+
+char* RingBuffer(Ring& ring, uint16_t bid) {
+
+  return ring.bufBase + (size_t) bid * ring.bufSize;
+}
+
+void RecycleBuffer(Ring& ring, uint16_t bid) {
+
+  unsigned short tail = ring.bufRing -> tail;
+  // Index from the ring base: in C++ the header's flexible bufs[] lands 8 bytes late.
+  struct io_uring_buf* buf = (struct io_uring_buf*) ring.bufRing + (tail & (ring.bufEntries - 1));
+  buf -> addr = (uint64_t) (uintptr_t) RingBuffer(ring, bid);
+  buf -> len = ring.bufSize;
+  buf -> bid = bid;
+  __atomic_store_n(&ring.bufRing -> tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,122 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: A minimal io_uring submission/completion ring with a provided buffer ring,
+// driven through the raw system calls.
+
+#ifndef MSGRING_H
+#define MSGRING_H
+
+// Standard Library
+#include<cstddef>
+#include<stdint.h>
+
+// Kernel Interface
+#include<linux/io_uring.h>
+
+using namespace std;
+
+// DATA TYPES
+struct Ring {
+  int fd;
+  // Submission queue
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqArray;
+  unsigned sqMask;
+  unsigned sqEntries;
+  struct io_uring_sqe* sqes;
+  unsigned toSubmit;
+  // Completion queue
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe* cqes;
+  // Completions moved off the queue so a full submission queue could be handed over; these are
+  // older than the ones still on the queue and are consumed first.
+  struct io_uring_cqe* stash;
+  unsigned stashHead;
+  unsigned stashCount;
+  unsigned stashSize;
+  // Set once io_uring_enter fails for good; every later submit reports it, and GetSqe hands out spare.
+  int error;
+  struct io_uring_sqe spare;
+  // Provided receive buffers, handed out by the kernel per completion.
+  struct io_uring_buf_ring* bufRing;
+  char* bufBase;
+  unsigned bufEntries;
+  size_t bufSize;
+  // Mappings, kept for TeardownRing.
+  void* sqMap;
+  size_t sqMapSize;
+  void* cqMap;
+  size_t cqMapSize;
+  size_t sqesSize;
+};
+
+// GLOBALS
+const unsigned RING_ENTRIES = 256;
+const unsigned RING_CQ_ENTRIES = 4096;
+const unsigned RING_BUFFERS = 128;
+const size_t RING_BUFFER_SIZE = 4096;
+const uint16_t RING_BUFFER_GROUP = 0;
+
+// Function Prototypes
+bool SetupRing(Ring& ring, unsigned entries, unsigned cqEntries);
+// Function creates an io_uring and maps its queues.
+// pre: should be called on the thread that will submit to the ring.
+// post: returns false if the kernel refused.
+
+bool SetupBufferRing(Ring& ring, unsigned numBuffers, size_t bufSize);
+// Function registers numBuffers receive buffers as RING_BUFFER_GROUP.
+// pre: SetupRing should have succeeded. numBuffers must be a power of 2.
+// post: returns false on kernels without provided buffer rings (before 5.19).
+
+void TeardownRing(Ring& ring);
+// Function unmaps and closes a ring.
+// pre: none
+// post: none
+
+bool ProbeRing();
+// Function checks that this kernel and sandbox allow io_uring with provided buffer rings.
+// pre: none
+// post: none
+
+struct io_uring_sqe* GetSqe(Ring& ring);
+// Function hands out a zeroed submission entry, submitting queued ones first if the queue is full.
+// pre: none
+// post: the entry is submitted by the next SubmitAndWait. If the kernel refuses the queue for good,
+//       the entry is a spare that goes nowhere and SubmitAndWait reports the error.
+
+void StashCompletions(Ring& ring);
+// Function moves every completion on the queue to ring.stash, so the kernel has room to post more.
+// pre: none
+// post: PeekCqe returns them, oldest first, before anything newer.
+
+int SubmitAndWait(Ring& ring, unsigned waitNr);
+// Function submits queued entries and waits for at least waitNr completions.
+// pre: none
+// post: returns the io_uring_enter result, or -1 with the lasting error once GetSqe has given up.
+
+struct io_uring_cqe* PeekCqe(Ring& ring);
+// Function returns the oldest unconsumed completion, or NULL.
+// pre: none
+// post: none
+
+void AdvanceCq(Ring& ring);
+// Function marks the completion from PeekCqe as consumed.
+// pre: PeekCqe should have returned an entry.
+// post: the entry may be overwritten by the kernel.
+
+char* RingBuffer(Ring& ring, uint16_t bid);
+// Function finds the provided buffer the kernel filled for a completion.
+// pre: none
+// post: none
+
+void RecycleBuffer(Ring& ring, uint16_t bid);
+// Function hands a provided buffer back to the kernel.
+// pre: its contents should already have been copied out.
+// post: none
+
+#endif
@@ -7,24 +7,52 @@
 // Standard Library
 #include<iostream>
 #include<sstream>
+#include<fstream>
 #include<string>
 #include<ctime>
 #include<cstdlib>
+#include<cstring>
 #include<tr1/unordered_map>
 #include<deque>
+#include<vector>
+#include<algorithm>
+#include<set>
 
 // Network Functions
 #include<sys/types.h>
 #include<sys/socket.h>
-#include<sys/select.h>
 #include<sys/time.h>
 #include<netinet/in.h>
 #include<arpa/inet.h>
 #include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<signal.h>
+
+// Event Notification
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<poll.h>
+#include<stdint.h>
 
 // Multithreading
 #include<pthread.h>
 
+// User Directory
+#include "msgUsers.h"
+#include "msgCommands.h"
+#include "msgFrames.h"
+#include "msgRing.h"
+#include "msgStore.h"
+#include "msgMetrics.h"
+#include "msgAuth.h"
+#include "msgHistory.h"
+#include "msgCluster.h"
+#include "msgAccounts.h"
+
+// Hot Upgrades
+#include "msgUpgrade.h"
+
 using namespace std;
 
 // DATA TYPES
@@ -32,29 +60,102 @@ struct threadArgs {
   int clientSock;
 };
 
-struct User {
-  string username;
-  string password;
-  time_t timeConnected;
-  bool isConnected;
+// Tags what an epoll event or an io_uring completion belongs to.
+enum WatchType {
+  WATCH_HANDOFF,
+  WATCH_LISTEN,
+  WATCH_SOCKET,
+  WATCH_MAILBOX,
+  WATCH_ACCEPT,
+  WATCH_SEND,
+  WATCH_CANCEL
+};
+
+struct Session;
+struct Worker;
+
+struct Watch {
+  WatchType type;
+  Session* session;
+};
+
+enum SessionState {
+  SESSION_LOGIN_USER,
+  SESSION_LOGIN_PWD,
+  // The auth pool is checking the password; frames wait in the receive buffer.
+  SESSION_LOGIN_WAIT,
+  SESSION_CHAT
 };
 
-struct Msg {
-  string to;
-  string from;
-  string msg;
-  string cmd;
+struct Session {
+  int sock;
+  Worker* worker;
+  SessionState state;
+  string userName;
+  AuthRequest auth;
+  Mailbox* mailbox;
+  int wakeFd;
+  Watch sockWatch;
+  Watch mailWatch;
+  bool isClosed;
+  InBuffer in;
+  OutBuffer out;
+  // io_uring mode only: the session is freed once no operation refers to it.
+  int pendingOps;
+  bool sendBusy;
+  Watch sendWatch;
+  vector<struct iovec> sendIov;
+  struct msghdr sendHdr;
+  size_t sendWanted;
+  // Received while frames were held back and the buffer had no room; the receive is parked meanwhile.
+  string held;
+  bool isRecvArmed;
+  bool isRecvParked;
+  // epoll mode only: on the worker's readySessions list.
+  bool isReadQueued;
 };
 
+struct Worker {
+  int id;
+  pthread_t tid;
+  int epollFd;
+  int wakeFd;
+  Watch wakeWatch;
+  Watch listenWatch;
+  int cpu;
+  long accepted;
+  pthread_mutex_t pendingLock;
+  deque<int> pendingSocks;
+  // Sessions whose password check has finished, also under pendingLock.
+  deque<Session*> verifiedSessions;
+  // Sessions taken over from the previous process, also under pendingLock.
+  deque<Session*> adoptedSessions;
+  tr1::unordered_map<int, Session*> sessions;
+  vector<Session*> closedSessions;
+  // Sessions that used up their read budget with input left on the socket.
+  vector<Session*> readySessions;
+  // Set when the loop accepts for itself (-r, or io_uring mode).
+  int listenSock;
+  // io_uring mode only.
+  bool useRing;
+  Ring ring;
+  Watch acceptWatch;
+  Watch cancelWatch;
+  bool acceptMultishot;
+  bool recvMultishot;
+};
 
 // GLOBALS
-const int MAXPENDING = 20;
-tr1::unordered_map<string, User> UsersList;
-deque<Msg> MsgQueue;
-pthread_mutex_t MsgQueueLock;
-pthread_mutex_t UserListLock;
-int MsgStatus = pthread_mutex_init(&MsgQueueLock, NULL);
-int UserStatus = pthread_mutex_init(&UserListLock, NULL);
+const int DEFAULT_BACKLOG = SOMAXCONN;
+const int DEFAULT_WORKERS = 4;
+const int MAX_EVENTS = 64;
+const int RING_SEND_FRAMES = 16;
+// Bytes one session may read per wakeup before the others get a turn.
+const int READ_BUDGET = 16 * RING_BUFFER_SIZE;
+// Clients take anything but success as a failed login.
+const char* const LOGIN_BUSY_MSG = "Login Failed! Server busy, try again later.\n";
+vector<Worker*> Workers;
+unsigned int NextWorker = 0;
 
 // Function Prototypes
 void* clientThread(void* args_p);
@@ -67,150 +168,576 @@ void InstantMessage(int clientSock);
 // pre: none
 // post: none
 
-bool SendMessage(int HostSock, string msg);
-// Function sends message to Host socket.
-// pre: HostSock should exist.
-// post: none
+bool GetFrame(int HostSock, InBuffer& in, string& msg);
+// Function waits until a whole frame has arrived on Host socket and copies out its body.
+// pre: HostSock should be a blocking socket.
+// post: returns false if the socket failed or the frame was over MaxFrameSize.
 
-string GetMessage(int HostSock, int messageLength);
-// Function retrieves message from Host socket.
-// pre: HostSock should exist.
-// post: none
+bool hasAuthenticated(int clientSock, InBuffer& in, string &userName, bool &isOpen);
+// Function handles authentication of users.
+// pre: none
+// post: isOpen is false if the client went away.
 
-bool SendInteger(int HostSock, int hostInt);
-// Function sends a network long variable over the network.
-// pre: HostSock must exist
+void* statsThread(void* args_p);
+// Function prints the frame counters every time the server receives SIGUSR1.
+// pre: SIGUSR1 should be blocked in every thread.
 // post: none
 
-long GetInteger(int HostSocks);
-// Function listens to socket for a network Long variable.
-// pre: HostSock must exist.
+void* adminThread(void* args_p);
+// Function answers every connection on the admin socket with the metrics in the Prometheus text format.
+// pre: args_p should point to a listening socket; SIGUSR1 should be blocked.
 // post: none
 
-void addToMsgQueue(Msg newMsg);
-// Function Handles adding messages to the MsgQueue.
+string ServerMetrics();
+// Function renders the per-thread metrics and the process-wide frame, queue and store counters.
 // pre: none
 // post: none
 
-void processMsg(string &msg, string &cmdName, string &userTo);
-// Function strips a msg value for data relating to commands and to users.
-// pre: cmdName and userTo should be "" by default.
-// post: msg will be reduced in size.
+int OpenAdminListener(unsigned short adminPort);
+// Function listens on 127.0.0.1:adminPort.
+// pre: none
+// post: returns -1 on failure.
+
+int OpenListener(unsigned short serverPort, int backlog, bool reusePort);
+// Function creates a listening socket on serverPort, sharing the port with SO_REUSEPORT if asked.
+// pre: none
+// post: returns -1 on failure.
+
+bool StartWorkers(int numWorkers, const vector<int>& listenSocks, bool useRing, bool pinCpus);
+// Function creates the event loop threads used by the epoll and io_uring server modes.
+// pre: useRing requires ProbeRing() to have succeeded.
+// post: Workers holds numWorkers running event loops. With one listening socket per loop each
+//       accepts its own connections; io_uring loops always accept for themselves.
+
+void AssignToWorker(int clientSock);
+// Function hands an accepted socket to the next event loop.
+// pre: StartWorkers should have been called.
+// post: clientSock is owned by a worker.
 
-void SaveMsg(string msg, string userFrom);
-// Function takes data from Thread and processes the message and then finally adds to a queue.
+void* workerThread(void* args_p);
+// Function serves as the entry point to an event loop thread.
 // pre: none
 // post: none
 
-string GetMsgs(string username);
-// Function looks through the MsgQueue and compiles a list of messages to send.
+void EventLoop(Worker* worker);
+// Function waits on a worker's sockets and services them as they become ready.
+// pre: worker should be initialized.
+// post: none
+
+void AcceptPending(Worker* worker);
+// Function registers sockets handed over by AssignToWorker and finishes logins the auth pool has checked.
 // pre: none
-// post: MsgQueue will have items removed.
+// post: pendingSocks, verifiedSessions and adoptedSessions will be empty. While a successor waits,
+//       a loop with no login left on the auth pool parks here.
 
-void setUserDisconnected (string username);
-// Function changes user status to disconnected.
+void ResumeLogins(Worker* worker);
+// Function processes the passwords held back while a hand-over that was abandoned was pending.
 // pre: none
 // post: none
 
-void setUserConnected (User newUser);
-// Function changes user status to connected.
+void AcceptConnections(Worker* worker);
+// Function accepts everything waiting on a loop's own listening socket.
+// pre: worker -> listenSock should be non-blocking.
+// post: none
+
+void AddSession(Worker* worker, int clientSock);
+// Function makes an event loop serve a new connection.
 // pre: none
-// post: user's timeConnected value is updated.
+// post: clientSock is non-blocking and watched by the loop.
 
-bool isUserConnected (User newUser);
-// Function returns a user's connected status.
+Session* NewSession(Worker* worker, int clientSock);
+// Function creates the state for a freshly accepted connection.
 // pre: none
-// post: none
+// post: the session waits for a username.
+
+void LoginVerified(AuthRequest* request);
+// Function hands a checked login back to the event loop that owns the session.
+// pre: called on an auth pool thread; request should belong to a session.
+// post: the loop's wakeFd is signalled.
 
-bool doesUserExist (string username);
-// Function tests the existence of a user in the UserList.
+void CompleteLogin(Worker* worker, Session* session);
+// Function finishes a login once the auth pool is done with it and resumes the session.
+// pre: session -> state should be SESSION_LOGIN_WAIT.
+// post: a session closed while waiting is logged back out and freed.
+
+bool ProcessFrames(Worker* worker, Session* session);
+// Function processes every whole frame in a session's receive buffer.
 // pre: none
-// post: none
+// post: returns false if the session should be closed.
 
-void addToUsersList (User newUser);
-// Function adds a user to the UserList.
+bool IsHoldingFrames(Session* session);
+// Function tells whether a session's frames wait for a login to be decided or a successor to take over.
 // pre: none
 // post: none
 
-bool loginUser (string username, string password);
-// Function checks login credentials against the UserList.
+bool ReadSession(Worker* worker, Session* session);
+// Function reads everything available on a session and processes whole frames.
+// pre: session socket should be non-blocking.
+// post: returns false if the session should be closed. Stops reading while frames are held back,
+//       so whoever releases them must call it again: the socket will not signal data already there.
+//       Stops after READ_BUDGET bytes too, queueing the session on worker -> readySessions.
+
+void ReadReadySessions(Worker* worker);
+// Function gives every session that used up its read budget another turn.
 // pre: none
-// post: none
+// post: sessions still not drained are queued again for the next turn.
 
-bool hasAuthenticated(int clientSock, string &userName);
-// Function handles authentication of users.
+bool ProcessFrame(Worker* worker, Session* session, MsgView frame);
+// Function advances a session through login and chat with one received frame.
 // pre: none
-// post: none
+// post: returns false if the session should be closed.
+
+bool FlushSession(Session* session);
+// Function writes as much of a session's output buffer as the socket accepts.
+// pre: session socket should be non-blocking.
+// post: returns false if the socket failed.
+
+bool WatchMailbox(Worker* worker, Session* session);
+// Function makes the worker wake up when mail arrives for a newly logged in session.
+// pre: session -> wakeFd should exist.
+// post: returns false if the worker could not watch it.
 
-void broadcastMsg(string userName, string msg, bool isConnected);
-// Function allows system to create a broadcast message to all other users.
+bool DeliverPending(Session* session);
+// Function moves queued messages for a session into its output buffer once the previous batch is out.
 // pre: none
+// post: returns false if the mailbox overflowed under OVERFLOW_DISCONNECT.
+//       While output is still queued, new messages wait in the bounded mailbox.
+
+void ServeUpgrade(int upgradeSock, const vector<int>& listenSocks);
+// Function hands the listening sockets, every session and the directory to a successor that connected.
+// pre: the event loops should be epoll loops.
+// post: exits the process once the successor has taken over; otherwise the loops carry on.
+
+void WaitForClient(int listenSock, int upgradeSock, const vector<int>& listenSocks);
+// Function waits until listenSock has a connection, serving any successor that connects meanwhile.
+// pre: listenSock may be -1 when the event loops accept for themselves.
+// post: never returns for -1.
+
+void PutSession(string& state, vector<int>& fds, int sock, SessionState sessionState, const string& userName,
+		const InBuffer& in, const OutBuffer& out);
+// Function appends one connection's socket, login state and unsent bytes to a hand-over.
+// pre: the loop that owns it should be parked.
+// post: sock is added to fds.
+
+bool AdoptSessions(const string& state, size_t& pos, const vector<int>& fds);
+// Function spreads the sessions of a previous process over the event loops.
+// pre: StartWorkers should have been called and the directory restored.
+// post: returns false if the state is cut short.
+
+void AdoptSession(Worker* worker, Session* session);
+// Function makes an event loop serve a session taken over from the previous process.
+// pre: session should hold the socket, state and buffers PutSession wrote.
+// post: chat sessions get their mailbox back; nothing is announced to other users.
+
+void CloseSession(Worker* worker, Session* session);
+// Function closes a session's socket and announces the user left.
+// pre: none
+// post: session is freed once the current batch of events is done
+//       (io_uring: once its last operation has completed).
+
+void RingLoop(Worker* worker);
+// Function submits a worker's io_uring operations and handles their completions.
+// pre: worker -> ring should be set up on this thread.
 // post: none
 
-string GrabUsers(string userName);
-// Function returns a list of connected users.
+void HandleCompletion(Worker* worker, Watch* watch, int res, unsigned flags);
+// Function advances whatever an io_uring completion belongs to.
+// pre: none
+// post: finished multishot operations are re-armed while their session stays open.
+
+void ArmHandoff(Worker* worker);
+// Function queues a multishot poll on the loop's wake descriptor.
 // pre: none
 // post: none
 
-string GrabTime(string userName);
-// Function returns a duration of a user.
+void ArmAccept(Worker* worker);
+// Function queues an accept, multishot where the kernel allows it, on the loop's listening socket.
 // pre: none
 // post: none
 
-string GrabJoke();
-// Function returns a joke.
+void ArmRecv(Worker* worker, Session* session);
+// Function queues a receive into the worker's provided buffers.
+// pre: none
+// post: session -> pendingOps is incremented.
+
+void ArmMailbox(Worker* worker, Session* session);
+// Function queues a multishot poll on a session's mailbox wakeup descriptor.
+// pre: none
+// post: session -> pendingOps is incremented.
+
+void StartSend(Worker* worker, Session* session);
+// Function queues one sendmsg for a session's output buffer unless one is already in flight.
 // pre: none
 // post: none
 
-string GrabPic();
-// Function returns a picture
+bool ReceiveBytes(Worker* worker, Session* session, const char* data, size_t length);
+// Function feeds bytes from a provided buffer through a session's frame parser.
 // pre: none
+// post: returns false if the session should be closed. What does not fit behind held frames is
+//       kept in session -> held and the receive is cancelled until ResumeRecv.
+
+void ResumeRecv(Worker* worker, Session* session);
+// Function feeds what was kept while frames were held through the parser and receives again.
+// pre: io_uring mode; the session should no longer be holding frames.
 // post: none
 
+void DropOp(Worker* worker, Session* session);
+// Function records that one of a session's io_uring operations has finished.
+// pre: none
+// post: a closed session with nothing in flight is queued to be freed.
+
 int main(int argc, char* argv[]){
 
   // Local Vars
+  string serverMode = "threaded";
+  int numWorkers = DEFAULT_WORKERS;
+  int backlog = DEFAULT_BACKLOG;
+  bool reusePort = false;
+  bool pinCpus = false;
+  string storeDir;
+  long storeTtl = DEFAULT_STORE_TTL;
+  long userCap = DEFAULT_USER_CAP;
+  long indexCap = DEFAULT_INDEX_CAP;
+  string overflowPolicy = "presence";
+  int adminPort = 0;
+  // One hash per CPU at a time; more only queue behind each other.
+  int authThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  long authQueue = DEFAULT_AUTH_QUEUE;
+  long presenceWindow = DEFAULT_PRESENCE_WINDOW;
+  string historyDir;
+  long historySlots = DEFAULT_HISTORY_SLOTS;
+  long channelRings = DEFAULT_CHANNEL_RINGS;
+  long directRings = DEFAULT_DIRECT_RINGS;
+  int nodeId = 0;
+  string nodePeers;
+  string nodeKeyPath;
+  string accountDir;
+  string upgradePath;
+  int upgradeSock = -1;
+  string upgradeState;
+  vector<int> upgradeFds;
+  size_t statePos = 0;
+  int opt;
 
   // Process Arguments
   unsigned short serverPort; 
-  if (argc != 2){
+  while ((opt = getopt(argc, argv, "m:w:f:b:rcs:t:q:Q:l:L:o:a:H:k:P:y:Y:C:D:n:N:d:U:K:W:")) != -1) {
+    switch (opt) {
+    case 'm':
+      serverMode = optarg;
+      break;
+    case 'w':
+      numWorkers = atoi(optarg);
+      break;
+    case 'f':
+      MaxFrameSize = atol(optarg);
+      break;
+    case 'b':
+      backlog = atoi(optarg);
+      break;
+    case 'r':
+      reusePort = true;
+      break;
+    case 'c':
+      pinCpus = true;
+      break;
+    case 's':
+      storeDir = optarg;
+      break;
+    case 't':
+      storeTtl = atol(optarg);
+      break;
+    case 'q':
+      userCap = atol(optarg);
+      break;
+    case 'Q':
+      indexCap = atol(optarg);
+      break;
+    case 'l':
+      MailboxLimits.maxMsgs = atol(optarg);
+      break;
+    case 'L':
+      MailboxLimits.maxBytes = atol(optarg);
+      break;
+    case 'o':
+      overflowPolicy = optarg;
+      break;
+    case 'a':
+      adminPort = atoi(optarg);
+      break;
+    case 'H':
+      authThreads = atoi(optarg);
+      break;
+    case 'W':
+      authQueue = atol(optarg);
+      break;
+    case 'k':
+      HashCost = atoi(optarg);
+      break;
+    case 'P':
+      presenceWindow = atol(optarg);
+      break;
+    case 'y':
+      historyDir = optarg;
+      break;
+    case 'Y':
+      historySlots = atol(optarg);
+      break;
+    case 'C':
+      channelRings = atol(optarg);
+      break;
+    case 'D':
+      directRings = atol(optarg);
+      break;
+    case 'n':
+      nodeId = atoi(optarg);
+      break;
+    case 'N':
+      nodePeers = optarg;
+      break;
+    case 'K':
+      nodeKeyPath = optarg;
+      break;
+    case 'd':
+      accountDir = optarg;
+      break;
+    case 'U':
+      upgradePath = optarg;
+      break;
+    default:
+      cerr << "Usage: " << argv[0] << " [-m threaded|epoll|uring] [-w workers] [-f max frame bytes]"
+	   << " [-b backlog] [-r] [-c] [-s store dir] [-t store ttl seconds] [-q per-user cap]"
+	   << " [-Q total cap] [-l queue messages] [-L queue bytes] [-o oldest|presence|disconnect] [-a admin port]"
+	   << " [-H hashing threads] [-W waiting logins] [-k hash cost] [-P presence window ms] [-y history dir]"
+	   << " [-Y history per conversation] [-C history channels] [-D history pairs] [-n node id]"
+	   << " [-N node link host:port,...] [-K node key file]"
+	   << " [-d account dir] [-U upgrade socket] port" << endl;
+      return -1;
+    }
+  }
+  if (argc - optind != 1){
     // Incorrect number of arguments
     cerr << "Incorrect number of arguments. Please try again." << endl;
     return -1;
   }
-  serverPort = atoi(argv[1]);
+  if (serverMode != "threaded" && serverMode != "epoll" && serverMode != "uring") {
+    cerr << "Unknown server mode: " << serverMode << endl;
+    return -1;
+  }
+  if (numWorkers < 1) {
+    numWorkers = 1;
+  }
+  if (MaxFrameSize < 1) {
+    MaxFrameSize = DEFAULT_MAX_FRAME;
+  }
+  if (backlog < 1) {
+    backlog = DEFAULT_BACKLOG;
+  }
+  if (storeTtl < 1) {
+    storeTtl = DEFAULT_STORE_TTL;
+  }
+  if (userCap < 1) {
+    userCap = DEFAULT_USER_CAP;
+  }
+  if (indexCap < 1) {
+    indexCap = DEFAULT_INDEX_CAP;
+  }
+  if (MailboxLimits.maxMsgs < 1) {
+    MailboxLimits.maxMsgs = DEFAULT_QUEUE_MSGS;
+  }
+  if (MailboxLimits.maxBytes < 1) {
+    MailboxLimits.maxBytes = DEFAULT_QUEUE_BYTES;
+  }
+  if (presenceWindow < 0) {
+    presenceWindow = DEFAULT_PRESENCE_WINDOW;
+  }
+  if (authThreads < 1) {
+    authThreads = 1;
+  }
+  if (authQueue < 1) {
+    authQueue = DEFAULT_AUTH_QUEUE;
+  }
+  if (historySlots < 0 || historySlots > (long) MAX_HISTORY_SLOTS) {
+    historySlots = DEFAULT_HISTORY_SLOTS;
+  }
+  if (channelRings < 0) {
+    channelRings = DEFAULT_CHANNEL_RINGS;
+  }
+  if (directRings < 0) {
+    directRings = DEFAULT_DIRECT_RINGS;
+  }
+  if (HashCost < 1 || HashCost > 11) {
+    HashCost = DEFAULT_HASH_COST;
+  }
+  if (overflowPolicy == "oldest") {
+    MailboxLimits.policy = OVERFLOW_DROP_OLDEST;
+  } else if (overflowPolicy == "presence") {
+    MailboxLimits.policy = OVERFLOW_DROP_PRESENCE;
+  } else if (overflowPolicy == "disconnect") {
+    MailboxLimits.policy = OVERFLOW_DISCONNECT;
+  } else {
+    cerr << "Unknown overflow policy: " << overflowPolicy << endl;
+    return -1;
+  }
+  if (serverMode == "threaded" && (reusePort || pinCpus)) {
+    cerr << "-r and -c need event loops: use -m epoll or -m uring." << endl;
+    return -1;
+  }
+  if (!upgradePath.empty() && (serverMode != "epoll" || !nodePeers.empty())) {
+    cerr << "-U hands over epoll sessions: use -m epoll, without -N." << endl;
+    return -1;
+  }
+  serverPort = atoi(argv[optind]);
+
+  // A client hanging up mid-send should fail the send, not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  // A server already running on -U hands everything over and exits before anything here is opened.
+  long upgradeStarted = MetricsClock();
+  if (!upgradePath.empty()) {
+    int predecessor = ConnectUpgrade(upgradePath);
+    if (predecessor >= 0) {
+      cout << "SERVER: taking over from the running server." << endl;
+      if (!ReceiveUpgrade(predecessor, upgradeState, upgradeFds)) {
+	cerr << "The running server did not hand over." << endl;
+	return -1;
+      }
+    }
+  }
 
-  // Create socket connection
-  int conn_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (conn_socket < 0){
-    cerr << "Error with socket." << endl;
-    exit(-1);
+  // SIGUSR1 is only ever taken by statsThread; every thread created below inherits the mask.
+  sigset_t statsSignals;
+  sigemptyset(&statsSignals);
+  sigaddset(&statsSignals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &statsSignals, NULL);
+  pthread_t statsTid;
+  pthread_create(&statsTid, NULL, statsThread, NULL);
+
+  // Metrics for scrapers, on loopback only.
+  if (adminPort > 0) {
+    int adminSock = OpenAdminListener(adminPort);
+    if (adminSock < 0) {
+      exit(-1);
+    }
+    pthread_t adminTid;
+    pthread_create(&adminTid, NULL, adminThread, (void*) (intptr_t) adminSock);
   }
 
-  // Set the socket Fields
-  struct sockaddr_in serverAddress;
-  serverAddress.sin_family = AF_INET;    // Always AF_INET
-  serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-  serverAddress.sin_port = htons(serverPort);
-  
-  // Assign Port to socket
-  int sock_status = bind(conn_socket, (struct sockaddr *) &serverAddress, sizeof(serverAddress));
-  if (sock_status < 0) {
-    cerr << "Error with bind." << endl;
-    exit(-1);
+  // Accounts saved under -d, so a restart does not hand names to whoever logs in first.
+  if (!accountDir.empty() && (!OpenAccounts(accountDir) || !StartCheckpoints())) {
+    cerr << "Unable to open the accounts in " << accountDir << endl;
+    return -1;
   }
 
-  // Set socket to listen.
-  int listen_status = listen(conn_socket, MAXPENDING);
-  if (listen_status < 0) {
-    cerr << "Error with listening." << endl;
+  // Passwords are hashed off the connection threads and event loops.
+  if (!StartAuthPool(authThreads, authQueue)) {
+    cerr << "Unable to start the hashing threads." << endl;
+    return -1;
+  }
+
+  // Joins and leaves go out as one notice per window.
+  if (!StartPresence(presenceWindow)) {
+    cerr << "Unable to start the presence thread." << endl;
+    return -1;
+  }
+
+  // Recent messages per conversation, in files under -y so they outlast a restart.
+  if (!StartHistory(historyDir, historySlots, channelRings, directRings)) {
+    cerr << "Unable to open the history directory " << historyDir << endl;
+    return -1;
+  }
+
+  // Mail for offline users goes to disk instead of waiting in memory.
+  if (!storeDir.empty() && !OpenStore(storeDir, storeTtl, userCap, indexCap)) {
+    cerr << "Unable to open the offline store in " << storeDir << endl;
+    return -1;
+  }
+
+  // Other servers share the directory: each user's home node knows where they are.
+  // Links only take frames from a node that knows the key.
+  string nodeKey;
+  if (!nodeKeyPath.empty()) {
+    ifstream keyFile(nodeKeyPath.c_str());
+    if (!getline(keyFile, nodeKey) || nodeKey.empty()) {
+      cerr << "Unable to read a node key from " << nodeKeyPath << endl;
+      return -1;
+    }
+  }
+  if (!nodePeers.empty() && !StartCluster(nodeId, nodePeers, nodeKey)) {
+    return -1;
+  }
+
+  // One listening socket, or one per event loop sharing the port; after a hand-over, the old ones.
+  vector<int> listenSocks;
+  uint32_t numListeners = 0;
+  if (!upgradeFds.empty()) {
+    if (!GetNumber(upgradeState, statePos, numListeners) || numListeners < 1 || numListeners > upgradeFds.size() ||
+	!RestoreDirectory(upgradeState, statePos)) {
+      cerr << "The hand-over from the running server is damaged." << endl;
+      return -1;
+    }
+    listenSocks.assign(upgradeFds.begin(), upgradeFds.begin() + numListeners);
+    reusePort = numListeners > 1;
+    if (reusePort) {
+      numWorkers = numListeners;
+    } else {
+      // The old loops may have made it non-blocking; this thread accepts with it now.
+      fcntl(listenSocks[0], F_SETFL, fcntl(listenSocks[0], F_GETFL, 0) & ~O_NONBLOCK);
+    }
+  } else {
+    for (int i = 0; i < (reusePort ? numWorkers : 1); i++) {
+      int listenSock = OpenListener(serverPort, backlog, reusePort);
+      if (listenSock < 0) {
+	exit(-1);
+      }
+      listenSocks.push_back(listenSock);
+    }
+  }
+  int conn_socket = listenSocks[0];
+
+  if (serverMode == "uring" && !ProbeRing()) {
+    cerr << "io_uring with provided buffers is unavailable; falling back to epoll." << endl;
+    serverMode = "epoll";
+  }
+  if (serverMode != "threaded" && !StartWorkers(numWorkers, listenSocks, serverMode == "uring", pinCpus)) {
+    cerr << "Error starting event loops." << endl;
     exit(-1);
   }
+  if (!upgradeFds.empty()) {
+    if (!AdoptSessions(upgradeState, statePos, upgradeFds)) {
+      cerr << "The hand-over from the running server is damaged." << endl;
+      exit(-1);
+    }
+    Upgrade.seconds = (MetricsClock() - upgradeStarted) / 1e9;
+    cout << "SERVER: took over " << Upgrade.sessions << " sessions and " << Upgrade.users
+	 << " users in " << Upgrade.seconds << " s." << endl;
+  }
+  // The next binary connects here to take over from this one.
+  if (!upgradePath.empty()) {
+    upgradeSock = OpenUpgradeListener(upgradePath);
+    if (upgradeSock < 0) {
+      cerr << "Unable to listen for upgrades on " << upgradePath << endl;
+      exit(-1);
+    }
+  }
   cout << endl << endl << "SERVER: Ready to accept connections. " << endl;
 
+  if (serverMode == "uring" || reusePort) {
+    // The event loops accept for themselves.
+    if (upgradeSock >= 0) {
+      WaitForClient(-1, upgradeSock, listenSocks);
+    }
+    while (true) {
+      pause();
+    }
+  }
+
 
   // Accept connections
   while (true) {
+    if (upgradeSock >= 0) {
+      WaitForClient(conn_socket, upgradeSock, listenSocks);
+    }
     // Accept connections
     struct sockaddr_in clientAddress;
     socklen_t addrLen = sizeof(clientAddress);
@@ -220,6 +747,12 @@ int main(int argc, char* argv[]){
       exit(-1);
     }
 
+    if (serverMode == "epoll") {
+      // An event loop owns the socket from here on.
+      AssignToWorker(clientSocket);
+      continue;
+    }
+
     // Create child thread to handle process
     struct threadArgs* args_p = new threadArgs;
     args_p -> clientSock = clientSocket;
@@ -260,623 +793,1573 @@ void* clientThread(void* args_p) {
 void InstantMessage(int clientSock) {
 
   // Locals
-  string clientMsg = "";
-  long clientMsgLength = 0;
-  int messageID = 1;
-  fd_set clientfd;
-  struct timeval tv;
-  int numberOfSocks = 0;
-  bool hasRead = true;
+  InBuffer in;
+  OutBuffer out;
+  struct pollfd fds[2];
 
   // Login Credentials
   string userName;
   string userpwd;
 
   // Login loop
-  while (!hasAuthenticated(clientSock, userName)) {
+  bool isOpen = true;
+  while (!hasAuthenticated(clientSock, in, userName, isOpen)) {
+    if (!isOpen) {
+      ReleaseBuffer(in, true);
+      return;
+    }
+  }
+  Mailbox* mailbox = GetMailbox(userName);
+
+  // The mailbox signals wakeFd whenever something is queued for us.
+  int wakeFd = eventfd(0, EFD_NONBLOCK);
+  if (wakeFd < 0) {
+    cerr << "Unable to create wakeup descriptor." << endl;
+    LogoutUser (userName);
+    return;
   }
+  AttachMailbox(mailbox, wakeFd);
 
   // Announce That user has connected!
-  broadcastMsg( userName, "", true);
+  AnnouncePresence(userName, true);
   // TODO
 
-  // Clear FD_Set and set timeout.
-  FD_ZERO(&clientfd);
-  tv.tv_sec = 2;
-  tv.tv_usec = 100000;
-
-  // Initialize Data
-  FD_SET(clientSock, &clientfd);
-  numberOfSocks = clientSock + 1;
-
-  while (clientMsg != "/quit" && clientMsg != "/close") {
-
-    // Send Data.
-    string msg = GetMsgs(userName);
-    if (msg.length() != 0) {
-      //cout << msg << endl;
-      if (!SendInteger(clientSock, msg.length()+1)) {
-	cerr << "Unable to send Int. " << endl;
+  // From here on a stalled reader must not block this thread: unsent output waits
+  // in out, and anything newer waits in the bounded mailbox.
+  fcntl(clientSock, F_SETFL, fcntl(clientSock, F_GETFL, 0) | O_NONBLOCK);
+
+  // Initialize Data: poll, not select, since each session holds two descriptors and may be past FD_SETSIZE.
+  fds[0].fd = clientSock;
+  fds[1].fd = wakeFd;
+  fds[1].events = POLLIN;
+
+  while (isOpen) {
+
+    // Process every whole frame received so far.
+    MsgView frame;
+    FrameStatus status;
+    while (isOpen && (status = NextFrame(in, frame)) == FRAME_READY) {
+      cout << "Client Said: ";
+      cout.write(frame.data, frame.length) << endl;
+      if (ViewEquals(frame, "/quit") || ViewEquals(frame, "/close")) {
+	isOpen = false;
 	break;
       }
+      // Process message and Add to queue
+      SaveMsg(frame.data, frame.length, userName);
+    }
+    if (!isOpen) {
+      break;
+    }
+    if (status == FRAME_INVALID) {
+      cerr << "Frame too large. Closing clientSocket: " << clientSock << "." << endl;
+      break;
+    }
+    // Idle sessions give their buffer back.
+    ReleaseBuffer(in, false);
 
-      if (!SendMessage(clientSock, msg)) {
-	cerr << "Unable to send Message. " << endl;
-	break;
+    if (IsOverflowed(mailbox)) {
+      cerr << "Outbound queue overflowed. Closing clientSocket: " << clientSock << "." << endl;
+      break;
+    }
+    // Send Data: everything queued since the last batch went out goes as one frame.
+    if (out.frames.empty()) {
+      int numMsgs = 0;
+      vector<long> queuedAt;
+      string msg = GetMsgs(mailbox, &numMsgs, &queuedAt);
+      if (msg.length() != 0) {
+	QueueFrame(out, msg, numMsgs, &queuedAt);
       }
     }
-    
+    if (FlushFrames(clientSock, out) == FLUSH_FAILED) {
+      cerr << "Unable to send Message. " << endl;
+      break;
+    }
 
-    // Read Data
-    int pollSock = select(numberOfSocks, &clientfd, NULL, NULL, &tv);
-    tv.tv_sec = 1;
-    tv.tv_usec = 100000;
-    FD_SET(clientSock, &clientfd);
-    if (pollSock != 0 && pollSock != -1) {
-      string tmp;
-      long msgLength = GetInteger(clientSock);
-      if (msgLength <= 0) {
-	cerr << "Couldn't get integer from Client." << endl;
-	break;
-      }
-      string clientMsg = GetMessage(clientSock, msgLength);
-      if (clientMsg == "") {
-	cerr << "Couldn't get message from Client." << endl;
+    // Sleep until the client sends something, a message is queued for us, or there is room to send.
+    fds[0].events = POLLIN | (out.frames.empty() ? 0 : POLLOUT);
+    int pollSock = poll(fds, 2, -1);
+    if (pollSock > 0 && (fds[1].revents & POLLIN)) {
+      // Reset the counter; GetMsgs at the top of the loop drains the mailbox.
+      uint64_t count;
+      read(wakeFd, &count, sizeof(count));
+    }
+    if (pollSock > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+      // Take what has arrived; a partial frame waits in the buffer for the rest.
+      int bytesRecv = RecvFrames(clientSock, in);
+      if (bytesRecv == 0 ||
+	  (bytesRecv < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+	cerr << "Could not recv bytes. Closing clientSocket: " << clientSock << "." << endl;
 	break;
       }
-      tmp = "Client Said: ";
-      tmp.append(clientMsg);
-      cout << tmp << endl;
-      tmp.clear();
-      
-      // Process message and Add to queue
-      SaveMsg(clientMsg, userName); 
     }
   }//*/
 
   cout << "Closing Thread." << endl;
-  setUserDisconnected (userName);
+  ReleaseBuffer(in, true);
+  DetachMailbox(mailbox);
+  close(wakeFd);
+  LeaveAllChannels(userName);
+  LogoutUser (userName);
   // Announce that user has disconnected
-  broadcastMsg(userName, "", false);
-}
-
-void broadcastMsg(string userName, string msg, bool isConnected) {
-
-  if (msg == "") {
-    // This is a login/logoff announcement.
-    msg = "";
-    Msg tmp;
-    tmp.to;
-    tmp.from = userName;
-    tmp.msg = msg;
-    tmp.cmd = "/all";
-
-    pthread_mutex_lock(&UserListLock);
-    tr1::unordered_map<string, User>::iterator got = UsersList.begin();
-    for ( ; got != UsersList.end(); got++) {
-      if ((got)->second.isConnected == true && (got)->second.username != userName) {
-	// Send them a message.
-	tmp.to = (got)->second.username;
-	msg.append (userName);
-	if (isConnected) {
-	  msg.append (" has connected! :)\n");
-	} else {
-	  msg.append (" has disconnected! :(\n");
-	}
-	tmp.msg = msg;
-	msg.clear();
-	addToMsgQueue(tmp);
-	tmp.msg.clear();
-	//SaveMsg(msg, userName);
-	
+  AnnouncePresence(userName, false);
+}
+
+void* statsThread(void* args_p) {
+
+  // Locals
+  sigset_t statsSignals;
+  int sig;
+  sigemptyset(&statsSignals);
+  sigaddset(&statsSignals, SIGUSR1);
+
+  pthread_detach(pthread_self());
+  while (sigwait(&statsSignals, &sig) == 0) {
+    long messages = FrameCounters.messages;
+    long sendCalls = FrameCounters.sendCalls;
+    cout << "SERVER: frames " << FrameCounters.framesQueued
+	 << " messages " << messages
+	 << " send calls " << sendCalls
+	 << " partial sends " << FrameCounters.partialSends;
+    if (messages > 0) {
+      cout << " send calls/message " << (double) sendCalls / messages;
+    }
+    cout << endl;
+    long acquires = FrameCounters.bufferAcquires;
+    cout << "SERVER: recv buffers acquired " << acquires
+	 << " pool hits " << FrameCounters.bufferHits;
+    if (acquires > 0) {
+      cout << " (" << 100.0 * FrameCounters.bufferHits / acquires << "%)";
+    }
+    cout << " bytes in use " << FrameCounters.bytesInUse << endl;
+    cout << "SERVER: queue overflow dropped " << QueueCounters.dropped
+	 << " (presence " << QueueCounters.presenceDropped << ")"
+	 << " disconnects " << QueueCounters.disconnects << endl;
+    if (!Workers.empty()) {
+      cout << "SERVER: accepted per worker";
+      for (size_t i = 0; i < Workers.size(); i++) {
+	cout << " " << Workers[i] -> accepted;
       }
+      cout << endl;
     }
-    pthread_mutex_unlock(&UserListLock);
-  } else {
-    string globMsg = "";
-    globMsg.append (userName);
-    globMsg.append (" has said: ");
-    globMsg.append (msg);
-    Msg tmp;
-    tmp.from = userName;
-    tmp.msg = globMsg;
-    tmp.cmd = "/all";
-    // This is a global Msg
-    pthread_mutex_lock(&UserListLock);
-    tr1::unordered_map<string, User>::iterator got = UsersList.begin();
-    for ( ; got != UsersList.end(); got++) {
-      if ((got)->second.isConnected == true && (got)->second.username != userName) {
-	// Send them a message.
-	tmp.to = (got)->second.username;
-	addToMsgQueue(tmp);
-	//SaveMsg(msg, userName);
-	
+    pthread_mutex_lock(&AuthWorkers.lock);
+    cout << "SERVER: logins checked " << AuthWorkers.accepted + AuthWorkers.rejected
+	 << " rejected " << AuthWorkers.rejected
+	 << " accounts created " << AuthWorkers.created
+	 << " rehashed " << AuthWorkers.rehashed
+	 << " hashing " << AuthWorkers.busy << "/" << AuthWorkers.numThreads
+	 << " waiting " << AuthWorkers.waiting.size()
+	 << " turned away " << AuthWorkers.turnedAway << endl;
+    pthread_mutex_unlock(&AuthWorkers.lock);
+    pthread_mutex_lock(&PendingPresence.lock);
+    cout << "SERVER: presence events " << PendingPresence.events
+	 << " cancelled " << PendingPresence.cancelled
+	 << " notices " << PendingPresence.notices << endl;
+    pthread_mutex_unlock(&PendingPresence.lock);
+    pthread_rwlock_rdlock(&History.lock);
+    cout << "SERVER: history recorded " << History.recorded
+	 << " conversations " << History.rings.size() + History.channels.owners.size() + History.direct.owners.size()
+	 << " channels " << History.channels.owners.size() << " (rings reused " << History.channels.reused << ")"
+	 << " pairs " << History.direct.owners.size() << " (rings reused " << History.direct.reused << ")"
+	 << " pages sent " << History.pagesSent << endl;
+    pthread_rwlock_unlock(&History.lock);
+    if (Accounts.isOpen) {
+      pthread_mutex_lock(&Accounts.logLock);
+      cout << "SERVER: accounts registered " << Accounts.registered
+	   << " hashes changed " << Accounts.changed
+	   << " replayed " << Accounts.replayed
+	   << " not yet in snapshot " << Accounts.pending.size() + Accounts.sealed.size()
+	   << " checkpoints " << Accounts.checkpoints
+	   << " last checkpoint " << Accounts.checkpointSeconds << " s"
+	   << " opened in " << Accounts.openSeconds << " s" << endl;
+      pthread_mutex_unlock(&Accounts.logLock);
+    }
+    if (Upgrade.seconds > 0) {
+      cout << "SERVER: took over " << Upgrade.sessions << " sessions and " << Upgrade.users
+	   << " users from the previous process in " << Upgrade.seconds << " s" << endl;
+    }
+    if (Cluster.isOn) {
+      cout << "SERVER: node " << Cluster.self << " routed " << Cluster.routed
+	   << " forwarded " << Cluster.forwarded
+	   << " received " << Cluster.received << endl;
+      for (size_t i = 0; i < Cluster.links.size(); i++) {
+	NodeLink* link = Cluster.links[i];
+	if (link == NULL) {
+	  continue;
+	}
+	pthread_mutex_lock(&link -> lock);
+	cout << "SERVER: link to node " << i << " frames " << link -> frames
+	     << " writes " << link -> writes
+	     << " frames per write " << (link -> writes > 0 ? (double) link -> frames / link -> writes : 0)
+	     << " connects " << link -> connects
+	     << " dropped " << link -> dropped << endl;
+	pthread_mutex_unlock(&link -> lock);
       }
     }
-    pthread_mutex_unlock(&UserListLock);
+    if (MailStore.isOpen) {
+      pthread_mutex_lock(&MailStore.lock);
+      cout << "SERVER: offline store appended " << MailStore.appended
+	   << " replayed " << MailStore.replayed
+	   << " dropped " << MailStore.dropped
+	   << " waiting users " << MailStore.index.size()
+	   << " messages " << MailStore.indexed
+	   << " segments " << MailStore.segments.size()
+	   << " compactions " << MailStore.compactions << endl;
+      pthread_mutex_unlock(&MailStore.lock);
+    }
   }
-}
 
+  pthread_exit(NULL);
+}
 
-bool hasAuthenticated(int clientSock, string &userName) {
+void* adminThread(void* args_p) {
 
   // Locals
-  string loginSuccessMsg = "Login Successful!\n";
-  string loginFailureMsg = "Login Failed!\n";
-  string userPwd;
-  long responseLen = 0;
-  string clientResponse;
-
-  // Get UserName
-  responseLen = GetInteger(clientSock);
-  userName = GetMessage(clientSock, responseLen);
+  int adminSock = (int) (intptr_t) args_p;
+  char request[1024];
 
-  // Get Password
-  responseLen = GetInteger(clientSock);
-  userPwd = GetMessage(clientSock, responseLen);
-  
-  // Need to process username and password
-  if (loginUser (userName, userPwd)) {
-    // User Exists and password was successful.
-    // Send message to client
-    SendInteger(clientSock, loginSuccessMsg.length()+1);
-    SendMessage(clientSock, loginSuccessMsg);
-    cout << "Logged in as: " << userName << endl;
-    return true;
-  } else {
-    // User could not login.
-    SendInteger(clientSock, loginFailureMsg.length()+1);
-    SendMessage(clientSock, loginFailureMsg);
-    cout << "Failed to login as: " << userName << endl;
-    return false;
+  pthread_detach(pthread_self());
+  while (true) {
+    int clientSock = accept(adminSock, NULL, NULL);
+    if (clientSock < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+	continue;
+      }
+      cerr << "Error accepting on the admin socket." << endl;
+      break;
+    }
+    // Whatever was asked, the answer is the metrics page; a plain connect gets it too.
+    struct timeval timeout = { 1, 0 };
+    setsockopt(clientSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    recv(clientSock, request, sizeof(request), 0);
+    string body = ServerMetrics();
+    stringstream reply;
+    reply << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+	  << body.length() << "\r\n\r\n" << body;
+    string page = reply.str();
+    size_t offset = 0;
+    while (offset < page.length()) {
+      int sent = send(clientSock, page.data() + offset, page.length() - offset, MSG_NOSIGNAL);
+      if (sent <= 0) {
+	break;
+      }
+      offset += sent;
+    }
+    close(clientSock);
   }
+
+  pthread_exit(NULL);
 }
 
-bool SendMessage(int HostSock, string msg) {
+string ServerMetrics() {
 
-  // Local Variables
-  int msgLength = msg.length()+1;
-  char msgBuff[msgLength];
-  strcpy(msgBuff, msg.c_str());
-  msgBuff[msgLength-1] = '\0';
-
-  // Since they now know how many bytes to receive, we'll send the message
-  int msgSent = send(HostSock, msgBuff, msgLength, 0);
-  if (msgSent != msgLength){
-    // Failed to send
-    cerr << "Unable to send data. Closing clientSocket: " << HostSock << "." << endl;
-    return false;
+  stringstream ss;
+  ss << FormatMetrics();
+  ss << "# HELP msgserver_frames_total Frames queued for sending." << endl
+     << "# TYPE msgserver_frames_total counter" << endl
+     << "msgserver_frames_total " << FrameCounters.framesQueued << endl;
+  ss << "# HELP msgserver_send_calls_total sendmsg calls, including ones that would have blocked." << endl
+     << "# TYPE msgserver_send_calls_total counter" << endl
+     << "msgserver_send_calls_total " << FrameCounters.sendCalls << endl;
+  ss << "# HELP msgserver_recv_buffer_bytes Bytes held in receive buffers." << endl
+     << "# TYPE msgserver_recv_buffer_bytes gauge" << endl
+     << "msgserver_recv_buffer_bytes " << FrameCounters.bytesInUse << endl;
+  ss << "# HELP msgserver_queue_dropped_total Messages dropped from full mailboxes." << endl
+     << "# TYPE msgserver_queue_dropped_total counter" << endl
+     << "msgserver_queue_dropped_total " << QueueCounters.dropped << endl;
+  ss << "# HELP msgserver_queue_disconnects_total Sessions closed because their mailbox overflowed." << endl
+     << "# TYPE msgserver_queue_disconnects_total counter" << endl
+     << "msgserver_queue_disconnects_total " << QueueCounters.disconnects << endl;
+  pthread_mutex_lock(&AuthWorkers.lock);
+  ss << "# HELP msgserver_auth_checks_total Passwords checked by the hashing threads." << endl
+     << "# TYPE msgserver_auth_checks_total counter" << endl
+     << "msgserver_auth_checks_total{result=\"accepted\"} " << AuthWorkers.accepted << endl
+     << "msgserver_auth_checks_total{result=\"rejected\"} " << AuthWorkers.rejected << endl;
+  ss << "# HELP msgserver_auth_busy Hashing threads working on a password." << endl
+     << "# TYPE msgserver_auth_busy gauge" << endl
+     << "msgserver_auth_busy " << AuthWorkers.busy << endl;
+  ss << "# HELP msgserver_auth_waiting Logins queued for a hashing thread." << endl
+     << "# TYPE msgserver_auth_waiting gauge" << endl
+     << "msgserver_auth_waiting " << AuthWorkers.waiting.size() << endl;
+  ss << "# HELP msgserver_auth_turned_away_total Logins refused because the hashing queue was full." << endl
+     << "# TYPE msgserver_auth_turned_away_total counter" << endl
+     << "msgserver_auth_turned_away_total " << AuthWorkers.turnedAway << endl;
+  pthread_mutex_unlock(&AuthWorkers.lock);
+  pthread_mutex_lock(&PendingPresence.lock);
+  ss << "# HELP msgserver_presence_events_total Logins and logouts handed to the presence batcher." << endl
+     << "# TYPE msgserver_presence_events_total counter" << endl
+     << "msgserver_presence_events_total " << PendingPresence.events << endl;
+  ss << "# HELP msgserver_presence_cancelled_total Events undone by the opposite event in the same window." << endl
+     << "# TYPE msgserver_presence_cancelled_total counter" << endl
+     << "msgserver_presence_cancelled_total " << PendingPresence.cancelled << endl;
+  ss << "# HELP msgserver_presence_notices_total Coalesced presence notices sent." << endl
+     << "# TYPE msgserver_presence_notices_total counter" << endl
+     << "msgserver_presence_notices_total " << PendingPresence.notices << endl;
+  pthread_mutex_unlock(&PendingPresence.lock);
+  pthread_rwlock_rdlock(&History.lock);
+  ss << "# HELP msgserver_history_recorded_total Messages written to conversation history rings." << endl
+     << "# TYPE msgserver_history_recorded_total counter" << endl
+     << "msgserver_history_recorded_total " << History.recorded << endl;
+  ss << "# HELP msgserver_history_conversations Conversations holding a history ring." << endl
+     << "# TYPE msgserver_history_conversations gauge" << endl
+     << "msgserver_history_conversations "
+     << History.rings.size() + History.channels.owners.size() + History.direct.owners.size() << endl;
+  ss << "# HELP msgserver_history_channels Channels holding a ring of the channel history pool." << endl
+     << "# TYPE msgserver_history_channels gauge" << endl
+     << "msgserver_history_channels " << History.channels.owners.size() << endl;
+  ss << "# HELP msgserver_history_channels_reused_total Channel history rings taken from the least recently written channel." << endl
+     << "# TYPE msgserver_history_channels_reused_total counter" << endl
+     << "msgserver_history_channels_reused_total " << History.channels.reused << endl;
+  ss << "# HELP msgserver_history_pairs Pairs of users holding a ring of the direct history pool." << endl
+     << "# TYPE msgserver_history_pairs gauge" << endl
+     << "msgserver_history_pairs " << History.direct.owners.size() << endl;
+  ss << "# HELP msgserver_history_pairs_reused_total Direct history rings taken from the least recently written pair." << endl
+     << "# TYPE msgserver_history_pairs_reused_total counter" << endl
+     << "msgserver_history_pairs_reused_total " << History.direct.reused << endl;
+  ss << "# HELP msgserver_history_pages_total /history pages queued." << endl
+     << "# TYPE msgserver_history_pages_total counter" << endl
+     << "msgserver_history_pages_total " << History.pagesSent << endl;
+  pthread_rwlock_unlock(&History.lock);
+  if (Accounts.isOpen) {
+    pthread_mutex_lock(&Accounts.logLock);
+    ss << "# HELP msgserver_accounts_logged_total Account changes appended to the account log." << endl
+       << "# TYPE msgserver_accounts_logged_total counter" << endl
+       << "msgserver_accounts_logged_total{type=\"register\"} " << Accounts.registered << endl
+       << "msgserver_accounts_logged_total{type=\"password\"} " << Accounts.changed << endl;
+    ss << "# HELP msgserver_accounts_unsnapshotted Account changes not yet in the snapshot." << endl
+       << "# TYPE msgserver_accounts_unsnapshotted gauge" << endl
+       << "msgserver_accounts_unsnapshotted " << Accounts.pending.size() + Accounts.sealed.size() << endl;
+    ss << "# HELP msgserver_accounts_checkpoints_total Snapshots written." << endl
+       << "# TYPE msgserver_accounts_checkpoints_total counter" << endl
+       << "msgserver_accounts_checkpoints_total " << Accounts.checkpoints << endl;
+    ss << "# HELP msgserver_accounts_checkpoint_seconds How long the last snapshot took to write." << endl
+       << "# TYPE msgserver_accounts_checkpoint_seconds gauge" << endl
+       << "msgserver_accounts_checkpoint_seconds " << Accounts.checkpointSeconds << endl;
+    ss << "# HELP msgserver_accounts_open_seconds How long mapping the snapshot and replaying the log took." << endl
+       << "# TYPE msgserver_accounts_open_seconds gauge" << endl
+       << "msgserver_accounts_open_seconds " << Accounts.openSeconds << endl;
+    pthread_mutex_unlock(&Accounts.logLock);
   }
-
-  return true;
+  if (Upgrade.seconds > 0) {
+    ss << "# HELP msgserver_upgrade_sessions Sessions taken over from the previous process." << endl
+       << "# TYPE msgserver_upgrade_sessions gauge" << endl
+       << "msgserver_upgrade_sessions " << Upgrade.sessions << endl;
+    ss << "# HELP msgserver_upgrade_seconds From connecting to the previous process to serving its sessions." << endl
+       << "# TYPE msgserver_upgrade_seconds gauge" << endl
+       << "msgserver_upgrade_seconds " << Upgrade.seconds << endl;
+  }
+  if (Cluster.isOn) {
+    ss << "# HELP msgserver_cluster_routed_total Private messages sent to another node." << endl
+       << "# TYPE msgserver_cluster_routed_total counter" << endl
+       << "msgserver_cluster_routed_total " << Cluster.routed << endl;
+    ss << "# HELP msgserver_cluster_forwarded_total Broadcast and channel frames sent to other nodes." << endl
+       << "# TYPE msgserver_cluster_forwarded_total counter" << endl
+       << "msgserver_cluster_forwarded_total " << Cluster.forwarded << endl;
+    ss << "# HELP msgserver_cluster_received_total Frames received from other nodes." << endl
+       << "# TYPE msgserver_cluster_received_total counter" << endl
+       << "msgserver_cluster_received_total " << Cluster.received << endl;
+    ss << "# HELP msgserver_link_frames_total Frames queued per node link." << endl
+       << "# TYPE msgserver_link_frames_total counter" << endl;
+    stringstream writes;
+    stringstream dropped;
+    for (size_t i = 0; i < Cluster.links.size(); i++) {
+      NodeLink* link = Cluster.links[i];
+      if (link == NULL) {
+	continue;
+      }
+      pthread_mutex_lock(&link -> lock);
+      ss << "msgserver_link_frames_total{node=\"" << i << "\"} " << link -> frames << endl;
+      writes << "msgserver_link_writes_total{node=\"" << i << "\"} " << link -> writes << endl;
+      dropped << "msgserver_link_dropped_total{node=\"" << i << "\"} " << link -> dropped << endl;
+      pthread_mutex_unlock(&link -> lock);
+    }
+    ss << "# HELP msgserver_link_writes_total Writes per node link; frames over writes is the batching." << endl
+       << "# TYPE msgserver_link_writes_total counter" << endl << writes.str();
+    ss << "# HELP msgserver_link_dropped_total Frames lost to a full backlog or a broken link." << endl
+       << "# TYPE msgserver_link_dropped_total counter" << endl << dropped.str();
+  }
+  if (MailStore.isOpen) {
+    pthread_mutex_lock(&MailStore.lock);
+    ss << "# HELP msgserver_offline_stored_total Messages appended to the offline store." << endl
+       << "# TYPE msgserver_offline_stored_total counter" << endl
+       << "msgserver_offline_stored_total " << MailStore.appended << endl;
+    ss << "# HELP msgserver_offline_waiting_users Users with offline mail waiting." << endl
+       << "# TYPE msgserver_offline_waiting_users gauge" << endl
+       << "msgserver_offline_waiting_users " << MailStore.index.size() << endl;
+    ss << "# HELP msgserver_offline_waiting_messages Messages in the offline store's index (-Q caps it)." << endl
+       << "# TYPE msgserver_offline_waiting_messages gauge" << endl
+       << "msgserver_offline_waiting_messages " << MailStore.indexed << endl;
+    pthread_mutex_unlock(&MailStore.lock);
+  }
+  return ss.str();
 }
 
-string GetMessage(int HostSock, int messageLength) {
+int OpenAdminListener(unsigned short adminPort) {
 
-  // Retrieve msg
-  int bytesLeft = messageLength;
-  char buffer[messageLength];
-  char* buffPTR = buffer;
-  while (bytesLeft > 0){
-    int bytesRecv = recv(HostSock, buffPTR, messageLength, 0);
-    if (bytesRecv <= 0) {
-      // Failed to Read for some reason.
-      cerr << "Could not recv bytes. Closing clientSocket: " << HostSock << "." << endl;
-      return "";
-    }
-    bytesLeft = bytesLeft - bytesRecv;
-    buffPTR = buffPTR + bytesRecv;
+  int adminSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (adminSock < 0) {
+    cerr << "Error with admin socket." << endl;
+    return -1;
   }
-
-  return buffer;
+  int on = 1;
+  setsockopt(adminSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in adminAddress;
+  memset(&adminAddress, 0, sizeof(adminAddress));
+  adminAddress.sin_family = AF_INET;
+  adminAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  adminAddress.sin_port = htons(adminPort);
+  if (bind(adminSock, (struct sockaddr *) &adminAddress, sizeof(adminAddress)) < 0 ||
+      listen(adminSock, 16) < 0) {
+    cerr << "Error with admin bind." << endl;
+    close(adminSock);
+    return -1;
+  }
+  return adminSock;
 }
 
-long GetInteger(int HostSock) {
+int OpenListener(unsigned short serverPort, int backlog, bool reusePort) {
 
-  // Retreive length of msg
-  int bytesLeft = sizeof(long);
-  long networkInt;
-  char* bp = (char *) &networkInt;
-  
-  while (bytesLeft) {
-    int bytesRecv = recv(HostSock, bp, bytesLeft, 0);
-    if (bytesRecv <= 0){
-      // Failed to receive bytes
-      cerr << "Failed to receive bytes. Closing clientSocket: " << HostSock << "." << endl;
-      return -1;
-    }
-    bytesLeft = bytesLeft - bytesRecv;
-    bp = bp + bytesRecv;
+  // Create socket connection
+  int conn_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (conn_socket < 0){
+    cerr << "Error with socket." << endl;
+    return -1;
   }
-  return ntohl(networkInt);
-}
 
-bool SendInteger(int HostSock, int hostInt) {
+  // Restarting shouldn't wait out TIME_WAIT; -r lets every event loop bind the same port.
+  int on = 1;
+  setsockopt(conn_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (reusePort && setsockopt(conn_socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    cerr << "Error with SO_REUSEPORT." << endl;
+    close(conn_socket);
+    return -1;
+  }
 
-  // Local Variables
-  long networkInt = htonl(hostInt);
+  // Set the socket Fields
+  struct sockaddr_in serverAddress;
+  serverAddress.sin_family = AF_INET;    // Always AF_INET
+  serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+  serverAddress.sin_port = htons(serverPort);
+  
+  // Assign Port to socket
+  int sock_status = bind(conn_socket, (struct sockaddr *) &serverAddress, sizeof(serverAddress));
+  if (sock_status < 0) {
+    cerr << "Error with bind." << endl;
+    close(conn_socket);
+    return -1;
+  }
 
-  // Send Integer (as a long)
-  int didSend = send(HostSock, &networkInt, sizeof(long), 0);
-  if (didSend != sizeof(long)){
-    // Failed to Send
-    cerr << "Unable to send data. Closing clientSocket: " << HostSock << "."  << endl;
-    return false;
+  // Set socket to listen.
+  int listen_status = listen(conn_socket, backlog);
+  if (listen_status < 0) {
+    cerr << "Error with listening." << endl;
+    close(conn_socket);
+    return -1;
   }
 
-  return true;
+  return conn_socket;
 }
 
-void addToMsgQueue(Msg newMsg) {
-  pthread_mutex_lock(&MsgQueueLock);
-  MsgQueue.push_back(newMsg);
-  pthread_mutex_unlock(&MsgQueueLock);
-}
+bool StartWorkers(int numWorkers, const vector<int>& listenSocks, bool useRing, bool pinCpus) {
 
-string GetMsgs(string username) {
-  stringstream ss;
-  pthread_mutex_lock(&MsgQueueLock);
-  for (int i = 0; i < MsgQueue.size(); i++) {
-    if (MsgQueue[i].to == username) {
-      if (MsgQueue[i].cmd == "/msg") {
-	// Msg was intended for our user.
-	ss << "/\b\n************************************\npm from " << MsgQueue[i].from << ": ";
-	ss << MsgQueue[i].msg << endl << "************************************" << endl;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      } else if (MsgQueue[i].cmd == "/all") {
-	// Msg was intended for all users.
-	ss << MsgQueue[i].msg << endl;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      } else if (MsgQueue[i].cmd == "/users") {
-	ss << MsgQueue[i].msg << endl;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      } else if (MsgQueue[i].cmd == "/poke" ) {
-	ss << "/\b\n" << MsgQueue[i].from << " has poked you!" << endl;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      } else if (MsgQueue[i].cmd == "/time" ) {
-	ss << MsgQueue[i].msg;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      } else if (MsgQueue[i].cmd == "/joke" ) {
-	ss << MsgQueue[i].msg;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      } else if (MsgQueue[i].cmd == "/picture" ) {
-	ss << MsgQueue[i].msg;
-	MsgQueue.erase (MsgQueue.begin()+i);
-	i--;
-      }
+  // Locals
+  long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 0; i < numWorkers; i++) {
+    Worker* worker = new Worker;
+    worker -> id = i;
+    worker -> cpu = pinCpus && numCpus > 0 ? i % numCpus : -1;
+    worker -> accepted = 0;
+    worker -> useRing = useRing;
+    worker -> listenSock = -1;
+    if (listenSocks.size() > 1) {
+      worker -> listenSock = listenSocks[i];
+    } else if (useRing) {
+      worker -> listenSock = listenSocks[0];
+    }
+    worker -> acceptWatch.type = WATCH_ACCEPT;
+    worker -> acceptWatch.session = NULL;
+    worker -> cancelWatch.type = WATCH_CANCEL;
+    worker -> cancelWatch.session = NULL;
+    worker -> acceptMultishot = true;
+    worker -> recvMultishot = true;
+    worker -> epollFd = epoll_create1(0);
+    worker -> wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (worker -> epollFd < 0 || worker -> wakeFd < 0) {
+      cerr << "Unable to create event loop " << i << "." << endl;
+      return false;
+    }
+    pthread_mutex_init(&worker -> pendingLock, NULL);
+
+    // The wake descriptor tells the loop that new sockets are pending.
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    worker -> wakeWatch.type = WATCH_HANDOFF;
+    worker -> wakeWatch.session = NULL;
+    ev.data.ptr = &worker -> wakeWatch;
+    epoll_ctl(worker -> epollFd, EPOLL_CTL_ADD, worker -> wakeFd, &ev);
+
+    if (!useRing && worker -> listenSock >= 0) {
+      // This loop accepts its own connections.
+      fcntl(worker -> listenSock, F_SETFL, fcntl(worker -> listenSock, F_GETFL, 0) | O_NONBLOCK);
+      worker -> listenWatch.type = WATCH_LISTEN;
+      worker -> listenWatch.session = NULL;
+      ev.events = EPOLLIN;
+      ev.data.ptr = &worker -> listenWatch;
+      epoll_ctl(worker -> epollFd, EPOLL_CTL_ADD, worker -> listenSock, &ev);
+    }
+
+    int threadStatus = pthread_create(&worker -> tid, NULL, workerThread, (void*)worker);
+    if (threadStatus != 0) {
+      cerr << "Failed to create event loop thread." << endl;
+      return false;
     }
+    Workers.push_back(worker);
   }
-  pthread_mutex_unlock(&MsgQueueLock);
-  
-  return ss.str();
+
+  return true;
 }
 
-void SaveMsg(string msg, string userFrom) {
-  
-  // Local Variables
-  Msg newMsg;
-  newMsg.msg = msg;
-  newMsg.to = "";
-  newMsg.from = userFrom;
-  newMsg.cmd = "";
-  processMsg(newMsg.msg, newMsg.cmd, newMsg.to);
-
-  if (newMsg.cmd == "/all") {
-    // Global Message, need to add a message for all connected users.
-    broadcastMsg(userFrom, msg, false);
-  } else if (newMsg.cmd == "/msg") {
-    // Regular Private message.
-      if (doesUserExist(newMsg.to)) {
-	addToMsgQueue(newMsg);
+void AssignToWorker(int clientSock) {
+
+  // Spread connections round-robin across the event loops.
+  Worker* worker = Workers[NextWorker++ % Workers.size()];
+
+  pthread_mutex_lock(&worker -> pendingLock);
+  worker -> pendingSocks.push_back(clientSock);
+  pthread_mutex_unlock(&worker -> pendingLock);
+
+  uint64_t one = 1;
+  write(worker -> wakeFd, &one, sizeof(one));
+}
+
+void* workerThread(void* args_p) {
+
+  // Local Variables
+  Worker* worker = (Worker*) args_p;
+
+  // Detach Thread to ensure that resources are deallocated on return.
+  pthread_detach(pthread_self());
+
+  if (worker -> cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker -> cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      cerr << "Unable to pin event loop " << worker -> id << " to CPU " << worker -> cpu << "." << endl;
+    }
+  }
+
+  // Serve every session owned by this loop.
+  if (worker -> useRing) {
+    // The ring belongs to the thread that submits to it.
+    if (!SetupRing(worker -> ring, RING_ENTRIES, RING_CQ_ENTRIES) ||
+	!SetupBufferRing(worker -> ring, RING_BUFFERS, RING_BUFFER_SIZE)) {
+      cerr << "Unable to create io_uring for event loop " << worker -> id << "." << endl;
+      exit(-1);
+    }
+    RingLoop(worker);
+  } else {
+    EventLoop(worker);
+  }
+
+  // Quit thread
+  pthread_exit(NULL);
+}
+
+void EventLoop(Worker* worker) {
+
+  // Locals
+  struct epoll_event events[MAX_EVENTS];
+
+  while (true) {
+    // No timeout: sockets and mailboxes wake us when there is work. Sessions cut off by their
+    // read budget are only polled for, so they cannot starve what the other sockets bring in.
+    int timeout = worker -> readySessions.empty() ? -1 : 0;
+    int numEvents = epoll_wait(worker -> epollFd, events, MAX_EVENTS, timeout);
+    if (numEvents < 0 && errno != EINTR) {
+      cerr << "Error waiting on event loop " << worker -> id << "." << endl;
+      break;
+    }
+
+    for (int i = 0; i < numEvents; i++) {
+      Watch* watch = (Watch*) events[i].data.ptr;
+      if (watch -> type == WATCH_HANDOFF) {
+	AcceptPending(worker);
+	continue;
       }
-  } else if (newMsg.cmd == "/users") {
-    newMsg.to = userFrom;
-    newMsg.from = "SERVER";
-    newMsg.msg = GrabUsers(userFrom);
-    addToMsgQueue(newMsg);
-  } else if (newMsg.cmd == "/poke") {
-      if (doesUserExist(newMsg.to)) {
-	addToMsgQueue(newMsg);
+      if (watch -> type == WATCH_LISTEN) {
+	AcceptConnections(worker);
+	continue;
       }
-  } else if (newMsg.cmd == "/time") {
-    newMsg.from = "SERVER";
-    if (newMsg.to == "") {
-      newMsg.msg = GrabTime(userFrom);
-    } else {
-      newMsg.msg = GrabTime(newMsg.to);
+
+      Session* session = watch -> session;
+      if (session -> isClosed) {
+	// Closed by an earlier event in this batch.
+	continue;
+      }
+      bool isOpen = true;
+      if (watch -> type == WATCH_SOCKET &&
+	  (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+	isOpen = ReadSession(worker, session);
+      }
+      bool wasBacklogged = !session -> out.frames.empty();
+      if (isOpen) {
+	isOpen = DeliverPending(session) && FlushSession(session);
+      }
+      if (isOpen && wasBacklogged && session -> out.frames.empty()) {
+	// The last batch went out in full; pick up whatever queued behind it.
+	isOpen = DeliverPending(session) && FlushSession(session);
+      }
+      if (!isOpen) {
+	CloseSession(worker, session);
+      }
+    }
+    ReadReadySessions(worker);
+
+    // Nothing in this batch refers to closed sessions any more.
+    for (size_t i = 0; i < worker -> closedSessions.size(); i++) {
+      delete worker -> closedSessions[i];
     }
-    newMsg.to = userFrom;
-    addToMsgQueue(newMsg);
-  } else if (newMsg.cmd == "/joke") {
-    newMsg.to = userFrom;
-    newMsg.from = "SERVER";
-    newMsg.msg = GrabJoke();
-    addToMsgQueue(newMsg);
-  } else if (newMsg.cmd == "/picture") {
-    newMsg.to = userFrom;
-    newMsg.from = "SERVER";
-    newMsg.msg = GrabPic();
-    addToMsgQueue(newMsg);
+    worker -> closedSessions.clear();
   }
+}
+
+void ReadReadySessions(Worker* worker) {
 
+  vector<Session*> ready;
+  ready.swap(worker -> readySessions);
+  for (size_t i = 0; i < ready.size(); i++) {
+    Session* session = ready[i];
+    if (session -> isClosed) {
+      continue;
+    }
+    session -> isReadQueued = false;
+    bool isOpen = ReadSession(worker, session) && DeliverPending(session) && FlushSession(session);
+    if (!isOpen) {
+      CloseSession(worker, session);
+    }
+  }
+
+  // A session may have queued itself again and then closed; it is freed before the next turn.
+  size_t kept = 0;
+  for (size_t i = 0; i < worker -> readySessions.size(); i++) {
+    if (!worker -> readySessions[i] -> isClosed) {
+      worker -> readySessions[kept++] = worker -> readySessions[i];
+    }
+  }
+  worker -> readySessions.resize(kept);
 }
 
-void processMsg(string &msg, string &cmdName, string &userTo) {
-  
-  // Turn
-  // "/msg user blahblahbah"
-  // into
-  // (blahblahblah, /msg, user)
-
-  if (msg.c_str()[0] == '/') {
-    // Was a Command, Let's figure out what it was.
-    int cmdSize = 0;
-    for (int i = 1; i < msg.length(); i++) {
-      if (msg.c_str()[i] == ' ') {
-	cmdSize = i;
-	break;
-      }
+void AcceptPending(Worker* worker) {
+
+  // Reset the wake counter before draining so no hand-off is missed.
+  uint64_t count;
+  read(worker -> wakeFd, &count, sizeof(count));
+
+  pthread_mutex_lock(&worker -> pendingLock);
+  deque<int> newSocks;
+  newSocks.swap(worker -> pendingSocks);
+  deque<Session*> verified;
+  verified.swap(worker -> verifiedSessions);
+  deque<Session*> adopted;
+  adopted.swap(worker -> adoptedSessions);
+  pthread_mutex_unlock(&worker -> pendingLock);
+
+  for (size_t i = 0; i < newSocks.size(); i++) {
+    AddSession(worker, newSocks[i]);
+  }
+  for (size_t i = 0; i < verified.size(); i++) {
+    CompleteLogin(worker, verified[i]);
+  }
+  for (size_t i = 0; i < adopted.size(); i++) {
+    AdoptSession(worker, adopted[i]);
+  }
+
+  if (!UpgradeWanted()) {
+    return;
+  }
+  // Park once the auth pool holds none of this loop's logins; each one finishing wakes us again.
+  for (tr1::unordered_map<int, Session*>::iterator it = worker -> sessions.begin(); it != worker -> sessions.end(); ++it) {
+    if (it->second -> state == SESSION_LOGIN_WAIT) {
+      return;
     }
-    if (cmdSize == 0) {
-      // must be a non-argument command.
-      cmdSize = msg.length();
+  }
+  ParkLoop();
+  ResumeLogins(worker);
+}
+
+void ResumeLogins(Worker* worker) {
+
+  vector<Session*> held;
+  for (tr1::unordered_map<int, Session*>::iterator it = worker -> sessions.begin(); it != worker -> sessions.end(); ++it) {
+    if (it->second -> state == SESSION_LOGIN_PWD) {
+      held.push_back(it->second);
     }
-    // Build Command name
-    for (int i = 0; i < cmdSize; i++) {
-      stringstream ss;
-      ss << msg.c_str()[i];
-      cmdName.append(ss.str());
+  }
+  for (size_t i = 0; i < held.size(); i++) {
+    if (!ReadSession(worker, held[i]) || !FlushSession(held[i])) {
+      CloseSession(worker, held[i]);
     }
+  }
+}
 
-    int userSize = 0;
-    if (cmdName == "/msg" || cmdName == "/poke" || cmdName == "/time") {
-      // Need to grab user information.
-      for (int i = cmdSize+1; i < msg.length(); i++) {
-	if (msg.c_str()[i] == ' ' ) {
-	  userSize = i;
-	  break;
-	}
-      }
-      
-      if (userSize == 0) {
-	// no message, just action
-	userSize = msg.length();
-      }
+void AcceptConnections(Worker* worker) {
 
-      // Build UserTo
-      for (int i = cmdSize+1; i < userSize; i++) {
-	stringstream ss;
-	ss << msg.c_str()[i];
-	userTo.append(ss.str());
-      }
-    
-      // Set our values
-      msg.replace(0, userSize+cmdSize-3, "");
-    } else if (cmdName == "/users" || cmdName == "/joke" || cmdName == "/picture") {
-      // Need to process outside this function.
-    } 
+  while (true) {
+    int clientSock = accept4(worker -> listenSock, NULL, NULL, SOCK_NONBLOCK);
+    if (clientSock >= 0) {
+      AddSession(worker, clientSock);
+      continue;
+    }
+    if (errno == EINTR || errno == ECONNABORTED) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      cerr << "Error accepting connections." << endl;
+    }
+    break;
+  }
+}
+
+void AddSession(Worker* worker, int clientSock) {
+
+  fcntl(clientSock, F_SETFL, fcntl(clientSock, F_GETFL, 0) | O_NONBLOCK);
+
+  Session* session = NewSession(worker, clientSock);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = &session -> sockWatch;
+  if (epoll_ctl(worker -> epollFd, EPOLL_CTL_ADD, clientSock, &ev) < 0) {
+    cerr << "Unable to watch clientSocket: " << clientSock << "." << endl;
+    close(clientSock);
+    delete session;
+    return;
+  }
+  worker -> sessions[clientSock] = session;
+  worker -> accepted++;
+}
 
+Session* NewSession(Worker* worker, int clientSock) {
+
+  Session* session = new Session;
+  session -> sock = clientSock;
+  session -> worker = worker;
+  session -> state = SESSION_LOGIN_USER;
+  session -> mailbox = NULL;
+  session -> wakeFd = -1;
+  session -> isClosed = false;
+  session -> sockWatch.type = WATCH_SOCKET;
+  session -> sockWatch.session = session;
+  session -> mailWatch.type = WATCH_MAILBOX;
+  session -> mailWatch.session = session;
+  session -> pendingOps = 0;
+  session -> sendBusy = false;
+  session -> sendWatch.type = WATCH_SEND;
+  session -> sendWatch.session = session;
+  session -> sendWanted = 0;
+  session -> isRecvArmed = false;
+  session -> isRecvParked = false;
+  session -> isReadQueued = false;
+  session -> auth.isLoggedIn = false;
+  session -> auth.onDone = LoginVerified;
+  session -> auth.owner = session;
+  return session;
+}
+
+void LoginVerified(AuthRequest* request) {
+
+  Session* session = (Session*) request -> owner;
+  Worker* worker = session -> worker;
+
+  pthread_mutex_lock(&worker -> pendingLock);
+  worker -> verifiedSessions.push_back(session);
+  pthread_mutex_unlock(&worker -> pendingLock);
+
+  uint64_t one = 1;
+  write(worker -> wakeFd, &one, sizeof(one));
+}
+
+void CompleteLogin(Worker* worker, Session* session) {
+
+  // Locals
+  string loginSuccessMsg = "Login Successful!\n";
+  string loginFailureMsg = "Login Failed!\n";
+  bool isLoggedIn = session -> auth.isLoggedIn;
 
+  if (worker -> useRing) {
+    // The check counted as one of the session's operations.
+    DropOp(worker, session);
+  }
+  if (session -> isClosed) {
+    // The client left while its password was being checked.
+    if (isLoggedIn) {
+      LogoutUser (session -> userName);
+    }
+    if (!worker -> useRing) {
+      worker -> closedSessions.push_back(session);
+    }
+    return;
+  }
+
+  if (isLoggedIn) {
+    QueueFrame(session -> out, loginSuccessMsg, 0);
+    cout << "Logged in as: " << session -> userName << endl;
+    session -> mailbox = GetMailbox(session -> userName);
+    session -> wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (session -> wakeFd < 0 || !WatchMailbox(worker, session)) {
+      cerr << "Unable to watch mailbox for: " << session -> userName << endl;
+      LogoutUser (session -> userName);
+      if (session -> wakeFd >= 0 && !worker -> useRing) {
+	close(session -> wakeFd);
+      }
+      session -> state = SESSION_LOGIN_USER;
+      CloseSession(worker, session);
+      return;
+    }
+    AttachMailbox(session -> mailbox, session -> wakeFd);
+    session -> state = SESSION_CHAT;
+    // Announce That user has connected!
+    AnnouncePresence(session -> userName, true);
   } else {
-    userTo.append("all");
-    cmdName = "/all";
+    QueueFrame(session -> out, loginFailureMsg, 0);
+    cout << "Failed to login as: " << session -> userName << endl;
+    session -> state = SESSION_LOGIN_USER;
+  }
+
+  // Frames that arrived during the check, then the reply.
+  if (worker -> useRing) {
+    if (ProcessFrames(worker, session)) {
+      ResumeRecv(worker, session);
+    } else {
+      CloseSession(worker, session);
+    }
+    if (!session -> isClosed) {
+      // The send completion picks up anything those frames queued.
+      StartSend(worker, session);
+    }
+    return;
+  }
+  // Reading stopped at the password; whatever the client sent meanwhile is still on the socket.
+  bool isOpen = ReadSession(worker, session);
+  if (isOpen) {
+    // The reply goes first; DeliverPending holds mail back while output is queued.
+    isOpen = FlushSession(session) && DeliverPending(session) && FlushSession(session);
+  }
+  if (!isOpen) {
+    CloseSession(worker, session);
   }
 }
 
-string GrabPic() {
+bool ProcessFrames(Worker* worker, Session* session) {
 
-  stringstream welcomeMsg;
-  welcomeMsg <<"/\b#############################################################"<<endl;
-  welcomeMsg <<"#                    _                                      #"<<endl;  
-  welcomeMsg <<"#                  -=\\`\\                                    #"<<endl;  
-  welcomeMsg <<"#              |\\ ____\\_\\__                                 #"<<endl;  
-  welcomeMsg <<"#            -=\\c`\"\"\"\"\"\"\" \"`)                               #"<<endl;  
-  welcomeMsg <<"#               `~~~~~/ /~~`                                #"<<endl;  
-  welcomeMsg <<"#                 -==/ /                                    #"<<endl;  
-  welcomeMsg <<"#                   '-'                                     #"<<endl;  
-  welcomeMsg <<"#                  _  _                                     #"<<endl;  
-  welcomeMsg <<"#                 ( `   )_                                  #"<<endl;  
-  welcomeMsg <<"#                (    )    `)                               #"<<endl;  
-  welcomeMsg <<"#              (_   (_ .  _) _)                             #"<<endl;  
-  welcomeMsg <<"#                                             _             #"<<endl;  
-  welcomeMsg <<"#                                            (  )           #"<<endl;  
-  welcomeMsg <<"#             _ .                         ( `  ) . )        #"<<endl;  
-  welcomeMsg <<"#           (  _ )_                      (_, _(  ,_)_)      #"<<endl;  
-  welcomeMsg <<"#         (_  _(_ ,)                                        #"<<endl; 
-  welcomeMsg <<"#############################################################"<<endl;
+  MsgView frame;
+  FrameStatus status = FRAME_PARTIAL;
+  while (!IsHoldingFrames(session) && (status = NextFrame(session -> in, frame)) == FRAME_READY) {
+    if (!ProcessFrame(worker, session, frame)) {
+      return false;
+    }
+  }
+  if (status == FRAME_INVALID) {
+    cerr << "Frame too large. Closing clientSocket: " << session -> sock << "." << endl;
+    return false;
+  }
+  return true;
+}
 
-  return welcomeMsg.str();
+bool IsHoldingFrames(Session* session) {
+
+  // Nothing more is handled until a pending login has been decided. No new ones start while a
+  // successor waits for the loops to park; the password stays in the buffer for it.
+  return session -> state == SESSION_LOGIN_WAIT || (session -> state == SESSION_LOGIN_PWD && UpgradeWanted());
 }
 
-string GrabJoke() {
+bool ReadSession(Worker* worker, Session* session) {
 
-  stringstream ss;
-  // Need to get a random number.
-  srand (time(NULL));
-  int rndNum = rand() % 10 + 1; // between 1 and 10
-
-  // Grab the joke!
-  switch (rndNum) {
-  case 1:
-    ss << "/\bMost people believe that if it ain't broke, don't fix it. Engineers believe that if it ain't broke, it doesn't have enough features yet." << endl;
-    break;
-  case 2:
-    ss << "/\bQ: How does a computer tell you it needs more memory?   A: It says ''byte me''" << endl;
-    break;
-  case 3:
-    ss << "/\bQ: What is the first programming language you learn when studying computer science?  A: Profanity" << endl;
-    break;
-  case 4:
-    ss << "/\bA blind man walks into a bar...   and a chair and a table." << endl;
-    break;
-  case 5:
-    ss << "/\bQ: Why don't cows make large bets?   A: The steaks are too high." << endl;
-    break;
-  case 6:
-    ss << "/\bQ: Why aren't jokes in base 8 funny?   A: Because 7, 10, 11." << endl;
-    break;
-  case 7:
-    ss << "/\bQ: What did people say after two satellite dishes got married?   A: The wedding was dull, but the reception was great." << endl;
-    break;
-  case 8:
-    ss << "/\bQ: If Al Gore tried his hand as a musician, what would his album be called?   A. Algorithms." << endl;
+  // Edge-triggered: keep reading until the socket is drained, handling frames as they complete.
+  int budget = READ_BUDGET;
+  while (true) {
+    if (!ProcessFrames(worker, session)) {
+      return false;
+    }
+    if (IsHoldingFrames(session)) {
+      // The rest waits in the socket; CompleteLogin or ResumeLogins reads it.
+      return true;
+    }
+    if (budget <= 0) {
+      // No new edge comes for what is already there, so the loop comes back for it.
+      if (!session -> isReadQueued) {
+	session -> isReadQueued = true;
+	worker -> readySessions.push_back(session);
+      }
+      return true;
+    }
+
+    int bytesRecv = RecvFrames(session -> sock, session -> in);
+    if (bytesRecv > 0) {
+      budget -= bytesRecv;
+      continue;
+    }
+    if (bytesRecv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (bytesRecv < 0 && errno == EINTR) {
+      continue;
+    }
+    // Peer closed or the socket failed.
+    return false;
+  }
+
+  // Idle sessions give their buffer back.
+  ReleaseBuffer(session -> in, false);
+
+  return true;
+}
+
+bool ProcessFrame(Worker* worker, Session* session, MsgView frame) {
+
+  switch (session -> state) {
+  case SESSION_LOGIN_USER:
+    session -> userName.assign(frame.data, frame.length);
+    session -> state = SESSION_LOGIN_PWD;
     break;
-  case 9:
-    ss << "/\bA programmer goes to do groceries. His wife tells him: \n-- Buy a loaf of bread, and if they have eggs, buy a dozen.\n";
-    ss << " He comes back with thirteen loaves of bread.\n -- 'But why?', she asks.\n --'They had eggs.'" << endl;
+  case SESSION_LOGIN_PWD:
+    // Hashing takes tens of milliseconds: hand it to the pool and resume in CompleteLogin.
+    session -> auth.username = session -> userName;
+    session -> auth.password.assign(frame.data, frame.length);
+    session -> state = SESSION_LOGIN_WAIT;
+    if (worker -> useRing) {
+      session -> pendingOps++;
+    }
+    if (!SubmitAuth(&session -> auth)) {
+      // Every hashing thread is far behind; answer now rather than queue without end.
+      if (worker -> useRing) {
+	session -> pendingOps--;
+      }
+      string busyMsg = LOGIN_BUSY_MSG;
+      QueueFrame(session -> out, busyMsg, 0);
+      cout << "Too busy to check the login of: " << session -> userName << endl;
+      session -> state = SESSION_LOGIN_USER;
+    }
     break;
-  case 10:
-    ss << "/\bSilly chat person, NO JOKE FOR YOU!" << endl;
+  case SESSION_LOGIN_WAIT:
+    // ProcessFrames holds frames back until the login is decided.
     break;
-  default:
-    ss << "/\bSilly chat person, NO JOKE FOR YOU!" << endl;
+  case SESSION_CHAT:
+    cout << "Client Said: ";
+    cout.write(frame.data, frame.length) << endl;
+    if (ViewEquals(frame, "/quit") || ViewEquals(frame, "/close")) {
+      return false;
+    }
+    // Process message and Add to queue
+    SaveMsg(frame.data, frame.length, session -> userName);
     break;
   }
-  
-  return ss.str();
+
+  return true;
 }
 
-string GrabTime(string userName) {
+bool WatchMailbox(Worker* worker, Session* session) {
 
-  stringstream ss;
+  if (worker -> useRing) {
+    ArmMailbox(worker, session);
+    return true;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &session -> mailWatch;
+  return epoll_ctl(worker -> epollFd, EPOLL_CTL_ADD, session -> wakeFd, &ev) == 0;
+}
 
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::iterator got = UsersList.find (userName);
- if (got == UsersList.end() ) {
-    // User not in list
-    ss << "/\bCould not find: " << userName << endl;
- } else {
-   // User was found.
-   if ((got)->second.isConnected) {
-     ss << "/\b" << userName << " has been connected for "
-	<< time(NULL) - (got)->second.timeConnected << " seconds." << endl;
-   } else {
-     ss << "/\b" << userName << " is not connected." << endl;
-   }
- }
- pthread_mutex_unlock(&UserListLock);
+bool FlushSession(Session* session) {
 
-  return ss.str();
+  // EPOLLOUT will tell us when there is room for whatever stays queued.
+  if (FlushFrames(session -> sock, session -> out) == FLUSH_FAILED) {
+    cerr << "Unable to send data. Closing clientSocket: " << session -> sock << "." << endl;
+    return false;
+  }
+
+  return true;
 }
 
-string GrabUsers(string userName) {
+bool DeliverPending(Session* session) {
 
-  stringstream ss;
-  int numOfUsers = 1;
-  ss << "/\bConnected Users: " << endl;
-
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::iterator got = UsersList.begin();
-  for ( ; got != UsersList.end(); got++) {
-    if ((got)->second.isConnected == true) {
-      // Add to list
-      if ((got)->second.username == userName) {
-	ss << numOfUsers++ << ". " << "You" << endl;
-      } else {
-	ss << numOfUsers++ << ". " << (got)->second.username << endl;
+  if (session -> state != SESSION_CHAT) {
+    return true;
+  }
+  if (IsOverflowed(session -> mailbox)) {
+    cerr << "Outbound queue overflowed. Closing clientSocket: " << session -> sock << "." << endl;
+    return false;
+  }
+  // Reset the counter before draining so a message queued meanwhile signals again.
+  // Reset it even when not draining: the mailbox watch is level-triggered.
+  uint64_t count;
+  read(session -> wakeFd, &count, sizeof(count));
+  if (!session -> out.frames.empty()) {
+    // Slow reader: leave the rest where MailboxLimits applies. EventLoop drains
+    // it once the output has gone out.
+    return true;
+  }
+  int numMsgs = 0;
+  vector<long> queuedAt;
+  string msg = GetMsgs(session -> mailbox, &numMsgs, &queuedAt);
+  if (msg.length() != 0) {
+    QueueFrame(session -> out, msg, numMsgs, &queuedAt);
+  }
+  return true;
+}
+
+void ServeUpgrade(int upgradeSock, const vector<int>& listenSocks) {
+
+  // Locals
+  string state;
+  string sessions;
+  vector<int> fds(listenSocks);
+  set<string> connected;
+  uint32_t numSessions = 0;
+
+  int successor = accept(upgradeSock, NULL, NULL);
+  if (successor < 0) {
+    return;
+  }
+  cout << "SERVER: handing over to a new process." << endl;
+  long started = MetricsClock();
+
+  // Every loop stops between events, so nothing below changes under us.
+  RequestPark();
+  for (size_t i = 0; i < Workers.size(); i++) {
+    uint64_t one = 1;
+    write(Workers[i] -> wakeFd, &one, sizeof(one));
+  }
+  WaitForParked(Workers.size());
+
+  for (size_t i = 0; i < Workers.size(); i++) {
+    Worker* worker = Workers[i];
+    for (tr1::unordered_map<int, Session*>::iterator it = worker -> sessions.begin(); it != worker -> sessions.end(); ++it) {
+      Session* session = it->second;
+      PutSession(sessions, fds, session -> sock, session -> state, session -> userName, session -> in, session -> out);
+      if (session -> state == SESSION_CHAT) {
+	connected.insert(session -> userName);
       }
+      numSessions++;
+    }
+    // Accepted, but not yet picked up by the loop.
+    pthread_mutex_lock(&worker -> pendingLock);
+    for (size_t j = 0; j < worker -> pendingSocks.size(); j++) {
+      PutSession(sessions, fds, worker -> pendingSocks[j], SESSION_LOGIN_USER, "", InBuffer(), OutBuffer());
+      numSessions++;
     }
+    pthread_mutex_unlock(&worker -> pendingLock);
+  }
+  PutNumber(state, listenSocks.size());
+  PutDirectory(state, connected);
+  PutNumber(state, numSessions);
+  state.append(sessions);
+
+  if (SendUpgrade(successor, state, fds)) {
+    cout << "SERVER: handed over " << numSessions << " sessions in "
+	 << (MetricsClock() - started) / 1e9 << " s. Exiting." << endl;
+    // No destructors or logouts: other threads are still running and the clients are the successor's now.
+    _exit(0);
   }
-  pthread_mutex_unlock(&UserListLock);
+  cerr << "The new process did not take over; carrying on." << endl;
+  close(successor);
+  ResumeLoops();
+}
 
-  return ss.str();
+void WaitForClient(int listenSock, int upgradeSock, const vector<int>& listenSocks) {
+
+  while (true) {
+    // poll skips a negative descriptor.
+    struct pollfd fds[2];
+    fds[0].fd = listenSock;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = upgradeSock;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    if (poll(fds, 2, -1) < 0) {
+      continue;
+    }
+    if (fds[1].revents & POLLIN) {
+      ServeUpgrade(upgradeSock, listenSocks);
+    }
+    if (fds[0].revents & POLLIN) {
+      return;
+    }
+  }
 }
 
-bool loginUser (string username, string password) {
-  // locals
-  User newUser;
-  newUser.username = username;
-  newUser.password = password;
-  newUser.isConnected = true;
-  newUser.timeConnected = time(NULL);
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::iterator got = UsersList.find (username);
-  if (got == UsersList.end() ) {
-    // User not in list, so let's add them!
-    UsersList.insert (make_pair<string, User> (newUser.username, newUser));
-    pthread_mutex_unlock(&UserListLock);
-    return true;
-  } else {
-    if (got->second.password == password) {
-      if (got->second.isConnected) {
-	// someone else is already connected.
-	pthread_mutex_unlock(&UserListLock);
+void PutSession(string& state, vector<int>& fds, int sock, SessionState sessionState, const string& userName,
+		const InBuffer& in, const OutBuffer& out) {
+
+  PutNumber(state, fds.size());
+  fds.push_back(sock);
+  PutNumber(state, sessionState);
+  PutString(state, userName);
+  // Received bytes not yet parsed, and frames not yet fully sent.
+  PutString(state, in.data == NULL ? string() : string(in.data + in.start, in.end - in.start));
+  PutNumber(state, out.frames.size());
+  PutNumber(state, out.frontSent);
+  for (deque<OutFrame>::const_iterator it = out.frames.begin(); it != out.frames.end(); ++it) {
+    PutString(state, string((const char*) &it -> header, sizeof(it -> header)));
+    PutString(state, it -> body);
+  }
+}
+
+bool AdoptSessions(const string& state, size_t& pos, const vector<int>& fds) {
+
+  // Locals
+  uint32_t numSessions;
+
+  if (!GetNumber(state, pos, numSessions)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numSessions; i++) {
+    uint32_t fdIndex, sessionState, numFrames, frontSent;
+    string userName, input;
+    if (!GetNumber(state, pos, fdIndex) || fdIndex >= fds.size() || !GetNumber(state, pos, sessionState) ||
+	sessionState > SESSION_CHAT || sessionState == SESSION_LOGIN_WAIT || !GetString(state, pos, userName) ||
+	!GetString(state, pos, input) || !GetNumber(state, pos, numFrames) || !GetNumber(state, pos, frontSent)) {
+      return false;
+    }
+
+    Worker* worker = Workers[NextWorker++ % Workers.size()];
+    Session* session = NewSession(worker, fds[fdIndex]);
+    session -> state = (SessionState) sessionState;
+    session -> userName = userName;
+    if (!input.empty()) {
+      session -> in.capacity = max(RECV_CHUNK_SIZE, input.length());
+      session -> in.data = AcquireChunk(session -> in.capacity);
+      memcpy(session -> in.data, input.data(), input.length());
+      session -> in.end = input.length();
+    }
+    for (uint32_t j = 0; j < numFrames; j++) {
+      string header;
+      OutFrame frame;
+      if (!GetString(state, pos, header) || header.length() != sizeof(frame.header) ||
+	  !GetString(state, pos, frame.body)) {
+	ReleaseBuffer(session -> in, true);
+	delete session;
 	return false;
-      } else {
-	// Password matches, and not connected.
-	got->second.isConnected = true;
-	got->second.timeConnected = time(NULL);
-	pthread_mutex_unlock(&UserListLock);
-	return true;
       }
-    } else {
-      pthread_mutex_unlock(&UserListLock);
-      return false;
+      memcpy(&frame.header, header.data(), sizeof(frame.header));
+      session -> out.bytesQueued += FRAME_HEADER_SIZE + frame.body.length() + 1;
+      session -> out.frames.push_back(frame);
     }
+    session -> out.frontSent = frontSent;
+    session -> out.bytesQueued -= frontSent;
+
+    pthread_mutex_lock(&worker -> pendingLock);
+    worker -> adoptedSessions.push_back(session);
+    pthread_mutex_unlock(&worker -> pendingLock);
+    uint64_t one = 1;
+    write(worker -> wakeFd, &one, sizeof(one));
+    Upgrade.sessions++;
   }
+  return true;
 }
 
-void addToUsersList (User newUser) {
-  pthread_mutex_lock(&UserListLock);
-  UsersList.insert (make_pair<string, User> (newUser.username, newUser));
-  pthread_mutex_unlock(&UserListLock);
+void AdoptSession(Worker* worker, Session* session) {
+
+  fcntl(session -> sock, F_SETFL, fcntl(session -> sock, F_GETFL, 0) | O_NONBLOCK);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = &session -> sockWatch;
+  if (epoll_ctl(worker -> epollFd, EPOLL_CTL_ADD, session -> sock, &ev) < 0) {
+    cerr << "Unable to watch clientSocket: " << session -> sock << "." << endl;
+    if (session -> state == SESSION_CHAT) {
+      LogoutUser (session -> userName);
+    }
+    close(session -> sock);
+    ReleaseBuffer(session -> in, true);
+    delete session;
+    return;
+  }
+  worker -> sessions[session -> sock] = session;
+
+  if (session -> state == SESSION_CHAT) {
+    session -> mailbox = GetMailbox(session -> userName);
+    session -> wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (session -> mailbox == NULL || session -> wakeFd < 0 || !WatchMailbox(worker, session)) {
+      cerr << "Unable to watch mailbox for: " << session -> userName << endl;
+      LogoutUser (session -> userName);
+      if (session -> wakeFd >= 0) {
+	close(session -> wakeFd);
+      }
+      session -> state = SESSION_LOGIN_USER;
+      CloseSession(worker, session);
+      return;
+    }
+    // Mail that was waiting when the old process stopped signals right away.
+    AttachMailbox(session -> mailbox, session -> wakeFd);
+  }
+
+  // Frames the old process had not got to; its unsent output goes out ahead of the replies.
+  bool isOpen = ProcessFrames(worker, session) && FlushSession(session) &&
+    DeliverPending(session) && FlushSession(session);
+  if (!isOpen) {
+    CloseSession(worker, session);
+  }
 }
 
-bool doesUserExist (string username) {
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::const_iterator got = UsersList.find (username);
-  if (got == UsersList.end() ) {
-    pthread_mutex_unlock(&UserListLock);
-    return false;
-  } else {
-    pthread_mutex_unlock(&UserListLock);
-    return true;
+void CloseSession(Worker* worker, Session* session) {
+
+  worker -> sessions.erase(session -> sock);
+  ReleaseBuffer(session -> in, true);
+  session -> isClosed = true;
+
+  if (session -> state == SESSION_CHAT) {
+    cout << "Closing Session." << endl;
+    DetachMailbox(session -> mailbox);
+    LeaveAllChannels(session -> userName);
+    LogoutUser (session -> userName);
+    // Announce that user has disconnected
+    AnnouncePresence(session -> userName, false);
   }
-  
+
+  if (worker -> useRing) {
+    // Operations still in flight hold the session; DropOp frees it after the last one.
+    shutdown(session -> sock, SHUT_RDWR);
+    struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+    sqe -> opcode = IORING_OP_ASYNC_CANCEL;
+    sqe -> addr = (uint64_t) (uintptr_t) &session -> sockWatch;
+    sqe -> user_data = (uint64_t) (uintptr_t) &worker -> cancelWatch;
+    if (session -> state == SESSION_CHAT) {
+      sqe = GetSqe(worker -> ring);
+      sqe -> opcode = IORING_OP_ASYNC_CANCEL;
+      sqe -> addr = (uint64_t) (uintptr_t) &session -> mailWatch;
+      sqe -> user_data = (uint64_t) (uintptr_t) &worker -> cancelWatch;
+    }
+    session -> pendingOps++;
+    DropOp(worker, session);
+    return;
+  }
+
+  epoll_ctl(worker -> epollFd, EPOLL_CTL_DEL, session -> sock, NULL);
+  close(session -> sock);
+  if (session -> state == SESSION_CHAT) {
+    epoll_ctl(worker -> epollFd, EPOLL_CTL_DEL, session -> wakeFd, NULL);
+    close(session -> wakeFd);
+  }
+  if (session -> state == SESSION_LOGIN_WAIT) {
+    // The auth pool still holds it; CompleteLogin frees it.
+    return;
+  }
+  worker -> closedSessions.push_back(session);
 }
 
-bool isUserConnected (User newUser) {
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::const_iterator got = UsersList.find (newUser.username);
-  if (got == UsersList.end() ) {
-    pthread_mutex_unlock(&UserListLock);
-    return false;
+void RingLoop(Worker* worker) {
+
+  ArmHandoff(worker);
+  ArmAccept(worker);
+  while (true) {
+    // Submit everything queued and sleep until at least one operation completes.
+    if (SubmitAndWait(worker -> ring, 1) < 0 && errno != EBUSY && errno != EAGAIN) {
+      cerr << "Error waiting on event loop " << worker -> id << "." << endl;
+      break;
+    }
+
+    struct io_uring_cqe* cqe;
+    while ((cqe = PeekCqe(worker -> ring)) != NULL) {
+      Watch* watch = (Watch*) (uintptr_t) cqe -> user_data;
+      int res = cqe -> res;
+      unsigned flags = cqe -> flags;
+      AdvanceCq(worker -> ring);
+      HandleCompletion(worker, watch, res, flags);
+    }
+
+    // Nothing refers to these sessions any more.
+    for (size_t i = 0; i < worker -> closedSessions.size(); i++) {
+      delete worker -> closedSessions[i];
+    }
+    worker -> closedSessions.clear();
+  }
+}
+
+void HandleCompletion(Worker* worker, Watch* watch, int res, unsigned flags) {
+
+  bool isFinal = !(flags & IORING_CQE_F_MORE);
+
+  if (watch -> type == WATCH_CANCEL) {
+    return;
+  }
+  if (watch -> type == WATCH_HANDOFF) {
+    AcceptPending(worker);
+    if (isFinal) {
+      ArmHandoff(worker);
+    }
+    return;
+  }
+  if (watch -> type == WATCH_ACCEPT) {
+    if (res >= 0) {
+      Session* session = NewSession(worker, res);
+      worker -> sessions[res] = session;
+      worker -> accepted++;
+      ArmRecv(worker, session);
+    } else if (res == -EINVAL && worker -> acceptMultishot) {
+      // Kernel predates multishot accept (5.19); take one connection per operation.
+      worker -> acceptMultishot = false;
+    } else if (res != -EAGAIN && res != -EINTR) {
+      cerr << "Error accepting connections." << endl;
+    }
+    if (isFinal) {
+      ArmAccept(worker);
+    }
+    return;
+  }
+
+  Session* session = watch -> session;
+  bool isOpen = true;
+  switch (watch -> type) {
+  case WATCH_SOCKET:
+    if (flags & IORING_CQE_F_BUFFER) {
+      uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      if (res > 0 && !session -> isClosed) {
+	isOpen = ReceiveBytes(worker, session, RingBuffer(worker -> ring, bid), res);
+      }
+      RecycleBuffer(worker -> ring, bid);
+    }
+    if (res == -EINVAL && worker -> recvMultishot) {
+      // Kernel predates multishot receive (6.0); take one buffer per operation.
+      worker -> recvMultishot = false;
+    } else if (res == -ECANCELED && !session -> isClosed) {
+      // Parked by ReceiveBytes; ResumeRecv starts it again.
+    } else if (res == 0 || (res < 0 && res != -ENOBUFS)) {
+      // Peer closed, the socket failed, or we cancelled it.
+      isOpen = false;
+    }
+    if (isFinal) {
+      session -> isRecvArmed = false;
+      DropOp(worker, session);
+      if (isOpen && !session -> isClosed && !session -> isRecvParked) {
+	ArmRecv(worker, session);
+      }
+    }
+    break;
+  case WATCH_MAILBOX:
+    if (!session -> isClosed) {
+      isOpen = DeliverPending(session);
+    }
+    if (isFinal) {
+      DropOp(worker, session);
+      if (res >= 0 && !session -> isClosed) {
+	ArmMailbox(worker, session);
+      }
+    }
+    break;
+  case WATCH_SEND:
+    session -> sendBusy = false;
+    if (res >= 0) {
+      RetireFrames(session -> out, res, session -> sendWanted);
+      // Messages held back while this send was in flight.
+      isOpen = session -> isClosed || DeliverPending(session);
+    } else {
+      isOpen = false;
+    }
+    DropOp(worker, session);
+    break;
+  default:
+    break;
+  }
+
+  if (session -> isClosed) {
+    return;
+  }
+  if (isOpen) {
+    StartSend(worker, session);
   } else {
-    if (got->second.isConnected) {
-      pthread_mutex_unlock(&UserListLock);
+    CloseSession(worker, session);
+  }
+}
+
+void ArmHandoff(Worker* worker) {
+
+  struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+  sqe -> opcode = IORING_OP_POLL_ADD;
+  sqe -> fd = worker -> wakeFd;
+  sqe -> poll32_events = POLLIN;
+  sqe -> len = IORING_POLL_ADD_MULTI;
+  sqe -> user_data = (uint64_t) (uintptr_t) &worker -> wakeWatch;
+}
+
+void ArmAccept(Worker* worker) {
+
+  struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+  sqe -> opcode = IORING_OP_ACCEPT;
+  sqe -> fd = worker -> listenSock;
+  if (worker -> acceptMultishot) {
+    sqe -> ioprio = IORING_ACCEPT_MULTISHOT;
+  }
+  sqe -> user_data = (uint64_t) (uintptr_t) &worker -> acceptWatch;
+}
+
+void ArmRecv(Worker* worker, Session* session) {
+
+  struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+  sqe -> opcode = IORING_OP_RECV;
+  sqe -> fd = session -> sock;
+  sqe -> flags = IOSQE_BUFFER_SELECT;
+  sqe -> buf_group = RING_BUFFER_GROUP;
+  if (worker -> recvMultishot) {
+    sqe -> ioprio = IORING_RECV_MULTISHOT;
+  }
+  sqe -> user_data = (uint64_t) (uintptr_t) &session -> sockWatch;
+  session -> pendingOps++;
+  session -> isRecvArmed = true;
+}
+
+void ResumeRecv(Worker* worker, Session* session) {
+
+  // Locals
+  string held;
+
+  if (!session -> isRecvParked) {
+    return;
+  }
+  session -> isRecvParked = false;
+  held.swap(session -> held);
+  if (!ReceiveBytes(worker, session, held.data(), held.length())) {
+    CloseSession(worker, session);
+    return;
+  }
+  // Parked again if those bytes filled the buffer behind another held frame.
+  if (!session -> isRecvParked && !session -> isRecvArmed) {
+    ArmRecv(worker, session);
+  }
+}
+
+void ArmMailbox(Worker* worker, Session* session) {
+
+  struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+  sqe -> opcode = IORING_OP_POLL_ADD;
+  sqe -> fd = session -> wakeFd;
+  sqe -> poll32_events = POLLIN;
+  sqe -> len = IORING_POLL_ADD_MULTI;
+  sqe -> user_data = (uint64_t) (uintptr_t) &session -> mailWatch;
+  session -> pendingOps++;
+}
+
+void StartSend(Worker* worker, Session* session) {
+
+  if (session -> sendBusy || session -> out.frames.empty()) {
+    return;
+  }
+  // The kernel reads the iovecs when it runs the send, so they live in the session.
+  session -> sendIov.resize(2 * RING_SEND_FRAMES);
+  memset(&session -> sendHdr, 0, sizeof(session -> sendHdr));
+  session -> sendHdr.msg_iov = &session -> sendIov[0];
+  session -> sendHdr.msg_iovlen = GatherFrames(session -> out, &session -> sendIov[0],
+					       RING_SEND_FRAMES, session -> sendWanted);
+
+  struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+  sqe -> opcode = IORING_OP_SENDMSG;
+  sqe -> fd = session -> sock;
+  sqe -> addr = (uint64_t) (uintptr_t) &session -> sendHdr;
+  sqe -> len = 1;
+  sqe -> msg_flags = MSG_NOSIGNAL;
+  sqe -> user_data = (uint64_t) (uintptr_t) &session -> sendWatch;
+  session -> sendBusy = true;
+  session -> pendingOps++;
+}
+
+bool ReceiveBytes(Worker* worker, Session* session, const char* data, size_t length) {
+
+  CountMetric(METRIC_BYTES_IN, length);
+  while (length > 0) {
+    size_t room = session -> held.empty() ? ReserveSpace(session -> in) : 0;
+    if (room == 0) {
+      // Whole frames piled up behind a pending login: keep the rest and stop receiving until it is decided.
+      session -> held.append(data, length);
+      if (!session -> isRecvParked) {
+	session -> isRecvParked = true;
+	struct io_uring_sqe* sqe = GetSqe(worker -> ring);
+	sqe -> opcode = IORING_OP_ASYNC_CANCEL;
+	sqe -> addr = (uint64_t) (uintptr_t) &session -> sockWatch;
+	sqe -> user_data = (uint64_t) (uintptr_t) &worker -> cancelWatch;
+      }
       return true;
-    } else {
-      pthread_mutex_unlock(&UserListLock);
+    }
+    size_t chunk = min(room, length);
+    memcpy(session -> in.data + session -> in.end, data, chunk);
+    session -> in.end += chunk;
+    data += chunk;
+    length -= chunk;
+    if (!ProcessFrames(worker, session)) {
       return false;
     }
   }
+
+  // Idle sessions give their buffer back.
+  ReleaseBuffer(session -> in, false);
+  return true;
 }
 
-void setUserConnected (User newUser) {
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::iterator got = UsersList.find (newUser.username);
-  if (got == UsersList.end() ) {
-    pthread_mutex_unlock(&UserListLock);
-  } else {
-    got->second.isConnected = true;
-    got->second.timeConnected = time(NULL);
-    pthread_mutex_unlock(&UserListLock);
+void DropOp(Worker* worker, Session* session) {
+
+  session -> pendingOps--;
+  if (session -> isClosed && session -> pendingOps == 0) {
+    close(session -> sock);
+    if (session -> wakeFd >= 0) {
+      close(session -> wakeFd);
+    }
+    worker -> closedSessions.push_back(session);
   }
 }
 
-void setUserDisconnected (string username) {
-  pthread_mutex_lock(&UserListLock);
-  tr1::unordered_map<string, User>::iterator got = UsersList.find (username);
-  if (got == UsersList.end() ) {
-    pthread_mutex_unlock(&UserListLock);
+bool hasAuthenticated(int clientSock, InBuffer& in, string &userName, bool &isOpen) {
+
+  // Locals
+  string loginSuccessMsg = "Login Successful!\n";
+  string loginFailureMsg = "Login Failed!\n";
+  string userPwd;
+
+  // Get UserName and Password
+  if (!GetFrame(clientSock, in, userName) || !GetFrame(clientSock, in, userPwd)) {
+    isOpen = false;
+    return false;
+  }
+  
+  // Need to process username and password; this thread waits while the pool hashes it.
+  bool isBusy;
+  if (AuthenticateAndWait (userName, userPwd, isBusy)) {
+    // User Exists and password was successful.
+    // Send message to client
+    SendFrame(clientSock, loginSuccessMsg);
+    cout << "Logged in as: " << userName << endl;
+    return true;
   } else {
-    got->second.isConnected = false;
-    pthread_mutex_unlock(&UserListLock);
+    // User could not login, or the pool was too far behind to check.
+    SendFrame(clientSock, isBusy ? LOGIN_BUSY_MSG : loginFailureMsg);
+    cout << (isBusy ? "Too busy to check the login of: " : "Failed to login as: ") << userName << endl;
+    return false;
+  }
+}
+
+bool GetFrame(int HostSock, InBuffer& in, string& msg) {
+
+  // Retrieve msg
+  MsgView frame;
+  FrameStatus status;
+  while ((status = NextFrame(in, frame)) == FRAME_PARTIAL) {
+    int bytesRecv = RecvFrames(HostSock, in);
+    if (bytesRecv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRecv <= 0) {
+      // Failed to Read for some reason.
+      cerr << "Could not recv bytes. Closing clientSocket: " << HostSock << "." << endl;
+      return false;
+    }
+  }
+  if (status == FRAME_INVALID) {
+    cerr << "Frame too large. Closing clientSocket: " << HostSock << "." << endl;
+    return false;
   }
+
+  msg.assign(frame.data, frame.length);
+  return true;
 }
@@ -0,0 +1,513 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Durable mail for offline users: an append-only log of memory-mapped segment
+// files with a per-user index, replayed at login and compacted in the background.
+
+#include "msgStore.h"
+
+// Instrumentation
+#include "msgMetrics.h"
+
+// Standard Library
+#include<cstring>
+#include<cstdio>
+#include<cstdlib>
+#include<algorithm>
+
+// System Calls
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<unistd.h>
+#include<errno.h>
+
+// GLOBALS
+OfflineStore MailStore = { PTHREAD_MUTEX_INITIALIZER, false, "", DEFAULT_STORE_TTL,
+			   DEFAULT_USER_CAP, DEFAULT_INDEX_CAP, 0, 1, tr1::unordered_map<string, deque<StoreEntry> >(),
+			   deque<Segment>(), -1, NULL, 0, 0, 0, 0 };
+
+size_t PaddedLength(size_t length) {
+  return (length + 7) & ~(size_t) 7;
+}
+
+bool SeqBefore(const StoreEntry& a, const StoreEntry& b) {
+  return a.seq < b.seq;
+}
+
+string SegmentPath(uint32_t id) {
+
+  char name[32];
+  snprintf(name, sizeof(name), "/seg-%08u.log", id);
+  return MailStore.dir + name;
+}
+
+Segment* FindSegment(uint32_t id) {
+
+  for (size_t i = 0; i < MailStore.segments.size(); i++) {
+    if (MailStore.segments[i].id == id) {
+      return &MailStore.segments[i];
+    }
+  }
+  return NULL;
+}
+
+bool OpenActiveSegment(uint32_t id) {
+
+  int fd = open(SegmentPath(id).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  // Zero-filled, so an unwritten tail never reads as a record.
+  if (ftruncate(fd, SEGMENT_SIZE) < 0) {
+    close(fd);
+    return false;
+  }
+  void* map = mmap(NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  MailStore.activeFd = fd;
+  MailStore.activeMap = (char*) map;
+  Segment segment = { id, 0, 0 };
+  MailStore.segments.push_back(segment);
+  return true;
+}
+
+void SealActiveSegment() {
+
+  if (MailStore.activeMap == NULL) {
+    return;
+  }
+  // Pages already written survive a crash of this process; only flush them toward disk.
+  msync(MailStore.activeMap, SEGMENT_SIZE, MS_ASYNC);
+  munmap(MailStore.activeMap, SEGMENT_SIZE);
+  if (ftruncate(MailStore.activeFd, MailStore.segments.back().size) < 0) {
+    // Harmless: the zero tail stops the scan at open.
+  }
+  close(MailStore.activeFd);
+  MailStore.activeMap = NULL;
+  MailStore.activeFd = -1;
+}
+
+bool AppendRecord(RecordType type, const Msg& msg, uint64_t seq, time_t stamp, StoreEntry& entry) {
+
+  size_t length = PaddedLength(sizeof(StoreRecord) + msg.to.length() + msg.from.length() +
+			       msg.msg.length());
+  if (length > SEGMENT_SIZE || msg.to.length() > 0xffff || msg.from.length() > 0xffff) {
+    return false;
+  }
+  if (MailStore.activeMap == NULL || MailStore.segments.back().size + length > SEGMENT_SIZE) {
+    uint32_t nextId = MailStore.segments.empty() ? 1 : MailStore.segments.back().id + 1;
+    SealActiveSegment();
+    if (!OpenActiveSegment(nextId)) {
+      return false;
+    }
+  }
+
+  Segment& active = MailStore.segments.back();
+  char* at = MailStore.activeMap + active.size;
+  StoreRecord record;
+  memset(&record, 0, sizeof(record));
+  record.length = length;
+  record.seq = seq;
+  record.stamp = stamp;
+  record.type = type;
+  record.cmd = msg.cmd;
+  record.toLen = msg.to.length();
+  record.fromLen = msg.from.length();
+  record.msgLen = msg.msg.length();
+  char* body = at + sizeof(StoreRecord);
+  memcpy(body, msg.to.data(), record.toLen);
+  memcpy(body + record.toLen, msg.from.data(), record.fromLen);
+  memcpy(body + record.toLen + record.fromLen, msg.msg.data(), record.msgLen);
+  memcpy(at, &record, sizeof(record));
+  __atomic_store_n((uint32_t*) at, STORE_MAGIC, __ATOMIC_RELEASE);
+
+  entry.segment = active.id;
+  entry.offset = active.size;
+  entry.length = length;
+  entry.seq = seq;
+  entry.stamp = stamp;
+  active.size += length;
+  if (type == RECORD_MSG) {
+    active.liveBytes += length;
+  }
+  return true;
+}
+
+bool ReadRecord(const StoreEntry& entry, Msg& msg, int& fd, uint32_t& fdSegment) {
+
+  // Locals
+  vector<char> copy;
+  const char* at;
+
+  if (MailStore.activeMap != NULL && entry.segment == MailStore.segments.back().id) {
+    at = MailStore.activeMap + entry.offset;
+  } else {
+    if (fd < 0 || fdSegment != entry.segment) {
+      if (fd >= 0) {
+	close(fd);
+      }
+      fdSegment = entry.segment;
+      fd = open(SegmentPath(entry.segment).c_str(), O_RDONLY);
+      if (fd < 0) {
+	return false;
+      }
+    }
+    copy.resize(entry.length);
+    if (pread(fd, &copy[0], entry.length, entry.offset) != (ssize_t) entry.length) {
+      return false;
+    }
+    at = &copy[0];
+  }
+
+  StoreRecord record;
+  memcpy(&record, at, sizeof(record));
+  if (record.magic != STORE_MAGIC || record.length != entry.length) {
+    return false;
+  }
+  const char* body = at + sizeof(StoreRecord);
+  msg.to.assign(body, record.toLen);
+  msg.from.assign(body + record.toLen, record.fromLen);
+  msg.msg.assign(body + record.toLen + record.fromLen, record.msgLen);
+  msg.cmd = (CommandType) record.cmd;
+  return true;
+}
+
+void DropEntry(const StoreEntry& entry) {
+
+  Segment* segment = FindSegment(entry.segment);
+  if (segment != NULL) {
+    segment -> liveBytes -= entry.length;
+  }
+}
+
+bool LoadSegment(uint32_t id, tr1::unordered_set<uint64_t>& loaded) {
+
+  int fd = open(SegmentPath(id).c_str(), O_RDWR);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return false;
+  }
+  size_t fileSize = info.st_size;
+  Segment segment = { id, 0, 0 };
+  MailStore.segments.push_back(segment);
+  if (fileSize == 0) {
+    close(fd);
+    return true;
+  }
+
+  // Mapped only for the scan; the pages are dropped again right after.
+  char* map = (char*) mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  madvise(map, fileSize, MADV_SEQUENTIAL);
+
+  time_t now = time(NULL);
+  size_t offset = 0;
+  while (offset + sizeof(StoreRecord) <= fileSize) {
+    StoreRecord record;
+    memcpy(&record, map + offset, sizeof(record));
+    if (record.magic != STORE_MAGIC || record.length < sizeof(StoreRecord) ||
+	record.length > fileSize - offset) {
+      // End of what was written (or a torn append).
+      break;
+    }
+    string to(map + offset + sizeof(StoreRecord), record.toLen);
+    StoreEntry entry = { id, (uint32_t) offset, record.length, record.seq, (time_t) record.stamp };
+    MailStore.nextSeq = max(MailStore.nextSeq, record.seq + 1);
+    if (record.type == RECORD_MSG) {
+      // A compaction that failed or crashed before deleting the old segments leaves two copies.
+      if (entry.stamp + MailStore.ttl >= now && loaded.insert(record.seq).second) {
+	MailStore.index[to].push_back(entry);
+	MailStore.indexed++;
+	MailStore.segments.back().liveBytes += entry.length;
+      }
+    } else if (record.type == RECORD_ACK) {
+      tr1::unordered_map<string, deque<StoreEntry> >::iterator got = MailStore.index.find(to);
+      if (got != MailStore.index.end()) {
+	deque<StoreEntry> kept;
+	for (size_t i = 0; i < got->second.size(); i++) {
+	  if (got->second[i].seq <= record.seq) {
+	    DropEntry(got->second[i]);
+	    MailStore.indexed--;
+	  } else {
+	    kept.push_back(got->second[i]);
+	  }
+	}
+	got->second.swap(kept);
+      }
+    }
+    offset += record.length;
+  }
+  MailStore.segments.back().size = offset;
+
+  munmap(map, fileSize);
+  if (offset < fileSize && ftruncate(fd, offset) < 0) {
+    // Left as is; the next scan stops at the same place.
+  }
+  close(fd);
+  return true;
+}
+
+bool OpenStore(string dir, long ttl, size_t userCap, size_t indexCap) {
+
+  // Locals
+  vector<uint32_t> ids;
+  tr1::unordered_set<uint64_t> loaded;
+
+  if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+    return false;
+  }
+  DIR* listing = opendir(dir.c_str());
+  if (listing == NULL) {
+    return false;
+  }
+  struct dirent* file;
+  while ((file = readdir(listing)) != NULL) {
+    unsigned id;
+    char tail;
+    if (sscanf(file -> d_name, "seg-%8u.lo%c", &id, &tail) == 2 && tail == 'g') {
+      ids.push_back(id);
+    }
+  }
+  closedir(listing);
+  sort(ids.begin(), ids.end());
+
+  pthread_mutex_lock(&MailStore.lock);
+  MailStore.dir = dir;
+  MailStore.ttl = ttl;
+  MailStore.userCap = userCap;
+  MailStore.indexCap = indexCap;
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (!LoadSegment(ids[i], loaded)) {
+      pthread_mutex_unlock(&MailStore.lock);
+      return false;
+    }
+  }
+
+  // Compaction copies can land after newer records, so order each queue by seq.
+  tr1::unordered_map<string, deque<StoreEntry> >::iterator got = MailStore.index.begin();
+  while (got != MailStore.index.end()) {
+    deque<StoreEntry>& entries = got->second;
+    sort(entries.begin(), entries.end(), SeqBefore);
+    while (entries.size() > userCap) {
+      DropEntry(entries.front());
+      entries.pop_front();
+      MailStore.indexed--;
+    }
+    if (entries.empty()) {
+      got = MailStore.index.erase(got);
+    } else {
+      got++;
+    }
+  }
+
+  // Appends always go to a fresh segment.
+  uint32_t nextId = ids.empty() ? 1 : ids.back() + 1;
+  if (!OpenActiveSegment(nextId)) {
+    pthread_mutex_unlock(&MailStore.lock);
+    return false;
+  }
+  MailStore.isOpen = true;
+  pthread_mutex_unlock(&MailStore.lock);
+
+  pthread_t compactId;
+  if (pthread_create(&compactId, NULL, compactThread, NULL) != 0) {
+    return false;
+  }
+  pthread_detach(compactId);
+  return true;
+}
+
+bool StoreOffline(const Msg& newMsg) {
+
+  pthread_mutex_lock(&MailStore.lock);
+  if (MailStore.indexed >= MailStore.indexCap) {
+    MailStore.dropped++;
+    pthread_mutex_unlock(&MailStore.lock);
+    return true;
+  }
+  StoreEntry entry;
+  bool isStored = AppendRecord(RECORD_MSG, newMsg, MailStore.nextSeq, time(NULL), entry);
+  if (isStored) {
+    MailStore.nextSeq++;
+    MailStore.appended++;
+    deque<StoreEntry>& entries = MailStore.index[newMsg.to];
+    entries.push_back(entry);
+    MailStore.indexed++;
+    if (entries.size() > MailStore.userCap) {
+      DropEntry(entries.front());
+      entries.pop_front();
+      MailStore.indexed--;
+      MailStore.dropped++;
+    }
+  }
+  pthread_mutex_unlock(&MailStore.lock);
+  return isStored;
+}
+
+int ReplayOffline(string username, Mailbox* mailbox) {
+
+  // Locals
+  int delivered = 0;
+  int fd = -1;
+  uint32_t fdSegment = 0;
+
+  pthread_mutex_lock(&MailStore.lock);
+  tr1::unordered_map<string, deque<StoreEntry> >::iterator got = MailStore.index.find(username);
+  if (got == MailStore.index.end()) {
+    pthread_mutex_unlock(&MailStore.lock);
+    return 0;
+  }
+
+  time_t now = time(NULL);
+  uint64_t lastSeq = 0;
+  deque<StoreEntry>& entries = got->second;
+  size_t taken = 0;
+  for ( ; taken < entries.size(); taken++) {
+    Msg* waiting = new Msg;
+    bool isLive = entries[taken].stamp + MailStore.ttl >= now && ReadRecord(entries[taken], *waiting, fd, fdSegment);
+    if (isLive && MsgCost(*waiting) > MailboxLimits.maxBytes) {
+      // No mailbox will ever take it; waiting for the next login would hold back the rest for good.
+      isLive = false;
+    }
+    if (isLive) {
+      // Waiting on disk doesn't count against delivery; the clock starts at replay.
+      waiting->queuedAt = MetricsClock();
+      if (!TryAddToMailbox(mailbox, MsgRef(waiting))) {
+	// The mailbox is full, and making room would drop what was just replayed. The ack covers
+	// everything up to its seq, so this one and the ones after it wait for the next login.
+	break;
+      }
+      Bump(LocalMetrics().enqueued[waiting->cmd], 1);
+      delivered++;
+    } else {
+      delete waiting;
+      MailStore.dropped++;
+    }
+    lastSeq = max(lastSeq, entries[taken].seq);
+    DropEntry(entries[taken]);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  // Without the ack a restart would deliver them again.
+  if (taken > 0) {
+    Msg ack;
+    ack.to = username;
+    ack.cmd = CMD_UNKNOWN;
+    StoreEntry ackEntry;
+    AppendRecord(RECORD_ACK, ack, lastSeq, now, ackEntry);
+  }
+  entries.erase(entries.begin(), entries.begin() + taken);
+  MailStore.indexed -= taken;
+  if (entries.empty()) {
+    MailStore.index.erase(got);
+  }
+  MailStore.replayed += delivered;
+  pthread_mutex_unlock(&MailStore.lock);
+  return delivered;
+}
+
+void ExpireOffline() {
+
+  pthread_mutex_lock(&MailStore.lock);
+  time_t now = time(NULL);
+  tr1::unordered_map<string, deque<StoreEntry> >::iterator got = MailStore.index.begin();
+  while (got != MailStore.index.end()) {
+    deque<StoreEntry>& entries = got->second;
+    while (!entries.empty() && entries.front().stamp + MailStore.ttl < now) {
+      DropEntry(entries.front());
+      entries.pop_front();
+      MailStore.indexed--;
+      MailStore.dropped++;
+    }
+    if (entries.empty()) {
+      got = MailStore.index.erase(got);
+    } else {
+      got++;
+    }
+  }
+  pthread_mutex_unlock(&MailStore.lock);
+}
+
+void CompactStore() {
+
+  pthread_mutex_lock(&MailStore.lock);
+
+  // Sealed segments at the front with nothing live go first; acks in them only
+  // cover messages that are gone too.
+  while (MailStore.segments.size() > 1 && MailStore.segments.front().liveBytes == 0) {
+    unlink(SegmentPath(MailStore.segments.front().id).c_str());
+    MailStore.segments.pop_front();
+  }
+
+  size_t sealedBytes = 0;
+  size_t sealedLive = 0;
+  uint32_t activeId = MailStore.segments.back().id;
+  for (size_t i = 0; i + 1 < MailStore.segments.size(); i++) {
+    sealedBytes += MailStore.segments[i].size;
+    sealedLive += MailStore.segments[i].liveBytes;
+  }
+  if (sealedBytes == 0 || sealedLive * 2 > sealedBytes) {
+    pthread_mutex_unlock(&MailStore.lock);
+    return;
+  }
+
+  // Mostly dead: copy what is still waiting to the end of the log, keeping seq and stamp.
+  int fd = -1;
+  uint32_t fdSegment = 0;
+  bool isCopied = true;
+  tr1::unordered_map<string, deque<StoreEntry> >::iterator got = MailStore.index.begin();
+  for ( ; got != MailStore.index.end() && isCopied; got++) {
+    deque<StoreEntry>& entries = got->second;
+    for (size_t i = 0; i < entries.size() && isCopied; i++) {
+      if (entries[i].segment >= activeId) {
+	continue;
+      }
+      Msg waiting;
+      StoreEntry moved;
+      isCopied = ReadRecord(entries[i], waiting, fd, fdSegment) &&
+	AppendRecord(RECORD_MSG, waiting, entries[i].seq, entries[i].stamp, moved);
+      if (isCopied) {
+	DropEntry(entries[i]);
+	entries[i] = moved;
+      }
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  // Nothing points into the old segments any more.
+  while (isCopied && MailStore.segments.front().id < activeId) {
+    unlink(SegmentPath(MailStore.segments.front().id).c_str());
+    MailStore.segments.pop_front();
+  }
+  MailStore.compactions++;
+  pthread_mutex_unlock(&MailStore.lock);
+}
+
+void* compactThread(void* args_p) {
+
+  while (true) {
+    sleep(COMPACT_INTERVAL);
+    ExpireOffline();
+    CompactStore();
+  }
+  return NULL;
+}
@@ -0,0 +1,174 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Durable mail for offline users: an append-only log of memory-mapped segment
+// files with a per-user index, replayed at login and compacted in the background.
+
+#ifndef MSGSTORE_H
+#define MSGSTORE_H
+
+// Standard Library
+#include<string>
+#include<deque>
+#include<vector>
+#include<tr1/unordered_map>
+#include<tr1/unordered_set>
+#include<ctime>
+#include<stdint.h>
+
+// Multithreading
+#include<pthread.h>
+
+// User Directory
+#include "msgUsers.h"
+
+using namespace std;
+
+// DATA TYPES
+enum RecordType {
+  RECORD_MSG = 1,
+  // Everything for record "to" up to and including seq has been delivered.
+  RECORD_ACK = 2
+};
+
+// On disk, followed by to, from and msg and padded to 8 bytes.
+// magic is written last, so a torn append is never mistaken for a record.
+struct StoreRecord {
+  uint32_t magic;
+  uint32_t length;
+  uint64_t seq;
+  int64_t stamp;
+  uint8_t type;
+  uint8_t cmd;
+  uint16_t toLen;
+  uint16_t fromLen;
+  uint16_t pad;
+  uint32_t msgLen;
+  uint32_t pad2;
+};
+
+// Where one waiting message lives. Each one costs 32 bytes of RAM on a 64-bit build (deque blocks
+// amortize to that), plus about 600 bytes per user with anything waiting (the index node, the
+// name and the deque's first block).
+struct StoreEntry {
+  uint32_t segment;
+  uint32_t offset;
+  uint32_t length;
+  uint64_t seq;
+  time_t stamp;
+};
+
+struct Segment {
+  uint32_t id;
+  size_t size;
+  size_t liveBytes;
+};
+
+struct OfflineStore {
+  pthread_mutex_t lock;
+  bool isOpen;
+  string dir;
+  long ttl;
+  size_t userCap;
+  // Entries across every user's queue; new mail is dropped once it reaches indexCap.
+  size_t indexCap;
+  size_t indexed;
+  uint64_t nextSeq;
+  tr1::unordered_map<string, deque<StoreEntry> > index;
+  // Oldest first; the last one is the active segment.
+  deque<Segment> segments;
+  int activeFd;
+  char* activeMap;
+  long appended;
+  long replayed;
+  long dropped;
+  long compactions;
+};
+
+// GLOBALS
+const uint32_t STORE_MAGIC = 0x4d534731;   // "MSG1"
+const size_t SEGMENT_SIZE = 4 * 1024 * 1024;
+const long DEFAULT_STORE_TTL = 7 * 24 * 3600;
+const size_t DEFAULT_USER_CAP = 1000;
+// About 32 MB of index.
+const size_t DEFAULT_INDEX_CAP = 1000000;
+const int COMPACT_INTERVAL = 10;
+extern OfflineStore MailStore;
+
+// Function Prototypes
+string SegmentPath(uint32_t id);
+// Function names the file that holds a segment.
+// pre: MailStore.dir should be set.
+// post: none
+
+Segment* FindSegment(uint32_t id);
+// Function looks up a segment by id.
+// pre: MailStore.lock should be held.
+// post: returns NULL for deleted segments.
+
+bool OpenActiveSegment(uint32_t id);
+// Function creates a SEGMENT_SIZE segment file, maps it and makes it the one appends go to.
+// pre: MailStore.lock should be held.
+// post: returns false if the file could not be created or mapped.
+
+void SealActiveSegment();
+// Function unmaps the active segment and trims its file to what was written.
+// pre: MailStore.lock should be held.
+// post: nothing is mapped.
+
+bool AppendRecord(RecordType type, const Msg& msg, uint64_t seq, time_t stamp, StoreEntry& entry);
+// Function writes one record at the end of the active segment, starting a new one when it is full.
+// pre: MailStore.lock should be held.
+// post: entry says where the record went.
+
+bool ReadRecord(const StoreEntry& entry, Msg& msg, int& fd, uint32_t& fdSegment);
+// Function reads a message back from its segment.
+// pre: MailStore.lock should be held. fd/fdSegment cache an open sealed segment between calls.
+// post: the caller closes fd when done.
+
+void DropEntry(const StoreEntry& entry);
+// Function marks a record's bytes dead.
+// pre: MailStore.lock should be held.
+// post: none
+
+bool LoadSegment(uint32_t id, tr1::unordered_set<uint64_t>& loaded);
+// Function replays one segment file into the index while the store opens.
+// pre: MailStore.lock should be held. Segments must be loaded oldest first; loaded holds the seq of
+//      every message indexed from the ones before.
+// post: a torn tail is trimmed off the file. A compaction copy of a message already indexed is skipped.
+
+bool OpenStore(string dir, long ttl, size_t userCap, size_t indexCap);
+// Function opens (or creates) the store in dir, rebuilds the index and starts compaction.
+// pre: dir should be writable.
+// post: returns false if the store could not be opened; offline mail then stays in memory.
+
+bool StoreOffline(const Msg& newMsg);
+// Function appends a message for an offline user.
+// pre: the recipient's mailbox -> storing should count it, so a login's replay waits for it.
+// post: the oldest waiting message is dropped if the user is over the cap. With indexCap entries
+//       already waiting, the message itself is dropped; it still returns true, since falling back
+//       to memory would only move the growth there.
+
+int ReplayOffline(string username, Mailbox* mailbox);
+// Function moves a user's waiting messages into their mailbox, oldest first.
+// pre: no shard lock should be held; see ReplayStored.
+// post: the messages the mailbox took are acknowledged in the log; returns how many it took. From
+//       the first one it turns away, the rest stay stored for the next login.
+
+void ExpireOffline();
+// Function drops waiting messages older than the TTL.
+// pre: none
+// post: none
+
+void CompactStore();
+// Function rewrites live messages out of sealed segments once most of their bytes are dead.
+// pre: none
+// post: segments with nothing live left are deleted.
+
+void* compactThread(void* args_p);
+// Function runs ExpireOffline and CompactStore every COMPACT_INTERVAL seconds.
+// pre: none
+// post: none
+
+#endif
@@ -0,0 +1,349 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Hot upgrades. A new server process connects to the running one over a Unix socket
+// and is handed the listening sockets, every client connection (SCM_RIGHTS) and the user
+// directory with its mailboxes, so a new binary goes live without a client noticing.
+
+#include "msgUpgrade.h"
+
+// User Directory
+#include "msgUsers.h"
+#include "msgChannels.h"
+
+// Cluster Routing
+#include "msgCluster.h"
+
+// Standard Library
+#include<cstring>
+#include<algorithm>
+
+// Network Functions
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/time.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+#include<errno.h>
+
+// GLOBALS
+UpgradeState Upgrade = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0 };
+
+bool UpgradeAddress(const string& path, struct sockaddr_un& address) {
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.length() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return true;
+}
+
+int OpenUpgradeListener(const string& path) {
+
+  // Locals
+  struct sockaddr_un address;
+
+  if (!UpgradeAddress(path, address)) {
+    return -1;
+  }
+  // Nobody answered on it, so whatever is there was left by a server that is gone.
+  unlink(path.c_str());
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    return -1;
+  }
+  if (bind(sock, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(sock, 1) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+int ConnectUpgrade(const string& path) {
+
+  // Locals
+  struct sockaddr_un address;
+
+  if (!UpgradeAddress(path, address)) {
+    return -1;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr*) &address, sizeof(address)) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+bool WriteAll(int sock, const char* data, size_t length) {
+
+  while (length > 0) {
+    ssize_t sent = send(sock, data, length, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool ReadAll(int sock, char* data, size_t length) {
+
+  while (length > 0) {
+    ssize_t got = recv(sock, data, length, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    data += got;
+    length -= got;
+  }
+  return true;
+}
+
+bool SendUpgrade(int sock, const string& state, const vector<int>& fds) {
+
+  // Locals
+  uint32_t header[2] = { htonl(state.length()), htonl(fds.size()) };
+  char control[CMSG_SPACE(UPGRADE_FDS_PER_MSG * sizeof(int))];
+  char reply = 0;
+
+  // The clients are frozen meanwhile: a successor that stalls is given up on.
+  struct timeval timeout = { UPGRADE_TIMEOUT, 0 };
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (!WriteAll(sock, (const char*) header, sizeof(header)) || !WriteAll(sock, state.data(), state.length())) {
+    return false;
+  }
+
+  // Each batch of descriptors rides on one byte of its own.
+  for (size_t i = 0; i < fds.size(); i += UPGRADE_FDS_PER_MSG) {
+    size_t batch = min(fds.size() - i, (size_t) UPGRADE_FDS_PER_MSG);
+    char tag = 'F';
+    struct iovec iov = { &tag, 1 };
+    struct msghdr msg = msghdr();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(batch * sizeof(int));
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg -> cmsg_level = SOL_SOCKET;
+    cmsg -> cmsg_type = SCM_RIGHTS;
+    cmsg -> cmsg_len = CMSG_LEN(batch * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fds[i], batch * sizeof(int));
+    ssize_t sent;
+    do {
+      sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != 1) {
+      return false;
+    }
+  }
+
+  if (!ReadAll(sock, &reply, 1) || reply != UPGRADE_RECEIVED) {
+    return false;
+  }
+  reply = UPGRADE_COMMIT;
+  return WriteAll(sock, &reply, 1);
+}
+
+bool ReceiveUpgrade(int sock, string& state, vector<int>& fds) {
+
+  // Locals
+  uint32_t header[2];
+  char control[CMSG_SPACE(UPGRADE_FDS_PER_MSG * sizeof(int))];
+  char reply = UPGRADE_RECEIVED;
+  bool isTaken = ReadAll(sock, (char*) header, sizeof(header));
+
+  if (isTaken) {
+    state.resize(ntohl(header[0]));
+    isTaken = state.empty() || ReadAll(sock, &state[0], state.length());
+  }
+  while (isTaken && fds.size() < ntohl(header[1])) {
+    char tag;
+    struct iovec iov = { &tag, 1 };
+    struct msghdr msg = msghdr();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(sock, &msg, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    for (struct cmsghdr* cmsg = got == 1 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SCM_RIGHTS) {
+	int* passed = (int*) CMSG_DATA(cmsg);
+	fds.insert(fds.end(), passed, passed + (cmsg -> cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      }
+    }
+    // Truncated control data means descriptors were lost, most likely to RLIMIT_NOFILE.
+    isTaken = got == 1 && !(msg.msg_flags & MSG_CTRUNC);
+  }
+
+  // Say everything arrived, then wait for the go-ahead and for the old server to be gone.
+  isTaken = isTaken && WriteAll(sock, &reply, 1) && ReadAll(sock, &reply, 1) && reply == UPGRADE_COMMIT;
+  if (isTaken) {
+    ssize_t got;
+    while ((got = read(sock, &reply, 1)) != 0 && (got > 0 || errno == EINTR)) {
+    }
+  }
+  close(sock);
+
+  if (!isTaken) {
+    // The old server still has its own copies; these are only duplicates.
+    for (size_t i = 0; i < fds.size(); i++) {
+      close(fds[i]);
+    }
+    fds.clear();
+  }
+  return isTaken;
+}
+
+void PutDirectory(string& out, const set<string>& connected) {
+
+  // Locals
+  string users;
+  uint32_t numUsers = 0;
+
+  for (int i = 0; i < USER_SHARDS; i++) {
+    UserShard& shard = UsersList[i];
+    ReadLockShard(shard);
+    for (tr1::unordered_map<string, User>::const_iterator it = shard.users.begin(); it != shard.users.end(); ++it) {
+      const User& user = it->second;
+      PutString(users, user.username);
+      PutString(users, user.passwordHash);
+      PutNumber(users, user.timeConnected);
+      PutNumber(users, connected.count(user.username));
+      PutNumber(users, user.wantsPresence);
+      PutString(users, user.channel);
+      PutNumber(users, user.channels.size());
+      for (size_t j = 0; j < user.channels.size(); j++) {
+	PutString(users, user.channels[j]);
+      }
+      LockMailbox(user.mailbox);
+      PutNumber(users, user.mailbox -> msgs.size());
+      for (size_t j = 0; j < user.mailbox -> msgs.size(); j++) {
+	PutMsg(users, *user.mailbox -> msgs[j]);
+      }
+      pthread_mutex_unlock(&user.mailbox -> lock);
+      numUsers++;
+    }
+    pthread_rwlock_unlock(&shard.lock);
+  }
+
+  PutNumber(out, numUsers);
+  out.append(users);
+}
+
+bool RestoreDirectory(const string& state, size_t& pos) {
+
+  // Locals
+  uint32_t numUsers;
+
+  if (!GetNumber(state, pos, numUsers)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numUsers; i++) {
+    User user;
+    uint32_t timeConnected, isConnected, wantsPresence, numChannels, numMsgs;
+    if (!GetString(state, pos, user.username) || !GetString(state, pos, user.passwordHash) ||
+	!GetNumber(state, pos, timeConnected) || !GetNumber(state, pos, isConnected) ||
+	!GetNumber(state, pos, wantsPresence) || !GetString(state, pos, user.channel) ||
+	!GetNumber(state, pos, numChannels)) {
+      return false;
+    }
+    vector<string> channels(min(numChannels, (uint32_t) (state.length() - pos)));
+    for (size_t j = 0; j < channels.size(); j++) {
+      if (!GetString(state, pos, channels[j])) {
+	return false;
+      }
+    }
+    user.timeConnected = timeConnected;
+    user.isConnected = isConnected != 0;
+    user.wantsPresence = wantsPresence != 0;
+    user.node = LocalNode;
+    user.mailbox = NewMailbox();
+
+    // Messages waiting when the old server stopped, in the order they were queued.
+    if (!GetNumber(state, pos, numMsgs)) {
+      return false;
+    }
+    for (uint32_t j = 0; j < numMsgs; j++) {
+      Msg msg;
+      if (!GetMsg(state, pos, msg)) {
+	return false;
+      }
+      addToMailbox(user.mailbox, MsgRef(new Msg(msg)));
+    }
+
+    // The channel index is rebuilt by joining again; the current channel is put back after.
+    string current = user.channel;
+    user.channel.clear();
+    addToUsersList(user);
+    for (size_t j = 0; j < channels.size(); j++) {
+      JoinChannel(user.username, channels[j]);
+    }
+    UserShard& shard = ShardFor(user.username);
+    WriteLockShard(shard);
+    shard.users[user.username].channel = current;
+    pthread_rwlock_unlock(&shard.lock);
+    Upgrade.users++;
+  }
+  return true;
+}
+
+bool UpgradeWanted() {
+
+  return __sync_fetch_and_add(&Upgrade.isWanted, 0) != 0;
+}
+
+void ParkLoop() {
+
+  pthread_mutex_lock(&Upgrade.lock);
+  Upgrade.parked++;
+  pthread_cond_broadcast(&Upgrade.changed);
+  while (Upgrade.isWanted) {
+    pthread_cond_wait(&Upgrade.changed, &Upgrade.lock);
+  }
+  Upgrade.parked--;
+  pthread_mutex_unlock(&Upgrade.lock);
+}
+
+void RequestPark() {
+
+  pthread_mutex_lock(&Upgrade.lock);
+  __sync_lock_test_and_set(&Upgrade.isWanted, 1);
+  pthread_mutex_unlock(&Upgrade.lock);
+}
+
+void WaitForParked(int numLoops) {
+
+  pthread_mutex_lock(&Upgrade.lock);
+  while (Upgrade.parked < numLoops) {
+    pthread_cond_wait(&Upgrade.changed, &Upgrade.lock);
+  }
+  pthread_mutex_unlock(&Upgrade.lock);
+}
+
+void ResumeLoops() {
+
+  pthread_mutex_lock(&Upgrade.lock);
+  __sync_lock_test_and_set(&Upgrade.isWanted, 0);
+  pthread_cond_broadcast(&Upgrade.changed);
+  pthread_mutex_unlock(&Upgrade.lock);
+}
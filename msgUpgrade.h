@@ -0,0 +1,125 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: Hot upgrades. A new server process connects to the running one over a Unix socket
+// and is handed the listening sockets, every client connection (SCM_RIGHTS) and the user
+// directory with its mailboxes, so a new binary goes live without a client noticing.
+
+#ifndef MSGUPGRADE_H
+#define MSGUPGRADE_H
+
+// Standard Library
+#include<string>
+#include<vector>
+#include<set>
+#include<stdint.h>
+
+// Network Functions
+#include<sys/un.h>
+
+// Multithreading
+#include<pthread.h>
+
+using namespace std;
+
+// DATA TYPES
+// The successor sends one byte once it holds everything; the old process answers with one more
+// before it exits. Without that last byte the old process carried on, and so must the successor.
+enum UpgradeReply {
+  UPGRADE_RECEIVED = 'R',
+  UPGRADE_COMMIT = 'C'
+};
+
+struct UpgradeState {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  // Set while a successor is being handed the server; event loops park once no login is pending.
+  int isWanted;
+  int parked;
+  // Taken over from the previous process.
+  long sessions;
+  long users;
+  double seconds;
+};
+
+// GLOBALS
+// Descriptors passed per sendmsg; the kernel takes at most 253.
+const int UPGRADE_FDS_PER_MSG = 250;
+// How long the old process waits for its successor before carrying on by itself.
+const int UPGRADE_TIMEOUT = 10;
+extern UpgradeState Upgrade;
+
+// Function Prototypes
+bool UpgradeAddress(const string& path, struct sockaddr_un& address);
+// Function fills in the address of the Unix socket at path.
+// pre: none
+// post: returns false if path is empty or too long.
+
+int OpenUpgradeListener(const string& path);
+// Function listens on the Unix socket path for the process that will replace this one.
+// pre: nothing else should be listening on path.
+// post: returns -1 on failure.
+
+int ConnectUpgrade(const string& path);
+// Function connects to the server running on the Unix socket path.
+// pre: none
+// post: returns -1 if no server is listening there.
+
+bool SendUpgrade(int sock, const string& state, const vector<int>& fds);
+// Function passes the serialized state and the descriptors to a successor and waits for it to take them.
+// pre: every event loop should be parked.
+// post: returns true once the successor has confirmed and been told to go ahead; this process
+//       must then exit without touching the clients again. On false the successor gave up.
+
+bool ReceiveUpgrade(int sock, string& state, vector<int>& fds);
+// Function takes the state and descriptors from the running server and waits for it to exit.
+// pre: sock should come from ConnectUpgrade.
+// post: returns false, closing whatever was received, if the old server carried on instead.
+
+bool WriteAll(int sock, const char* data, size_t length);
+// Function writes a whole buffer to a blocking socket.
+// pre: none
+// post: returns false if the socket failed.
+
+bool ReadAll(int sock, char* data, size_t length);
+// Function reads exactly length bytes from a blocking socket.
+// pre: none
+// post: returns false if the socket failed or closed first.
+
+void PutDirectory(string& out, const set<string>& connected);
+// Function appends every user in the directory with their settings, channels and queued messages.
+// pre: connected should name the users whose sessions are being handed over.
+// post: everyone else is written out as disconnected.
+
+bool RestoreDirectory(const string& state, size_t& pos);
+// Function rebuilds the directory, channel index and mailboxes written by PutDirectory.
+// pre: the directory should be empty.
+// post: returns false if the state is cut short.
+
+bool UpgradeWanted();
+// Function tells an event loop whether a successor is waiting for it to park.
+// pre: none
+// post: none
+
+void ParkLoop();
+// Function blocks the calling event loop until the hand-over is done or abandoned.
+// pre: the loop should have no login waiting on the auth pool.
+// post: returns only if the hand-over was abandoned.
+
+void RequestPark();
+// Function asks every event loop to park at its next wakeup.
+// pre: none
+// post: the caller should wake each loop.
+
+void WaitForParked(int numLoops);
+// Function waits until numLoops event loops have parked.
+// pre: RequestPark should have been called.
+// post: none
+
+void ResumeLoops();
+// Function lets parked event loops carry on after a failed hand-over.
+// pre: none
+// post: Upgrade.isWanted is cleared.
+
+#endif
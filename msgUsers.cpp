@@ -0,0 +1,510 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: The user directory and per-user mailboxes shared by every server mode.
+
+#include "msgUsers.h"
+
+// Offline Mail
+#include "msgStore.h"
+
+// Saved Accounts
+#include "msgAccounts.h"
+
+// Instrumentation
+#include "msgMetrics.h"
+
+// Standard Library
+#include<stdint.h>
+#include<algorithm>
+
+// Network Functions
+#include<unistd.h>
+
+// GLOBALS
+UserShard UsersList[USER_SHARDS];
+int LocalNode = 0;
+QueueLimits MailboxLimits = { DEFAULT_QUEUE_MSGS, DEFAULT_QUEUE_BYTES, OVERFLOW_DROP_PRESENCE };
+QueueStats QueueCounters = { 0, 0, 0 };
+
+int InitUsersList() {
+  for (int i = 0; i < USER_SHARDS; i++) {
+    pthread_rwlock_init(&UsersList[i].lock, NULL);
+  }
+  return 0;
+}
+int UserStatus = InitUsersList();
+
+UserShard& ShardFor(const string& username) {
+  static tr1::hash<string> hashName;
+  return UsersList[hashName(username) % USER_SHARDS];
+}
+
+void ReadLockShard(UserShard& shard) {
+  // Uncontended locks cost no clock reads.
+  if (pthread_rwlock_tryrdlock(&shard.lock) == 0) {
+    return;
+  }
+  long start = MetricsClock();
+  pthread_rwlock_rdlock(&shard.lock);
+  CountMetric(METRIC_SHARD_WAITS, 1);
+  CountMetric(METRIC_SHARD_WAIT_NS, MetricsClock() - start);
+}
+
+void WriteLockShard(UserShard& shard) {
+  if (pthread_rwlock_trywrlock(&shard.lock) == 0) {
+    return;
+  }
+  long start = MetricsClock();
+  pthread_rwlock_wrlock(&shard.lock);
+  CountMetric(METRIC_SHARD_WAITS, 1);
+  CountMetric(METRIC_SHARD_WAIT_NS, MetricsClock() - start);
+}
+
+void LockMailbox(Mailbox* mailbox) {
+  if (pthread_mutex_trylock(&mailbox -> lock) == 0) {
+    return;
+  }
+  long start = MetricsClock();
+  pthread_mutex_lock(&mailbox -> lock);
+  CountMetric(METRIC_MAILBOX_WAITS, 1);
+  CountMetric(METRIC_MAILBOX_WAIT_NS, MetricsClock() - start);
+}
+
+void addToMsgQueue(Msg newMsg) {
+  newMsg.queuedAt = MetricsClock();
+  UserShard& shard = ShardFor(newMsg.to);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (newMsg.to);
+  if (got == shard.users.end() ) {
+    // A saved account nobody has used since the restart.
+    pthread_rwlock_unlock(&shard.lock);
+    if (!LoadSavedUser(newMsg.to)) {
+      return;
+    }
+    ReadLockShard(shard);
+    got = shard.users.find (newMsg.to);
+  }
+  Mailbox* mailbox = got->second.mailbox;
+  bool isOffline = !got->second.isConnected && MailStore.isOpen;
+  if (isOffline) {
+    // Counted before the shard is unlocked, so a login cannot replay before the message is in the log.
+    LockMailbox(mailbox);
+    mailbox -> storing++;
+    pthread_mutex_unlock(&mailbox -> lock);
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  if (isOffline) {
+    bool isStored = StoreOffline(newMsg);
+    LockMailbox(mailbox);
+    if (--mailbox -> storing == 0) {
+      pthread_cond_broadcast(&mailbox -> stored);
+    }
+    pthread_mutex_unlock(&mailbox -> lock);
+    if (isStored) {
+      return;
+    }
+  }
+  if (addToMailbox(mailbox, MsgRef(new Msg(newMsg)))) {
+    Bump(LocalMetrics().enqueued[newMsg.cmd], 1);
+  }
+}
+
+void addToMailboxes(const vector<Mailbox*>& mailboxes, MsgRef newMsg, Mailbox* except) {
+  long queued = 0;
+  for (size_t i = 0; i < mailboxes.size(); i++) {
+    if (mailboxes[i] == except) {
+      continue;
+    }
+    queued += addToMailbox(mailboxes[i], newMsg) ? 1 : 0;
+  }
+  Bump(LocalMetrics().enqueued[newMsg -> cmd], queued);
+}
+
+vector<Mailbox*> GetConnectedMailboxes(string exceptUser, bool presenceOnly) {
+  vector<Mailbox*> mailboxes;
+  for (int shard = 0; shard < USER_SHARDS; shard++) {
+    ReadLockShard(UsersList[shard]);
+    tr1::unordered_map<string, User>::const_iterator got = UsersList[shard].users.begin();
+    for ( ; got != UsersList[shard].users.end(); got++) {
+      if (got->second.isConnected && got->second.node == LocalNode && got->second.username != exceptUser &&
+	  (got->second.wantsPresence || !presenceOnly)) {
+	mailboxes.push_back(got->second.mailbox);
+      }
+    }
+    pthread_rwlock_unlock(&UsersList[shard].lock);
+  }
+  return mailboxes;
+}
+
+size_t MsgCost(const Msg& msg) {
+  // Roughly what it becomes on the wire once GetMsgs formats it.
+  return MSG_FORMAT_OVERHEAD + msg.from.length() + msg.msg.length();
+}
+
+bool MakeRoom(Mailbox* mailbox, size_t cost) {
+  deque<MsgRef>& msgs = mailbox -> msgs;
+  if (msgs.size() < MailboxLimits.maxMsgs && mailbox -> bytesQueued + cost <= MailboxLimits.maxBytes) {
+    return true;
+  }
+  if (MailboxLimits.policy == OVERFLOW_DISCONNECT && mailbox -> notifyFd >= 0) {
+    // Nobody is reading: wake the session so it closes itself.
+    if (!mailbox -> isOverflowed) {
+      mailbox -> isOverflowed = true;
+      __sync_fetch_and_add(&QueueCounters.disconnects, 1);
+      uint64_t one = 1;
+      write(mailbox -> notifyFd, &one, sizeof(one));
+    }
+    __sync_fetch_and_add(&QueueCounters.dropped, 1);
+    return false;
+  }
+
+  while (!msgs.empty() &&
+	 (msgs.size() >= MailboxLimits.maxMsgs || mailbox -> bytesQueued + cost > MailboxLimits.maxBytes)) {
+    deque<MsgRef>::iterator victim = msgs.begin();
+    if (MailboxLimits.policy == OVERFLOW_DROP_PRESENCE && mailbox -> presenceQueued > 0) {
+      while (victim != msgs.end() && (*victim) -> cmd != CMD_PRESENCE) {
+	victim++;
+      }
+      if (victim == msgs.end()) {
+	victim = msgs.begin();
+      }
+      __sync_fetch_and_add(&QueueCounters.presenceDropped, 1);
+    }
+    if ((*victim) -> cmd == CMD_PRESENCE) {
+      mailbox -> presenceQueued--;
+    }
+    mailbox -> bytesQueued -= MsgCost(**victim);
+    msgs.erase(victim);
+    __sync_fetch_and_add(&QueueCounters.dropped, 1);
+  }
+  // A single message bigger than maxBytes still goes through on its own.
+  return true;
+}
+
+bool addToMailbox(Mailbox* mailbox, MsgRef newMsg) {
+  return PutInMailbox(mailbox, newMsg, true);
+}
+
+bool TryAddToMailbox(Mailbox* mailbox, MsgRef newMsg) {
+  return PutInMailbox(mailbox, newMsg, false);
+}
+
+bool PutInMailbox(Mailbox* mailbox, MsgRef newMsg, bool canDrop) {
+  size_t cost = MsgCost(*newMsg);
+  LockMailbox(mailbox);
+  bool fits = mailbox -> msgs.size() < MailboxLimits.maxMsgs && mailbox -> bytesQueued + cost <= MailboxLimits.maxBytes;
+  if (!fits && (!canDrop || !MakeRoom(mailbox, cost))) {
+    pthread_mutex_unlock(&mailbox -> lock);
+    return false;
+  }
+  mailbox -> msgs.push_back(newMsg);
+  mailbox -> bytesQueued += cost;
+  if (newMsg -> cmd == CMD_PRESENCE) {
+    mailbox -> presenceQueued++;
+  }
+  // Only the first message since the last drain needs to wake the session.
+  if (mailbox -> msgs.size() == 1 && mailbox -> notifyFd >= 0) {
+    uint64_t one = 1;
+    write(mailbox -> notifyFd, &one, sizeof(one));
+  }
+  pthread_mutex_unlock(&mailbox -> lock);
+  return true;
+}
+
+Mailbox* NewMailbox() {
+  Mailbox* mailbox = new Mailbox;
+  pthread_mutex_init(&mailbox -> lock, NULL);
+  pthread_cond_init(&mailbox -> stored, NULL);
+  mailbox -> storing = 0;
+  mailbox -> bytesQueued = 0;
+  mailbox -> presenceQueued = 0;
+  mailbox -> isOverflowed = false;
+  mailbox -> notifyFd = -1;
+  return mailbox;
+}
+
+void TakeMessages(Mailbox* mailbox, deque<MsgRef>& msgs) {
+  LockMailbox(mailbox);
+  msgs.swap(mailbox -> msgs);
+  mailbox -> bytesQueued = 0;
+  mailbox -> presenceQueued = 0;
+  pthread_mutex_unlock(&mailbox -> lock);
+}
+
+bool IsOverflowed(Mailbox* mailbox) {
+  LockMailbox(mailbox);
+  bool isOverflowed = mailbox -> isOverflowed;
+  pthread_mutex_unlock(&mailbox -> lock);
+  return isOverflowed;
+}
+
+void AttachMailbox(Mailbox* mailbox, int notifyFd) {
+  LockMailbox(mailbox);
+  mailbox -> notifyFd = notifyFd;
+  mailbox -> isOverflowed = false;
+  if (!mailbox -> msgs.empty()) {
+    // Messages arrived while the user was away.
+    uint64_t one = 1;
+    write(notifyFd, &one, sizeof(one));
+  }
+  pthread_mutex_unlock(&mailbox -> lock);
+}
+
+void DetachMailbox(Mailbox* mailbox) {
+  LockMailbox(mailbox);
+  mailbox -> notifyFd = -1;
+  pthread_mutex_unlock(&mailbox -> lock);
+}
+
+bool SetPresenceWanted (string username, bool wanted) {
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  bool exists = got != shard.users.end();
+  if (exists) {
+    got->second.wantsPresence = wanted;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return exists;
+}
+
+bool GetCurrentChannel (string username, string& channel, Mailbox*& mailbox) {
+  UserShard& shard = ShardFor(username);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (username);
+  bool exists = got != shard.users.end();
+  if (exists) {
+    channel = got->second.channel;
+    mailbox = got->second.mailbox;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return exists;
+}
+
+bool IsChannelMember (string username, string channel) {
+  UserShard& shard = ShardFor(username);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (username);
+  bool isMember = got != shard.users.end() &&
+    find(got->second.channels.begin(), got->second.channels.end(), channel) != got->second.channels.end();
+  pthread_rwlock_unlock(&shard.lock);
+  return isMember;
+}
+
+bool GetPasswordHash (string username, string& passwordHash) {
+  UserShard& shard = ShardFor(username);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (username);
+  bool exists = got != shard.users.end();
+  if (exists) {
+    passwordHash = got->second.passwordHash;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return exists || FindAccount(username, passwordHash);
+}
+
+bool ChangePasswordHash (string username, string oldHash, string newHash) {
+  string savedHash;
+  uint64_t position = 0;
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  bool isCurrent = got != shard.users.end() ? got->second.passwordHash == oldHash :
+    FindAccount(username, savedHash) && savedHash == oldHash;
+  bool isChanged = isCurrent && (!Accounts.isOpen || LogAccount(ACCOUNT_PASSWORD, username, newHash, position));
+  if (isChanged && got != shard.users.end()) {
+    got->second.passwordHash = newHash;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return isChanged && (position == 0 || SyncAccountLog(position));
+}
+
+bool loginUser (string username, string passwordHash) {
+  return claimUser(username, passwordHash, LocalNode, true);
+}
+
+bool claimUser (string username, string passwordHash, int node, bool isHome) {
+  // locals
+  User newUser;
+  newUser.username = username;
+  newUser.passwordHash = passwordHash;
+  newUser.isConnected = true;
+  newUser.wantsPresence = true;
+  newUser.timeConnected = time(NULL);
+  newUser.node = node;
+  newUser.mailbox = NULL;
+  uint64_t position = 0;
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  if (got == shard.users.end() ) {
+    // Not in memory: an account saved before the restart, or a new one to save.
+    if (isHome && Accounts.isOpen) {
+      string savedHash;
+      bool isSaved = FindAccount(username, savedHash);
+      if (isSaved ? savedHash != passwordHash : !LogAccount(ACCOUNT_REGISTER, username, passwordHash, position)) {
+	pthread_rwlock_unlock(&shard.lock);
+	return false;
+      }
+    }
+    // User not in list, so let's add them!
+    newUser.mailbox = NewMailbox();
+    shard.users.insert (make_pair(newUser.username, newUser));
+    pthread_rwlock_unlock(&shard.lock);
+    // A new account is not promised to anyone until it would survive a crash.
+    if (position != 0 && !SyncAccountLog(position)) {
+      releaseUser(username, node);
+      return false;
+    }
+    // Mail can outlive the directory across a restart.
+    ReplayStored(username, newUser.mailbox);
+    CountMetric(METRIC_LOGINS, 1);
+    return true;
+  } else {
+    if (got->second.passwordHash == passwordHash) {
+      if (got->second.isConnected) {
+	// someone else is already connected.
+	pthread_rwlock_unlock(&shard.lock);
+	return false;
+      } else {
+	// Password matches, and not connected.
+	got->second.isConnected = true;
+	got->second.timeConnected = time(NULL);
+	got->second.node = node;
+	Mailbox* mailbox = got->second.mailbox;
+	pthread_rwlock_unlock(&shard.lock);
+	ReplayStored(username, mailbox);
+	CountMetric(METRIC_LOGINS, 1);
+	return true;
+      }
+    } else {
+      pthread_rwlock_unlock(&shard.lock);
+      return false;
+    }
+  }
+}
+
+void ReplayStored (string username, Mailbox* mailbox) {
+  if (!MailStore.isOpen) {
+    return;
+  }
+  // Appends that saw the user offline finish first; later ones see them connected.
+  LockMailbox(mailbox);
+  while (mailbox -> storing > 0) {
+    pthread_cond_wait(&mailbox -> stored, &mailbox -> lock);
+  }
+  pthread_mutex_unlock(&mailbox -> lock);
+  ReplayOffline(username, mailbox);
+}
+
+bool releaseUser (string username, int node) {
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  bool wasThere = got != shard.users.end() && got->second.isConnected && got->second.node == node;
+  if (wasThere) {
+    got->second.isConnected = false;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return wasThere;
+}
+
+bool LocateUser (string username, bool& isConnected, int& node) {
+  UserShard& shard = ShardFor(username);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (username);
+  bool exists = got != shard.users.end();
+  isConnected = exists && got->second.isConnected;
+  node = isConnected ? got->second.node : LocalNode;
+  pthread_rwlock_unlock(&shard.lock);
+  string savedHash;
+  return exists || FindAccount(username, savedHash);
+}
+
+bool LoadSavedUser (string username) {
+  // locals
+  string savedHash;
+  if (!FindAccount(username, savedHash)) {
+    return false;
+  }
+  User newUser;
+  newUser.username = username;
+  newUser.passwordHash = savedHash;
+  newUser.isConnected = false;
+  newUser.wantsPresence = true;
+  newUser.timeConnected = 0;
+  newUser.node = LocalNode;
+  newUser.mailbox = NULL;
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  if (shard.users.find (username) == shard.users.end()) {
+    newUser.mailbox = NewMailbox();
+    shard.users.insert (make_pair(username, newUser));
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return true;
+}
+
+void addToUsersList (User newUser) {
+  if (newUser.mailbox == NULL) {
+    newUser.mailbox = NewMailbox();
+  }
+  UserShard& shard = ShardFor(newUser.username);
+  WriteLockShard(shard);
+  shard.users.insert (make_pair(newUser.username, newUser));
+  pthread_rwlock_unlock(&shard.lock);
+}
+
+Mailbox* GetMailbox(string username) {
+  Mailbox* mailbox = NULL;
+  UserShard& shard = ShardFor(username);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (username);
+  if (got != shard.users.end() ) {
+    mailbox = got->second.mailbox;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return mailbox;
+}
+
+bool doesUserExist (string username) {
+  string savedHash;
+  UserShard& shard = ShardFor(username);
+  ReadLockShard(shard);
+  bool exists = shard.users.find (username) != shard.users.end();
+  pthread_rwlock_unlock(&shard.lock);
+  return exists || FindAccount(username, savedHash);
+}
+
+bool isUserConnected (User newUser) {
+  UserShard& shard = ShardFor(newUser.username);
+  ReadLockShard(shard);
+  tr1::unordered_map<string, User>::const_iterator got = shard.users.find (newUser.username);
+  bool connected = got != shard.users.end() && got->second.isConnected;
+  pthread_rwlock_unlock(&shard.lock);
+  return connected;
+}
+
+void setUserConnected (User newUser) {
+  UserShard& shard = ShardFor(newUser.username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (newUser.username);
+  if (got != shard.users.end() ) {
+    got->second.isConnected = true;
+    got->second.timeConnected = time(NULL);
+  }
+  pthread_rwlock_unlock(&shard.lock);
+}
+
+void setUserDisconnected (string username) {
+  UserShard& shard = ShardFor(username);
+  WriteLockShard(shard);
+  tr1::unordered_map<string, User>::iterator got = shard.users.find (username);
+  if (got != shard.users.end() && got->second.isConnected) {
+    got->second.isConnected = false;
+    CountMetric(METRIC_LOGOUTS, 1);
+  }
+  pthread_rwlock_unlock(&shard.lock);
+}
@@ -0,0 +1,299 @@
+// AUTHOR: Raymond Powers
+// DATE: October 17th, 2026
+// PLATFORM: C++
+
+// DESCRIPTION: The user directory and per-user mailboxes shared by every server mode.
+
+#ifndef MSGUSERS_H
+#define MSGUSERS_H
+
+// Standard Library
+#include<string>
+#include<ctime>
+#include<tr1/unordered_map>
+#include<tr1/memory>
+#include<deque>
+#include<vector>
+
+// Multithreading
+#include<pthread.h>
+
+using namespace std;
+
+// DATA TYPES
+enum CommandType {
+  CMD_UNKNOWN,
+  CMD_ALL,
+  CMD_MSG,
+  CMD_USERS,
+  CMD_POKE,
+  CMD_TIME,
+  CMD_JOKE,
+  CMD_PICTURE,
+  // Login/logout announcements: broadcast like CMD_ALL, but the first to go when a queue is full.
+  // Also "/presence on|off", which opts a user in or out of them.
+  CMD_PRESENCE,
+  // "/join #name" and "/leave [#name]", and the replies to them.
+  CMD_JOIN,
+  CMD_LEAVE,
+  // A plain chat line sent to the sender's current channel.
+  CMD_CHANNEL,
+  // "/history", and the pages of past messages sent back.
+  CMD_HISTORY
+};
+
+struct Msg {
+  string to;
+  string from;
+  string msg;
+  CommandType cmd;
+  long queuedAt;   // MetricsClock() when it was first queued
+};
+
+// Queued messages are immutable and shared, so a broadcast is stored once
+// no matter how many mailboxes hold it.
+typedef tr1::shared_ptr<const Msg> MsgRef;
+
+// What a full mailbox does with one more message.
+enum OverflowPolicy {
+  OVERFLOW_DROP_OLDEST,
+  OVERFLOW_DROP_PRESENCE,   // presence notices first, then the oldest
+  OVERFLOW_DISCONNECT       // the attached session is closed; nothing is dropped silently
+};
+
+struct QueueLimits {
+  size_t maxMsgs;
+  size_t maxBytes;
+  OverflowPolicy policy;
+};
+
+// Process-wide totals, updated atomically.
+struct QueueStats {
+  long dropped;
+  long presenceDropped;
+  long disconnects;
+};
+
+struct Mailbox {
+  pthread_mutex_t lock;
+  deque<MsgRef> msgs;
+  size_t bytesQueued;
+  size_t presenceQueued;
+  // Set under OVERFLOW_DISCONNECT; the session closes when it sees it.
+  bool isOverflowed;
+  int notifyFd;
+  // Offline appends under way for this user, done with no shard lock held; a login's replay
+  // waits on stored for them, so none is left on disk behind it.
+  int storing;
+  pthread_cond_t stored;
+};
+
+struct User {
+  string username;
+  // yescrypt hash; the plaintext never reaches the directory.
+  string passwordHash;
+  time_t timeConnected;
+  bool isConnected;
+  // Cleared by "/presence off": no join/leave notices for this user.
+  bool wantsPresence;
+  // Where plain chat goes ("" for everyone) and every channel the user is in; see msgChannels.
+  string channel;
+  vector<string> channels;
+  // Where the user is connected; in a cluster, a home node also tracks users on other nodes.
+  int node;
+  Mailbox* mailbox;
+};
+
+// One slice of the user directory. Lookups take the lock shared, logins and
+// status changes take it exclusive.
+struct UserShard {
+  pthread_rwlock_t lock;
+  tr1::unordered_map<string, User> users;
+};
+
+// GLOBALS
+const int USER_SHARDS = 64;
+const size_t DEFAULT_QUEUE_MSGS = 65536;
+const size_t DEFAULT_QUEUE_BYTES = 4 * 1024 * 1024;
+const size_t MSG_FORMAT_OVERHEAD = 32;
+extern UserShard UsersList[USER_SHARDS];
+// This server's node id in a cluster, 0 otherwise.
+extern int LocalNode;
+extern QueueLimits MailboxLimits;
+extern QueueStats QueueCounters;
+
+// Function Prototypes
+UserShard& ShardFor(const string& username);
+// Function finds the directory shard that owns a username.
+// pre: none
+// post: none
+
+void ReadLockShard(UserShard& shard);
+// Function takes a shard lock shared, counting any time spent waiting for it.
+// pre: none
+// post: release with pthread_rwlock_unlock.
+
+void WriteLockShard(UserShard& shard);
+// Function takes a shard lock exclusive, counting any time spent waiting for it.
+// pre: none
+// post: release with pthread_rwlock_unlock.
+
+void LockMailbox(Mailbox* mailbox);
+// Function takes a mailbox lock, counting any time spent waiting for it.
+// pre: none
+// post: release with pthread_mutex_unlock.
+
+void addToMsgQueue(Msg newMsg);
+// Function Handles adding messages to the recipient's mailbox.
+// pre: none
+// post: Messages to unknown users are dropped.
+
+bool addToMailbox(Mailbox* mailbox, MsgRef newMsg);
+// Function appends a message to a mailbox, applying MailboxLimits.
+// pre: mailbox should exist. Safe to call while holding a shard lock.
+// post: the mailbox never holds more than maxMsgs messages or maxBytes bytes.
+//       Returns false if the overflow policy turned the message away.
+
+bool TryAddToMailbox(Mailbox* mailbox, MsgRef newMsg);
+// Function appends a message to a mailbox only if it fits without dropping anything.
+// pre: mailbox should exist. Safe to call while holding a shard lock.
+// post: returns false, leaving the mailbox as it was, if it is full.
+
+bool PutInMailbox(Mailbox* mailbox, MsgRef newMsg, bool canDrop);
+// Function appends a message to a mailbox, applying the overflow policy if canDrop is set.
+// pre: mailbox should exist.
+// post: returns false if the message was turned away.
+
+size_t MsgCost(const Msg& msg);
+// Function estimates the bytes a queued message accounts for against maxBytes.
+// pre: none
+// post: none
+
+bool MakeRoom(Mailbox* mailbox, size_t cost);
+// Function applies the overflow policy until one more message of cost bytes fits.
+// pre: mailbox -> lock should be held.
+// post: returns false if the new message must not be queued.
+
+void TakeMessages(Mailbox* mailbox, deque<MsgRef>& msgs);
+// Function empties a mailbox into msgs.
+// pre: none
+// post: none
+
+bool IsOverflowed(Mailbox* mailbox);
+// Function tells a session whether its mailbox overflowed under OVERFLOW_DISCONNECT.
+// pre: none
+// post: none
+
+void addToMailboxes(const vector<Mailbox*>& mailboxes, MsgRef newMsg, Mailbox* except = NULL);
+// Function appends one shared message to many mailboxes.
+// pre: none
+// post: every mailbox but except holds a reference to the same payload.
+
+vector<Mailbox*> GetConnectedMailboxes(string exceptUser, bool presenceOnly = false);
+// Function collects the mailboxes of every user connected to this node but one.
+// pre: none
+// post: no directory locks are held on return. With presenceOnly, users who opted out are left out.
+
+Mailbox* GetMailbox(string username);
+// Function finds a user's mailbox.
+// pre: none
+// post: returns NULL if the user does not exist.
+
+Mailbox* NewMailbox();
+// Function creates an empty mailbox with nobody waiting on it.
+// pre: none
+// post: none
+
+void AttachMailbox(Mailbox* mailbox, int notifyFd);
+// Function makes a mailbox signal notifyFd (an eventfd) when messages arrive.
+// pre: none
+// post: notifyFd is signalled right away if messages are already waiting. Clears isOverflowed.
+
+void DetachMailbox(Mailbox* mailbox);
+// Function stops a mailbox from signalling its session.
+// pre: none
+// post: the old notifyFd may be closed safely.
+
+void setUserDisconnected (string username);
+// Function changes user status to disconnected.
+// pre: none
+// post: none
+
+void setUserConnected (User newUser);
+// Function changes user status to connected.
+// pre: none
+// post: user's timeConnected value is updated.
+
+bool isUserConnected (User newUser);
+// Function returns a user's connected status.
+// pre: none
+// post: none
+
+bool doesUserExist (string username);
+// Function tests the existence of a user in the UserList or among the saved accounts.
+// pre: none
+// post: none
+
+void addToUsersList (User newUser);
+// Function adds a user to the UserList.
+// pre: none
+// post: none
+
+bool SetPresenceWanted (string username, bool wanted);
+// Function opts a user in or out of join/leave notices.
+// pre: none
+// post: returns false if the user does not exist.
+
+bool GetCurrentChannel (string username, string& channel, Mailbox*& mailbox);
+// Function looks up the channel a user's plain chat goes to, and their own mailbox.
+// pre: none
+// post: channel is "" if they are in none; returns false if the user does not exist.
+
+bool IsChannelMember (string username, string channel);
+// Function tells whether a user has joined a channel.
+// pre: channel should be given without its '#'.
+// post: returns false if the user does not exist.
+
+bool GetPasswordHash (string username, string& passwordHash);
+// Function looks up the stored password hash for a user.
+// pre: none
+// post: returns false if the user does not exist.
+
+bool ChangePasswordHash (string username, string oldHash, string newHash);
+// Function replaces a user's password hash, saving the change when accounts are saved.
+// pre: newHash should be for the same password as oldHash.
+// post: returns false if the stored hash is no longer oldHash or the change could not be saved.
+
+bool loginUser (string username, string passwordHash);
+// Function marks a user connected, creating the account with passwordHash if it does not exist.
+// pre: passwordHash should already have been checked against GetPasswordHash (see Authenticate).
+// post: returns false if the stored hash differs or the user is already connected.
+
+bool claimUser (string username, string passwordHash, int node, bool isHome);
+// Function is loginUser for a user connecting to the given node.
+// pre: as for loginUser. isHome is false on a cluster node that only mirrors an account kept by
+//      another node; only the home directory checks and saves accounts.
+// post: the user's node is recorded; returns false as loginUser does, or if a new account's
+//       record could not be synced to disk.
+
+void ReplayStored (string username, Mailbox* mailbox);
+// Function moves a user's offline mail into their mailbox once appends already under way are done.
+// pre: the user should just have been marked connected. No shard lock should be held.
+// post: none
+
+bool releaseUser (string username, int node);
+// Function marks a user disconnected if they are connected to the given node.
+// pre: none
+// post: returns false if they were not.
+
+bool LocateUser (string username, bool& isConnected, int& node);
+// Function finds whether and where a user is connected.
+// pre: none
+// post: node is LocalNode for users not connected. Returns false if the user does not exist.
+
+bool LoadSavedUser (string username);
+// Function brings a saved account into the UserList, disconnected, so mail can be queued for it.
+// pre: none
+// post: returns false if there is no such account.
+
+#endif